@@ -0,0 +1,242 @@
+/**
+ * End-to-end latency harness, for the emulated Kinesta (boards/native_sim).
+ *
+ * Stimuli are injected one at a time in the emulated sensors of each slice,
+ * and the latency is measured from the injection to the corresponding
+ * Control Change out of kinesta_midi_out(). On native_sim, code runs in zero
+ * simulated time: the measured latencies come from the architecture
+ * (debouncing, sampling periods, work queues and scheduling).
+ *
+ * Beforehand, a hand is brought above the first slice at reset, to measure
+ * the time from reset to its first Control Change.
+ */
+
+#include "kinesta_midi.h"
+#include "kinesta_boot.h"
+#include "usb_midi.h"
+#include "encoder_emul.h"
+#include "distance_emul.h"
+#include "perf.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <posix_board_if.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(latency_harness);
+
+/* Let the application initialize all slices before injecting anything */
+#define HARNESS_START_DELAY_MS 2000
+
+PERF_STAGE_DEFINE(e2e_touch);
+PERF_STAGE_DEFINE(e2e_encoder);
+PERF_STAGE_DEFINE(e2e_distance);
+
+enum harness_input {
+    INPUT_TOUCH,
+    INPUT_ENCODER,
+    INPUT_DISTANCE,
+    N_INPUTS,
+};
+
+struct harness_input_type {
+    const char *name;
+    // CC number in the slice CC group
+    uint8_t cc;
+    struct perf_stage *stage;
+    uint32_t max_p99_us;
+};
+
+static const struct harness_input_type inputs[N_INPUTS] = {
+    [INPUT_TOUCH] = {
+        .name = "touch",
+        .cc = 2,
+        .stage = &perf_stage_e2e_touch,
+        .max_p99_us = CONFIG_KINESTA_LATENCY_HARNESS_TOUCH_MAX_P99_US,
+    },
+    [INPUT_ENCODER] = {
+        .name = "encoder",
+        .cc = 3,
+        .stage = &perf_stage_e2e_encoder,
+        .max_p99_us = CONFIG_KINESTA_LATENCY_HARNESS_ENCODER_MAX_P99_US,
+    },
+    [INPUT_DISTANCE] = {
+        .name = "distance",
+        .cc = 1,
+        .stage = &perf_stage_e2e_distance,
+        .max_p99_us = CONFIG_KINESTA_LATENCY_HARNESS_DISTANCE_MAX_P99_US,
+    },
+};
+
+struct harness_slice {
+    uint8_t midi_cc_group;
+    struct gpio_dt_spec secondary_touch;
+    const struct emul *encoder;
+    const struct device *tof;
+};
+
+#define HARNESS_SLICE_FROM_DT(node) \
+    {\
+        .midi_cc_group=DT_PROP(node, midi_cc_group),\
+        .secondary_touch=GPIO_DT_SPEC_GET(DT_PROP(node, secondary_touchpad), touch_gpios),\
+        .encoder=EMUL_DT_GET(DT_PROP(node, encoder)),\
+        .tof=DEVICE_DT_GET(DT_PROP(node, distance_sensor)),\
+    },
+
+static const struct harness_slice slices[] = {
+    DT_FOREACH_STATUS_OKAY(kinesta_functional_block, HARNESS_SLICE_FROM_DT)
+};
+
+/* The stimulus waiting for its MIDI output */
+static struct {
+    enum harness_input input;
+    uint8_t cc;
+    uint32_t start;
+    bool pending;
+} expected;
+
+static K_SEM_DEFINE(expected_midi_received, 0, 1);
+
+static unsigned timeouts[N_INPUTS];
+
+static void harness_midi_tap(const uint8_t pkt[3])
+{
+    if ((pkt[0] >> 4) != MIDI_CMD_CONTROL_CHANGE || ! expected.pending || pkt[1] != expected.cc){
+        return;
+    }
+    perf_stage_record(inputs[expected.input].stage, expected.start);
+    expected.pending = false;
+    k_sem_give(&expected_midi_received);
+}
+
+static void harness_stimulate(const struct harness_slice *slice, enum harness_input input, unsigned round)
+{
+    // Every stimulus is reverted on the next round, so that each one changes the MIDI value
+    bool forward = (round % 2) == 0;
+
+    k_sem_reset(&expected_midi_received);
+    expected.input = input;
+    expected.cc = slice->midi_cc_group | inputs[input].cc;
+    expected.start = perf_now();
+    expected.pending = true;
+
+    switch (input){
+    case INPUT_TOUCH:
+        gpio_emul_input_set(slice->secondary_touch.port, slice->secondary_touch.pin, forward);
+        break;
+    case INPUT_ENCODER:
+        encoder_emul_turn(slice->encoder, forward ? 1 : -1);
+        break;
+    case INPUT_DISTANCE:
+        distance_emul_set(slice->tof, forward ? 0.20 : 0.30);
+        break;
+    default:
+        break;
+    }
+
+    if (k_sem_take(&expected_midi_received, K_MSEC(CONFIG_KINESTA_LATENCY_HARNESS_TIMEOUT_MS))){
+        expected.pending = false;
+        timeouts[input]++;
+        LOG_WRN("No MIDI CC 0x%02X after %s stimulus", expected.cc, inputs[input].name);
+    }
+}
+
+/* Time from reset to the first MIDI event, with a hand above the first slice */
+static void harness_boot(void)
+{
+    distance_emul_set(slices[0].tof, 0.20);
+
+    struct kinesta_boot_times times;
+    do {
+        k_sleep(K_MSEC(1));
+        kinesta_boot_get_times(&times);
+    } while (! times.first_event_ms && k_uptime_get_32() < 2 * CONFIG_KINESTA_LATENCY_HARNESS_BOOT_MAX_MS);
+
+    // Out of the tracking zone for the stimuli
+    distance_emul_set(slices[0].tof, 2.0);
+}
+
+static bool harness_report_boot(void)
+{
+    struct kinesta_boot_times times;
+    kinesta_boot_get_times(&times);
+
+    printk("\n=== Boot ===\n");
+    printk("slices ready %8u ms\n", times.slices_ready_ms);
+    printk("first event  %8u ms\n", times.first_event_ms);
+    printk("usb          %8u ms\n", times.usb_configured_ms);
+
+    bool ok = true;
+    if (! times.first_event_ms || times.first_event_ms > CONFIG_KINESTA_LATENCY_HARNESS_BOOT_MAX_MS){
+        printk("FAIL: boot (bound %ums)\n", CONFIG_KINESTA_LATENCY_HARNESS_BOOT_MAX_MS);
+        ok = false;
+    }
+    if (! times.usb_configured_ms){
+        printk("usb not configured, no host attached\n");
+    } else if (times.usb_configured_ms > CONFIG_KINESTA_LATENCY_HARNESS_USB_MAX_MS){
+        printk("FAIL: usb (bound %ums)\n", CONFIG_KINESTA_LATENCY_HARNESS_USB_MAX_MS);
+        ok = false;
+    }
+    return ok;
+}
+
+static bool harness_report(void)
+{
+    bool ok = harness_report_boot();
+
+    printk("\n=== Stimulus to MIDI latency, %d slice(s) x %d rounds ===\n",
+           (int) ARRAY_SIZE(slices), CONFIG_KINESTA_LATENCY_HARNESS_ROUNDS);
+    printk("%-10s %8s %8s %10s %10s %10s %10s\n",
+           "input", "count", "timeouts", "min[us]", "avg[us]", "p99[us]", "max[us]");
+
+    for (int i=0; i<N_INPUTS; i++){
+        const struct perf_stage *stage = inputs[i].stage;
+        uint32_t p99_us = 0;
+
+        if (stage->count){
+            p99_us = perf_cycles_to_ns(perf_stage_percentile(stage, 99)) / 1000;
+            printk("%-10s %8u %8u %10u %10u %10u %10u\n", inputs[i].name, stage->count, timeouts[i],
+                   (uint32_t) (perf_cycles_to_ns(stage->min) / 1000),
+                   (uint32_t) (perf_cycles_to_ns(stage->total / stage->count) / 1000),
+                   p99_us,
+                   (uint32_t) (perf_cycles_to_ns(stage->max) / 1000));
+        } else {
+            printk("%-10s %8u %8u\n", inputs[i].name, 0, timeouts[i]);
+        }
+
+        if (timeouts[i] || p99_us > inputs[i].max_p99_us){
+            printk("FAIL: %s (p99 bound %uus)\n", inputs[i].name, inputs[i].max_p99_us);
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+static void harness_main(void *p1, void *p2, void *p3)
+{
+    harness_boot();
+    k_sleep(K_TIMEOUT_ABS_MS(HARNESS_START_DELAY_MS));
+
+    kinesta_midi_set_tap(harness_midi_tap);
+
+    for (unsigned round=0; round<CONFIG_KINESTA_LATENCY_HARNESS_ROUNDS; round++){
+        for (size_t i=0; i<ARRAY_SIZE(slices); i++){
+            for (int input=0; input<N_INPUTS; input++){
+                harness_stimulate(&slices[i], input, round);
+                // Do not stay in phase with the sampling and debouncing timers
+                k_sleep(K_MSEC(1 + (round * 7) % 13));
+            }
+        }
+    }
+
+    kinesta_midi_set_tap(NULL);
+    posix_exit(harness_report() ? 0 : 1);
+}
+
+K_THREAD_DEFINE(latency_harness_tid, 2048,
+                harness_main, NULL, NULL, NULL,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
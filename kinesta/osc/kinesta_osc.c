@@ -0,0 +1,221 @@
+/**
+ * OSC stream of the sensor values, from a thread at the lowest application
+ * priority: the sampling of the slices only updates their snapshot, so the
+ * MIDI path never waits on the network.
+ *
+ * The thread sends a bundle per frame of CONFIG_KINESTA_OSC_FRAME_MS, as soon
+ * as a slice is updated, and then not before the next frame.
+ */
+
+#include "kinesta_osc.h"
+#include "osc.h"
+#include "distance_filter.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/net/socket.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(osc);
+
+#define N_SLICES DT_NUM_INST_STATUS_OKAY(kinesta_functional_block)
+
+/* Room for the 4 messages of each slice, with their addresses */
+#define OSC_PACKET_SIZE (16 + N_SLICES * 4 * 40)
+
+#define OSC_ADDRESS_SIZE 32
+
+struct kinesta_osc_slice {
+    float distance_cm;
+    float velocity_cm_s;
+    float encoder;
+    // Time of the distance, 0 before the first one
+    int64_t distance_ticks;
+    bool distance_updated;
+    bool encoder_updated;
+};
+
+static struct kinesta_osc_slice slices[N_SLICES];
+static struct sockaddr_in dest = {
+    .sin_family = AF_INET,
+    .sin_port = htons(CONFIG_KINESTA_OSC_PORT),
+};
+static struct kinesta_osc_stats stats;
+static struct k_spinlock lock;
+static K_SEM_DEFINE(frame_ready, 0, 1);
+
+void kinesta_osc_distance(unsigned slice, double filtered_cm)
+{
+    if (slice >= N_SLICES){
+        return;
+    }
+
+    int64_t now = k_uptime_ticks();
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    struct kinesta_osc_slice *s = &slices[slice];
+    if (s->distance_ticks){
+        float dt_s = (float) k_ticks_to_us_floor64(now - s->distance_ticks) / USEC_PER_SEC;
+        s->velocity_cm_s = (dt_s > 0) ? (filtered_cm - s->distance_cm) / dt_s : 0;
+    }
+    s->distance_cm = filtered_cm;
+    s->distance_ticks = now;
+    s->distance_updated = true;
+    k_spin_unlock(&lock, key);
+
+    k_sem_give(&frame_ready);
+}
+
+void kinesta_osc_encoder(unsigned slice, float value)
+{
+    if (slice >= N_SLICES){
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    slices[slice].encoder = value;
+    slices[slice].encoder_updated = true;
+    k_spin_unlock(&lock, key);
+
+    k_sem_give(&frame_ready);
+}
+
+void kinesta_osc_get_stats(struct kinesta_osc_stats *st)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    *st = stats;
+    k_spin_unlock(&lock, key);
+}
+
+static void kinesta_osc_message(struct osc_writer *w, unsigned slice, const char *name, float value)
+{
+    char address[OSC_ADDRESS_SIZE];
+    snprintk(address, sizeof(address), "/kinesta/%u/%s", slice, name);
+    osc_bundle_float(w, address, value);
+}
+
+/* Bundle of the slices updated since the previous frame */
+static int kinesta_osc_frame(uint8_t *buf, size_t size, struct sockaddr_in *to, int *n_messages)
+{
+    struct kinesta_osc_slice frame[N_SLICES];
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    memcpy(frame, slices, sizeof(frame));
+    for (size_t i=0; i<N_SLICES; i++){
+        slices[i].distance_updated = false;
+        slices[i].encoder_updated = false;
+    }
+    *to = dest;
+    k_spin_unlock(&lock, key);
+
+    struct osc_writer w;
+    *n_messages = 0;
+    osc_bundle_begin(&w, buf, size, OSC_TIMETAG_IMMEDIATE);
+    for (unsigned i=0; i<N_SLICES; i++){
+        if (frame[i].distance_updated){
+            kinesta_osc_message(&w, i, "distance", frame[i].distance_cm);
+            kinesta_osc_message(&w, i, "position", distance_to_t(frame[i].distance_cm));
+            kinesta_osc_message(&w, i, "velocity", frame[i].velocity_cm_s);
+            *n_messages += 3;
+        }
+        if (frame[i].encoder_updated){
+            kinesta_osc_message(&w, i, "encoder", frame[i].encoder);
+            *n_messages += 1;
+        }
+    }
+    return osc_bundle_end(&w);
+}
+
+static void kinesta_osc_task()
+{
+    static uint8_t buf[OSC_PACKET_SIZE];
+
+    if (zsock_inet_pton(AF_INET, CONFIG_KINESTA_OSC_HOST, &dest.sin_addr) != 1){
+        LOG_ERR("Invalid OSC host %s", CONFIG_KINESTA_OSC_HOST);
+    }
+
+    int sock = zsock_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0){
+        LOG_ERR("Unable to open a UDP socket (%d)", -errno);
+        return;
+    }
+    LOG_INF("Streaming to %s:%d", CONFIG_KINESTA_OSC_HOST, CONFIG_KINESTA_OSC_PORT);
+
+    while (true){
+        k_sem_take(&frame_ready, K_FOREVER);
+        int64_t frame_start = k_uptime_get();
+
+        struct sockaddr_in to;
+        int n_messages;
+        int len = kinesta_osc_frame(buf, sizeof(buf), &to, &n_messages);
+        int r = (len > 0) ? zsock_sendto(sock, buf, len, 0, (const struct sockaddr *) &to, sizeof(to)) : 0;
+
+        k_spinlock_key_t key = k_spin_lock(&lock);
+        if (len < 0){
+            stats.overflows++;
+        } else if (r < 0){
+            stats.send_errors++;
+        } else {
+            stats.bundles++;
+            stats.messages += n_messages;
+            stats.bytes += len;
+        }
+        k_spin_unlock(&lock, key);
+
+        // The updates of the slices until then go in the next frame
+        k_sleep(K_TIMEOUT_ABS_MS(frame_start + CONFIG_KINESTA_OSC_FRAME_MS));
+    }
+}
+
+K_THREAD_DEFINE(kinesta_osc_tid, CONFIG_KINESTA_OSC_STACK_SIZE, kinesta_osc_task, NULL, NULL, NULL,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
+
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+
+static int cmd_osc_status(const struct shell *sh, size_t argc, char **argv)
+{
+    struct kinesta_osc_stats st;
+    kinesta_osc_get_stats(&st);
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    struct sockaddr_in to = dest;
+    k_spin_unlock(&lock, key);
+
+    char host[NET_IPV4_ADDR_LEN];
+    zsock_inet_ntop(AF_INET, &to.sin_addr, host, sizeof(host));
+    shell_print(sh, "Streaming to %s:%d every %dms", host, ntohs(to.sin_port), CONFIG_KINESTA_OSC_FRAME_MS);
+    shell_print(sh, "%u bundles, %u messages, %u bytes, %u overflows, %u send errors",
+                st.bundles, st.messages, st.bytes, st.overflows, st.send_errors);
+    return 0;
+}
+
+static int cmd_osc_host(const struct shell *sh, size_t argc, char **argv)
+{
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(argc > 2 ? strtoul(argv[2], NULL, 10) : CONFIG_KINESTA_OSC_PORT),
+    };
+    if (zsock_inet_pton(AF_INET, argv[1], &to.sin_addr) != 1){
+        shell_error(sh, "Invalid IPv4 address %s", argv[1]);
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    dest = to;
+    k_spin_unlock(&lock, key);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(osc_cmds,
+    SHELL_CMD(status, NULL, "Show the destination and the counters", cmd_osc_status),
+    SHELL_CMD_ARG(host, NULL, "Stream to <ipv4> [port]", cmd_osc_host, 2, 1),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((kinesta), osc, &osc_cmds, "OSC stream of the sensors", NULL, 1, 0);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef KINESTA_OSC_H
+#define KINESTA_OSC_H
+
+#include <stdint.h>
+
+/**
+ * OSC stream of the sensor values of the slices, at full resolution, for the
+ * visuals and the patches that want more than the 7 bits of the MIDI CCs.
+ *
+ * Each frame is a bundle of the messages of the slices updated since the
+ * previous one, sent over UDP to CONFIG_KINESTA_OSC_HOST:CONFIG_KINESTA_OSC_PORT:
+ *   /kinesta/<slice>/distance  filtered distance, in cm
+ *   /kinesta/<slice>/position  distance remapped on 0..1 in the tracking zone,
+ *                              below 0 above it (see distance_to_t)
+ *   /kinesta/<slice>/velocity  rate of change of the filtered distance, in cm/s
+ *   /kinesta/<slice>/encoder   encoder value, on 0..1
+ */
+
+#if defined(CONFIG_KINESTA_OSC)
+
+/* A new filtered distance of a slice */
+void kinesta_osc_distance(unsigned slice, double filtered_cm);
+
+void kinesta_osc_encoder(unsigned slice, float value);
+
+struct kinesta_osc_stats {
+    uint32_t bundles;
+    uint32_t messages;
+    uint32_t bytes;
+    // Bundles that did not fit in a packet, and failed sends
+    uint32_t overflows;
+    uint32_t send_errors;
+};
+
+void kinesta_osc_get_stats(struct kinesta_osc_stats *stats);
+
+#else
+
+static inline void kinesta_osc_distance(unsigned slice, double filtered_cm) {}
+
+static inline void kinesta_osc_encoder(unsigned slice, float value) {}
+
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef OSC_H
+#define OSC_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+
+/**
+ * Writer of OSC 1.0 bundles of messages with a float argument.
+ *
+ * Strings are padded with NULs to a multiple of 4 bytes, numbers are big
+ * endian. A bundle is "#bundle", a timetag, then each message preceded by
+ * its size.
+ */
+
+/* Timetag of the bundles to process immediately */
+#define OSC_TIMETAG_IMMEDIATE 1
+
+struct osc_writer {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+};
+
+static inline void osc_put(struct osc_writer *w, const void *data, size_t len)
+{
+    if (w->overflow || w->len + len > w->size){
+        w->overflow = true;
+        return;
+    }
+    memcpy(&w->buf[w->len], data, len);
+    w->len += len;
+}
+
+static inline void osc_put_string(struct osc_writer *w, const char *s)
+{
+    static const uint8_t padding[4] = {0};
+    size_t len = strlen(s);
+    osc_put(w, s, len);
+    osc_put(w, padding, 4 - (len % 4));
+}
+
+static inline void osc_put_u32(struct osc_writer *w, uint32_t value)
+{
+    uint8_t bytes[4];
+    sys_put_be32(value, bytes);
+    osc_put(w, bytes, sizeof(bytes));
+}
+
+static inline void osc_bundle_begin(struct osc_writer *w, uint8_t *buf, size_t size, uint64_t timetag)
+{
+    *w = (struct osc_writer) {.buf=buf, .size=size};
+    osc_put_string(w, "#bundle");
+    osc_put_u32(w, timetag >> 32);
+    osc_put_u32(w, timetag);
+}
+
+/* Add a message with a float argument to the bundle */
+static inline void osc_bundle_float(struct osc_writer *w, const char *address, float value)
+{
+    size_t size_pos = w->len;
+    osc_put_u32(w, 0);
+    size_t start = w->len;
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    osc_put_string(w, address);
+    osc_put_string(w, ",f");
+    osc_put_u32(w, bits);
+
+    if (! w->overflow){
+        sys_put_be32(w->len - start, &w->buf[size_pos]);
+    }
+}
+
+/**
+ * @brief      End a bundle
+ * @return     Its size, -ENOMEM if it did not fit in the buffer
+ */
+static inline int osc_bundle_end(struct osc_writer *w)
+{
+    return w->overflow ? -ENOMEM : (int) w->len;
+}
+
+#endif
@@ -13,8 +13,4 @@
  */
 #define DISTANCE_SENSOR_FILTERING_ALPHA 1
 
-/* Cable number on the USB-MIDI interface for the MIDI events emitted by
- * the sensors of Kinesta itself */
-#define USB_MIDI_SENSORS_JACK_ID 1
-
 #endif
@@ -0,0 +1,57 @@
+#ifndef DISTANCE_FILTER_H
+#define DISTANCE_FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/**
+ * @brief      Filter a new distance measurement
+ *
+ * Moving average while in the tracking zone, with an hysteresis on entering
+ * and leaving the zone. Outside of the zone, the measurement is taken as is.
+ *
+ * @param[in]  filtered_cm           The previous filtered distance
+ * @param[in]  measured_cm           The new measurement
+ * @param      is_in_tracking_zone   Whether the previous filtered distance was
+ *                                   in the tracking zone, updated for the new one
+ * @return     The new filtered distance
+ */
+static inline double distance_filter(double filtered_cm, double measured_cm, bool *is_in_tracking_zone)
+{
+    if (*is_in_tracking_zone){
+        filtered_cm = (
+            DISTANCE_SENSOR_FILTERING_ALPHA * measured_cm +
+            (1 - DISTANCE_SENSOR_FILTERING_ALPHA) * filtered_cm
+        );
+    } else {
+        filtered_cm = measured_cm;
+    }
+
+    // Hysteresis on enter/exit tracking zone
+    double threshold = *is_in_tracking_zone ?
+        DISTANCE_SENSOR_TRACKING_ZONE_CM :
+        DISTANCE_SENSOR_TRACKING_ZONE_CM - DISTANCE_SENSOR_TRACKING_HYSTERESIS_CM;
+    *is_in_tracking_zone = filtered_cm < threshold;
+    return filtered_cm;
+}
+
+/* Distance remapped on 0..1
+ *   Below 0 is above the tracking zone
+ *   0 is the highest position in the tracking zone
+ *   1 is the lowest position
+ */
+static inline double distance_to_t(double filtered_cm)
+{
+    return 1 - (filtered_cm / DISTANCE_SENSOR_TRACKING_ZONE_CM);
+}
+
+/* MIDI CC value of a filtered distance */
+static inline uint8_t distance_to_midi_cc(double filtered_cm)
+{
+    double t = distance_to_t(filtered_cm);
+    return (t < 0) ? 0 : (127 * t);
+}
+
+#endif
@@ -0,0 +1,190 @@
+#include "kinesta_boot.h"
+#include "kinesta_functional_block.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/usb/usb_device.h>
+#include <zephyr/shell/shell.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(boot);
+
+#define N_SLICES DT_NUM_INST_STATUS_OKAY(kinesta_functional_block)
+
+/* USB, then 4 stages per slice */
+#define BOOT_MAX_STEPS (1 + 4 * N_SLICES)
+
+typedef int (*boot_step_func_t)(kinesta_functional_block *kfb);
+
+struct boot_step {
+    const char *name;
+    boot_step_func_t func;
+    kinesta_functional_block *kfb;
+};
+
+/* Steps sharing a resource (a bus), run in sequence by a thread */
+struct boot_lane {
+    const void *resource;
+    const char *name;
+    const struct boot_step *steps[BOOT_MAX_STEPS];
+    size_t n_steps;
+    struct k_thread thread;
+    uint32_t duration_us;
+    int result;
+};
+
+static struct boot_step steps[BOOT_MAX_STEPS];
+static size_t n_steps;
+
+static struct boot_lane lanes[CONFIG_KINESTA_BOOT_LANES];
+static size_t n_lanes;
+
+K_THREAD_STACK_ARRAY_DEFINE(lane_stacks, CONFIG_KINESTA_BOOT_LANES, CONFIG_KINESTA_BOOT_LANE_STACK_SIZE);
+
+static atomic_t slices_ready_ms;
+static atomic_t usb_configured_ms;
+static atomic_t first_event_ms;
+
+/* Resource of the USB lane */
+static const char usb_resource[] = "usb";
+
+static void boot_usb_status(enum usb_dc_status_code status, const uint8_t *param)
+{
+    if (status == USB_DC_CONFIGURED && atomic_cas(&usb_configured_ms, 0, MAX(k_uptime_get_32(), 1))){
+        LOG_INF("USB configured at %u ms", (uint32_t) atomic_get(&usb_configured_ms));
+    }
+}
+
+static int boot_usb_enable(kinesta_functional_block *kfb)
+{
+    return usb_enable(boot_usb_status);
+}
+
+/* Add a step to the lane of its resource, steps without resource share a lane */
+static void boot_add(const char *name, const void *resource, boot_step_func_t func, kinesta_functional_block *kfb)
+{
+    __ASSERT_NO_MSG(n_steps < BOOT_MAX_STEPS);
+    struct boot_step *step = &steps[n_steps++];
+    *step = (struct boot_step) {.name=name, .func=func, .kfb=kfb};
+
+    struct boot_lane *lane = NULL;
+    for (size_t i=0; i<n_lanes; i++){
+        if (lanes[i].resource == resource){
+            lane = &lanes[i];
+            break;
+        }
+    }
+    if (! lane){
+        // More resources than lanes: the last lane takes the extra ones
+        lane = (n_lanes < ARRAY_SIZE(lanes)) ? &lanes[n_lanes++] : &lanes[n_lanes - 1];
+        if (! lane->n_steps){
+            lane->resource = resource;
+            lane->name = (resource == usb_resource) ? usb_resource :
+                         resource ? ((const struct device *) resource)->name : "local";
+        }
+    }
+    lane->steps[lane->n_steps++] = step;
+}
+
+static void boot_lane_run(void *p1, void *p2, void *p3)
+{
+    struct boot_lane *lane = p1;
+    uint32_t start = k_cycle_get_32();
+
+    for (size_t i=0; i<lane->n_steps && ! lane->result; i++){
+        const struct boot_step *step = lane->steps[i];
+        lane->result = step->func(step->kfb);
+        if (lane->result){
+            LOG_ERR("[%s] %s failed: %d", step->kfb ? step->kfb->name : "boot", step->name, lane->result);
+        }
+    }
+    lane->duration_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+}
+
+int kinesta_boot()
+{
+    int r = 0;
+
+    // USB first, the host enumerates the device while the slices come up
+    boot_add("usb_enable", usb_resource, boot_usb_enable, NULL);
+
+    // All encoders of a bus are reset before their configuration, their
+    // reset delays overlap
+    for (size_t i=0; i<N_KFBS; i++){
+        boot_add("encoder_reset", kfbs[i].encoder_bus, kfb_init_encoder_reset, &kfbs[i]);
+    }
+    for (size_t i=0; i<N_KFBS; i++){
+        boot_add("encoder", kfbs[i].encoder_bus, kfb_init_encoder, &kfbs[i]);
+        boot_add("tof", kfbs[i].tof_bus, kfb_init_tof, &kfbs[i]);
+        boot_add("touchpads", NULL, kfb_init_touchpads, &kfbs[i]);
+    }
+
+    int prio = k_thread_priority_get(k_current_get());
+    for (size_t i=0; i<n_lanes; i++){
+        k_thread_create(&lanes[i].thread, lane_stacks[i], K_THREAD_STACK_SIZEOF(lane_stacks[i]),
+                        boot_lane_run, &lanes[i], NULL, NULL, prio, 0, K_NO_WAIT);
+        k_thread_name_set(&lanes[i].thread, lanes[i].name);
+    }
+
+    for (size_t i=0; i<n_lanes; i++){
+        k_thread_join(&lanes[i].thread, K_FOREVER);
+        LOG_INF("Lane %s: %d steps in %u us", lanes[i].name, (int) lanes[i].n_steps, lanes[i].duration_us);
+        if (lanes[i].result && ! r){
+            r = lanes[i].result;
+        }
+    }
+    if (r){
+        return r;
+    }
+
+    // The slices emit MIDI from here on, one at a time. The leds were not
+    // blanked: the first update paints them
+    for (size_t i=0; i<N_KFBS; i++){
+        int result = kfb_start(&kfbs[i]);
+        if (result){
+            LOG_ERR("[%s] start failed: %d", kfbs[i].name, result);
+            if (! r){
+                r = result;
+            }
+        }
+    }
+    if (r){
+        return r;
+    }
+    atomic_set(&slices_ready_ms, MAX(k_uptime_get_32(), 1));
+    LOG_INF("%d slice(s) ready at %u ms", (int) N_KFBS, (uint32_t) atomic_get(&slices_ready_ms));
+    return 0;
+}
+
+void kinesta_boot_midi_event()
+{
+    if (! atomic_get(&first_event_ms) && atomic_cas(&first_event_ms, 0, MAX(k_uptime_get_32(), 1))){
+        LOG_INF("First MIDI event at %u ms", (uint32_t) atomic_get(&first_event_ms));
+    }
+}
+
+void kinesta_boot_get_times(struct kinesta_boot_times *times)
+{
+    times->slices_ready_ms = atomic_get(&slices_ready_ms);
+    times->usb_configured_ms = atomic_get(&usb_configured_ms);
+    times->first_event_ms = atomic_get(&first_event_ms);
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_boot(const struct shell *sh, size_t argc, char **argv)
+{
+    struct kinesta_boot_times times;
+    kinesta_boot_get_times(&times);
+
+    shell_print(sh, "Slices ready: %u ms, USB configured: %u ms, first MIDI event: %u ms",
+                times.slices_ready_ms, times.usb_configured_ms, times.first_event_ms);
+    for (size_t i=0; i<n_lanes; i++){
+        shell_print(sh, "Lane %-12s %2d steps %8u us %s", lanes[i].name, (int) lanes[i].n_steps,
+                    lanes[i].duration_us, lanes[i].result ? "FAILED" : "");
+    }
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((kinesta), boot, NULL, "Boot times and bring-up lanes", cmd_boot, 1, 0);
+#endif
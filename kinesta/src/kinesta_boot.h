@@ -0,0 +1,32 @@
+#ifndef KINESTA_BOOT_H
+#define KINESTA_BOOT_H
+
+#include <stdint.h>
+
+/*
+ * Boot scheduler: the bring-up of the slices is split in steps using a
+ * single bus each (see kfb_init_encoder() and friends). The steps of a bus
+ * run in sequence in a lane thread of their own, the lanes of the different
+ * buses run in parallel, along with the USB enumeration.
+ */
+
+/* Uptimes in ms, 0 until reached */
+struct kinesta_boot_times {
+    uint32_t slices_ready_ms;
+    uint32_t usb_configured_ms;
+    // First MIDI event sent by a slice
+    uint32_t first_event_ms;
+};
+
+/**
+ * @brief      Enable USB and bring all the slices up
+ * @return     0 once all slices are ready, or the error of the first failed step
+ */
+int kinesta_boot();
+
+/* A slice sent a MIDI event */
+void kinesta_boot_midi_event();
+
+void kinesta_boot_get_times(struct kinesta_boot_times *times);
+
+#endif
@@ -1,8 +1,18 @@
 #include "kinesta_functional_block.h"
 #include "config.h"
+#include "distance_filter.h"
 #include "usb_midi.h"
 #include "kinesta_midi.h"
 #include "lookup.h"
+#include "perf.h"
+#include "sensor_trace.h"
+#include "midi_trace.h"
+#include "midi_clock.h"
+#include "midi_transform.h"
+#include "kinesta_power.h"
+#include "kinesta_boot.h"
+#include "kinesta_osc.h"
+#include "kinesta_telemetry.h"
 
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
@@ -12,13 +22,23 @@
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(kfb);
 
-#define TOF_SAMPLING_FREQ 25
+PERF_STAGE_DEFINE(tof_fetch);
+PERF_STAGE_DEFINE(kfb_update_distance);
+PERF_STAGE_DEFINE(touchpad_set_color);
+
+#define KFB_I2C_BUS(node) COND_CODE_1(DT_ON_BUS(node, i2c), (DEVICE_DT_GET(DT_BUS(node))), (NULL))
 
 #define KFB_FROM_DT(inst) \
     {\
         .name=DT_NODE_FULL_NAME(inst),\
         .midi_cc_group=DT_PROP(inst, midi_cc_group),\
+        .midi_cable=COND_CODE_1(DT_NODE_HAS_PROP(inst, usb_midi_cable),\
+            (USB_MIDI_CABLE(DT_PROP(inst, usb_midi_cable))), (0)),\
+        .midi_transform=COND_CODE_1(DT_NODE_HAS_PROP(inst, midi_transform),\
+            (MIDI_TRANSFORM_DT_GET(DT_PROP(inst, midi_transform))), (NULL)),\
         .tof=DEVICE_DT_GET(DT_PROP(inst, distance_sensor)),\
+        .encoder_bus=KFB_I2C_BUS(DT_PROP(inst, encoder)),\
+        .tof_bus=KFB_I2C_BUS(DT_PROP(inst, distance_sensor)),\
         .primary_touchpad=DEVICE_DT_GET(DT_PROP(inst, primary_touchpad)),\
         .secondary_touchpad=DEVICE_DT_GET(DT_PROP(inst, secondary_touchpad)),\
         .encoder=DEVICE_DT_GET(DT_PROP(inst, encoder)),\
@@ -36,7 +56,9 @@ kinesta_functional_block *kfbs = __kfbs__;
 
 static int kfb_measure_distance_cm(kinesta_functional_block *self, double *res)
 {
+    uint32_t start = perf_now();
     int r = sensor_sample_fetch(self->tof);
+    PERF_RECORD(tof_fetch, start);
     if (r){
         return r;
     }
@@ -51,73 +73,128 @@ static int kfb_measure_distance_cm(kinesta_functional_block *self, double *res)
     return 0;
 }
 
-/* Distance remapped on 0..1
- *   Below 0 is above the tracking zone
- *   0 is the highest position in the tracking zone
- *   1 is the lowest position
- */
-static inline double kfb_get_distance_t(kinesta_functional_block *self)
+/* Pass a MIDI event of the slice through its transform if any
+ * @return false if the event is filtered out */
+static bool kfb_midi_transform(kinesta_functional_block *self, uint8_t pkt[3])
 {
-    return 1 - (self->filtered_distance_cm / DISTANCE_SENSOR_TRACKING_ZONE_CM);
+    if (self->midi_transform && ! midi_transform_apply(self->midi_transform, pkt)){
+        return false;
+    }
+    kinesta_power_activity();
+    kinesta_boot_midi_event();
+    return true;
 }
 
-static int kfb_update_distance(kinesta_functional_block *self)
+/* 32 bits Control Change value of t in [0, 1] */
+static inline uint32_t kfb_cc32(double t)
 {
-    double measured_distance_cm;
-    int r = kfb_measure_distance_cm(self, &measured_distance_cm);
-    if (r){
-        return r;
+    return (t <= 0) ? 0 : (t >= 1) ? UINT32_MAX : (uint32_t) (t * UINT32_MAX);
+}
+
+/*
+ * Send a Control Change of the slice, through its transform if any: value is
+ * its 7 bits value, value32 its 32 bits value for a USB MIDI 2.0 host. The
+ * MIDI 1.0 outputs only get the changes of the 7 bits value (value_changed).
+ * The curves of the transforms are defined on 7 bits: through a transform,
+ * the 32 bits value is always scaled up from the transformed 7 bits one.
+ */
+static void kfb_cc_out(kinesta_functional_block *self, uint8_t cc, uint8_t value, bool value_changed,
+                       uint32_t value32, uint32_t captured)
+{
+    if (self->midi_transform && ! value_changed){
+        return;
     }
 
+    uint8_t pkt[] = MIDI_CONTROL_CHANGE(0, self->midi_cc_group | cc, value);
+    if (! kfb_midi_transform(self, pkt)){
+        return;
+    }
+    if (self->midi_transform){
+        value32 = midi_ump_scale7(pkt[2]);
+    }
+    kinesta_midi_out_cc32(self->midi_cable, pkt, value_changed, value32, captured);
+}
+
+static inline double kfb_get_distance_t(kinesta_functional_block *self)
+{
+    return distance_to_t(self->filtered_distance_cm);
+}
+
+void kfb_process_distance(kinesta_functional_block *self, double measured_distance_cm, uint32_t captured)
+{
     // This is definitely a reading error !
     if (measured_distance_cm < 1){
         return;
     }
 
-    if (self->is_in_tracking_zone){
-        self->filtered_distance_cm = (
-            DISTANCE_SENSOR_FILTERING_ALPHA * measured_distance_cm +
-            (1 - DISTANCE_SENSOR_FILTERING_ALPHA) * self->filtered_distance_cm
-        );
-    } else {
-        self->filtered_distance_cm = measured_distance_cm;
+    self->filtered_distance_cm = distance_filter(self->filtered_distance_cm, measured_distance_cm,
+                                                 &self->is_in_tracking_zone);
+    kinesta_osc_distance(self - kfbs, self->filtered_distance_cm);
+    if (self->filtered_distance_cm < 3 * DISTANCE_SENSOR_TRACKING_ZONE_CM){
+        // A hand above the sensor
+        kinesta_power_activity();
     }
 
-    // Hysteresis on enter/exit tracking zone
-    double threshold = self->is_in_tracking_zone ?
-        DISTANCE_SENSOR_TRACKING_ZONE_CM :
-        DISTANCE_SENSOR_TRACKING_ZONE_CM - DISTANCE_SENSOR_TRACKING_HYSTERESIS_CM;
-    self->is_in_tracking_zone = self->filtered_distance_cm < threshold;
-
-    double t = kfb_get_distance_t(self);
-    uint8_t distance_midi_cc_value = (t < 0) ? 0 : (127 * t);
-    if (distance_midi_cc_value != self->distance_midi_cc_value && ! self->is_frozen){
-        const uint8_t pkt[] = MIDI_CONTROL_CHANGE(0, self->midi_cc_group | 1, distance_midi_cc_value);
-        kinesta_midi_out(pkt);
+    uint8_t distance_midi_cc_value = distance_to_midi_cc(self->filtered_distance_cm);
+    uint32_t distance_ump_cc_value = kfb_cc32(kfb_get_distance_t(self));
+    bool changed = distance_midi_cc_value != self->distance_midi_cc_value;
+    if ((changed || (usb_midi_is_ump() && distance_ump_cc_value != self->distance_ump_cc_value)) && ! self->is_frozen){
+        kfb_cc_out(self, 1, distance_midi_cc_value, changed, distance_ump_cc_value, captured);
         self->distance_midi_cc_value = distance_midi_cc_value;
+        self->distance_ump_cc_value = distance_ump_cc_value;
+    }
+}
+
+static void kfb_distance_sampled(kinesta_functional_block *self, double measured_distance_cm, uint32_t captured)
+{
+    MIDI_TRACE("tof_sample", self - kfbs, (uint32_t) (10 * measured_distance_cm));
+    sensor_trace_distance(self - kfbs, measured_distance_cm);
+    kinesta_telemetry_distance(self - kfbs, measured_distance_cm);
+    kfb_process_distance(self, measured_distance_cm, captured);
+}
+
+static int kfb_update_distance(kinesta_functional_block *self)
+{
+    if (self->is_replaying){
+        return 0;
     }
+
+    // The end of the measurement, signaled by the data ready trigger
+    uint32_t captured = k_cycle_get_32();
+    double measured_distance_cm;
+    int r = kfb_measure_distance_cm(self, &measured_distance_cm);
+    if (r){
+        return r;
+    }
+
+    kfb_distance_sampled(self, measured_distance_cm, captured);
     return 0;
 }
 
-static int kfb_update_primary_touchpad(kinesta_functional_block *self)
+/* Phase of the blinking animations, 0..255: on the beat of the host MIDI clock if any */
+static uint8_t kfb_blink_phase(int64_t now)
+{
+#if defined(CONFIG_MIDI_CLOCK_FOLLOWER)
+    if (midi_clock_is_locked()){
+        return midi_clock_beat_phase() >> 8;
+    }
+#endif
+    return (now >> 1) & 0xff;
+}
+
+static color_t kfb_primary_touchpad_color(kinesta_functional_block *self)
 {
     int64_t now = k_uptime_get();
-    self->was_primary_pad_touched = self->is_primary_pad_touched;
-    self->is_primary_pad_touched = touchpad_is_touched(self->primary_touchpad) > 0;
 
-    // Update touchpad color
     color_t color;
     if (self->is_primary_pad_touched){
         // Pad touched: white
         color = WHITE_FOR_TOUCH;
-        if (! self->was_primary_pad_touched){
-            self->is_frozen = ! self->is_frozen;
-        }
     } else if (self->is_frozen) {
         // Frozen to a MIDI value: blink in the color map
         float t = (float) self->distance_midi_cc_value / 127;
         color = color_map(COLOR_GREEN, COLOR_RED, t);
-        color = color_mul(color, cos256f32[(now >> 1) & 0xff]);
+        color = color_mul(color, cos256f32[kfb_blink_phase(now)]);
     } else if (self->is_in_tracking_zone){
         // In tracking zone: colormap green to red
         color = color_map(COLOR_GREEN, COLOR_RED, kfb_get_distance_t(self));
@@ -131,100 +208,185 @@ static int kfb_update_primary_touchpad(kinesta_functional_block *self)
         // Otherwise: light magenta if USB not configured
         color = color_mul(COLOR_MAGENTA, 0.05);
     }
-    touchpad_set_color(self->primary_touchpad, color);
-    return 0;
+    return color;
 }
 
-static int kfb_update_secondary_touchpad(kinesta_functional_block *self)
+static color_t kfb_secondary_touchpad_color(kinesta_functional_block *self)
 {
-    self->was_secondary_pad_touched = self->is_secondary_pad_touched;
-    self->is_secondary_pad_touched = touchpad_is_touched(self->secondary_touchpad);
-    if (self->was_secondary_pad_touched != self->is_secondary_pad_touched) {
-        const uint8_t pkt[] = MIDI_CONTROL_CHANGE(0, self->midi_cc_group | 2, 127 * self->is_secondary_pad_touched);
-        kinesta_midi_out(pkt);
-    }
+    return self->is_secondary_pad_touched ? WHITE_FOR_TOUCH : 0;
+}
 
-    color_t color = self->is_secondary_pad_touched ? WHITE_FOR_TOUCH : 0;
-    touchpad_set_color(self->secondary_touchpad, color);
-    return 0;
+/* Both touchpads of a slice switch to their new color simultaneously */
+static void kfb_set_touchpads_colors(kinesta_functional_block *self, color_t primary, color_t secondary)
+{
+    const struct device *const touchpads[] = {self->primary_touchpad, self->secondary_touchpad};
+    float brightness = kinesta_power_brightness();
+    const color_t colors[] = {color_mul(primary, brightness), color_mul(secondary, brightness)};
+    uint32_t start = perf_now();
+    MIDI_TRACE("led_commit", self - kfbs, primary);
+    touchpad_set_colors(touchpads, colors, ARRAY_SIZE(touchpads));
+    PERF_RECORD(touchpad_set_color, start);
+}
+
+int kfb_process_encoder(kinesta_functional_block *self, float value, uint32_t captured)
+{
+    self->encoder_value = value;
+    kinesta_osc_encoder(self - kfbs, value);
+
+    uint8_t encoder_midi_cc_value = 127 * self->encoder_value;
+    uint32_t encoder_ump_cc_value = kfb_cc32(self->encoder_value);
+    bool changed = encoder_midi_cc_value != self->encoder_midi_cc_value;
+    if (changed || (usb_midi_is_ump() && encoder_ump_cc_value != self->encoder_ump_cc_value)){
+        kfb_cc_out(self, 3, encoder_midi_cc_value, changed, encoder_ump_cc_value, captured);
+        self->encoder_midi_cc_value = encoder_midi_cc_value;
+        self->encoder_ump_cc_value = encoder_ump_cc_value;
+    }
+    color_t color = color_map(COLOR_GREEN, COLOR_RED, self->encoder_value);
+    return encoder_set_color(self->encoder, color);
 }
 
 static int kfb_update_encoder(kinesta_functional_block *self, int evt)
 {
+    uint32_t captured = k_cycle_get_32();
     int r;
+    float value;
     if (evt & ENCODER_EVT_PRESS){
         // Click on the encoder: reset value
-        r = encoder_get_value(self->encoder, &self->encoder_value);
+        r = encoder_get_value(self->encoder, &value);
         if (r){
             return r;
         }
         // If the actual encoder value is 0: set to 1, otherwise set to 0
-        self->encoder_value = (self->encoder_value == 0) ? 1 : 0;
-        r = encoder_set_value(self->encoder, self->encoder_value);
+        value = (value == 0) ? 1 : 0;
+        r = encoder_set_value(self->encoder, value);
         if (r){
             return r;
         }
     } else {
         // Otherwise get actual value
-        r = encoder_get_value(self->encoder, &self->encoder_value);
+        r = encoder_get_value(self->encoder, &value);
         if (r){
             return r;
         }
     }
 
-    uint8_t encoder_midi_cc_value = 127 * self->encoder_value;
-    if (encoder_midi_cc_value != self->encoder_midi_cc_value){
-        const uint8_t pkt[] = MIDI_CONTROL_CHANGE(0, self->midi_cc_group | 3, encoder_midi_cc_value);
-        kinesta_midi_out(pkt);
-        self->encoder_midi_cc_value = encoder_midi_cc_value;
-    }
-    color_t color = color_map(COLOR_GREEN, COLOR_RED, self->encoder_value);
-    return encoder_set_color(self->encoder, color);
+    sensor_trace_encoder(self - kfbs, value);
+    kinesta_telemetry_encoder(self - kfbs, value);
+    return kfb_process_encoder(self, value, captured);
 }
 
 static void kfb_encoder_changed(struct encoder_callback_t *callback, int event)
 {
     kinesta_functional_block *self = CONTAINER_OF(callback, kinesta_functional_block, encoder_change);
-    kfb_update_encoder(self, event);
+    if (! self->is_replaying){
+        kfb_update_encoder(self, event);
+    }
+}
+
+void kfb_process_touch(kinesta_functional_block *self, bool secondary, int evt, bool touched, uint32_t captured)
+{
+    kinesta_power_activity();
+    if (secondary){
+        self->is_secondary_pad_touched = touched;
+    } else {
+        self->is_primary_pad_touched = touched;
+    }
+    if (self->soft_disable){
+        return;
+    }
+
+    if (secondary){
+        kfb_cc_out(self, 2, 127 * touched, true, touched ? UINT32_MAX : 0, captured);
+    } else if (evt & TOUCHPAD_EVT_PRESS){
+        // Touching the primary pad toggles the freeze of the distance CC
+        self->is_frozen = ! self->is_frozen;
+    }
+}
+
+static void kfb_primary_touch_changed(struct touchpad_callback_t *callback, int evt, uint32_t timestamp)
+{
+    kinesta_functional_block *self = CONTAINER_OF(callback, kinesta_functional_block, primary_touch_change);
+    if (self->is_replaying){
+        return;
+    }
+    bool touched = touchpad_is_touched(self->primary_touchpad);
+    sensor_trace_touch(self - kfbs, false, evt, touched);
+    kinesta_telemetry_touch(self - kfbs, false, evt, touched);
+    kfb_process_touch(self, false, evt, touched, timestamp);
+}
+
+static void kfb_secondary_touch_changed(struct touchpad_callback_t *callback, int evt, uint32_t timestamp)
+{
+    kinesta_functional_block *self = CONTAINER_OF(callback, kinesta_functional_block, secondary_touch_change);
+    if (self->is_replaying){
+        return;
+    }
+    bool touched = touchpad_is_touched(self->secondary_touchpad);
+    sensor_trace_touch(self - kfbs, true, evt, touched);
+    kinesta_telemetry_touch(self - kfbs, true, evt, touched);
+    kfb_process_touch(self, true, evt, touched, timestamp);
 }
 
 static void kfb_tof_data_ready(const struct device *tof, const struct sensor_trigger *trig)
 {
     for (size_t i=0; i<N_KFBS; i++){
         if (tof == kfbs[i].tof){
+            uint32_t start = perf_now();
             kfb_update_distance(&kfbs[i]);
+            PERF_RECORD(kfb_update_distance, start);
             return;
         }
     }
 }
 
-int kfb_init(kinesta_functional_block *self)
+int kfb_init_encoder_reset(kinesta_functional_block *self)
 {
-    int r;
-    touchpad_set_color(self->primary_touchpad, 0);
-    touchpad_set_color(self->secondary_touchpad, 0);
-
     if (! device_is_ready(self->encoder)){
         LOG_ERR("[%s] encoder is not ready", self->name);
         return -1;
     }
+    if (! IS_ENABLED(CONFIG_KINESTA_HW_ENCODER_DEFERRED_INIT)){
+        return 0;
+    }
+    return encoder_reset(self->encoder);
+}
+
+int kfb_init_encoder(kinesta_functional_block *self)
+{
+    int r;
+    if (IS_ENABLED(CONFIG_KINESTA_HW_ENCODER_DEFERRED_INIT)){
+        r = encoder_configure(self->encoder);
+        if (r){
+            LOG_ERR("[%s] Unable to configure the encoder", self->name);
+            return r;
+        }
+    }
 
-    if (encoder_set_color(self->encoder, 0)){
-        LOG_ERR("[%s] Unable to light off the encoder", self->name);
+    self->first_encoder_captured = k_cycle_get_32();
+    r = encoder_get_value(self->encoder, &self->first_encoder_value);
+    if (r){
+        LOG_ERR("[%s] Unable to read the encoder", self->name);
     }
+    return r;
+}
 
+int kfb_init_tof(kinesta_functional_block *self)
+{
+    int r;
     if (! device_is_ready(self->tof)){
         LOG_ERR("[%s] ToF sensor is not ready", self->name);
         return -1;
     }
 
-    const struct sensor_value freq = {.val1=TOF_SAMPLING_FREQ, .val2=0};
+    const struct sensor_value freq = {.val1=KFB_TOF_SAMPLING_FREQ, .val2=0};
     r = sensor_attr_set(self->tof, SENSOR_CHAN_DISTANCE, SENSOR_ATTR_SAMPLING_FREQUENCY, &freq);
     if (r){
-        LOG_ERR("[%s] Unable to configure ToF sampling freq to %dHz", self->name, TOF_SAMPLING_FREQ);
+        LOG_ERR("[%s] Unable to configure ToF sampling freq to %dHz", self->name, KFB_TOF_SAMPLING_FREQ);
         return r;
     }
 
+    self->tof_period_ms = MSEC_PER_SEC / KFB_TOF_SAMPLING_FREQ;
+
     const struct sensor_trigger trig = {
         .chan = SENSOR_CHAN_DISTANCE,
         .type = SENSOR_TRIG_DATA_READY,
@@ -237,34 +399,102 @@ int kfb_init(kinesta_functional_block *self)
         return r;
     }
 
+    if (! self->trigger_enabled){
+        // The first sample starts the sensor (address and calibration). It
+        // runs in a bring-up lane, in parallel with the other slices: its
+        // MIDI output waits for kfb_start()
+        self->tof_last_sample = k_uptime_get();
+        self->first_sample_captured = k_cycle_get_32();
+        r = kfb_measure_distance_cm(self, &self->first_distance_cm);
+        if (r){
+            LOG_ERR("[%s] Unable to start the ToF sensor", self->name);
+            return r;
+        }
+        self->has_first_sample = true;
+    }
+    return 0;
+}
+
+int kfb_init_touchpads(kinesta_functional_block *self)
+{
+    self->is_primary_pad_touched = touchpad_is_touched(self->primary_touchpad);
+    self->is_secondary_pad_touched = touchpad_is_touched(self->secondary_touchpad);
+    return 0;
+}
+
+int kfb_init(kinesta_functional_block *self)
+{
+    int (*const stages[])(kinesta_functional_block *) = {
+        kfb_init_encoder_reset, kfb_init_encoder, kfb_init_tof, kfb_init_touchpads,
+    };
+
+    for (size_t i=0; i<ARRAY_SIZE(stages); i++){
+        int r = stages[i](self);
+        if (r){
+            return r;
+        }
+    }
+    return kfb_start(self);
+}
+
+int kfb_start(kinesta_functional_block *self)
+{
+    // Armed once all the slices are up: their events send MIDI from here on
     self->encoder_change.func = kfb_encoder_changed;
     encoder_set_callback(self->encoder, &self->encoder_change);
-
-    r = kfb_update_encoder(self, 0);
+    self->primary_touch_change.func = kfb_primary_touch_changed;
+    touchpad_set_callback(self->primary_touchpad, &self->primary_touch_change);
+    self->secondary_touch_change.func = kfb_secondary_touch_changed;
+    touchpad_set_callback(self->secondary_touchpad, &self->secondary_touch_change);
+
+    sensor_trace_encoder(self - kfbs, self->first_encoder_value);
+    kinesta_telemetry_encoder(self - kfbs, self->first_encoder_value);
+    int r = kfb_process_encoder(self, self->first_encoder_value, self->first_encoder_captured);
     if (r){
         return r;
     }
 
+    if (self->has_first_sample){
+        self->has_first_sample = false;
+        if (! self->is_replaying){
+            kfb_distance_sampled(self, self->first_distance_cm, self->first_sample_captured);
+        }
+    }
     return kfb_update(self);
 }
 
 int kfb_update(kinesta_functional_block *self)
 {
     if (self->soft_disable){
-        touchpad_set_color(self->primary_touchpad, 0);
-        touchpad_set_color(self->secondary_touchpad, 0);
+        kfb_set_touchpads_colors(self, 0, 0);
         encoder_set_color(self->encoder, 0);
         return 0;
     }
 
-    if (! self->trigger_enabled){
+    int64_t now = k_uptime_get();
+    if (! self->trigger_enabled && self->tof_period_ms && now - self->tof_last_sample >= self->tof_period_ms){
+        self->tof_last_sample = now;
+        uint32_t start = perf_now();
         kfb_update_distance(self);
+        PERF_RECORD(kfb_update_distance, start);
     }
 
-    int r = kfb_update_primary_touchpad(self);
-    if (r){
-        return r;
+    kfb_set_touchpads_colors(self, kfb_primary_touchpad_color(self), kfb_secondary_touchpad_color(self));
+    return 0;
+}
+
+int kfb_set_ranging(kinesta_functional_block *self, unsigned int freq_hz)
+{
+    self->tof_period_ms = freq_hz ? MSEC_PER_SEC / freq_hz : 0;
+    if (! self->trigger_enabled){
+        return 0;
     }
+    const struct sensor_value freq = {.val1=freq_hz, .val2=0};
+    return sensor_attr_set(self->tof, SENSOR_CHAN_DISTANCE, SENSOR_ATTR_SAMPLING_FREQUENCY, &freq);
+}
 
-    return kfb_update_secondary_touchpad(self);
+void kfb_blank(kinesta_functional_block *self)
+{
+    kfb_set_touchpads_colors(self, 0, 0);
+    encoder_set_color(self->encoder, 0);
 }
@@ -4,43 +4,105 @@
 #include "encoder.h"
 #include "touchpad.h"
 
+/* Distance sampling frequency of the slices, in Hz */
+#define KFB_TOF_SAMPLING_FREQ 25
+
 typedef struct {
     bool soft_disable;
 
     bool trigger_enabled;
+    // Distance sampling period of the sensors without trigger, 0 when stopped
+    uint32_t tof_period_ms;
+    int64_t tof_last_sample;
+    // Encoder value and distance read by the bring-up, sent by kfb_start()
+    float first_encoder_value;
+    uint32_t first_encoder_captured;
+    bool has_first_sample;
+    double first_distance_cm;
+    uint32_t first_sample_captured;
 
     const char *name;
     const uint8_t midi_cc_group;
+    // USB-MIDI cable of the slice
+    const uint8_t midi_cable;
+    // Transform of the MIDI events of the slice, or NULL
+    const struct midi_transform *midi_transform;
     const struct device *tof;
+    // I2C buses of the encoder and of the distance sensor, NULL when not on a bus
+    const struct device *encoder_bus;
+    const struct device *tof_bus;
     const struct device *primary_touchpad;
     const struct device *secondary_touchpad;
     const struct device *encoder;
 
     // Events
     struct encoder_callback_t encoder_change;
+    struct touchpad_callback_t primary_touch_change;
+    struct touchpad_callback_t secondary_touch_change;
 
     // Sensor input values
     double filtered_distance_cm;
     float encoder_value;
     bool is_in_tracking_zone;
     bool is_primary_pad_touched;
-    bool was_primary_pad_touched;
     bool is_secondary_pad_touched;
-    bool was_secondary_pad_touched;
 
-    // MIDI-CC values
+    // MIDI-CC values, and their 32 bits version for a USB MIDI 2.0 host
     uint8_t distance_midi_cc_value;
     uint8_t encoder_midi_cc_value;
+    uint32_t distance_ump_cc_value;
+    uint32_t encoder_ump_cc_value;
 
     // Software functions
     bool is_frozen;
+
+    // Inputs come from a sensor trace instead of the sensors
+    bool is_replaying;
 } kinesta_functional_block;
 
 extern const size_t N_KFBS;
 extern kinesta_functional_block *kfbs;
 
+/*
+ * Bring-up of a slice in stages, each one using the bus of a single device,
+ * so that the stages on different buses can run in parallel (kinesta_boot.h).
+ * The encoder has to be reset before being configured. The stages only read
+ * the inputs: no MIDI is sent and no callback is armed before kfb_start().
+ */
+int kfb_init_encoder_reset(kinesta_functional_block *self);
+
+int kfb_init_encoder(kinesta_functional_block *self);
+
+int kfb_init_tof(kinesta_functional_block *self);
+
+int kfb_init_touchpads(kinesta_functional_block *self);
+
+/*
+ * End of the bring-up, once all the stages of all slices are done: arms the
+ * encoder and touchpad callbacks, sends the first encoder value and distance
+ * sample as MIDI, then a first update
+ */
+int kfb_start(kinesta_functional_block *self);
+
+/* All the stages in sequence, then kfb_start() */
 int kfb_init(kinesta_functional_block *self);
 
 int kfb_update(kinesta_functional_block *self);
 
+/* Distance sampling frequency, 0 to stop the ranging */
+int kfb_set_ranging(kinesta_functional_block *self, unsigned int freq_hz);
+
+/* Switch off all the leds of the slice, until its next update */
+void kfb_blank(kinesta_functional_block *self);
+
+/*
+ * Processing of the sensor inputs, as read from the sensors or replayed from a
+ * trace, captured at the k_cycle_get_32() captured
+ */
+void kfb_process_distance(kinesta_functional_block *self, double measured_distance_cm, uint32_t captured);
+
+int kfb_process_encoder(kinesta_functional_block *self, float value, uint32_t captured);
+
+void kfb_process_touch(kinesta_functional_block *self, bool secondary, int evt, bool touched, uint32_t captured);
+
 #endif
@@ -1,6 +1,12 @@
 #include "kinesta_midi.h"
-#include "config.h"
 #include "usb_midi.h"
+#include "perf.h"
+#include "midi_trace.h"
+#include "midi_monitor.h"
+#include "kinesta_power.h"
+#if defined(CONFIG_MIDI_RTP)
+#include "midi_rtp.h"
+#endif
 
 #include <zephyr/drivers/uart.h>
 #include <zephyr/drivers/gpio.h>
@@ -10,15 +16,22 @@ struct kinesta_midi_din {
     const struct device *uart;
     const struct gpio_dt_spec rx_led;
     const struct gpio_dt_spec tx_led;
+    struct midi_encoder encoder;
 };
 
 #define KMIDI_FROM_DT(node) \
     {.enabled=true, .uart=DEVICE_DT_GET(DT_PROP(node, uart)), \
      .rx_led=GPIO_DT_SPEC_GET(node, rx_led_gpios), \
-     .tx_led=GPIO_DT_SPEC_GET(node, tx_led_gpios)},
+     .tx_led=GPIO_DT_SPEC_GET(node, tx_led_gpios), \
+     .encoder={.running_status=true}},
 
 #define N_MIDI_DINS ARRAY_SIZE(midi_dins)
 
+PERF_STAGE_DEFINE(midi_out);
+PERF_STAGE_DEFINE(din_tx);
+/* Time between the submission of a transfer to the host and its completion */
+PERF_STAGE_DEFINE(usb_in_transfer);
+
 static struct kinesta_midi_din midi_dins[] = {
     DT_FOREACH_STATUS_OKAY(kinesta_midi_din, KMIDI_FROM_DT)
 };
@@ -27,32 +40,104 @@ static void kinesta_midi_din_transmit(struct kinesta_midi_din *self, const uint8
     if (! self->enabled){
         gpio_pin_set_dt(&self->tx_led, 0);
         gpio_pin_set_dt(&self->rx_led, 0);
+        // The first message once enabled again carries its status
+        self->encoder.last_status = 0;
         return;
     }
 
+    uint32_t start = perf_now();
     gpio_pin_set_dt(&self->tx_led, 1);
 
-    uint8_t midi_cmd = midi_pkt[0] >> 4;
-    for (size_t i=0; i<midi_datasize(midi_cmd); i++){
-        uart_poll_out(self->uart, midi_pkt[i]);
+    // The sensors stream Control Changes: running status saves a third of the bytes
+    uint8_t bytes[3];
+    size_t n_bytes = midi_encoder_put_msg(&self->encoder, midi_pkt, bytes);
+    for (size_t i=0; i<n_bytes; i++){
+        MIDI_TRACE("din_tx", bytes[i], i);
+        uart_poll_out(self->uart, bytes[i]);
     }
 
     gpio_pin_set_dt(&self->tx_led, 0);
+    PERF_RECORD(din_tx, start);
+    midi_monitor_record(MIDI_MONITOR_PORT_DIN(self - midi_dins), midi_pkt);
 }
 
 static bool kinesta_midi_usb_enabled = true;
 
-void kinesta_midi_out(const uint8_t midi_pkt[3])
+static void kinesta_midi_usb_in_transfer(bool done, int size)
 {
+    static uint32_t start;
+    if (done){
+        PERF_RECORD(usb_in_transfer, start);
+    } else {
+        start = perf_now();
+    }
+}
+
+static kinesta_midi_tap_t kinesta_midi_tap = NULL;
+
+/* Send to all the outputs, except the USB host if it gets the UMP version */
+static void kinesta_midi_send(uint8_t cable, const uint8_t midi_pkt[3], bool usb)
+{
+    MIDI_TRACE("midi_out", MIDI_TRACE_PKT(midi_pkt), 0);
+    uint32_t start = perf_now();
     for (size_t i=0; i<N_MIDI_DINS; i++){
         kinesta_midi_din_transmit(&midi_dins[i], midi_pkt);
     }
 
-    if (kinesta_midi_usb_enabled) {
-        usb_midi_write(USB_MIDI_SENSORS_JACK_ID, midi_pkt);
+    if (usb && kinesta_midi_usb_enabled) {
+        usb_midi_write(cable, midi_pkt);
+    }
+#if defined(CONFIG_MIDI_RTP)
+    midi_rtp_write(midi_pkt);
+#endif
+    PERF_RECORD(midi_out, start);
+
+    if (kinesta_midi_tap){
+        kinesta_midi_tap(midi_pkt);
+    }
+}
+
+void kinesta_midi_out(uint8_t cable, const uint8_t midi_pkt[3])
+{
+    kinesta_midi_send(cable, midi_pkt, true);
+}
+
+void kinesta_midi_out_cc32(uint8_t cable, const uint8_t pkt[3], bool pkt_changed, uint32_t value, uint32_t captured)
+{
+    bool ump = usb_midi_is_ump();
+    if (ump && kinesta_midi_usb_enabled){
+        uint32_t msg[2];
+        midi_ump_control_change(cable, pkt[0] & 0x0f, pkt[1], value, msg);
+        usb_midi_write_ump(cable, msg, captured);
+    }
+    if (pkt_changed){
+        kinesta_midi_send(cable, pkt, ! ump);
+    }
+}
+
+void kinesta_midi_set_tap(kinesta_midi_tap_t tap)
+{
+    kinesta_midi_tap = tap;
+}
+
+/*
+ * The MIDI events from the host are not used, but they must be read for the
+ * host to keep sending, and for the MIDI clock to be followed (midi_clock.h)
+ */
+static void kinesta_midi_usb_rx_task()
+{
+    while (true){
+        if (usb_midi_is_suspended()){
+            kinesta_power_wait_host_awake();
+        } else if (! usb_midi_is_configured() || usb_midi_dispatch()){
+            k_sleep(K_MSEC(100));
+        }
     }
 }
 
+K_THREAD_DEFINE(kinesta_midi_usb_rx_id, 1024, kinesta_midi_usb_rx_task, NULL, NULL, NULL,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
+
 static bool din_btn_was_pressed = false;
 static bool usb_btn_was_pressed = false;
 static const struct gpio_dt_spec din_btn_pressed = GPIO_DT_SPEC_GET(DT_NODELABEL(midi_din_btn_pressed), gpios);
@@ -77,6 +162,10 @@ void kinesta_midi_init()
         gpio_pin_configure_dt(&midi_dins[i].tx_led, GPIO_OUTPUT);
         gpio_pin_configure_dt(&midi_dins[i].rx_led, GPIO_OUTPUT);
     }
+
+    if (IS_ENABLED(CONFIG_KINESTA_PERF)){
+        usb_midi_set_in_transfer_handler(kinesta_midi_usb_in_transfer);
+    }
 }
 
 void kinesta_midi_update()
@@ -1,8 +1,27 @@
 #ifndef KINESTA_MIDI_H
 #define KINESTA_MIDI_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
-void kinesta_midi_out(const uint8_t pkt[3]);
+/* Observer of all MIDI packets sent by kinesta_midi_out() */
+typedef void (*kinesta_midi_tap_t)(const uint8_t pkt[3]);
+
+void kinesta_midi_init();
+
+void kinesta_midi_update();
+
+/* Send a MIDI packet on the DIN outputs, on the given USB-MIDI cable and to the RTP-MIDI peer */
+void kinesta_midi_out(uint8_t cable, const uint8_t pkt[3]);
+
+/**
+ * Send a Control Change with a 32 bits value: to a USB MIDI 2.0 host at full
+ * resolution, with the JR timestamp of its capture (a k_cycle_get_32()), and
+ * as the MIDI 1.0 packet pkt to the other outputs, only if its 7 bits value
+ * changed (pkt_changed).
+ */
+void kinesta_midi_out_cc32(uint8_t cable, const uint8_t pkt[3], bool pkt_changed, uint32_t value, uint32_t captured);
+
+void kinesta_midi_set_tap(kinesta_midi_tap_t tap);
 
 #endif
@@ -0,0 +1,200 @@
+#include "kinesta_power.h"
+#include "kinesta_functional_block.h"
+#include "usb_midi.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(power);
+
+#define ACTIVE_LOOP_PERIOD K_MSEC(1)
+#define IDLE_LOOP_PERIOD   K_MSEC(CONFIG_KINESTA_POWER_IDLE_LOOP_PERIOD_MS)
+
+/* Set while the host is awake, cleared while it is suspended */
+#define POWER_EVT_HOST_AWAKE BIT(0)
+
+static K_EVENT_DEFINE(power_events);
+
+static enum kinesta_power_state state = KINESTA_POWER_ACTIVE;
+static float brightness = 1;
+static uint32_t fade_start;
+static uint32_t last_update;
+
+/* Uptime of the last activity, and cycle count of the last resume of the host */
+static atomic_t last_activity;
+static uint32_t resume_cycles;
+
+static struct kinesta_power_stats stats;
+
+static const char *const state_names[KINESTA_POWER_N_STATES] = {
+    [KINESTA_POWER_ACTIVE] = "active",
+    [KINESTA_POWER_IDLE] = "idle",
+    [KINESTA_POWER_SUSPENDING] = "suspending",
+    [KINESTA_POWER_SUSPENDED] = "suspended",
+};
+
+/* Called from the USB status callback */
+static void kinesta_power_usb_suspend(bool suspended)
+{
+    if (suspended){
+        k_event_set(&power_events, 0);
+    } else {
+        resume_cycles = k_cycle_get_32();
+        k_event_post(&power_events, POWER_EVT_HOST_AWAKE);
+    }
+}
+
+static void kinesta_power_set_ranging(unsigned int freq_hz)
+{
+    for (size_t i=0; i<N_KFBS; i++){
+        if (kfb_set_ranging(&kfbs[i], freq_hz)){
+            LOG_WRN("[%s] Unable to set the distance sampling to %uHz", kfbs[i].name, freq_hz);
+        }
+    }
+}
+
+static void kinesta_power_enter(enum kinesta_power_state new_state)
+{
+    LOG_INF("%s -> %s", state_names[state], state_names[new_state]);
+
+    switch (new_state){
+    case KINESTA_POWER_ACTIVE:
+        kinesta_power_set_ranging(KFB_TOF_SAMPLING_FREQ);
+        brightness = 1;
+        break;
+    case KINESTA_POWER_IDLE:
+        kinesta_power_set_ranging(CONFIG_KINESTA_POWER_IDLE_TOF_FREQ);
+        break;
+    case KINESTA_POWER_SUSPENDING:
+        kinesta_power_set_ranging(0);
+        fade_start = k_uptime_get_32();
+        break;
+    case KINESTA_POWER_SUSPENDED:
+        for (size_t i=0; i<N_KFBS; i++){
+            kfb_blank(&kfbs[i]);
+        }
+        brightness = 0;
+        stats.suspends++;
+        break;
+    default:
+        break;
+    }
+    state = new_state;
+}
+
+/* Sleep until the host resumes, with all timers of the main loop stopped */
+static void kinesta_power_wait_resume()
+{
+    kinesta_power_wait_host_awake();
+
+    uint32_t latency_us = k_cyc_to_us_floor32(k_cycle_get_32() - resume_cycles);
+    stats.resume_latency_last_us = latency_us;
+    stats.resume_latency_max_us = MAX(stats.resume_latency_max_us, latency_us);
+
+    atomic_set(&last_activity, k_uptime_get_32());
+    kinesta_power_enter(KINESTA_POWER_ACTIVE);
+    for (size_t i=0; i<N_KFBS; i++){
+        // Restore the encoder led
+        kfb_process_encoder(&kfbs[i], kfbs[i].encoder_value, k_cycle_get_32());
+    }
+}
+
+void kinesta_power_wait_host_awake()
+{
+    k_event_wait(&power_events, POWER_EVT_HOST_AWAKE, false, K_FOREVER);
+}
+
+void kinesta_power_init()
+{
+    uint32_t now = k_uptime_get_32();
+    last_update = now;
+    atomic_set(&last_activity, now);
+    usb_midi_set_suspend_handler(kinesta_power_usb_suspend);
+    if (! usb_midi_is_suspended()){
+        k_event_post(&power_events, POWER_EVT_HOST_AWAKE);
+    }
+}
+
+k_timeout_t kinesta_power_update()
+{
+    uint32_t now = k_uptime_get_32();
+    bool host_awake = k_event_wait(&power_events, POWER_EVT_HOST_AWAKE, false, K_NO_WAIT) != 0;
+
+    stats.time_ms[state] += now - last_update;
+    stats.wakeups[state]++;
+    last_update = now;
+
+    if (! host_awake){
+        if (state != KINESTA_POWER_SUSPENDING){
+            kinesta_power_enter(KINESTA_POWER_SUSPENDING);
+        }
+        uint32_t elapsed = now - fade_start;
+        if (elapsed < CONFIG_KINESTA_POWER_FADE_MS){
+            brightness = 1 - (float) elapsed / CONFIG_KINESTA_POWER_FADE_MS;
+            return ACTIVE_LOOP_PERIOD;
+        }
+
+        kinesta_power_enter(KINESTA_POWER_SUSPENDED);
+        kinesta_power_wait_resume();
+        last_update = k_uptime_get_32();
+        stats.time_ms[KINESTA_POWER_SUSPENDED] += last_update - now;
+        return ACTIVE_LOOP_PERIOD;
+    }
+
+    bool idle = now - (uint32_t) atomic_get(&last_activity) >= CONFIG_KINESTA_POWER_IDLE_TIMEOUT_S * MSEC_PER_SEC;
+    if (state == KINESTA_POWER_SUSPENDING || (state == KINESTA_POWER_IDLE && ! idle)){
+        // Host resumed while fading out, or activity while idle
+        kinesta_power_enter(KINESTA_POWER_ACTIVE);
+    } else if (state == KINESTA_POWER_ACTIVE && idle){
+        kinesta_power_enter(KINESTA_POWER_IDLE);
+    }
+
+    return (state == KINESTA_POWER_IDLE) ? IDLE_LOOP_PERIOD : ACTIVE_LOOP_PERIOD;
+}
+
+void kinesta_power_activity()
+{
+    atomic_set(&last_activity, k_uptime_get_32());
+}
+
+enum kinesta_power_state kinesta_power_state()
+{
+    return state;
+}
+
+const char *kinesta_power_state_name(enum kinesta_power_state power_state)
+{
+    return (power_state < KINESTA_POWER_N_STATES) ? state_names[power_state] : "unknown";
+}
+
+float kinesta_power_brightness()
+{
+    return brightness;
+}
+
+void kinesta_power_get_stats(struct kinesta_power_stats *res)
+{
+    *res = stats;
+}
+
+#if defined(CONFIG_SHELL)
+static int cmd_power(const struct shell *sh, size_t argc, char **argv)
+{
+    struct kinesta_power_stats snapshot;
+    kinesta_power_get_stats(&snapshot);
+
+    shell_print(sh, "State: %s, USB %s", kinesta_power_state_name(kinesta_power_state()),
+                usb_midi_is_suspended() ? "suspended" : "awake");
+    shell_print(sh, "%-12s %10s %10s %10s", "state", "time_ms", "wakeups", "wakeups/s");
+    for (int i=0; i<KINESTA_POWER_N_STATES; i++){
+        uint32_t rate = snapshot.time_ms[i] ? (uint64_t) snapshot.wakeups[i] * MSEC_PER_SEC / snapshot.time_ms[i] : 0;
+        shell_print(sh, "%-12s %10u %10u %10u", state_names[i], snapshot.time_ms[i], snapshot.wakeups[i], rate);
+    }
+    shell_print(sh, "Suspends: %u, resume latency: last %uus, max %uus", snapshot.suspends,
+                snapshot.resume_latency_last_us, snapshot.resume_latency_max_us);
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((kinesta), power, NULL, "Power state and wakeup counters", cmd_power, 1, 0);
+#endif
@@ -0,0 +1,58 @@
+#ifndef KINESTA_POWER_H
+#define KINESTA_POWER_H
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/*
+ * Power states of the instrument, driven by the USB suspend of the host and
+ * by the activity on the sensors:
+ * - active: distance sensors sampled at full rate, 1ms main loop
+ * - idle: no activity for a while, slow ranging and main loop, a hand above
+ *   a sensor or a touch brings the instrument back to active
+ * - suspending: the host sleeps, ranging stopped, the leds fade out
+ * - suspended: all leds off, the main loop waits for the host to resume
+ */
+enum kinesta_power_state {
+    KINESTA_POWER_ACTIVE,
+    KINESTA_POWER_IDLE,
+    KINESTA_POWER_SUSPENDING,
+    KINESTA_POWER_SUSPENDED,
+    KINESTA_POWER_N_STATES,
+};
+
+struct kinesta_power_stats {
+    // Time spent and main loop iterations in each state
+    uint32_t time_ms[KINESTA_POWER_N_STATES];
+    uint32_t wakeups[KINESTA_POWER_N_STATES];
+    uint32_t suspends;
+    // From the resume of the host to the main loop running again
+    uint32_t resume_latency_last_us;
+    uint32_t resume_latency_max_us;
+};
+
+void kinesta_power_init();
+
+/**
+ * @brief      Update the power state, once per main loop iteration. Blocks
+ *             while the host is suspended.
+ * @return     The period of the main loop in the new state
+ */
+k_timeout_t kinesta_power_update();
+
+/* Block while the host is suspended */
+void kinesta_power_wait_host_awake();
+
+/* Sensor activity, postpones the idle state */
+void kinesta_power_activity();
+
+enum kinesta_power_state kinesta_power_state();
+
+const char *kinesta_power_state_name(enum kinesta_power_state state);
+
+/* Brightness of the leds, from 1 down to 0 when fading out */
+float kinesta_power_brightness();
+
+void kinesta_power_get_stats(struct kinesta_power_stats *stats);
+
+#endif
@@ -3,6 +3,9 @@
 
 #include "touchpad.h"
 #include "kinesta_functional_block.h"
+#include "kinesta_midi.h"
+#include "kinesta_power.h"
+#include "kinesta_boot.h"
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(app);
@@ -67,12 +70,14 @@ void autotest()
  */
 void setup_wiring_workaround()
 {
+#if DT_NODE_EXISTS(DT_NODELABEL(gpiod))
     const struct device *dev = DEVICE_DT_GET(DT_NODELABEL(gpiod));
     if (! dev){
         LOG_ERR("Unable to open gpiod");
     } else {
         gpio_pin_configure(dev, 7, GPIO_INPUT);
     }
+#endif
 }
 
 void main(void)
@@ -86,28 +91,22 @@ void main(void)
 
     setup_wiring_workaround();
 
-    if (usb_enable(NULL) == 0){
-        LOG_INF("USB enabled");
-    } else {
-        LOG_ERR("Failed to enable USB");
+    // USB enumeration and bring-up of the slices, in parallel
+    if (kinesta_boot()){
+        LOG_ERR("Boot failed");
         return;
     }
 
-    LOG_INF("Initializing %d KFB(s)", (int) N_KFBS);
-
-    for (i=0; i<N_KFBS; i++){
-        LOG_INF("Initializing KFB %s", kfbs[i].name);
-        if (kfb_init(&kfbs[i])){
-            return;
-        }
-    }
+    kinesta_power_init();
 
     LOG_INF("Starting mainloop");
     while (true){
+        // Slower when idle, blocks while the host is suspended
+        k_timeout_t period = kinesta_power_update();
         for (i=0; i<N_KFBS; i++){
             kfb_update(&kfbs[i]);
         }
         kinesta_midi_update();
-        k_sleep(K_MSEC(1));
+        k_sleep(period);
     }
 }
@@ -0,0 +1,200 @@
+/**
+ * Telemetry frames on the CDC-ACM port of the kinesta,telemetry-uart chosen
+ * node. The sensor paths only append their record to the frame being filled;
+ * full frames are queued in a buffer, drained by the UART callback in chunks
+ * as large as the buffer allows, so that the CDC-ACM driver sends full bulk
+ * packets and the MIDI path never waits on the telemetry.
+ */
+
+#include "kinesta_telemetry.h"
+#include "kinesta_functional_block.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/init.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/ring_buffer.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(telemetry);
+
+/* Period of the polling of DTR, for the opening and closing of the port */
+#define DTR_POLL_MS 100
+
+struct telemetry_frame {
+    struct kinesta_telemetry_header header;
+    struct sensor_trace_record records[CONFIG_KINESTA_TELEMETRY_FRAME_RECORDS];
+} __packed;
+
+static const struct device *const uart = DEVICE_DT_GET(DT_CHOSEN(kinesta_telemetry_uart));
+
+/* The frame being filled, while the port is open */
+static struct telemetry_frame frame;
+static size_t n_records;
+static uint32_t seq;
+static bool port_open;
+static int64_t start_ticks;
+static struct kinesta_telemetry_stats stats;
+static struct k_spinlock lock;
+
+RING_BUF_DECLARE(telemetry_buf, CONFIG_KINESTA_TELEMETRY_BUFFER_SIZE);
+
+static void telemetry_flush_timeout(struct k_work *work);
+static void telemetry_poll_dtr(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(telemetry_flush_work, telemetry_flush_timeout);
+K_WORK_DELAYABLE_DEFINE(telemetry_dtr_work, telemetry_poll_dtr);
+
+/* Queue the frame being filled, with the lock held */
+static void telemetry_flush()
+{
+    if (n_records == 0){
+        return;
+    }
+
+    size_t size = sizeof(frame.header) + n_records * sizeof(frame.records[0]);
+    frame.header.magic = sys_cpu_to_le16(KINESTA_TELEMETRY_MAGIC);
+    frame.header.n_records = sys_cpu_to_le16(n_records);
+    frame.header.seq = sys_cpu_to_le32(seq++);
+    if (ring_buf_space_get(&telemetry_buf) >= size){
+        ring_buf_put(&telemetry_buf, (const uint8_t *) &frame, size);
+        stats.frames++;
+        stats.records += n_records;
+        stats.bytes += size;
+    } else {
+        stats.dropped_frames++;
+    }
+    n_records = 0;
+}
+
+void kinesta_telemetry_record(enum sensor_trace_type type, unsigned slice, uint16_t value)
+{
+    int64_t now = k_uptime_ticks();
+    bool first = false;
+    bool full = false;
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (port_open){
+        struct sensor_trace_record *rec = &frame.records[n_records++];
+        rec->timestamp_us = sys_cpu_to_le32(k_ticks_to_us_floor64(now - start_ticks));
+        rec->type = type;
+        rec->slice = slice;
+        rec->value = sys_cpu_to_le16(value);
+
+        first = n_records == 1;
+        full = n_records == ARRAY_SIZE(frame.records);
+        if (full){
+            telemetry_flush();
+        }
+    }
+    k_spin_unlock(&lock, key);
+
+    if (full){
+        uart_irq_tx_enable(uart);
+    } else if (first){
+        k_work_schedule(&telemetry_flush_work, K_MSEC(CONFIG_KINESTA_TELEMETRY_FLUSH_MS));
+    }
+}
+
+static void telemetry_flush_timeout(struct k_work *work)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    telemetry_flush();
+    k_spin_unlock(&lock, key);
+    uart_irq_tx_enable(uart);
+}
+
+/* The host opens the port by setting DTR: each opening starts a new trace.
+ * The legacy CDC-ACM driver has no notification of the line state changes,
+ * it is only exposed by uart_line_ctrl_get. */
+static void telemetry_poll_dtr(struct k_work *work)
+{
+    uint32_t dtr = 0;
+    int r = uart_line_ctrl_get(uart, UART_LINE_CTRL_DTR, &dtr);
+    if (r){
+        LOG_ERR("Unable to get the DTR of the telemetry port: %d", r);
+        return;
+    }
+
+    if ((bool) dtr != port_open){
+        k_spinlock_key_t key = k_spin_lock(&lock);
+        port_open = dtr;
+        n_records = 0;
+        seq = 0;
+        start_ticks = k_uptime_ticks();
+        k_spin_unlock(&lock, key);
+
+        LOG_INF("Telemetry port %s", dtr ? "opened" : "closed");
+        if (dtr){
+            kinesta_telemetry_record(SENSOR_TRACE_START, N_KFBS, SENSOR_TRACE_VERSION);
+        } else {
+            // The callback discards the frames not sent
+            uart_irq_tx_enable(uart);
+        }
+    }
+    k_work_schedule(&telemetry_dtr_work, K_MSEC(DTR_POLL_MS));
+}
+
+static void telemetry_uart_callback(const struct device *dev, void *user_data)
+{
+    while (uart_irq_update(dev) && uart_irq_tx_ready(dev)){
+        if (! port_open){
+            ring_buf_get(&telemetry_buf, NULL, ring_buf_size_get(&telemetry_buf));
+        }
+
+        uint8_t *data;
+        size_t len = ring_buf_get_claim(&telemetry_buf, &data, CONFIG_KINESTA_TELEMETRY_BUFFER_SIZE);
+        int sent = (len > 0) ? uart_fifo_fill(dev, data, len) : 0;
+        ring_buf_get_finish(&telemetry_buf, MAX(sent, 0));
+
+        if (len == 0){
+            uart_irq_tx_disable(dev);
+        }
+        // Called again once the driver has room
+        if (sent <= 0){
+            break;
+        }
+    }
+}
+
+void kinesta_telemetry_get_stats(struct kinesta_telemetry_stats *res)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    *res = stats;
+    k_spin_unlock(&lock, key);
+}
+
+static int kinesta_telemetry_init(void)
+{
+    if (! device_is_ready(uart)){
+        LOG_ERR("Telemetry port not ready");
+        return -ENODEV;
+    }
+
+    uart_irq_callback_set(uart, telemetry_uart_callback);
+    k_work_schedule(&telemetry_dtr_work, K_MSEC(DTR_POLL_MS));
+    return 0;
+}
+
+SYS_INIT(kinesta_telemetry_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+
+static int cmd_telemetry(const struct shell *sh, size_t argc, char **argv)
+{
+    struct kinesta_telemetry_stats st;
+    kinesta_telemetry_get_stats(&st);
+
+    shell_print(sh, "Port %s, %u/%u bytes queued", port_open ? "open" : "closed",
+                ring_buf_size_get(&telemetry_buf), (unsigned) CONFIG_KINESTA_TELEMETRY_BUFFER_SIZE);
+    shell_print(sh, "%u frames, %u records, %u bytes, %u frames dropped",
+                st.frames, st.records, st.bytes, st.dropped_frames);
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((kinesta), telemetry, NULL, "Show the state of the telemetry port", cmd_telemetry, 1, 0);
+#endif
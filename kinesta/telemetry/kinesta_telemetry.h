@@ -0,0 +1,72 @@
+#ifndef KINESTA_TELEMETRY_H
+#define KINESTA_TELEMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+
+#include "sensor_trace.h"
+
+/**
+ * Raw sensor telemetry on a CDC-ACM interface of the USB device, next to the
+ * USB-MIDI function: every distance sample, encoder value and touch edge of
+ * the slices, as the records of a sensor trace (sensor_trace.h).
+ *
+ * The stream starts with a SENSOR_TRACE_START record each time the host opens
+ * the port (DTR), and is cut in frames of up to
+ * CONFIG_KINESTA_TELEMETRY_FRAME_RECORDS records, each one sent at most
+ * CONFIG_KINESTA_TELEMETRY_FLUSH_MS after its first record. A frame is a
+ * kinesta_telemetry_header followed by its records, all little endian.
+ * Without the headers, the records of a capture are a trace that replays
+ * with CONFIG_KINESTA_SENSOR_TRACE_REPLAY. Their timestamps wrap after 71
+ * minutes, the records being in order the tooling can unwrap them.
+ */
+
+/* "KT", the first bytes of a frame */
+#define KINESTA_TELEMETRY_MAGIC 0x544B
+
+struct kinesta_telemetry_header {
+    uint16_t magic;
+    // Number of records in the frame
+    uint16_t n_records;
+    // Frame number since the opening of the port, a gap is a dropped frame
+    uint32_t seq;
+} __packed;
+
+#if defined(CONFIG_KINESTA_TELEMETRY)
+
+void kinesta_telemetry_record(enum sensor_trace_type type, unsigned slice, uint16_t value);
+
+struct kinesta_telemetry_stats {
+    uint32_t frames;
+    uint32_t records;
+    uint32_t bytes;
+    // Frames dropped on a full buffer, while the host does not read the port
+    uint32_t dropped_frames;
+};
+
+void kinesta_telemetry_get_stats(struct kinesta_telemetry_stats *stats);
+
+#else
+
+static inline void kinesta_telemetry_record(enum sensor_trace_type type, unsigned slice, uint16_t value) {}
+
+#endif
+
+static inline void kinesta_telemetry_distance(unsigned slice, double distance_cm)
+{
+    kinesta_telemetry_record(SENSOR_TRACE_DISTANCE, slice, sensor_trace_distance_value(distance_cm));
+}
+
+static inline void kinesta_telemetry_encoder(unsigned slice, float value)
+{
+    kinesta_telemetry_record(SENSOR_TRACE_ENCODER, slice, sensor_trace_encoder_value(value));
+}
+
+static inline void kinesta_telemetry_touch(unsigned slice, bool secondary, int evt, bool touched)
+{
+    kinesta_telemetry_record(secondary ? SENSOR_TRACE_SECONDARY_TOUCH : SENSOR_TRACE_PRIMARY_TOUCH,
+                             slice, SENSOR_TRACE_TOUCH_VALUE(evt, touched));
+}
+
+#endif
@@ -0,0 +1,128 @@
+/**
+ * Capture of the sensor inputs in RAM, dumped with the "kinesta trace" shell
+ * commands. The dump is plain hexadecimal, which converts back to a binary
+ * trace with `xxd -r -p dump.txt trace.bin`.
+ */
+
+#include "sensor_trace.h"
+#include "kinesta_functional_block.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+
+/* Records per line of dump */
+#define DUMP_RECORDS_PER_LINE 4
+
+static struct sensor_trace_record trace[CONFIG_KINESTA_SENSOR_TRACE_RECORDS];
+static size_t trace_len;
+static uint32_t trace_dropped;
+static bool trace_running;
+static int64_t trace_start_ticks;
+static struct k_spinlock trace_lock;
+
+static void sensor_trace_append(enum sensor_trace_type type, unsigned slice, uint16_t value)
+{
+    k_spinlock_key_t key = k_spin_lock(&trace_lock);
+
+    if (! trace_running){
+        // Not capturing
+    } else if (trace_len == ARRAY_SIZE(trace)){
+        // Keep the beginning of the capture, so that it always replays from a known state
+        trace_dropped++;
+    } else {
+        struct sensor_trace_record *rec = &trace[trace_len++];
+        rec->timestamp_us = sys_cpu_to_le32(k_ticks_to_us_floor64(k_uptime_ticks() - trace_start_ticks));
+        rec->type = type;
+        rec->slice = slice;
+        rec->value = sys_cpu_to_le16(value);
+    }
+
+    k_spin_unlock(&trace_lock, key);
+}
+
+void sensor_trace_start(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&trace_lock);
+    trace_len = 0;
+    trace_dropped = 0;
+    trace_start_ticks = k_uptime_ticks();
+    trace_running = true;
+    k_spin_unlock(&trace_lock, key);
+
+    sensor_trace_append(SENSOR_TRACE_START, N_KFBS, SENSOR_TRACE_VERSION);
+}
+
+void sensor_trace_stop(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&trace_lock);
+    trace_running = false;
+    k_spin_unlock(&trace_lock, key);
+}
+
+void sensor_trace_distance(unsigned slice, double distance_cm)
+{
+    sensor_trace_append(SENSOR_TRACE_DISTANCE, slice, sensor_trace_distance_value(distance_cm));
+}
+
+void sensor_trace_encoder(unsigned slice, float value)
+{
+    sensor_trace_append(SENSOR_TRACE_ENCODER, slice, sensor_trace_encoder_value(value));
+}
+
+void sensor_trace_touch(unsigned slice, bool secondary, int evt, bool touched)
+{
+    enum sensor_trace_type type = secondary ? SENSOR_TRACE_SECONDARY_TOUCH : SENSOR_TRACE_PRIMARY_TOUCH;
+    sensor_trace_append(type, slice, SENSOR_TRACE_TOUCH_VALUE(evt, touched));
+}
+
+static int cmd_trace_start(const struct shell *sh, size_t argc, char **argv)
+{
+    sensor_trace_start();
+    shell_print(sh, "Capturing up to %d records", (int) ARRAY_SIZE(trace));
+    return 0;
+}
+
+static int cmd_trace_stop(const struct shell *sh, size_t argc, char **argv)
+{
+    sensor_trace_stop();
+    shell_print(sh, "%d records, %u dropped", (int) trace_len, trace_dropped);
+    return 0;
+}
+
+static int cmd_trace_status(const struct shell *sh, size_t argc, char **argv)
+{
+    shell_print(sh, "%s, %d/%d records, %u dropped", trace_running ? "capturing" : "stopped",
+                (int) trace_len, (int) ARRAY_SIZE(trace), trace_dropped);
+    return 0;
+}
+
+static int cmd_trace_dump(const struct shell *sh, size_t argc, char **argv)
+{
+    if (trace_running){
+        shell_error(sh, "Stop the capture first");
+        return -EBUSY;
+    }
+
+    char line[2 * DUMP_RECORDS_PER_LINE * sizeof(struct sensor_trace_record) + 1];
+    const uint8_t *bytes = (const uint8_t *) trace;
+    size_t n_bytes = trace_len * sizeof(struct sensor_trace_record);
+
+    for (size_t offset=0; offset<n_bytes; offset+=(sizeof(line) - 1) / 2){
+        size_t n = MIN((sizeof(line) - 1) / 2, n_bytes - offset);
+        bin2hex(&bytes[offset], n, line, sizeof(line));
+        shell_print(sh, "%s", line);
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(trace_cmds,
+    SHELL_CMD(start, NULL, "Start a new capture", cmd_trace_start),
+    SHELL_CMD(stop, NULL, "Stop the capture", cmd_trace_stop),
+    SHELL_CMD(status, NULL, "Show the capture state", cmd_trace_status),
+    SHELL_CMD(dump, NULL, "Dump the captured trace in hexadecimal", cmd_trace_dump),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((kinesta), trace, &trace_cmds, "Sensor trace capture", NULL, 1, 0);
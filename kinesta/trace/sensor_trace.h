@@ -0,0 +1,87 @@
+#ifndef SENSOR_TRACE_H
+#define SENSOR_TRACE_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/toolchain.h>
+#include <zephyr/sys/util.h>
+
+/**
+ * Sensor traces: the inputs of the slices, as seen by the application.
+ *
+ * A trace is a sequence of fixed-size little-endian records. It always starts
+ * with a SENSOR_TRACE_START record, whose value is the format version and
+ * whose slice is the number of slices of the capturing instrument.
+ */
+#define SENSOR_TRACE_VERSION 1
+
+enum sensor_trace_type {
+    SENSOR_TRACE_START = 0,
+    // value: measured distance in mm
+    SENSOR_TRACE_DISTANCE = 1,
+    // value: encoder value, on 0..UINT16_MAX
+    SENSOR_TRACE_ENCODER = 2,
+    // value: TOUCHPAD_EVT_* in the low byte, debounced touch state in the high byte
+    SENSOR_TRACE_PRIMARY_TOUCH = 3,
+    SENSOR_TRACE_SECONDARY_TOUCH = 4,
+};
+
+struct sensor_trace_record {
+    // Time since the start of the capture
+    uint32_t timestamp_us;
+    uint8_t type;
+    uint8_t slice;
+    uint16_t value;
+} __packed;
+
+#define SENSOR_TRACE_TOUCH_VALUE(evt, touched) (((evt) & 0xff) | ((touched) ? 0x100 : 0))
+
+/* Values of the records of distances and encoder values, rounded to the
+ * nearest: the distances of the sensors are whole millimeters, which the
+ * conversions to cm and back can leave just below */
+static inline uint16_t sensor_trace_distance_value(double distance_cm)
+{
+    double distance_mm = 10 * distance_cm;
+    if (distance_mm < 0){
+        return 0;
+    } else if (distance_mm > UINT16_MAX){
+        return UINT16_MAX;
+    }
+    return lround(distance_mm);
+}
+
+static inline uint16_t sensor_trace_encoder_value(float value)
+{
+    return lroundf(CLAMP(value, 0, 1) * UINT16_MAX);
+}
+
+#if defined(CONFIG_KINESTA_SENSOR_TRACE)
+
+/**
+ * @brief      Start a new capture, discarding the previous one
+ */
+void sensor_trace_start(void);
+
+/**
+ * @brief      Stop the capture, the recorded trace is kept
+ */
+void sensor_trace_stop(void);
+
+void sensor_trace_distance(unsigned slice, double distance_cm);
+
+void sensor_trace_encoder(unsigned slice, float value);
+
+void sensor_trace_touch(unsigned slice, bool secondary, int evt, bool touched);
+
+#else
+
+static inline void sensor_trace_distance(unsigned slice, double distance_cm) {}
+
+static inline void sensor_trace_encoder(unsigned slice, float value) {}
+
+static inline void sensor_trace_touch(unsigned slice, bool secondary, int evt, bool touched) {}
+
+#endif
+
+#endif
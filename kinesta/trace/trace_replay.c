@@ -0,0 +1,167 @@
+/**
+ * Replay of a sensor trace, embedded at build time, in place of the sensors.
+ *
+ * The records are fed to the slices at their original timestamps, through the
+ * same processing functions as the live sensors. Every MIDI packet out of
+ * kinesta_midi_out() is printed with the timestamp of the record which caused
+ * it, so that the output of two replays of the same trace can be diffed.
+ * A timing report follows the MIDI stream.
+ */
+
+#include "sensor_trace.h"
+#include "kinesta_functional_block.h"
+#include "kinesta_midi.h"
+#include "perf.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/byteorder.h>
+#if defined(CONFIG_ARCH_POSIX)
+#include <posix_board_if.h>
+#endif
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(trace_replay);
+
+/* Let the application initialize all slices before replaying anything */
+#define REPLAY_START_DELAY_MS 2000
+
+#define N_RECORD_TYPES (SENSOR_TRACE_SECONDARY_TOUCH + 1)
+
+PERF_STAGE_DEFINE(replay_distance);
+PERF_STAGE_DEFINE(replay_encoder);
+PERF_STAGE_DEFINE(replay_touch);
+
+static const uint8_t replay_trace[] __aligned(4) = {
+#include "sensor_trace_replay.inc"
+};
+
+static struct perf_stage *const replay_stages[N_RECORD_TYPES] = {
+    [SENSOR_TRACE_DISTANCE] = &perf_stage_replay_distance,
+    [SENSOR_TRACE_ENCODER] = &perf_stage_replay_encoder,
+    [SENSOR_TRACE_PRIMARY_TOUCH] = &perf_stage_replay_touch,
+    [SENSOR_TRACE_SECONDARY_TOUCH] = &perf_stage_replay_touch,
+};
+
+static uint32_t replay_timestamp_us;
+static unsigned replay_midi_packets;
+
+static void replay_midi_tap(const uint8_t pkt[3])
+{
+    printk("midi %10u %02x %02x %02x\n", replay_timestamp_us, pkt[0], pkt[1], pkt[2]);
+    replay_midi_packets++;
+}
+
+static int replay_record(const struct sensor_trace_record *rec)
+{
+    if (rec->slice >= N_KFBS){
+        return -ENODEV;
+    }
+
+    kinesta_functional_block *kfb = &kfbs[rec->slice];
+    uint16_t value = sys_le16_to_cpu(rec->value);
+
+    switch (rec->type){
+    case SENSOR_TRACE_DISTANCE:
+        kfb_process_distance(kfb, value / 10.0, k_cycle_get_32());
+        return 0;
+    case SENSOR_TRACE_ENCODER:
+        return kfb_process_encoder(kfb, (float) value / UINT16_MAX, k_cycle_get_32());
+    case SENSOR_TRACE_PRIMARY_TOUCH:
+    case SENSOR_TRACE_SECONDARY_TOUCH:
+        kfb_process_touch(kfb, rec->type == SENSOR_TRACE_SECONDARY_TOUCH, value & 0xff, value >> 8,
+                          k_cycle_get_32());
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+static void replay_report(size_t n_records, unsigned skipped, uint32_t max_lateness_us)
+{
+    static const char *const names[] = {"distance", "encoder", "touch"};
+    const struct perf_stage *stages[] = {&perf_stage_replay_distance, &perf_stage_replay_encoder, &perf_stage_replay_touch};
+
+    printk("\n=== Replayed %d record(s), %u skipped, %u MIDI packet(s) ===\n",
+           (int) n_records, skipped, replay_midi_packets);
+    printk("max lateness: %uus\n", max_lateness_us);
+    printk("%-10s %8s %10s %10s %10s %10s\n", "input", "count", "min[us]", "avg[us]", "p99[us]", "max[us]");
+
+    for (size_t i=0; i<ARRAY_SIZE(stages); i++){
+        const struct perf_stage *stage = stages[i];
+        if (! stage->count){
+            printk("%-10s %8u\n", names[i], 0);
+            continue;
+        }
+        printk("%-10s %8u %10u %10u %10u %10u\n", names[i], stage->count,
+               (uint32_t) (perf_cycles_to_ns(stage->min) / 1000),
+               (uint32_t) (perf_cycles_to_ns(stage->total / stage->count) / 1000),
+               (uint32_t) (perf_cycles_to_ns(perf_stage_percentile(stage, 99)) / 1000),
+               (uint32_t) (perf_cycles_to_ns(stage->max) / 1000));
+    }
+}
+
+static void replay_main(void *p1, void *p2, void *p3)
+{
+    const struct sensor_trace_record *records = (const struct sensor_trace_record *) replay_trace;
+    size_t n_records = sizeof(replay_trace) / sizeof(struct sensor_trace_record);
+    unsigned skipped = 0;
+    uint32_t max_lateness_us = 0;
+    int status = 1;
+
+    if (n_records == 0 || records[0].type != SENSOR_TRACE_START){
+        LOG_ERR("Not a sensor trace");
+        goto exit;
+    }
+    if (sys_le16_to_cpu(records[0].value) != SENSOR_TRACE_VERSION){
+        LOG_ERR("Unsupported sensor trace version %d", sys_le16_to_cpu(records[0].value));
+        goto exit;
+    }
+    if (records[0].slice != N_KFBS){
+        LOG_WRN("Trace captured with %d slice(s), replaying on %d", records[0].slice, (int) N_KFBS);
+    }
+
+    for (size_t i=0; i<N_KFBS; i++){
+        kfbs[i].is_replaying = true;
+    }
+    kinesta_midi_set_tap(replay_midi_tap);
+
+    int64_t origin = k_uptime_ticks();
+    for (size_t i=1; i<n_records; i++){
+        const struct sensor_trace_record *rec = &records[i];
+        replay_timestamp_us = sys_le32_to_cpu(rec->timestamp_us);
+
+        k_sleep(K_TIMEOUT_ABS_TICKS(origin + k_us_to_ticks_ceil64(replay_timestamp_us)));
+        int64_t elapsed_us = k_ticks_to_us_floor64(k_uptime_ticks() - origin);
+        if (elapsed_us - replay_timestamp_us > max_lateness_us){
+            max_lateness_us = elapsed_us - replay_timestamp_us;
+        }
+
+        uint32_t start = perf_now();
+        int r = replay_record(rec);
+        if (rec->type < N_RECORD_TYPES && replay_stages[rec->type]){
+            perf_stage_record(replay_stages[rec->type], start);
+        }
+        if (r){
+            LOG_WRN("Record %d (type %d, slice %d) not replayed: %d", (int) i, rec->type, rec->slice, r);
+            skipped++;
+        }
+    }
+
+    kinesta_midi_set_tap(NULL);
+    for (size_t i=0; i<N_KFBS; i++){
+        kfbs[i].is_replaying = false;
+    }
+    replay_report(n_records - 1, skipped, max_lateness_us);
+    status = 0;
+
+exit:
+#if defined(CONFIG_ARCH_POSIX)
+    posix_exit(status);
+#else
+    ARG_UNUSED(status);
+#endif
+}
+
+K_THREAD_DEFINE(trace_replay_tid, 2048,
+                replay_main, NULL, NULL, NULL,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, REPLAY_START_DELAY_MS);
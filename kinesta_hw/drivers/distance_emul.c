@@ -0,0 +1,129 @@
+#include "distance_emul.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/sensor.h>
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(distance_emul);
+
+#define DT_DRV_COMPAT kinesta_distance_emul
+
+struct distance_emul_config {
+    uint32_t initial_distance_mm;
+};
+
+struct distance_emul_data {
+    const struct device *dev;
+    struct k_timer sampling_timer;
+    struct k_work data_ready_work;
+    sensor_trigger_handler_t data_ready_handler;
+    struct sensor_trigger data_ready_trigger;
+
+    // Distances in um: the injected one, and the one of the last sample
+    atomic_t distance_um;
+    int32_t sample_um;
+};
+
+static void distance_emul_data_ready(struct k_work *work)
+{
+    struct distance_emul_data *drv_data = CONTAINER_OF(work, struct distance_emul_data, data_ready_work);
+    if (drv_data->data_ready_handler){
+        drv_data->data_ready_handler(drv_data->dev, &drv_data->data_ready_trigger);
+    }
+}
+
+static void distance_emul_sample(struct k_timer *timer)
+{
+    struct distance_emul_data *drv_data = CONTAINER_OF(timer, struct distance_emul_data, sampling_timer);
+    k_work_submit(&drv_data->data_ready_work);
+}
+
+static int distance_emul_sample_fetch(const struct device *dev, enum sensor_channel chan)
+{
+    struct distance_emul_data *drv_data = dev->data;
+    if (chan != SENSOR_CHAN_ALL && chan != SENSOR_CHAN_DISTANCE){
+        return -ENOTSUP;
+    }
+    drv_data->sample_um = atomic_get(&drv_data->distance_um);
+    return 0;
+}
+
+static int distance_emul_channel_get(const struct device *dev, enum sensor_channel chan, struct sensor_value *val)
+{
+    const struct distance_emul_data *drv_data = dev->data;
+    if (chan != SENSOR_CHAN_DISTANCE){
+        return -ENOTSUP;
+    }
+    val->val1 = drv_data->sample_um / 1000000;
+    val->val2 = drv_data->sample_um % 1000000;
+    return 0;
+}
+
+static int distance_emul_attr_set(const struct device *dev, enum sensor_channel chan,
+                                  enum sensor_attribute attr, const struct sensor_value *val)
+{
+    struct distance_emul_data *drv_data = dev->data;
+    if (chan != SENSOR_CHAN_DISTANCE || attr != SENSOR_ATTR_SAMPLING_FREQUENCY || val->val1 < 0){
+        return -ENOTSUP;
+    }
+    // A null frequency stops the sampling
+    if (val->val1 == 0){
+        k_timer_stop(&drv_data->sampling_timer);
+        return 0;
+    }
+    k_timeout_t period = K_USEC(USEC_PER_SEC / val->val1);
+    k_timer_start(&drv_data->sampling_timer, period, period);
+    return 0;
+}
+
+static int distance_emul_trigger_set(const struct device *dev, const struct sensor_trigger *trig,
+                                     sensor_trigger_handler_t handler)
+{
+    struct distance_emul_data *drv_data = dev->data;
+    if (trig->type != SENSOR_TRIG_DATA_READY){
+        return -ENOTSUP;
+    }
+    drv_data->data_ready_trigger = *trig;
+    drv_data->data_ready_handler = handler;
+    return 0;
+}
+
+static const struct sensor_driver_api distance_emul_api = {
+    .sample_fetch = distance_emul_sample_fetch,
+    .channel_get = distance_emul_channel_get,
+    .attr_set = distance_emul_attr_set,
+    .trigger_set = distance_emul_trigger_set,
+};
+
+void distance_emul_set(const struct device *dev, double distance)
+{
+    struct distance_emul_data *drv_data = dev->data;
+    atomic_set(&drv_data->distance_um, (atomic_val_t) (distance * 1000000));
+}
+
+static int distance_emul_init(const struct device *dev)
+{
+    const struct distance_emul_config *const config = dev->config;
+    struct distance_emul_data *drv_data = dev->data;
+
+    drv_data->dev = dev;
+    atomic_set(&drv_data->distance_um, config->initial_distance_mm * 1000);
+    k_work_init(&drv_data->data_ready_work, distance_emul_data_ready);
+    k_timer_init(&drv_data->sampling_timer, distance_emul_sample, NULL);
+    return 0;
+}
+
+#define DISTANCE_EMUL_INIT(inst)                                                \
+    static const struct distance_emul_config distance_emul_##inst##_config = {  \
+        .initial_distance_mm = DT_INST_PROP(inst, initial_distance_mm),         \
+    };                                                                          \
+                                                                                \
+    static struct distance_emul_data distance_emul_##inst##_data;               \
+                                                                                \
+    DEVICE_DT_INST_DEFINE(inst, distance_emul_init, NULL,                       \
+                          &distance_emul_##inst##_data,                         \
+                          &distance_emul_##inst##_config,                       \
+                          POST_KERNEL,                                          \
+                          CONFIG_SENSOR_INIT_PRIORITY,                          \
+                          &distance_emul_api);
+
+DT_INST_FOREACH_STATUS_OKAY(DISTANCE_EMUL_INIT)
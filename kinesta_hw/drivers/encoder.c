@@ -1,4 +1,5 @@
 #include "encoder.h"
+#include "perf.h"
 
 #include <zephyr/drivers/i2c.h>
 #include <zephyr/drivers/gpio.h>
@@ -9,6 +10,8 @@ LOG_MODULE_REGISTER(rgb_encoder);
 
 #define DT_DRV_COMPAT duppa_i2cencoderv21
 
+PERF_STAGE_DEFINE(encoder_i2c);
+
 #define COLOR_CHAN_RSHIFT (COLOR_CHAN_BITS - 8)
 
 #define REG_GCONF    0x00
@@ -55,12 +58,19 @@ struct encoder_data {
     struct gpio_callback int_callback;
     struct k_work handler_work;
     struct encoder_callback_t *user_callback;
+    // Uptime of the last reset, in ticks
+    int64_t reset_ticks;
 };
 
+/* Time for the encoder to come out of reset */
+#define ENCODER_RESET_DELAY_MS 1
+
 static inline int encoder_i2c_read(const struct device *dev, uint8_t reg, uint8_t *data, size_t size)
 {
     const struct encoder_config *const config = dev->config;
+    uint32_t start = perf_now();
     int ret = i2c_burst_read(config->i2c.bus, config->i2c.addr, reg, data, size);
+    PERF_RECORD(encoder_i2c, start);
     if (ret){
         LOG_ERR("[%s] I2C read of register 0x%02X with size %d failed: %d",
                 dev->name, (int) reg, size, ret);
@@ -71,7 +81,9 @@ static inline int encoder_i2c_read(const struct device *dev, uint8_t reg, uint8_
 static inline int encoder_i2c_write(const struct device *dev, uint8_t reg, const uint8_t *data, size_t size)
 {
     const struct encoder_config *const config = dev->config;
+    uint32_t start = perf_now();
     int ret = i2c_burst_write(config->i2c.bus, config->i2c.addr, reg, data, size);
+    PERF_RECORD(encoder_i2c, start);
     if (ret){
         LOG_ERR("[%s] I2C write of register 0x%02X with size %d failed: %d",
                 dev->name, (int) reg, size, ret);
@@ -129,11 +141,9 @@ static void encoder_interrupt_handler(const struct device *port, struct gpio_cal
     }
 }
 
-static int encoder_init(const struct device *dev)
+int encoder_reset(const struct device *dev)
 {
-    const struct encoder_config *const config = dev->config;
     struct encoder_data *drv_data = dev->data;
-    drv_data->dev = dev;
 
     // 1. Check device ID
     uint8_t idcode[2];
@@ -152,11 +162,24 @@ static int encoder_init(const struct device *dev)
     if (ret){
         return ret;
     }
+    drv_data->reset_ticks = k_uptime_ticks();
+    return 0;
+}
+
+int encoder_configure(const struct device *dev)
+{
+    const struct encoder_config *const config = dev->config;
+    struct encoder_data *drv_data = dev->data;
 
-    k_sleep(K_MSEC(1));
+    // Only wait for what is left of the reset delay
+    int64_t ready_ticks = drv_data->reset_ticks + k_ms_to_ticks_ceil64(ENCODER_RESET_DELAY_MS);
+    int64_t now = k_uptime_ticks();
+    if (now < ready_ticks){
+        k_sleep(K_TICKS(ready_ticks - now));
+    }
 
     // 3. Configure as RGB illuminated encoder in float32
-    ret = encoder_i2c_write_byte(dev, REG_GCONF, BIT_GCONF_ETYPE | BIT_GCONF_DTYPE);
+    int ret = encoder_i2c_write_byte(dev, REG_GCONF, BIT_GCONF_ETYPE | BIT_GCONF_DTYPE);
     if (ret){
         return ret;
     }
@@ -183,7 +206,6 @@ static int encoder_init(const struct device *dev)
 
     // 6. Configure interrupt if defined in the device tree
     if (config->interrupt.port){
-        k_work_init(&drv_data->handler_work, encoder_call_user_handler);
         gpio_pin_configure_dt(&config->interrupt, GPIO_INPUT);
         gpio_pin_interrupt_configure_dt(&config->interrupt, GPIO_INT_EDGE_TO_ACTIVE);
         gpio_init_callback(&drv_data->int_callback, encoder_interrupt_handler, BIT(config->interrupt.pin));
@@ -193,6 +215,23 @@ static int encoder_init(const struct device *dev)
     return 0;
 }
 
+static int encoder_init(const struct device *dev)
+{
+    struct encoder_data *drv_data = dev->data;
+    drv_data->dev = dev;
+    k_work_init(&drv_data->handler_work, encoder_call_user_handler);
+
+#if defined(CONFIG_KINESTA_HW_ENCODER_DEFERRED_INIT)
+    return 0;
+#else
+    int ret = encoder_reset(dev);
+    if (ret){
+        return ret;
+    }
+    return encoder_configure(dev);
+#endif
+}
+
 int encoder_set_color(const struct device *dev, color_t color)
 {
     uint8_t rgb_value[3];
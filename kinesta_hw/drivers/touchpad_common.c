@@ -0,0 +1,120 @@
+#include "touchpad_common.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(touchpad_touch);
+
+static void touchpad_touch_call_user_handler(struct k_work *work)
+{
+    struct touchpad_touch_data *drv_data = CONTAINER_OF(work, struct touchpad_touch_data, handler_work);
+    int evt = atomic_clear(&drv_data->pending_evts);
+    if (evt && drv_data->user_callback){
+        drv_data->user_callback->func(drv_data->user_callback, evt, drv_data->pending_timestamp);
+    }
+}
+
+/* Runs in the system timer interrupt, once the touch line is stable */
+static void touchpad_touch_timer_expired(struct k_timer *timer)
+{
+    struct touchpad_touch_data *drv_data = CONTAINER_OF(timer, struct touchpad_touch_data, debounce_timer);
+    const struct touchpad_touch_config *const config = drv_data->dev->config;
+    int value = gpio_pin_get_dt(&config->gpio);
+    if (value < 0){
+        return;
+    }
+
+    // Sampled mode: a new state has to be seen on 2 consecutive samples
+    if (drv_data->is_polled && ! drv_data->is_bouncing && (value > 0) != drv_data->is_touched){
+        drv_data->edge_timestamp = k_cycle_get_32();
+        drv_data->is_bouncing = true;
+        return;
+    }
+
+    drv_data->is_bouncing = false;
+    if ((value > 0) == drv_data->is_touched){
+        // Glitch shorter than the debounce duration
+        return;
+    }
+
+    drv_data->is_touched = value > 0;
+    drv_data->pending_timestamp = drv_data->edge_timestamp;
+    atomic_or(&drv_data->pending_evts, drv_data->is_touched ? TOUCHPAD_EVT_PRESS : TOUCHPAD_EVT_RELEASE);
+    if (drv_data->user_callback){
+        k_work_submit(&drv_data->handler_work);
+    }
+}
+
+static void touchpad_touch_interrupt_handler(const struct device *port, struct gpio_callback *cb, gpio_port_pins_t pins)
+{
+    struct touchpad_touch_data *drv_data = CONTAINER_OF(cb, struct touchpad_touch_data, gpio_callback);
+    const struct touchpad_touch_config *const config = drv_data->dev->config;
+
+    uint32_t now = k_cycle_get_32();
+    if (! drv_data->is_bouncing){
+        drv_data->edge_timestamp = now;
+        drv_data->is_bouncing = true;
+    }
+
+    // Every new edge restarts the debounce delay, but the line is sampled at
+    // most twice the debounce duration after the first edge: a pad that
+    // keeps bouncing still gets its event
+    uint32_t elapsed_ms = k_cyc_to_ms_floor32(now - drv_data->edge_timestamp);
+    uint32_t max_ms = 2 * config->debounce_ms;
+    uint32_t delay_ms = MIN(config->debounce_ms, (elapsed_ms < max_ms) ? max_ms - elapsed_ms : 0);
+    k_timer_start(&drv_data->debounce_timer, K_MSEC(delay_ms), K_NO_WAIT);
+}
+
+int touchpad_touch_init(const struct device *dev)
+{
+    const struct touchpad_touch_config *const config = dev->config;
+    struct touchpad_touch_data *drv_data = dev->data;
+    drv_data->dev = dev;
+
+    if (! device_is_ready(config->gpio.port)){
+        LOG_ERR("[%s] Touch GPIO %s is not ready", dev->name, config->gpio.port->name);
+        return -ENODEV;
+    }
+
+    int ret = gpio_pin_configure_dt(&config->gpio, GPIO_INPUT);
+    if (ret){
+        LOG_ERR("[%s] Unable to configure touch input %s%d", dev->name, config->gpio.port->name, config->gpio.pin);
+        return ret;
+    }
+    drv_data->is_touched = gpio_pin_get_dt(&config->gpio) > 0;
+
+    k_work_init(&drv_data->handler_work, touchpad_touch_call_user_handler);
+    k_timer_init(&drv_data->debounce_timer, touchpad_touch_timer_expired, NULL);
+
+    gpio_init_callback(&drv_data->gpio_callback, touchpad_touch_interrupt_handler, BIT(config->gpio.pin));
+    ret = gpio_add_callback(config->gpio.port, &drv_data->gpio_callback);
+    if (ret == 0){
+        ret = gpio_pin_interrupt_configure_dt(&config->gpio, GPIO_INT_EDGE_BOTH);
+    }
+
+    if (ret){
+        /*
+         * Some interrupt lines cannot be shared (for example pins with the
+         * same number on different ports of an STM32), so sample the touch
+         * input from the debounce timer instead.
+         */
+        LOG_WRN("[%s] No interrupt on %s%d (%d), sampling every %dms",
+                dev->name, config->gpio.port->name, config->gpio.pin, ret, config->debounce_ms);
+        gpio_remove_callback(config->gpio.port, &drv_data->gpio_callback);
+        drv_data->is_polled = true;
+        k_timeout_t period = K_MSEC(MAX(config->debounce_ms, 1));
+        k_timer_start(&drv_data->debounce_timer, period, period);
+    }
+
+    return 0;
+}
+
+bool touchpad_touch_is_touched(const struct device *dev)
+{
+    const struct touchpad_touch_data *drv_data = dev->data;
+    return drv_data->is_touched;
+}
+
+void touchpad_touch_set_callback(const struct device *dev, struct touchpad_callback_t *cb)
+{
+    struct touchpad_touch_data *drv_data = dev->data;
+    drv_data->user_callback = cb;
+}
@@ -0,0 +1,51 @@
+#ifndef TOUCHPAD_COMMON_H
+#define TOUCHPAD_COMMON_H
+
+#include "touchpad.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+
+/*
+ * Touch sensing shared by all touchpad drivers. This assumes that all
+ * touchpad driver configs start with a struct touchpad_touch_config, and all
+ * touchpad driver data start with a struct touchpad_touch_data !
+ */
+
+struct touchpad_touch_config {
+    struct gpio_dt_spec gpio;
+    uint32_t debounce_ms;
+};
+
+struct touchpad_touch_data {
+    const struct device *dev;
+    struct gpio_callback gpio_callback;
+    struct k_timer debounce_timer;
+    struct k_work handler_work;
+    struct touchpad_callback_t *user_callback;
+
+    // Cycle counter captured on the first edge of a bouncing sequence
+    uint32_t edge_timestamp;
+    bool is_bouncing;
+    bool is_touched;
+    // No edge interrupt available: the touch input is sampled by the timer
+    bool is_polled;
+
+    // Events waiting for the user handler, and the timestamp of the last one
+    atomic_t pending_evts;
+    uint32_t pending_timestamp;
+};
+
+#define TOUCHPAD_TOUCH_CONFIG_INST_GET(inst)                                \
+    {                                                                       \
+        .gpio = GPIO_DT_SPEC_INST_GET(inst, touch_gpios),                   \
+        .debounce_ms = DT_INST_PROP(inst, debounce_ms),                     \
+    }
+
+int touchpad_touch_init(const struct device *dev);
+
+bool touchpad_touch_is_touched(const struct device *dev);
+
+void touchpad_touch_set_callback(const struct device *dev, struct touchpad_callback_t *cb);
+
+#endif
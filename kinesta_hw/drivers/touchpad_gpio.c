@@ -1,4 +1,5 @@
 #include "touchpad.h"
+#include "touchpad_common.h"
 
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/logging/log.h>
@@ -7,26 +8,28 @@ LOG_MODULE_REGISTER(touchpad_gpio);
 #define DT_DRV_COMPAT kinesta_rgb_touchpad_gpio
 
 struct touchpad_gpio_config {
-    struct gpio_dt_spec touch;
+    struct touchpad_touch_config touch;
     struct gpio_dt_spec led_r;
     struct gpio_dt_spec led_g;
     struct gpio_dt_spec led_b;
 };
 
+struct touchpad_gpio_data {
+    struct touchpad_touch_data touch;
+};
+
 static int touchpad_gpio_init(const struct device *dev)
 {
     const struct touchpad_gpio_config *const config = dev->config;
     const struct gpio_dt_spec *gpios = &config->led_r;
 
-    gpio_pin_configure_dt(&config->touch, GPIO_INPUT | config->touch.dt_flags);
-
     for (int i=0; i<3; i++){
         if (gpio_pin_configure_dt(&gpios[i], GPIO_OUTPUT | gpios[i].dt_flags)){
             LOG_ERR("Unable to configure %s%d as output, unable to init touchpad_gpio", gpios[i].port->name, gpios[i].pin);
         }
     }
 
-    return 0;
+    return touchpad_touch_init(dev);
 }
 
 static void touchpad_gpio_set_color_channel(const struct device *dev, color_channel_t channel, unsigned value)
@@ -39,23 +42,58 @@ static void touchpad_gpio_set_color_channel(const struct device *dev, color_chan
     }
 }
 
+static void touchpad_gpio_set_color(const struct device *dev, color_t color)
+{
+    const struct touchpad_gpio_config *const config = dev->config;
+    const struct gpio_dt_spec *gpios = &config->led_r;
+    const unsigned values[COLOR_N_CHANS] = {
+        color_get_r(color), color_get_g(color), color_get_b(color)
+    };
+
+    // Leds spread over several ports: set them one by one
+    if (gpios[0].port != gpios[1].port || gpios[0].port != gpios[2].port){
+        for (int i=0; i<COLOR_N_CHANS; i++){
+            touchpad_gpio_set_color_channel(dev, i, values[i]);
+        }
+        return;
+    }
+
+    // Otherwise set all 3 leds with a single port write
+    gpio_port_pins_t mask = 0;
+    gpio_port_value_t value = 0;
+    for (int i=0; i<COLOR_N_CHANS; i++){
+        mask |= BIT(gpios[i].pin);
+        if (values[i] > COLOR_CHAN_MAX/2){
+            value |= BIT(gpios[i].pin);
+        }
+    }
+    if (gpio_port_set_masked(gpios[0].port, mask, value)){
+        LOG_ERR("[%s] Unable to set color on %s", dev->name, gpios[0].port->name);
+    }
+}
+
 const struct touchpad_driver_api touchpad_gpio_api_funcs = {
     .set_color_channel = touchpad_gpio_set_color_channel,
+    .set_color = touchpad_gpio_set_color,
+    .is_touched = touchpad_touch_is_touched,
+    .set_callback = touchpad_touch_set_callback,
 };
 
 #define TOUCHPAD_PWM_INIT(inst) \
     static const struct touchpad_gpio_config touchpad_##inst##_config = {   \
-        .touch = GPIO_DT_SPEC_INST_GET(inst, touch_gpios),                  \
+        .touch = TOUCHPAD_TOUCH_CONFIG_INST_GET(inst),                      \
         .led_r = GPIO_DT_SPEC_INST_GET(inst, r_gpios),                      \
         .led_g = GPIO_DT_SPEC_INST_GET(inst, g_gpios),                      \
         .led_b = GPIO_DT_SPEC_INST_GET(inst, b_gpios),                      \
     };                                                                      \
                                                                             \
+    static struct touchpad_gpio_data touchpad_##inst##_data;                \
+                                                                            \
     DEVICE_DT_INST_DEFINE(inst, touchpad_gpio_init, NULL,                   \
-                          NULL,                                             \
+                          &touchpad_##inst##_data,                          \
                           &touchpad_##inst##_config,                        \
                           POST_KERNEL,                                      \
-                          CONFIG_GPIO_INIT_PRIORITY,                        \
+                          CONFIG_KINESTA_HW_TOUCHPAD_INIT_PRIORITY,         \
                           &touchpad_gpio_api_funcs);
 
 DT_INST_FOREACH_STATUS_OKAY(TOUCHPAD_PWM_INIT)
@@ -1,61 +1,385 @@
 #include "touchpad.h"
+#include "touchpad_common.h"
 
+#include <limits.h>
 #include <zephyr/drivers/pwm.h>
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(touchpad_pwm);
 
 #define DT_DRV_COMPAT kinesta_rgb_touchpad_pwm
 
+#if defined(CONFIG_PWM_STM32)
+#include <stm32_ll_tim.h>
+
+/* Timer behind a named PWM channel of the touchpad, and its registers */
+#define TOUCHPAD_PWM_TIMER_NODE(inst, name) DT_PARENT(DT_INST_PWMS_CTLR_BY_NAME(inst, name))
+#define TOUCHPAD_PWM_TIMER(inst, name) \
+    ((TIM_TypeDef *) DT_REG_ADDR(TOUCHPAD_PWM_TIMER_NODE(inst, name)))
+
+/* Update interrupt of that timer (advanced timers have a dedicated line) */
+#define TOUCHPAD_PWM_TIMER_IRQ(inst, name)                                          \
+    COND_CODE_1(DT_IRQ_HAS_NAME(TOUCHPAD_PWM_TIMER_NODE(inst, name), up),          \
+                (DT_IRQ_BY_NAME(TOUCHPAD_PWM_TIMER_NODE(inst, name), up, irq)),    \
+                (DT_IRQN(TOUCHPAD_PWM_TIMER_NODE(inst, name))))
+#endif
+
 struct touchpad_pwm_config {
-    struct gpio_dt_spec touch;
+    struct touchpad_touch_config touch;
     struct pwm_dt_spec led_r;
     struct pwm_dt_spec led_g;
     struct pwm_dt_spec led_b;
+    uint32_t frequency;
+    bool dithering;
+#if defined(CONFIG_PWM_STM32)
+    TIM_TypeDef *timers[COLOR_N_CHANS];
+#endif
+#if defined(CONFIG_KINESTA_HW_TOUCHPAD_PWM_DITHERING)
+    unsigned timer_irqs[COLOR_N_CHANS];
+#endif
+};
+
+#if defined(CONFIG_KINESTA_HW_TOUCHPAD_PWM_DITHERING)
+/* Fractional bits of the duty cycles, when dithering */
+#define DITHER_BITS 8
+#define DITHER_ONE  (1 << DITHER_BITS)
+
+struct touchpad_pwm_dither_timer;
+
+/*
+ * A dithered channel: the update interrupt of its timer writes its compare
+ * register once per PWM period, with the integer part of the duty cycle plus
+ * the carry of a first order sigma-delta on the fractional part.
+ */
+struct touchpad_pwm_dither {
+    struct touchpad_pwm_dither_timer *timer;
+    volatile uint32_t *ccr;
+    uint32_t pulse;
+    uint16_t fraction;
+    uint16_t error;
+};
+
+/* A timer with dithered channels, possibly from several touchpads */
+struct touchpad_pwm_dither_timer {
+    TIM_TypeDef *regs;
+    struct touchpad_pwm_dither *chans[3 * DT_NUM_INST_STATUS_OKAY(DT_DRV_COMPAT)];
+    size_t n_chans;
+};
+
+static struct touchpad_pwm_dither_timer dither_timers[3 * DT_NUM_INST_STATUS_OKAY(DT_DRV_COMPAT)];
+static size_t n_dither_timers;
+static struct k_spinlock dither_lock;
+#endif
+
+struct touchpad_pwm_data {
+    struct touchpad_touch_data touch;
+    unsigned values[COLOR_N_CHANS];
+    uint32_t period_cycles[COLOR_N_CHANS];
+    uint32_t pulses[COLOR_N_CHANS];
+#if defined(CONFIG_PWM_STM32)
+    // Compare registers of the channels
+    volatile uint32_t *ccrs[COLOR_N_CHANS];
+#endif
+#if defined(CONFIG_KINESTA_HW_TOUCHPAD_PWM_DITHERING)
+    struct touchpad_pwm_dither dither[COLOR_N_CHANS];
+#endif
 };
 
+#if defined(CONFIG_KINESTA_HW_TOUCHPAD_PWM_DITHERING)
+static void touchpad_pwm_dither_isr(const void *arg)
+{
+    struct touchpad_pwm_dither_timer *timer = (struct touchpad_pwm_dither_timer *) arg;
+
+    // The update line may be shared with another timer
+    if (! LL_TIM_IsActiveFlag_UPDATE(timer->regs)){
+        return;
+    }
+    LL_TIM_ClearFlag_UPDATE(timer->regs);
+
+    // The compare registers are preloaded: the values written here are used
+    // for the next period
+    k_spinlock_key_t key = k_spin_lock(&dither_lock);
+    for (size_t i=0; i<timer->n_chans; i++){
+        struct touchpad_pwm_dither *chan = timer->chans[i];
+        uint32_t pulse = chan->pulse;
+        chan->error += chan->fraction;
+        if (chan->error >= DITHER_ONE){
+            chan->error -= DITHER_ONE;
+            pulse++;
+        }
+        *chan->ccr = pulse;
+    }
+    k_spin_unlock(&dither_lock, key);
+}
+
+/* Attach a channel to the update interrupt of its timer */
+static int touchpad_pwm_dither_attach(const struct device *dev, color_channel_t channel)
+{
+    const struct touchpad_pwm_config *const config = dev->config;
+    struct touchpad_pwm_data *drv_data = dev->data;
+    const struct pwm_dt_spec *pwm = &(&config->led_r)[channel];
+    TIM_TypeDef *regs = config->timers[channel];
+    struct touchpad_pwm_dither *chan = &drv_data->dither[channel];
+
+    struct touchpad_pwm_dither_timer *timer = NULL;
+    for (size_t i=0; i<n_dither_timers; i++){
+        if (dither_timers[i].regs == regs){
+            timer = &dither_timers[i];
+        }
+    }
+
+    if (! timer){
+        timer = &dither_timers[n_dither_timers++];
+        timer->regs = regs;
+        int ret = irq_connect_dynamic(config->timer_irqs[channel],
+                                      CONFIG_KINESTA_HW_TOUCHPAD_PWM_DITHERING_IRQ_PRIORITY,
+                                      touchpad_pwm_dither_isr, timer, 0);
+        if (ret < 0){
+            LOG_ERR("[%s] Unable to connect the update interrupt of %s", dev->name, pwm->dev->name);
+            n_dither_timers--;
+            return ret;
+        }
+        irq_enable(config->timer_irqs[channel]);
+    }
+
+    chan->timer = timer;
+    chan->ccr = drv_data->ccrs[channel];
+    timer->chans[timer->n_chans++] = chan;
+    return 0;
+}
+
+/*
+ * Set the duty cycle of a dithered channel. The update interrupt of its timer
+ * only runs while one of its channels has a fractional part.
+ */
+static void touchpad_pwm_dither_set(struct touchpad_pwm_dither *chan, uint32_t pulse, uint16_t fraction)
+{
+    struct touchpad_pwm_dither_timer *timer = chan->timer;
+    bool dithering = false;
+
+    k_spinlock_key_t key = k_spin_lock(&dither_lock);
+    chan->pulse = pulse;
+    chan->fraction = fraction;
+    for (size_t i=0; i<timer->n_chans; i++){
+        dithering |= timer->chans[i]->fraction != 0;
+    }
+    if (dithering){
+        LL_TIM_EnableIT_UPDATE(timer->regs);
+    } else {
+        LL_TIM_DisableIT_UPDATE(timer->regs);
+    }
+    k_spin_unlock(&dither_lock, key);
+}
+#endif
+
+/* Write the duty cycle of a channel, the first write also enables it */
+static int touchpad_pwm_write_pulse(const struct device *dev, color_channel_t channel, uint32_t pulse, bool enabled)
+{
+    const struct touchpad_pwm_config *const config = dev->config;
+    struct touchpad_pwm_data *drv_data = dev->data;
+    const struct pwm_dt_spec *pwm = &(&config->led_r)[channel];
+
+#if defined(CONFIG_PWM_STM32)
+    if (enabled){
+        // Period and polarity are already set: only the preloaded compare
+        // register changes, no need for a call to the PWM driver
+        *drv_data->ccrs[channel] = pulse;
+        return 0;
+    }
+#endif
+    return pwm_set_cycles(pwm->dev, pwm->channel, drv_data->period_cycles[channel], pulse, pwm->flags);
+}
+
+static void touchpad_pwm_write_channel(const struct device *dev, color_channel_t channel, unsigned value)
+{
+    const struct touchpad_pwm_config *const config = dev->config;
+    struct touchpad_pwm_data *drv_data = dev->data;
+    const struct pwm_dt_spec *pwm = &(&config->led_r)[channel];
+    uint32_t period = drv_data->period_cycles[channel];
+    if (! period){
+        // Channel could not be initialized
+        return;
+    }
+
+    // Duty cycle in timer cycles, only written when it changes
+    uint32_t pulse = ((uint64_t) value * period) / COLOR_CHAN_MAX;
+    bool enabled = drv_data->values[channel] != UINT_MAX;
+
+#if defined(CONFIG_KINESTA_HW_TOUCHPAD_PWM_DITHERING)
+    if (drv_data->dither[channel].timer){
+        // Fractional part of the duty cycle, on DITHER_BITS
+        uint64_t duty = ((uint64_t) value * period * DITHER_ONE) / COLOR_CHAN_MAX;
+        touchpad_pwm_dither_set(&drv_data->dither[channel], pulse, duty & (DITHER_ONE - 1));
+    }
+#endif
+
+    if (pulse != drv_data->pulses[channel] || ! enabled){
+        if (touchpad_pwm_write_pulse(dev, channel, pulse, enabled)){
+            LOG_ERR("[%s] Unable to set channel %d (%s%d)", dev->name, channel, pwm->dev->name, pwm->channel);
+        }
+        drv_data->pulses[channel] = pulse;
+    }
+    drv_data->values[channel] = value;
+}
+
+static int touchpad_pwm_init_channel(const struct device *dev, color_channel_t channel)
+{
+    const struct touchpad_pwm_config *const config = dev->config;
+    struct touchpad_pwm_data *drv_data = dev->data;
+    const struct pwm_dt_spec *pwm = &(&config->led_r)[channel];
+
+    uint64_t cycles_per_sec;
+    int ret = pwm_get_cycles_per_sec(pwm->dev, pwm->channel, &cycles_per_sec);
+    if (ret){
+        LOG_ERR("[%s] Unable to get clock of %s%d", dev->name, pwm->dev->name, pwm->channel);
+        return ret;
+    }
+
+    drv_data->period_cycles[channel] = cycles_per_sec / config->frequency;
+    if (drv_data->period_cycles[channel] == 0){
+        LOG_ERR("[%s] %s is too slow for %dHz", dev->name, pwm->dev->name, config->frequency);
+        return -EINVAL;
+    }
+
+#if defined(CONFIG_PWM_STM32)
+    // CCR1..CCR4 are contiguous
+    drv_data->ccrs[channel] = &config->timers[channel]->CCR1 + (pwm->channel - 1);
+#endif
+
+#if defined(CONFIG_KINESTA_HW_TOUCHPAD_PWM_DITHERING)
+    if (config->dithering){
+        ret = touchpad_pwm_dither_attach(dev, channel);
+        if (ret){
+            return ret;
+        }
+    }
+#else
+    if (config->dithering){
+        LOG_WRN("[%s] Dithering is not supported without CONFIG_KINESTA_HW_TOUCHPAD_PWM_DITHERING", dev->name);
+    }
+#endif
+    if (drv_data->period_cycles[channel] < COLOR_CHAN_MAX && ! config->dithering){
+        LOG_WRN("[%s] Only %d levels on %s%d at %dHz, consider enabling dithering",
+                dev->name, drv_data->period_cycles[channel] + 1, pwm->dev->name, pwm->channel, config->frequency);
+    }
+
+    // Start with the leds off, this also enables the PWM channels
+    drv_data->values[channel] = UINT_MAX;
+    touchpad_pwm_write_channel(dev, channel, 0);
+    return 0;
+}
+
 static int touchpad_pwm_init(const struct device *dev)
 {
     const struct touchpad_pwm_config *const config = dev->config;
+    struct touchpad_pwm_data *drv_data = dev->data;
     const struct pwm_dt_spec *pwms = &config->led_r;
 
-    gpio_pin_configure_dt(&config->touch, GPIO_INPUT | config->touch.dt_flags);
-
     for (int i=0; i<COLOR_N_CHANS; i++){
         if (! device_is_ready(pwms[i].dev)){
             LOG_ERR("PWM device %s is not ready, unable to init touchpad_pwm", pwms[i].dev->name);
+            drv_data->values[i] = UINT_MAX;
+        } else if (touchpad_pwm_init_channel(dev, i)){
+            drv_data->values[i] = UINT_MAX;
         }
     }
 
-    return 0;
+    return touchpad_touch_init(dev);
 }
 
 static void touchpad_pwm_set_color_channel(const struct device *dev, color_channel_t channel, unsigned value)
 {
     __ASSERT(channel < 3, "Invalid color channel !");
+    const struct touchpad_pwm_data *drv_data = dev->data;
+    if (drv_data->values[channel] != value){
+        touchpad_pwm_write_channel(dev, channel, value);
+    }
+}
+
+/*
+ * Called between touchpad_pwm_hold() calls by touchpad_set_color(s). Once
+ * the channels are enabled, each one is a single write of its compare
+ * register on STM32: the 3 channels take a few bus cycles, and switch to the
+ * new color on the same update event.
+ */
+static void touchpad_pwm_set_color(const struct device *dev, color_t color)
+{
+    touchpad_pwm_set_color_channel(dev, CHANNEL_RED, color_get_r(color));
+    touchpad_pwm_set_color_channel(dev, CHANNEL_GREEN, color_get_g(color));
+    touchpad_pwm_set_color_channel(dev, CHANNEL_BLUE, color_get_b(color));
+}
+
+/*
+ * The PWM compare registers are preloaded: new duty cycles only take effect
+ * on the next update event of their timer. Disabling the update events while
+ * writing the 3 channels (possibly on different timers) makes them all switch
+ * to the new color at once.
+ */
+static void touchpad_pwm_hold(const struct device *dev, bool hold)
+{
+#if defined(CONFIG_PWM_STM32)
     const struct touchpad_pwm_config *const config = dev->config;
-    const struct pwm_dt_spec *pwm = &(&config->led_r)[channel];
-    if (pwm_set_dt(pwm, 7000*COLOR_CHAN_MAX, 7000*value)){
-        LOG_ERR("[%s] Unable to set channel %d (%s%d)", dev->name, channel, pwm->dev->name, pwm->channel);
+    for (int i=0; i<COLOR_N_CHANS; i++){
+        if (hold){
+            LL_TIM_DisableUpdateEvent(config->timers[i]);
+        } else {
+            LL_TIM_EnableUpdateEvent(config->timers[i]);
+        }
     }
+#else
+    ARG_UNUSED(dev);
+    ARG_UNUSED(hold);
+#endif
 }
 
 const struct touchpad_driver_api touchpad_pwm_api_funcs = {
     .set_color_channel = touchpad_pwm_set_color_channel,
+    .set_color = touchpad_pwm_set_color,
+    .hold = touchpad_pwm_hold,
+    .is_touched = touchpad_touch_is_touched,
+    .set_callback = touchpad_touch_set_callback,
 };
 
+#if defined(CONFIG_PWM_STM32)
+#define TOUCHPAD_PWM_TIMERS(inst)                                           \
+        .timers = {                                                         \
+            TOUCHPAD_PWM_TIMER(inst, red),                                  \
+            TOUCHPAD_PWM_TIMER(inst, green),                                \
+            TOUCHPAD_PWM_TIMER(inst, blue),                                 \
+        },
+#else
+#define TOUCHPAD_PWM_TIMERS(inst)
+#endif
+
+#if defined(CONFIG_KINESTA_HW_TOUCHPAD_PWM_DITHERING)
+#define TOUCHPAD_PWM_TIMER_IRQS(inst)                                       \
+        .timer_irqs = {                                                     \
+            TOUCHPAD_PWM_TIMER_IRQ(inst, red),                              \
+            TOUCHPAD_PWM_TIMER_IRQ(inst, green),                            \
+            TOUCHPAD_PWM_TIMER_IRQ(inst, blue),                             \
+        },
+#else
+#define TOUCHPAD_PWM_TIMER_IRQS(inst)
+#endif
+
 #define TOUCHPAD_PWM_INIT(inst) \
     static const struct touchpad_pwm_config touchpad_##inst##_config = {    \
-        .touch = GPIO_DT_SPEC_INST_GET(inst, touch_gpios),                  \
+        .touch = TOUCHPAD_TOUCH_CONFIG_INST_GET(inst),                      \
         .led_r = PWM_DT_SPEC_GET_BY_NAME(DT_DRV_INST(inst), red),           \
         .led_g = PWM_DT_SPEC_GET_BY_NAME(DT_DRV_INST(inst), green),         \
         .led_b = PWM_DT_SPEC_GET_BY_NAME(DT_DRV_INST(inst), blue),          \
+        .frequency = DT_INST_PROP(inst, pwm_frequency),                     \
+        .dithering = DT_INST_PROP(inst, dithering),                         \
+        TOUCHPAD_PWM_TIMERS(inst)                                           \
+        TOUCHPAD_PWM_TIMER_IRQS(inst)                                       \
     };                                                                      \
                                                                             \
+    static struct touchpad_pwm_data touchpad_##inst##_data;                 \
+                                                                            \
     DEVICE_DT_INST_DEFINE(inst, touchpad_pwm_init, NULL,                    \
-                          NULL,                                             \
+                          &touchpad_##inst##_data,                          \
                           &touchpad_##inst##_config,                        \
                           POST_KERNEL,                                      \
-                          CONFIG_SYSTEM_CLOCK_INIT_PRIORITY,                \
+                          CONFIG_KINESTA_HW_TOUCHPAD_INIT_PRIORITY,         \
                           &touchpad_pwm_api_funcs);
 
 DT_INST_FOREACH_STATUS_OKAY(TOUCHPAD_PWM_INIT)
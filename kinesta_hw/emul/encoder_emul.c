@@ -0,0 +1,196 @@
+/**
+ * Emulator for the Duppa I2C Encoder V2.1, for use with the I2C emulation
+ * controller. It implements the subset of the register map used by the
+ * encoder driver, and drives the interrupt line of the encoder through the
+ * GPIO emulator.
+ */
+
+#include "encoder_emul.h"
+
+#include <zephyr/device.h>
+#include <zephyr/drivers/emul.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/drivers/i2c.h>
+#include <zephyr/drivers/i2c_emul.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(encoder_emul);
+
+#define DT_DRV_COMPAT duppa_i2cencoderv21
+
+#define REG_GCONF    0x00
+#define REG_INTCONF  0x04
+#define REG_ESTATUS  0x05
+#define REG_CVAL0    0x08
+#define REG_CMAX0    0x0C
+#define REG_CMIN0    0x10
+#define REG_ISTEP0   0x14
+#define REG_RLED     0x18
+#define REG_IDCODE   0x70
+#define N_REGS       0x80
+
+#define BIT_GCONF_RESET (1 << 7)
+
+#define BIT_ESTATUS_PUSHR (1 << 0)
+#define BIT_ESTATUS_PUSHP (1 << 1)
+#define BIT_ESTATUS_IRINC (1 << 3)
+#define BIT_ESTATUS_IRDEC (1 << 4)
+
+struct encoder_emul_config {
+    struct gpio_dt_spec interrupt;
+};
+
+struct encoder_emul_data {
+    struct k_spinlock lock;
+    uint8_t regs[N_REGS];
+};
+
+static void encoder_emul_update_interrupt(const struct emul *target)
+{
+    const struct encoder_emul_config *config = target->cfg;
+    const struct encoder_emul_data *data = target->data;
+    bool active = data->regs[REG_ESTATUS] & data->regs[REG_INTCONF];
+
+    if (config->interrupt.port){
+        // Physical level of the line, which is usually active low
+        bool inverted = config->interrupt.dt_flags & GPIO_ACTIVE_LOW;
+        gpio_emul_input_set(config->interrupt.port, config->interrupt.pin, active != inverted);
+    }
+}
+
+static void encoder_emul_reset(struct encoder_emul_data *data)
+{
+    memset(data->regs, 0, sizeof(data->regs));
+    data->regs[REG_IDCODE] = 0x53;
+    data->regs[REG_IDCODE + 1] = 0x23;
+}
+
+static float encoder_emul_get_float(const struct encoder_emul_data *data, uint8_t reg)
+{
+    float value;
+    uint32_t raw = sys_get_be32(&data->regs[reg]);
+    memcpy(&value, &raw, sizeof(value));
+    return value;
+}
+
+static void encoder_emul_set_float(struct encoder_emul_data *data, uint8_t reg, float value)
+{
+    uint32_t raw;
+    memcpy(&raw, &value, sizeof(raw));
+    sys_put_be32(raw, &data->regs[reg]);
+}
+
+static void encoder_emul_write_reg(struct encoder_emul_data *data, uint8_t reg, uint8_t value)
+{
+    if (reg == REG_GCONF && (value & BIT_GCONF_RESET)){
+        encoder_emul_reset(data);
+    } else if (reg < REG_IDCODE){
+        data->regs[reg] = value;
+    }
+}
+
+static int encoder_emul_transfer(const struct emul *target, struct i2c_msg *msgs, int num_msgs, int addr)
+{
+    struct encoder_emul_data *data = target->data;
+    bool has_address = false;
+    uint8_t reg = 0;
+    bool clear_status = false;
+
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+    for (int i=0; i<num_msgs; i++){
+        for (uint32_t j=0; j<msgs[i].len; j++){
+            if (msgs[i].flags & I2C_MSG_READ){
+                if (reg == REG_ESTATUS){
+                    clear_status = true;
+                }
+                msgs[i].buf[j] = data->regs[reg % N_REGS];
+                reg++;
+            } else if (! has_address){
+                // First written byte selects the register
+                reg = msgs[i].buf[j];
+                has_address = true;
+            } else {
+                encoder_emul_write_reg(data, reg % N_REGS, msgs[i].buf[j]);
+                reg++;
+            }
+        }
+    }
+
+    // Reading the status register acknowledges the events
+    if (clear_status){
+        data->regs[REG_ESTATUS] = 0;
+    }
+    k_spin_unlock(&data->lock, key);
+
+    encoder_emul_update_interrupt(target);
+    return 0;
+}
+
+static void encoder_emul_raise(const struct emul *target, uint8_t status)
+{
+    struct encoder_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+    data->regs[REG_ESTATUS] |= status;
+    k_spin_unlock(&data->lock, key);
+    encoder_emul_update_interrupt(target);
+}
+
+void encoder_emul_turn(const struct emul *target, int steps)
+{
+    struct encoder_emul_data *data = target->data;
+
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+    float value = encoder_emul_get_float(data, REG_CVAL0);
+    value += steps * encoder_emul_get_float(data, REG_ISTEP0);
+    value = CLAMP(value, encoder_emul_get_float(data, REG_CMIN0), encoder_emul_get_float(data, REG_CMAX0));
+    encoder_emul_set_float(data, REG_CVAL0, value);
+    k_spin_unlock(&data->lock, key);
+
+    encoder_emul_raise(target, (steps < 0) ? BIT_ESTATUS_IRDEC : BIT_ESTATUS_IRINC);
+}
+
+void encoder_emul_press(const struct emul *target)
+{
+    encoder_emul_raise(target, BIT_ESTATUS_PUSHP);
+}
+
+void encoder_emul_release(const struct emul *target)
+{
+    encoder_emul_raise(target, BIT_ESTATUS_PUSHR);
+}
+
+void encoder_emul_get_color(const struct emul *target, uint8_t rgb[3])
+{
+    struct encoder_emul_data *data = target->data;
+    k_spinlock_key_t key = k_spin_lock(&data->lock);
+    memcpy(rgb, &data->regs[REG_RLED], 3);
+    k_spin_unlock(&data->lock, key);
+}
+
+static int encoder_emul_init(const struct emul *target, const struct device *parent)
+{
+    ARG_UNUSED(parent);
+    encoder_emul_reset(target->data);
+    encoder_emul_update_interrupt(target);
+    return 0;
+}
+
+static struct i2c_emul_api encoder_emul_api = {
+    .transfer = encoder_emul_transfer,
+};
+
+#define ENCODER_EMUL(inst)                                                  \
+    static const struct encoder_emul_config encoder_emul_##inst##_config = {\
+        .interrupt = GPIO_DT_SPEC_INST_GET_OR(inst, interrupt_gpios, {0}),  \
+    };                                                                      \
+                                                                            \
+    static struct encoder_emul_data encoder_emul_##inst##_data;             \
+                                                                            \
+    EMUL_DT_INST_DEFINE(inst, encoder_emul_init,                            \
+                        &encoder_emul_##inst##_data,                        \
+                        &encoder_emul_##inst##_config,                      \
+                        &encoder_emul_api, NULL);
+
+DT_INST_FOREACH_STATUS_OKAY(ENCODER_EMUL)
@@ -0,0 +1,14 @@
+#ifndef DISTANCE_EMUL_H
+#define DISTANCE_EMUL_H
+
+#include <zephyr/device.h>
+
+/**
+ * @brief      Set the distance that the emulated sensor will measure from
+ *             its next sample on
+ * @param[in]  dev       The emulated distance sensor
+ * @param[in]  distance  The distance, in meters
+ */
+void distance_emul_set(const struct device *dev, double distance);
+
+#endif
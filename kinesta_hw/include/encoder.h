@@ -13,6 +13,20 @@ struct encoder_callback_t {
     void (*func)(struct encoder_callback_t *callback, int evt);
 };
 
+/**
+ * @brief      Check the identifier of the encoder, and reset it. With
+ *             CONFIG_KINESTA_HW_ENCODER_DEFERRED_INIT, the application brings
+ *             the encoders up with encoder_reset() then encoder_configure()
+ */
+int encoder_reset(const struct device *dev);
+
+/**
+ * @brief      Configure the encoder once out of reset, waiting for the end
+ *             of the reset delay if needed: resetting several encoders before
+ *             configuring them waits for the delay only once
+ */
+int encoder_configure(const struct device *dev);
+
 int encoder_set_color(const struct device *dev, color_t color);
 
 int encoder_get_value(const struct device *dev, float *value);
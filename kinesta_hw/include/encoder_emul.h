@@ -0,0 +1,22 @@
+#ifndef ENCODER_EMUL_H
+#define ENCODER_EMUL_H
+
+#include <zephyr/drivers/emul.h>
+
+/* Backdoor API of the Duppa I2C encoder emulator, to inject user input */
+
+/**
+ * @brief      Turn the emulated encoder knob
+ * @param[in]  target  The encoder emulator
+ * @param[in]  steps   The number of steps, negative to turn backwards
+ */
+void encoder_emul_turn(const struct emul *target, int steps);
+
+void encoder_emul_press(const struct emul *target);
+
+void encoder_emul_release(const struct emul *target);
+
+/* Get the color last written to the encoder led, as 8-bit RGB */
+void encoder_emul_get_color(const struct emul *target, uint8_t rgb[3]);
+
+#endif
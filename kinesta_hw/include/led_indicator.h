@@ -0,0 +1,63 @@
+/**
+ * LED indicators: steady states, slow and fast blinks, and short activity
+ * flashes, driven by a kernel timer per LED.
+ *
+ * A LED costs no wakeup while off, on or between flashes: its timer only
+ * runs during a flash or a blink. The timer handler sets the GPIO from the
+ * system clock interrupt, nothing ever blocks a thread or a workqueue, and
+ * every function can be called from any context. The GPIOs must be
+ * settable from an ISR (those of the SoC, not of an I2C expander).
+ */
+
+#ifndef LED_INDICATOR_H_
+#define LED_INDICATOR_H_
+
+#include <stdbool.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/drivers/gpio.h>
+
+enum led_indicator_mode {
+    LED_INDICATOR_OFF,
+    LED_INDICATOR_ON,
+    LED_INDICATOR_SLOW_BLINK,
+    LED_INDICATOR_FAST_BLINK,
+};
+
+struct led_indicator {
+    struct gpio_dt_spec gpio;
+    struct k_timer timer;
+    struct k_spinlock lock;
+    enum led_indicator_mode mode;
+    bool ready;
+    bool on;
+    bool flashing;
+};
+
+/* Define a LED indicator on the gpios of a devicetree node, like a child of
+ * a gpio-leds node. It is off until led_indicator_init. */
+#define LED_INDICATOR_DT_DEFINE(name, node_id) \
+    struct led_indicator name = {.gpio = GPIO_DT_SPEC_GET(node_id, gpios)}
+
+/**
+ * @brief      Configure the GPIO of a LED, and turn it off. On failure the
+ *             LED can still be used, its GPIO is left alone.
+ * @return     0 on success, -ENODEV if its GPIO controller is not ready, or
+ *             the error of the configuration of the pin
+ */
+int led_indicator_init(struct led_indicator *led);
+
+/**
+ * @brief      Set the state of a LED, a blink starts with the LED on. Setting
+ *             the current mode again keeps the phase of the blink.
+ */
+void led_indicator_set_mode(struct led_indicator *led, enum led_indicator_mode mode);
+
+/**
+ * @brief      Flash a steady LED for CONFIG_LED_INDICATOR_FLASH_MS: on when
+ *             off, off when on. Ignored during a flash, so that continuous
+ *             activity still shows distinct flashes, and while blinking.
+ */
+void led_indicator_flash(struct led_indicator *led);
+
+#endif
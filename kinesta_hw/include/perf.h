@@ -0,0 +1,80 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/iterable_sections.h>
+
+#if defined(CONFIG_KINESTA_PERF)
+
+#if defined(CONFIG_CPU_CORTEX_M_HAS_DWT)
+#include <soc.h>
+#endif
+
+/*
+ * Latency histograms have 4 bins per octave of cycles: bins 0..3 hold 0..3
+ * cycles, then each power of 2 is split in 4 equal bins. The last bin also
+ * holds all longer durations.
+ */
+#define PERF_BINS_PER_OCTAVE 4
+#define PERF_N_BINS (PERF_BINS_PER_OCTAVE * CONFIG_KINESTA_PERF_OCTAVES)
+
+struct perf_stage {
+    const char *name;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t histogram[PERF_N_BINS];
+};
+
+#define PERF_STAGE_DEFINE(_name)                                    \
+    STRUCT_SECTION_ITERABLE(perf_stage, perf_stage_##_name) = {     \
+        .name = #_name,                                             \
+        .min = UINT32_MAX,                                          \
+    }
+
+/* Record the time elapsed since start (from perf_now) in a stage */
+#define PERF_RECORD(_name, start) perf_stage_record(&perf_stage_##_name, (start))
+
+/**
+ * @brief      Get the current value of the cycle counter used for
+ *             measurements: the DWT cycle counter on Cortex-M, the system
+ *             timer otherwise.
+ */
+static inline uint32_t perf_now(void)
+{
+#if defined(CONFIG_CPU_CORTEX_M_HAS_DWT)
+    return DWT->CYCCNT;
+#else
+    return k_cycle_get_32();
+#endif
+}
+
+void perf_stage_record(struct perf_stage *stage, uint32_t start);
+
+void perf_stage_reset(struct perf_stage *stage);
+
+/**
+ * @brief      Estimate a percentile of the durations recorded in a stage
+ * @param[in]  stage       The stage
+ * @param[in]  percentile  The percentile (0...100)
+ * @return     The upper bound of the histogram bin containing the
+ *             percentile, in cycles
+ */
+uint32_t perf_stage_percentile(const struct perf_stage *stage, unsigned percentile);
+
+uint64_t perf_cycles_to_ns(uint64_t cycles);
+
+#else
+
+#define PERF_STAGE_DEFINE(_name)
+#define PERF_RECORD(_name, start) ((void) (start))
+
+static inline uint32_t perf_now(void)
+{
+    return 0;
+}
+
+#endif
+
+#endif
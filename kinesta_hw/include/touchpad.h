@@ -6,27 +6,86 @@
 
 #include "color.h"
 
+#define TOUCHPAD_EVT_PRESS   (1 << 0)
+#define TOUCHPAD_EVT_RELEASE (1 << 1)
+
+/**
+ * Called from the system workqueue once a touch edge is stable for the
+ * debounce duration of the touchpad. The timestamp is the cycle counter
+ * (k_cycle_get_32) captured in the ISR on the first edge.
+ */
+struct touchpad_callback_t {
+    void (*func)(struct touchpad_callback_t *callback, int evt, uint32_t timestamp);
+};
+
 __subsystem struct touchpad_driver_api {
     void (*set_color_channel)(const struct device *dev, color_channel_t channel, unsigned value);
+    void (*set_color)(const struct device *dev, color_t color);
+    /* Optional: while held, color updates are latched but not output */
+    void (*hold)(const struct device *dev, bool hold);
+    bool (*is_touched)(const struct device *dev);
+    void (*set_callback)(const struct device *dev, struct touchpad_callback_t *cb);
 };
 
 __syscall void touchpad_set_color(const struct device *dev, color_t color)
 {
     const struct touchpad_driver_api *api = dev->api;
-    __ASSERT(api->set_color, "Missing api function set_color_channel");
-    api->set_color_channel(dev, CHANNEL_RED, color_get_r(color));
-    api->set_color_channel(dev, CHANNEL_GREEN, color_get_g(color));
-    api->set_color_channel(dev, CHANNEL_BLUE, color_get_b(color));
+    __ASSERT(api->set_color, "Missing api function set_color");
+    if (api->hold){
+        api->hold(dev, true);
+    }
+    api->set_color(dev, color);
+    if (api->hold){
+        api->hold(dev, false);
+    }
 }
 
+/**
+ * @brief      Set the color of several touchpads at once
+ *
+ * All touchpads are held while their colors are written, so that the new
+ * colors appear on all of them simultaneously.
+ *
+ * @param[in]  devs    The touchpads
+ * @param[in]  colors  The color for each touchpad
+ * @param[in]  n       The number of touchpads
+ */
+static inline void touchpad_set_colors(const struct device *const devs[], const color_t colors[], size_t n)
+{
+    for (size_t i=0; i<n; i++){
+        const struct touchpad_driver_api *api = devs[i]->api;
+        if (api->hold){
+            api->hold(devs[i], true);
+        }
+    }
+
+    for (size_t i=0; i<n; i++){
+        const struct touchpad_driver_api *api = devs[i]->api;
+        __ASSERT(api->set_color, "Missing api function set_color");
+        api->set_color(devs[i], colors[i]);
+    }
+
+    for (size_t i=0; i<n; i++){
+        const struct touchpad_driver_api *api = devs[i]->api;
+        if (api->hold){
+            api->hold(devs[i], false);
+        }
+    }
+}
+
+/* Debounced touch state */
 __syscall bool touchpad_is_touched(const struct device *dev)
 {
-    /*
-     * This assumes that all touchpad driver configs start with a gpio_dt_spec
-     * as first member !
-     */
-    const struct gpio_dt_spec *touch = dev->config;
-    return gpio_pin_get_dt(touch);
+    const struct touchpad_driver_api *api = dev->api;
+    __ASSERT(api->is_touched, "Missing api function is_touched");
+    return api->is_touched(dev);
+}
+
+__syscall void touchpad_set_callback(const struct device *dev, struct touchpad_callback_t *cb)
+{
+    const struct touchpad_driver_api *api = dev->api;
+    __ASSERT(api->set_callback, "Missing api function set_callback");
+    api->set_callback(dev, cb);
 }
 
 #endif
@@ -0,0 +1,6 @@
+#include <zephyr/shell/shell.h>
+
+/* Root of the kinesta shell commands, extended with SHELL_SUBCMD_ADD((kinesta), ...) */
+SHELL_SUBCMD_SET_CREATE(kinesta_cmds, (kinesta));
+
+SHELL_CMD_REGISTER(kinesta, &kinesta_cmds, "Kinesta commands", NULL);
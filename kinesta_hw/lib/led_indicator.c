@@ -0,0 +1,86 @@
+#include "led_indicator.h"
+
+#include <errno.h>
+
+static void led_indicator_set(struct led_indicator *led, bool on)
+{
+    led->on = on;
+    if (led->ready){
+        gpio_pin_set_dt(&led->gpio, on);
+    }
+}
+
+/* End of a flash, or half period of a blink */
+static void led_indicator_expiry(struct k_timer *timer)
+{
+    struct led_indicator *led = CONTAINER_OF(timer, struct led_indicator, timer);
+
+    k_spinlock_key_t key = k_spin_lock(&led->lock);
+    switch (led->mode){
+    case LED_INDICATOR_SLOW_BLINK:
+    case LED_INDICATOR_FAST_BLINK:
+        led_indicator_set(led, ! led->on);
+        break;
+    default:
+        led->flashing = false;
+        led_indicator_set(led, led->mode == LED_INDICATOR_ON);
+        break;
+    }
+    k_spin_unlock(&led->lock, key);
+}
+
+int led_indicator_init(struct led_indicator *led)
+{
+    k_timer_init(&led->timer, led_indicator_expiry, NULL);
+    led->mode = LED_INDICATOR_OFF;
+    led->on = false;
+    led->flashing = false;
+
+    if (! device_is_ready(led->gpio.port)){
+        return -ENODEV;
+    }
+    int r = gpio_pin_configure_dt(&led->gpio, GPIO_OUTPUT_INACTIVE);
+    led->ready = r == 0;
+    return r;
+}
+
+void led_indicator_set_mode(struct led_indicator *led, enum led_indicator_mode mode)
+{
+    k_spinlock_key_t key = k_spin_lock(&led->lock);
+    if (mode == led->mode){
+        k_spin_unlock(&led->lock, key);
+        return;
+    }
+
+    led->mode = mode;
+    led->flashing = false;
+    switch (mode){
+    case LED_INDICATOR_SLOW_BLINK:
+        k_timer_start(&led->timer, K_MSEC(CONFIG_LED_INDICATOR_SLOW_BLINK_MS / 2),
+                      K_MSEC(CONFIG_LED_INDICATOR_SLOW_BLINK_MS / 2));
+        led_indicator_set(led, true);
+        break;
+    case LED_INDICATOR_FAST_BLINK:
+        k_timer_start(&led->timer, K_MSEC(CONFIG_LED_INDICATOR_FAST_BLINK_MS / 2),
+                      K_MSEC(CONFIG_LED_INDICATOR_FAST_BLINK_MS / 2));
+        led_indicator_set(led, true);
+        break;
+    default:
+        k_timer_stop(&led->timer);
+        led_indicator_set(led, mode == LED_INDICATOR_ON);
+        break;
+    }
+    k_spin_unlock(&led->lock, key);
+}
+
+void led_indicator_flash(struct led_indicator *led)
+{
+    k_spinlock_key_t key = k_spin_lock(&led->lock);
+    bool steady = led->mode == LED_INDICATOR_OFF || led->mode == LED_INDICATOR_ON;
+    if (steady && ! led->flashing){
+        led->flashing = true;
+        led_indicator_set(led, led->mode == LED_INDICATOR_OFF);
+        k_timer_start(&led->timer, K_MSEC(CONFIG_LED_INDICATOR_FLASH_MS), K_NO_WAIT);
+    }
+    k_spin_unlock(&led->lock, key);
+}
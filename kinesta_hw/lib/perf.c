@@ -0,0 +1,144 @@
+#include "perf.h"
+
+#include <zephyr/init.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+static struct k_spinlock perf_lock;
+
+static unsigned perf_bin(uint32_t cycles)
+{
+    if (cycles < PERF_BINS_PER_OCTAVE){
+        return cycles;
+    }
+    unsigned msb = find_msb_set(cycles) - 1;
+    unsigned bin = PERF_BINS_PER_OCTAVE * (msb - 1) + ((cycles >> (msb - 2)) & (PERF_BINS_PER_OCTAVE - 1));
+    return MIN(bin, PERF_N_BINS - 1);
+}
+
+static uint32_t perf_bin_lower_bound(unsigned bin)
+{
+    if (bin < PERF_BINS_PER_OCTAVE){
+        return bin;
+    }
+    unsigned msb = bin / PERF_BINS_PER_OCTAVE + 1;
+    unsigned sub = bin % PERF_BINS_PER_OCTAVE;
+    return (PERF_BINS_PER_OCTAVE + sub) << (msb - 2);
+}
+
+static uint32_t perf_cycles_per_sec(void)
+{
+#if defined(CONFIG_CPU_CORTEX_M_HAS_DWT)
+    return SystemCoreClock;
+#else
+    return sys_clock_hw_cycles_per_sec();
+#endif
+}
+
+void perf_stage_record(struct perf_stage *stage, uint32_t start)
+{
+    uint32_t cycles = perf_now() - start;
+
+    k_spinlock_key_t key = k_spin_lock(&perf_lock);
+    stage->count++;
+    stage->total += cycles;
+    stage->min = MIN(stage->min, cycles);
+    stage->max = MAX(stage->max, cycles);
+    stage->histogram[perf_bin(cycles)]++;
+    k_spin_unlock(&perf_lock, key);
+}
+
+void perf_stage_reset(struct perf_stage *stage)
+{
+    k_spinlock_key_t key = k_spin_lock(&perf_lock);
+    stage->count = 0;
+    stage->total = 0;
+    stage->min = UINT32_MAX;
+    stage->max = 0;
+    memset(stage->histogram, 0, sizeof(stage->histogram));
+    k_spin_unlock(&perf_lock, key);
+}
+
+uint32_t perf_stage_percentile(const struct perf_stage *stage, unsigned percentile)
+{
+    uint64_t threshold = ((uint64_t) stage->count * percentile + 99) / 100;
+    uint64_t cumulated = 0;
+
+    for (unsigned bin=0; bin<PERF_N_BINS-1; bin++){
+        cumulated += stage->histogram[bin];
+        if (cumulated >= threshold){
+            // Never report more than the actual maximum
+            return MIN(perf_bin_lower_bound(bin + 1) - 1, stage->max);
+        }
+    }
+    return stage->max;
+}
+
+uint64_t perf_cycles_to_ns(uint64_t cycles)
+{
+    return cycles * NSEC_PER_SEC / perf_cycles_per_sec();
+}
+
+#if defined(CONFIG_CPU_CORTEX_M_HAS_DWT)
+static int perf_init(void)
+{
+    // Enable the DWT cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    return 0;
+}
+
+SYS_INIT(perf_init, PRE_KERNEL_1, 0);
+#endif
+
+#if defined(CONFIG_SHELL)
+static int cmd_perf_show(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    shell_print(sh, "%-24s %10s %10s %10s %10s %10s",
+                "stage", "count", "min[ns]", "avg[ns]", "p99[ns]", "max[ns]");
+
+    STRUCT_SECTION_FOREACH(perf_stage, stage){
+        // Work on a snapshot, so that all statistics are consistent
+        static struct perf_stage snapshot;
+        k_spinlock_key_t key = k_spin_lock(&perf_lock);
+        snapshot = *stage;
+        k_spin_unlock(&perf_lock, key);
+
+        if (snapshot.count == 0){
+            shell_print(sh, "%-24s %10u", snapshot.name, 0);
+            continue;
+        }
+
+        shell_print(sh, "%-24s %10u %10u %10u %10u %10u", snapshot.name, snapshot.count,
+                    (uint32_t) perf_cycles_to_ns(snapshot.min),
+                    (uint32_t) perf_cycles_to_ns(snapshot.total / snapshot.count),
+                    (uint32_t) perf_cycles_to_ns(perf_stage_percentile(&snapshot, 99)),
+                    (uint32_t) perf_cycles_to_ns(snapshot.max));
+    }
+    return 0;
+}
+
+static int cmd_perf_reset(const struct shell *sh, size_t argc, char **argv)
+{
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    STRUCT_SECTION_FOREACH(perf_stage, stage){
+        perf_stage_reset(stage);
+    }
+    shell_print(sh, "Latency statistics cleared");
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(perf_cmds,
+    SHELL_CMD(show, NULL, "Show min/avg/p99/max latency per stage", cmd_perf_show),
+    SHELL_CMD(reset, NULL, "Clear latency statistics", cmd_perf_reset),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((kinesta), perf, &perf_cmds, "Latency of the processing stages", cmd_perf_show, 1, 0);
+#endif
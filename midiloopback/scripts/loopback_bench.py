@@ -0,0 +1,216 @@
+#!/usr/bin/env python3
+"""
+Host side of the midiloopback benchmark, through ALSA raw MIDI.
+
+Run the emulated device and attach it to the host with USB/IP first:
+
+    west build -b native_sim midiloopback && ./build/zephyr/zephyr.exe
+    sudo modprobe vhci-hcd
+    sudo usbip attach -r localhost -b 1-1
+
+Then measure the round-trip latency, the echo throughput (host to device to
+host), the device to host throughput and the SysEx echo throughput. The fill
+ratio of the bulk transfers is logged by the device on its console after each
+phase.
+"""
+
+import argparse
+import json
+import os
+import re
+import threading
+import time
+
+LOOPBACK_CHANNEL = 15
+LOOPBACK_BURST_CHANNEL = 14
+LOOPBACK_CC_STATS = 0x75
+LOOPBACK_CC_BURST_DONE = 0x76
+LOOPBACK_CC_BURST = 0x77
+
+NOTE_ON = 0x90
+CONTROL_CHANGE = 0xB0
+SYSEX_START = 0xF0
+SYSEX_END = 0xF7
+
+
+def find_device(name):
+    with open("/proc/asound/cards") as cards:
+        for line in cards:
+            match = re.match(r"\s*(\d+)\s+\[.*\]:.*- (.*)", line)
+            if match and name in match.group(2):
+                return f"/dev/snd/midiC{match.group(1)}D0"
+    raise SystemExit(f"No ALSA card named {name}, is the device attached ?")
+
+
+class RawMidi:
+    """Raw MIDI port, with a reader thread parsing 3-byte channel messages,
+    and SysEx as (SYSEX_START, payload)"""
+
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR)
+        self.cond = threading.Condition()
+        self.received = []
+        self.status = None
+        self.data = []
+        threading.Thread(target=self._read, daemon=True).start()
+
+    def _read(self):
+        while True:
+            for byte in os.read(self.fd, 256):
+                if byte >= 0xF8:
+                    continue
+                if byte == SYSEX_END and self.status == SYSEX_START:
+                    self._received((SYSEX_START, bytes(self.data)))
+                    self.status, self.data = None, []
+                    continue
+                if byte & 0x80:
+                    self.status, self.data = byte, []
+                    continue
+                self.data.append(byte)
+                if self.status not in (None, SYSEX_START) and len(self.data) == 2:
+                    self._received((self.status, *self.data))
+                    self.data = []
+
+    def _received(self, msg):
+        with self.cond:
+            self.received.append((time.perf_counter_ns(), msg))
+            self.cond.notify_all()
+
+    def send(self, *msg):
+        os.write(self.fd, bytes(msg))
+
+    def wait(self, predicate, timeout=5):
+        """Pop and return the first received message matching predicate"""
+        deadline = time.monotonic() + timeout
+        with self.cond:
+            while True:
+                for i, (timestamp, msg) in enumerate(self.received):
+                    if predicate(msg):
+                        del self.received[:i + 1]
+                        return timestamp, msg
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    return None
+                self.cond.wait(remaining)
+
+    def device_stats(self):
+        self.send(CONTROL_CHANGE | LOOPBACK_CHANNEL, LOOPBACK_CC_STATS, 0)
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, len(values) * p // 100)]
+
+
+def bench_round_trip(port, n):
+    latencies = []
+    lost = 0
+    for seq in range(n):
+        msg = (NOTE_ON, (seq >> 7) & 0x7F, seq & 0x7F)
+        start = time.perf_counter_ns()
+        port.send(*msg)
+        res = port.wait(lambda m: m == msg, timeout=1)
+        if res is None:
+            lost += 1
+        else:
+            latencies.append((res[0] - start) / 1000)
+    if not latencies:
+        return {"count": 0, "lost": lost}
+    return {
+        "count": len(latencies),
+        "lost": lost,
+        "min_us": min(latencies),
+        "avg_us": sum(latencies) / len(latencies),
+        "p50_us": percentile(latencies, 50),
+        "p99_us": percentile(latencies, 99),
+        "max_us": max(latencies),
+    }
+
+
+def bench_echo(port, n, window):
+    """Host to device to host, with up to window events in flight"""
+    received = 0
+    start = time.perf_counter_ns()
+    for seq in range(n):
+        if seq - received >= window:
+            if port.wait(lambda m: m[0] == NOTE_ON) is None:
+                break
+            received += 1
+        port.send(NOTE_ON, (seq >> 7) & 0x7F, seq & 0x7F)
+    while received < n and port.wait(lambda m: m[0] == NOTE_ON) is not None:
+        received += 1
+    elapsed = (time.perf_counter_ns() - start) / 1e9
+    return {"sent": n, "received": received, "events_per_s": received / elapsed}
+
+
+def bench_burst(port, thousands):
+    """Device to host"""
+    expected = 1000 * thousands
+    status = NOTE_ON | LOOPBACK_BURST_CHANNEL
+    received = gaps = 0
+    start = time.perf_counter_ns()
+    port.send(CONTROL_CHANGE | LOOPBACK_CHANNEL, LOOPBACK_CC_BURST, thousands)
+    while True:
+        res = port.wait(lambda m: m[0] == status or m[:2] == (CONTROL_CHANGE | LOOPBACK_CHANNEL, LOOPBACK_CC_BURST_DONE))
+        if res is None or res[1][0] != status:
+            break
+        seq = (res[1][1] << 7) | res[1][2]
+        gaps += seq != (received & 0x3FFF)
+        received += 1
+    elapsed = (time.perf_counter_ns() - start) / 1e9
+    return {"expected": expected, "received": received, "gaps": gaps, "events_per_s": received / elapsed}
+
+
+def bench_sysex(port, size, n):
+    """Host to device to host, one SysEx of size bytes in flight"""
+    received = errors = 0
+    start = time.perf_counter_ns()
+    for seq in range(n):
+        payload = bytes((seq + i) & 0x7F for i in range(size - 2))
+        port.send(SYSEX_START, *payload, SYSEX_END)
+        res = port.wait(lambda m: m[0] == SYSEX_START)
+        if res is None:
+            break
+        received += 1
+        errors += res[1][1] != payload
+    elapsed = (time.perf_counter_ns() - start) / 1e9
+    return {"sent": n, "received": received, "errors": errors,
+            "bytes_per_s": 2 * size * received / elapsed}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--device", help="Raw MIDI device (default: found from the ALSA card name)")
+    parser.add_argument("--name", default="midiloopback", help="ALSA card name of the device")
+    parser.add_argument("--round-trips", type=int, default=1000)
+    parser.add_argument("--echo-events", type=int, default=20000)
+    parser.add_argument("--window", type=int, default=16, help="Events in flight in the echo benchmark")
+    parser.add_argument("--burst", type=int, default=20, help="Thousands of events in the device burst")
+    parser.add_argument("--sysex-size", type=int, default=4096, help="Size of the echoed SysEx, up to 8192")
+    parser.add_argument("--sysex-count", type=int, default=50)
+    parser.add_argument("--json", action="store_true", help="Print the results as JSON")
+    args = parser.parse_args()
+
+    port = RawMidi(args.device or find_device(args.name))
+    results = {}
+
+    port.device_stats()
+    results["round_trip"] = bench_round_trip(port, args.round_trips)
+    port.device_stats()
+    results["echo"] = bench_echo(port, args.echo_events, args.window)
+    port.device_stats()
+    results["burst"] = bench_burst(port, args.burst)
+    port.device_stats()
+    results["sysex"] = bench_sysex(port, args.sysex_size, args.sysex_count)
+    port.device_stats()
+
+    if args.json:
+        print(json.dumps(results, indent=2))
+    else:
+        for name, result in results.items():
+            print(f"{name:12s} " + " ".join(
+                f"{k}={v:.1f}" if isinstance(v, float) else f"{k}={v}" for k, v in result.items()))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,142 @@
+/**
+ * USB-MIDI loopback, to benchmark the usb_midi function from the host
+ * (see scripts/loopback_bench.py).
+ *
+ * - All events from the host are echoed back to it, unchanged;
+ * - CC LOOPBACK_CC_BURST on LOOPBACK_CHANNEL with value n makes the device
+ *   stream n*1000 Note On events (with a sequence number in the note and
+ *   velocity) to the host as fast as possible, then LOOPBACK_CC_BURST_DONE.
+ *   A MIDI clock is sent every LOOPBACK_BURST_CLOCK_PERIOD events, to measure
+ *   the latency of the realtime messages under load;
+ * - CC LOOPBACK_CC_STATS on LOOPBACK_CHANNEL logs the transfer counters of
+ *   the USB-MIDI function since the previous one, and resets them;
+ * - SysEx of up to LOOPBACK_SYSEX_SIZE bytes are echoed back with
+ *   usb_midi_sysex_send, to measure the SysEx throughput.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/usb/usb_device.h>
+
+#include "usb_midi.h"
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(app);
+
+#define LOOPBACK_CHANNEL        15
+#define LOOPBACK_BURST_CHANNEL  14
+#define LOOPBACK_CC_STATS       0x75
+#define LOOPBACK_CC_BURST_DONE  0x76
+#define LOOPBACK_CC_BURST       0x77
+
+#define LOOPBACK_BURST_CLOCK_PERIOD 100
+
+#define LOOPBACK_SYSEX_SIZE 8192
+
+/* Time to wait for space in the buffer to the host */
+#define LOOPBACK_RETRY_DELAY K_USEC(100)
+
+static K_SEM_DEFINE(burst_requested, 0, 1);
+static unsigned burst_size;
+
+static uint8_t sysex_buf[LOOPBACK_SYSEX_SIZE];
+
+static void loopback_write(const uint8_t pkt[3])
+{
+    while (usb_midi_write(0, pkt) == -EAGAIN){
+        k_sleep(LOOPBACK_RETRY_DELAY);
+    }
+}
+
+static void loopback_log_stats()
+{
+    struct usb_midi_stats stats;
+    usb_midi_get_stats(&stats);
+    usb_midi_reset_stats();
+
+    LOG_INF("to host: %u transfers, %u bytes, fill %u%%",
+            stats.in_transfers, stats.in_bytes,
+            stats.in_transfers ? 100 * stats.in_bytes / (stats.in_transfers * MIDI_BULK_SIZE) : 0);
+    LOG_INF("from host: %u transfers, %u bytes, fill %u%%",
+            stats.out_transfers, stats.out_bytes,
+            stats.out_transfers ? 100 * stats.out_bytes / (stats.out_transfers * MIDI_BULK_SIZE) : 0);
+    LOG_INF("realtime: %u packets, %u dropped, latency min %uus avg %uus max %uus",
+            stats.realtime_packets, stats.realtime_dropped, stats.realtime_latency_min_us,
+            stats.realtime_latency_avg_us, stats.realtime_latency_max_us);
+    LOG_INF("sysex: %u sent, %u received, %u dropped",
+            stats.sysex_sent, stats.sysex_received, stats.sysex_dropped);
+    LOG_INF("queues: to host max %u, %u dropped, from host max %u, %u overruns, realtime max %u",
+            stats.to_host_queue_max, stats.to_host_dropped, stats.from_host_queue_max,
+            stats.from_host_overruns, stats.realtime_queue_max);
+}
+
+static void burst_task()
+{
+    while (true){
+        k_sem_take(&burst_requested, K_FOREVER);
+
+        int64_t start = k_uptime_get();
+        for (unsigned seq=0; seq<burst_size; seq++){
+            const uint8_t pkt[] = MIDI_NOTE_ON(LOOPBACK_BURST_CHANNEL, (seq >> 7) & 0x7f, seq & 0x7f);
+            loopback_write(pkt);
+            if (seq % LOOPBACK_BURST_CLOCK_PERIOD == 0){
+                const uint8_t clock[] = {MIDI_RT_CLOCK, 0, 0};
+                loopback_write(clock);
+            }
+        }
+        const uint8_t done[] = MIDI_CONTROL_CHANGE(LOOPBACK_CHANNEL, LOOPBACK_CC_BURST_DONE, 0);
+        loopback_write(done);
+
+        LOG_INF("Burst of %u events in %lldms", burst_size, k_uptime_get() - start);
+    }
+}
+
+K_THREAD_DEFINE(burst_task_id, 1024, burst_task, NULL, NULL, NULL, 5, 0, 0);
+
+static bool handle_control(const uint8_t pkt[3])
+{
+    if (pkt[0] != (MIDI_CMD_CONTROL_CHANGE << 4 | LOOPBACK_CHANNEL)){
+        return false;
+    }
+
+    switch (pkt[1]){
+    case LOOPBACK_CC_BURST:
+        burst_size = 1000 * pkt[2];
+        k_sem_give(&burst_requested);
+        return true;
+    case LOOPBACK_CC_STATS:
+        loopback_log_stats();
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void loopback_rx(uint8_t cable_number, const uint8_t pkt[3])
+{
+    if (! handle_control(pkt)){
+        loopback_write(pkt);
+    }
+}
+
+/* The reception waits meanwhile, the host is throttled by the bulk endpoint */
+static void loopback_sysex_rx(uint8_t cable_number, const uint8_t *sysex, size_t len)
+{
+    usb_midi_sysex_send(0, sysex, len);
+}
+
+void main(void)
+{
+    usb_midi_set_rx_handler(0, loopback_rx);
+    usb_midi_set_sysex_handler(0, sysex_buf, sizeof(sysex_buf), loopback_sysex_rx);
+
+    if (usb_enable(NULL) == 0){
+        LOG_INF("USB enabled");
+    } else {
+        LOG_ERR("Failed to enable USB");
+        return;
+    }
+
+    while (true){
+        usb_midi_dispatch();
+    }
+}
@@ -1,123 +1,34 @@
-#include <zephyr.h>
-#include <device.h>
-#include <devicetree.h>
-#include <drivers/gpio.h>
-#include <drivers/uart.h>
-#include <usb/usb_device.h>
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/usb/usb_device.h>
 
 #include "usb_midi.h"
+#include "midi_sequencer.h"
+#include "led_indicator.h"
 
-#include <logging/log.h>
+#include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(app);
 
-enum {
-    INIT,
-    USB_ENABLED,
-    RUNNING,
-} app_state = INIT;
-
-#define SLEEP_TIME_MS   100
-
-#define MIDI_UART_NODE   DT_ALIAS(midiport)
-#define MIDI_UART_LABEL  DT_LABEL(MIDI_UART_NODE)
-
-#define STATUS_LED_NODE  DT_NODELABEL(blue_led_1)
-#define STATUS_LED_LABEL DT_GPIO_LABEL(STATUS_LED_NODE, gpios)
-#define STATUS_LED_PIN   DT_GPIO_PIN(STATUS_LED_NODE, gpios)
-#define STATUS_LED_FLAGS DT_GPIO_FLAGS(STATUS_LED_NODE, gpios)
-
-#define ACT_LED_NODE  DT_ALIAS(midiled2)
-#define ACT_LED_LABEL DT_GPIO_LABEL(ACT_LED_NODE, gpios)
-#define ACT_LED_PIN   DT_GPIO_PIN(ACT_LED_NODE, gpios)
-#define ACT_LED_FLAGS DT_GPIO_FLAGS(ACT_LED_NODE, gpios)
-
-static K_SEM_DEFINE(act_led_sem, 0, 1);
-
-static void do_act_led()
-{
-    k_sem_give(&act_led_sem);
-}
-
-static struct k_delayed_work act_led_work;
-static void act_led_task()
-{
-    static const struct device *led_dev = NULL;
-
-    if (! led_dev){
-        led_dev = device_get_binding(ACT_LED_LABEL);
-        if (! led_dev){
-            return;
-        }
-        if (gpio_pin_configure(led_dev, ACT_LED_PIN, GPIO_OUTPUT_ACTIVE|ACT_LED_FLAGS) < 0){
-            return;
-        }
-        gpio_pin_set(led_dev, ACT_LED_PIN, 0);
-    }
-
-    // Wait for some activity
-    if (k_sem_take(&act_led_sem, K_MSEC(1)) == 0){
-        // Blink for 50ms
-        gpio_pin_set(led_dev, ACT_LED_PIN, 1);
-        k_sleep(K_MSEC(50));
-        gpio_pin_set(led_dev, ACT_LED_PIN, 0);
-    }
-
-    // Then redo
-    k_delayed_work_submit(&act_led_work, K_NO_WAIT);
-}
-
 /**
  * Status LED:
  * - Off when the board is not initialized
  * - Slow blink when MIDI-USB is not connected
  * - Fast blink when MIDI-USB is connected
+ *
+ * Activity LED: flashes on the notes to the host and to the MIDI out port
  */
-static struct k_delayed_work status_led_work;
-static void status_led_task()
-{
-    static unsigned int tick = 0;
-    static bool is_on = true;
-    static const struct device *led_dev = NULL;
-
-    if (! led_dev){
-        led_dev = device_get_binding(STATUS_LED_LABEL);
-        if (! led_dev){
-            return;
-        }
-        if (gpio_pin_configure(led_dev, STATUS_LED_PIN, GPIO_OUTPUT_ACTIVE|STATUS_LED_FLAGS) < 0){
-            return;
-        }
-    }
+static LED_INDICATOR_DT_DEFINE(status_led, DT_ALIAS(led1));
+static LED_INDICATOR_DT_DEFINE(act_led, DT_ALIAS(midiled2));
 
-    tick++;
-
-    switch (app_state){
-        case INIT:
-            is_on = false;
-            break;
-        case USB_ENABLED:
-            if (tick % 10 == 0){
-                is_on = ! is_on;
-            }
-            if (usb_midi_is_configured()){
-                app_state = RUNNING;
-            }
-            break;
-        case RUNNING:
-            is_on = ! is_on;
-            if (! usb_midi_is_configured()){
-                app_state = USB_ENABLED;
-                is_on = false;
-            }
-            break;
-        default: break;
-    }
-
-    gpio_pin_set(led_dev, STATUS_LED_PIN, (int) is_on);
-    k_delayed_work_submit(&status_led_work, K_MSEC(SLEEP_TIME_MS));
+/* Called from the USB driver interrupt, like the LED timers */
+static void usb_status(enum usb_dc_status_code status, const uint8_t *param)
+{
+    led_indicator_set_mode(&status_led, usb_midi_is_configured() ? LED_INDICATOR_FAST_BLINK
+                                                                 : LED_INDICATOR_SLOW_BLINK);
 }
 
-
 static void to_external_midi_out_func(void *p1, void *p2, void *p3)
 {
     const struct uart_config midi_uart_config = {
@@ -128,9 +39,9 @@ static void to_external_midi_out_func(void *p1, void *p2, void *p3)
         .flow_ctrl=UART_CFG_FLOW_CTRL_NONE,
     };
 
-    const struct device *midi_uart = device_get_binding(MIDI_UART_LABEL);
-    if (! midi_uart){
-        LOG_ERR("Unable to open MIDI uart");
+    const struct device *midi_uart = DEVICE_DT_GET(DT_ALIAS(midiport));
+    if (! device_is_ready(midi_uart)){
+        LOG_ERR("MIDI uart not ready");
         return;
     }
 
@@ -139,19 +50,22 @@ static void to_external_midi_out_func(void *p1, void *p2, void *p3)
         return;
     }
 
-    uint8_t cable_id;
-    uint8_t midi_pkt[3] = {0, 0, 0};
+    struct midi_encoder encoder;
+    midi_encoder_init(&encoder, true);
+
+    uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE];
     while (1){
-        if (usb_midi_read(&cable_id, midi_pkt)){
+        // Full event packets, for the SysEx to pass through
+        if (usb_midi_read_packet(usb_pkt)){
             continue;
         }
 
-        uint8_t cmd = midi_pkt[0] >> 4;
-
-        for (size_t i=0; i<midi_datasize(cmd); i++){
-            uart_poll_out(midi_uart, midi_pkt[i]);
+        uint8_t bytes[3];
+        size_t n_bytes = midi_encoder_put(&encoder, usb_pkt, bytes);
+        for (size_t i=0; i<n_bytes; i++){
+            uart_poll_out(midi_uart, bytes[i]);
         }
-        do_act_led();
+        led_indicator_flash(&act_led);
     }
 }
 
@@ -165,18 +79,39 @@ K_THREAD_DEFINE(to_external_midi_out_tid, 512,
 #define hat_open 2
 #define snare 3
 
-static void midi_beat(uint8_t chan, int steps)
+/* The drum pattern is made of 32th note steps, at 121 BPM */
+#define STEP (MIDI_SEQ_PPQN / 8)
+#define DRUMS_TEMPO MIDI_SEQ_BPM(121)
+
+#define DRUM(step, chan, steps) \
+    {.tick=(step) * STEP, .pkt=MIDI_NOTE_ON(chan, 0, 127)}, \
+    {.tick=((step) + (steps)) * STEP - 1, .pkt=MIDI_NOTE_OFF(chan, 0, 127)}
+
+#define DRUMS_LOOP(base) \
+    DRUM((base) + 0, kick, 2), \
+    DRUM((base) + 2, hat_open, 2), \
+    DRUM((base) + 4, hat, 4), \
+    DRUM((base) + 8, snare, 2), \
+    DRUM((base) + 10, hat_open, 2)
+
+static const struct midi_seq_event drums_events[] = {
+    DRUMS_LOOP(0), DRUM(12, hat, 4),
+    DRUMS_LOOP(16), DRUM(28, hat, 4),
+    DRUMS_LOOP(32), DRUM(44, hat, 4),
+    DRUMS_LOOP(48), DRUM(60, hat_open, 2), DRUM(62, kick, 1), DRUM(63, hat, 1),
+};
+
+static const struct midi_seq_pattern drums = {
+    .events = drums_events,
+    .n_events = ARRAY_SIZE(drums_events),
+    .length = 64 * STEP,
+};
+
+static void drums_output(const uint8_t pkt[3])
 {
-    const uint8_t noteOn[3] = MIDI_NOTE_ON(chan, 0, 127);
-    if (usb_midi_write(1, noteOn) == 0){
-        do_act_led();
-    }
-
-    k_sleep(K_MSEC(steps*62));
-
-    const uint8_t noteOff[3] = MIDI_NOTE_OFF(chan, 0, 127);
-    if (usb_midi_write(1, noteOff) == 0){
-        do_act_led();
+    // The clock is for the host, the leds only show the notes
+    if (usb_midi_write(1, pkt) == 0 && ! midi_is_realtime(pkt[0])){
+        led_indicator_flash(&act_led);
     }
 }
 
@@ -184,37 +119,22 @@ void main(void)
 {
     LOG_INF("Starting...");
 
-    k_delayed_work_init(&status_led_work, status_led_task);
-    k_delayed_work_submit(&status_led_work, K_NO_WAIT);
+    if (led_indicator_init(&status_led) || led_indicator_init(&act_led)){
+        LOG_WRN("Unable to configure the leds");
+    }
 
-    if (usb_enable(NULL) == 0){
+    // Before the first status callback
+    led_indicator_set_mode(&status_led, LED_INDICATOR_SLOW_BLINK);
+    if (usb_enable(usb_status) == 0){
         LOG_INF("USB enabled");
-        app_state = USB_ENABLED;
     } else {
         LOG_ERR("Failed to enable USB");
+        led_indicator_set_mode(&status_led, LED_INDICATOR_OFF);
         return;
     }
 
-    k_delayed_work_init(&act_led_work, act_led_task);
-    k_delayed_work_submit(&act_led_work, K_NO_WAIT);
-
-    unsigned long beat = 0;
-    while (1){
-        beat++;
-        midi_beat(kick, 2);
-        midi_beat(hat_open, 2);
-
-        midi_beat(hat, 4);
-        
-        midi_beat(snare, 2);
-        midi_beat(hat_open, 2);
-        
-        if (beat % 4){
-            midi_beat(hat, 4);
-        } else {
-            midi_beat(hat_open, 2);
-            midi_beat(kick, 1);
-            midi_beat(hat, 1);
-        }
-    }
+    midi_seq_set_output(drums_output);
+    midi_seq_set_tempo(DRUMS_TEMPO);
+    midi_seq_set_pattern(&drums);
+    midi_seq_start();
 }
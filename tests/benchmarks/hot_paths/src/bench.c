@@ -0,0 +1,32 @@
+#include "bench.h"
+
+#if defined(CONFIG_ARCH_POSIX)
+#include <native_rtc.h>
+#endif
+
+volatile uint32_t bench_sink;
+
+#if !defined(CONFIG_ARCH_POSIX)
+/* The 32 bits cycle counter, extended on 64 bits: it must not wrap between calls */
+static uint32_t bench_last_cycles;
+static uint64_t bench_cycles;
+#endif
+
+uint64_t bench_now_ns(void)
+{
+#if defined(CONFIG_ARCH_POSIX)
+    return native_rtc_gettime_us(RTC_CLOCK_PSEUDOHOSTREALTIME) * NSEC_PER_USEC;
+#else
+    uint32_t now = k_cycle_get_32();
+    bench_cycles += now - bench_last_cycles;
+    bench_last_cycles = now;
+    return k_cyc_to_ns_floor64(bench_cycles);
+#endif
+}
+
+void bench_report(const char *suite, const char *name, uint32_t iterations, uint64_t total_ns, uint32_t cycles)
+{
+    uint64_t ops_per_s = total_ns ? (uint64_t) iterations * NSEC_PER_SEC / total_ns : 0;
+    printk("BENCH %s.%s iterations=%u total_ns=%llu ops_per_s=%llu cycles=%u\n",
+           suite, name, iterations, total_ns, ops_per_s, cycles);
+}
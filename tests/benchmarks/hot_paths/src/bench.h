@@ -0,0 +1,38 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <zephyr/kernel.h>
+
+#define BENCH_ITERATIONS 100000
+
+/* Keeps the benchmarked results alive for the optimizer */
+extern volatile uint32_t bench_sink;
+
+/**
+ * @brief      Get the current time for measurements: the host clock on
+ *             native_sim (where code runs in zero simulated time), the
+ *             system timer otherwise.
+ */
+uint64_t bench_now_ns(void);
+
+/**
+ * @brief      Print the result of a benchmark on a single line, as
+ *             "BENCH <suite>.<name> iterations=<n> total_ns=<ns> ops_per_s=<n> cycles=<n>"
+ *
+ * The cycles are those of k_cycle_get_32, they do not advance on native_sim.
+ */
+void bench_report(const char *suite, const char *name, uint32_t iterations, uint64_t total_ns, uint32_t cycles);
+
+/* Run body for i in 0..iterations, and report its duration */
+#define BENCH_RUN(suite, name, iterations, body)                            \
+    do {                                                                    \
+        uint64_t _bench_start = bench_now_ns();                             \
+        uint32_t _bench_start_cycles = k_cycle_get_32();                    \
+        for (uint32_t i=0; i<(iterations); i++){                            \
+            body;                                                           \
+        }                                                                   \
+        uint32_t _bench_cycles = k_cycle_get_32() - _bench_start_cycles;    \
+        bench_report(suite, name, (iterations), bench_now_ns() - _bench_start, _bench_cycles); \
+    } while (0)
+
+#endif
@@ -0,0 +1,37 @@
+#include "bench.h"
+#include "color.h"
+
+#include <zephyr/ztest.h>
+
+ZTEST(color, test_color_rgbf)
+{
+    zassert_equal(color_rgbf(1, 0, 0), color_rgb(COLOR_CHAN_MAX, 0, 0));
+    zassert_equal(color_rgbf(0, 0, 0), 0);
+
+    BENCH_RUN("color", "color_rgbf", BENCH_ITERATIONS,
+        bench_sink += color_rgbf((i & 0xff) / 255.0f, 0.5f, 1.0f)
+    );
+}
+
+ZTEST(color, test_color_map)
+{
+    zassert_equal(color_map(COLOR_GREEN, COLOR_RED, 0), COLOR_GREEN);
+    zassert_equal(color_map(COLOR_GREEN, COLOR_RED, 1), COLOR_RED);
+    zassert_equal(color_map(COLOR_GREEN, COLOR_RED, 2), COLOR_RED);
+
+    BENCH_RUN("color", "color_map", BENCH_ITERATIONS,
+        bench_sink += color_map(COLOR_GREEN, COLOR_RED, (i & 0xff) / 255.0f)
+    );
+}
+
+ZTEST(color, test_color_mul)
+{
+    zassert_equal(color_mul(COLOR_WHITE, 1), COLOR_WHITE);
+    zassert_equal(color_mul(COLOR_WHITE, 0), 0);
+
+    BENCH_RUN("color", "color_mul", BENCH_ITERATIONS,
+        bench_sink += color_mul(COLOR_CYAN, (i & 0xff) / 255.0f)
+    );
+}
+
+ZTEST_SUITE(color, NULL, NULL, NULL, NULL, NULL);
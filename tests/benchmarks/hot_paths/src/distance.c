@@ -0,0 +1,42 @@
+#include "bench.h"
+#include "distance_filter.h"
+
+#include <zephyr/ztest.h>
+
+/* A hand going down and up through the tracking zone, in cm */
+static double bench_distance_cm(uint32_t i)
+{
+    uint32_t phase = i % 200;
+    return (phase < 100) ? 100 - phase : phase - 100;
+}
+
+ZTEST(distance, test_distance_filter)
+{
+    bool in_zone = false;
+    double filtered = distance_filter(0, 100, &in_zone);
+    zassert_false(in_zone);
+
+    // Entering the zone requires going below the hysteresis
+    filtered = distance_filter(filtered, DISTANCE_SENSOR_TRACKING_ZONE_CM - 1, &in_zone);
+    zassert_false(in_zone);
+    filtered = distance_filter(filtered, 10, &in_zone);
+    zassert_true(in_zone);
+
+    BENCH_RUN("distance", "filter", BENCH_ITERATIONS,
+        filtered = distance_filter(filtered, bench_distance_cm(i), &in_zone);
+        bench_sink += in_zone
+    );
+}
+
+ZTEST(distance, test_distance_to_midi_cc)
+{
+    zassert_equal(distance_to_midi_cc(0), 127);
+    zassert_equal(distance_to_midi_cc(DISTANCE_SENSOR_TRACKING_ZONE_CM), 0);
+    zassert_equal(distance_to_midi_cc(2 * DISTANCE_SENSOR_TRACKING_ZONE_CM), 0);
+
+    BENCH_RUN("distance", "midi_cc", BENCH_ITERATIONS,
+        bench_sink += distance_to_midi_cc(bench_distance_cm(i))
+    );
+}
+
+ZTEST_SUITE(distance, NULL, NULL, NULL, NULL, NULL);
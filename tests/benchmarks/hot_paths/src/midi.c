@@ -0,0 +1,420 @@
+#include "bench.h"
+#include "usb_midi.h"
+#include "midi_codec.h"
+#include "midi_ump.h"
+#include "midi_transform.h"
+#include "midi_rtp_payload.h"
+
+#include <string.h>
+#include <zephyr/ztest.h>
+
+/* A DIN stream: notes with running status, interleaved clocks, a SysEx and System Common */
+static const uint8_t stream[] = {
+    0x90, 60, 100, 62, 101, 0xF8, 64, 102,
+    0xB0, 7, 0xF8, 100, 0xB0, 10, 64,
+    0xF0, 0x7E, 0x7F, 0xF8, 0x06, 0x01, 0xF7,
+    0xF2, 0x10, 0x20, 0xC1, 5, 6, 0xF6,
+};
+
+static const uint8_t stream_pkts[][MIDI_CODEC_PKT_SIZE] = {
+    {0x39, 0x90, 60, 100},
+    {0x39, 0x90, 62, 101},
+    {0x3F, 0xF8, 0, 0},
+    {0x39, 0x90, 64, 102},
+    {0x3F, 0xF8, 0, 0},
+    {0x3B, 0xB0, 7, 100},
+    {0x3B, 0xB0, 10, 64},
+    {0x34, 0xF0, 0x7E, 0x7F},
+    {0x3F, 0xF8, 0, 0},
+    {0x37, 0x06, 0x01, 0xF7},
+    {0x33, 0xF2, 0x10, 0x20},
+    {0x3C, 0xC1, 5, 0},
+    {0x3C, 0xC1, 6, 0},
+    {0x35, 0xF6, 0, 0},
+};
+
+ZTEST(midi, test_midi_cin_length)
+{
+    // Size of the MIDI event for each Code Index Number (midi10, 4)
+    static const uint8_t expected[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+    for (uint8_t cin=0; cin<16; cin++){
+        zassert_equal(midi_cin_length(cin), expected[cin], "Wrong size for CIN 0x%X", cin);
+    }
+    for (unsigned int status=0x80; status<0xF0; status++){
+        zassert_equal(midi_status_cin(status), status >> 4);
+        zassert_equal(midi_status_length(status), midi_cin_length(status >> 4));
+    }
+
+    BENCH_RUN("midi", "midi_cin_length", BENCH_ITERATIONS,
+        bench_sink += midi_cin_length(i & 0x0f)
+    );
+    BENCH_RUN("midi", "midi_status_cin", BENCH_ITERATIONS,
+        bench_sink += midi_status_cin(i & 0xff) + midi_status_length(i & 0xff)
+    );
+}
+
+ZTEST(midi, test_midi_decode)
+{
+    struct midi_parser parser;
+    uint8_t pkts[32][MIDI_CODEC_PKT_SIZE];
+    size_t n_bytes = sizeof(stream);
+
+    midi_parser_init(&parser, 3);
+    size_t n_pkts = midi_decode(&parser, stream, &n_bytes, pkts, ARRAY_SIZE(pkts));
+    zassert_equal(n_bytes, sizeof(stream));
+    zassert_equal(n_pkts, ARRAY_SIZE(stream_pkts), "%d packets", (int) n_pkts);
+    zassert_mem_equal(pkts, stream_pkts, sizeof(stream_pkts));
+
+    // Stops when the packets are full
+    midi_parser_init(&parser, 3);
+    n_bytes = sizeof(stream);
+    zassert_equal(midi_decode(&parser, stream, &n_bytes, pkts, 2), 2);
+    zassert_equal(n_bytes, 5);
+
+    // One iteration parses the whole stream
+    BENCH_RUN("midi", "decode_stream", BENCH_ITERATIONS / 16,
+        n_bytes = sizeof(stream);
+        bench_sink += midi_decode(&parser, stream, &n_bytes, pkts, ARRAY_SIZE(pkts))
+    );
+}
+
+ZTEST(midi, test_midi_encode)
+{
+    struct midi_encoder encoder;
+    struct midi_parser parser;
+    uint8_t bytes[64];
+    uint8_t pkts[32][MIDI_CODEC_PKT_SIZE];
+    size_t n_pkts = ARRAY_SIZE(stream_pkts);
+
+    midi_encoder_init(&encoder, true);
+    size_t n_bytes = midi_encode(&encoder, stream_pkts, &n_pkts, bytes, sizeof(bytes));
+    zassert_equal(n_pkts, ARRAY_SIZE(stream_pkts));
+    // The stream has a redundant Control Change status, the encoder omits it
+    zassert_equal(n_bytes, sizeof(stream) - 1);
+
+    // The clocks move ahead of the messages they interrupted, the packets are the same
+    midi_parser_init(&parser, 3);
+    zassert_equal(midi_decode(&parser, bytes, &n_bytes, pkts, ARRAY_SIZE(pkts)), ARRAY_SIZE(stream_pkts));
+    zassert_mem_equal(pkts, stream_pkts, sizeof(stream_pkts));
+
+    // Without running status, the 4 omitted status are sent
+    midi_encoder_init(&encoder, false);
+    n_pkts = ARRAY_SIZE(stream_pkts);
+    zassert_equal(midi_encode(&encoder, stream_pkts, &n_pkts, bytes, sizeof(bytes)), sizeof(stream) + 3);
+
+    // Stops when less than 3 bytes are left
+    n_pkts = ARRAY_SIZE(stream_pkts);
+    zassert_equal(midi_encode(&encoder, stream_pkts, &n_pkts, bytes, 5), 3);
+    zassert_equal(n_pkts, 1);
+
+    midi_encoder_init(&encoder, true);
+    BENCH_RUN("midi", "encode_stream", BENCH_ITERATIONS / 16,
+        n_pkts = ARRAY_SIZE(stream_pkts);
+        bench_sink += midi_encode(&encoder, stream_pkts, &n_pkts, bytes, sizeof(bytes))
+    );
+}
+
+ZTEST(midi, test_midi_encoder_put_msg)
+{
+    const uint8_t cc[] = MIDI_CONTROL_CHANGE(0, 1, 64);
+    struct midi_encoder encoder;
+    uint8_t bytes[3];
+
+    midi_encoder_init(&encoder, true);
+    zassert_equal(midi_encoder_put_msg(&encoder, cc, bytes), 3);
+    zassert_equal(midi_encoder_put_msg(&encoder, cc, bytes), 2);
+
+    // The sensors of kinesta stream Control Changes to the DIN outputs
+    BENCH_RUN("midi", "encoder_put_msg", BENCH_ITERATIONS,
+        bench_sink += midi_encoder_put_msg(&encoder, cc, bytes)
+    );
+}
+
+ZTEST(midi, test_midi_sysex)
+{
+    static uint8_t dump[4096];
+    static uint8_t received[sizeof(dump)];
+    static uint8_t pkts[sizeof(dump) / 3 + 1][MIDI_CODEC_PKT_SIZE];
+    struct midi_sysex_assembler assembler;
+
+    dump[0] = 0xF0;
+    for (size_t i=1; i<sizeof(dump)-1; i++){
+        dump[i] = i & 0x7f;
+    }
+    dump[sizeof(dump) - 1] = 0xF7;
+
+    // Segmented in two calls, as in two transfers
+    size_t pos = 0;
+    size_t n_pkts = midi_sysex_segment(1, dump, sizeof(dump), &pos, pkts, 100);
+    zassert_equal(pos, 300);
+    n_pkts += midi_sysex_segment(1, dump, sizeof(dump), &pos, &pkts[n_pkts], ARRAY_SIZE(pkts) - n_pkts);
+    zassert_equal(pos, sizeof(dump));
+    zassert_equal(n_pkts, ARRAY_SIZE(pkts));
+    // 4096 = 3 * 1365 + 1: the last packet holds the end alone
+    zassert_equal(pkts[0][0], 0x14);
+    zassert_equal(pkts[n_pkts - 1][0], 0x15);
+    zassert_true(midi_codec_is_sysex(pkts[n_pkts - 1]));
+
+    midi_sysex_assembler_init(&assembler, received, sizeof(received));
+    int len = 0;
+    for (size_t i=0; i<n_pkts; i++){
+        zassert_true(midi_codec_is_sysex(pkts[i]));
+        len = midi_sysex_assemble(&assembler, pkts[i]);
+    }
+    zassert_equal(len, sizeof(dump));
+    zassert_mem_equal(received, dump, sizeof(dump));
+
+    // Too long for the buffer
+    midi_sysex_assembler_init(&assembler, received, 100);
+    for (size_t i=0; i<n_pkts; i++){
+        len = midi_sysex_assemble(&assembler, pkts[i]);
+    }
+    zassert_equal(len, -ENOMEM);
+
+    // One iteration segments then reassembles the 4kB dump
+    midi_sysex_assembler_init(&assembler, received, sizeof(received));
+    BENCH_RUN("midi", "sysex_4k", BENCH_ITERATIONS / 1000,
+        pos = 0;
+        n_pkts = midi_sysex_segment(0, dump, sizeof(dump), &pos, pkts, ARRAY_SIZE(pkts));
+        for (size_t j=0; j<n_pkts; j++){
+            len = midi_sysex_assemble(&assembler, pkts[j]);
+        }
+        bench_sink += len
+    );
+}
+
+ZTEST(midi, test_midi_ump)
+{
+    uint8_t pkt[3];
+    uint32_t ump[MIDI_UMP_MAX_WORDS];
+
+    // Min-center-max scaling of the 7 bits values
+    zassert_equal(midi_ump_scale7(0), 0);
+    zassert_equal(midi_ump_scale7(64), 0x80000000);
+    zassert_equal(midi_ump_scale7(127), 0xFFFFFFFF);
+    zassert_equal(midi_ump_scale7(1), 0x02000000);
+
+    // MIDI 1.0 messages, on the group of their cable
+    zassert_equal(midi_ump_from_midi1(2, (uint8_t[]) MIDI_CONTROL_CHANGE(3, 7, 100)), 0x22B30764);
+    zassert_equal(midi_ump_from_midi1(0, (uint8_t[]) {0xF8, 0, 0}), 0x10F80000);
+    zassert_equal(midi_ump_from_midi1(0, (uint8_t[]) {0xF0, 1, 2}), 0);
+    ump[0] = 0x22B30764;
+    zassert_ok(midi_ump_to_midi1(ump, pkt));
+    zassert_mem_equal(pkt, ((uint8_t[]) MIDI_CONTROL_CHANGE(3, 7, 100)), 3);
+
+    // MIDI 2.0 controllers are truncated to 7 bits, a Note On keeps a velocity
+    midi_ump_control_change(1, 3, 7, midi_ump_scale7(100) | 0x1FFFF, ump);
+    zassert_equal(ump[0], 0x41B30700);
+    zassert_ok(midi_ump_to_midi1(ump, pkt));
+    zassert_mem_equal(pkt, ((uint8_t[]) MIDI_CONTROL_CHANGE(3, 7, 100)), 3);
+    ump[0] = 0x40903C00;
+    ump[1] = 0x00010000;
+    zassert_ok(midi_ump_to_midi1(ump, pkt));
+    zassert_mem_equal(pkt, ((uint8_t[]) MIDI_NOTE_ON(0, 60, 1)), 3);
+    ump[0] = midi_ump_jr_timestamp(1000);
+    zassert_equal(midi_ump_to_midi1(ump, pkt), -ENOTSUP);
+    zassert_equal(midi_ump_words(ump[0]), 1);
+    zassert_equal(midi_ump_words(0xF0000000), 4);
+
+    // SysEx7: 6 bytes per UMP, reassembled with its 0xF0 and 0xF7
+    static uint8_t dump[100];
+    static uint8_t received[sizeof(dump)];
+    static uint32_t umps[17][2];
+    struct midi_sysex_assembler assembler;
+    dump[0] = 0xF0;
+    for (size_t i=1; i<sizeof(dump)-1; i++){
+        dump[i] = i & 0x7f;
+    }
+    dump[sizeof(dump) - 1] = 0xF7;
+
+    size_t pos = 0;
+    size_t n_umps = midi_ump_sysex_segment(4, dump, sizeof(dump), &pos, umps, 10);
+    n_umps += midi_ump_sysex_segment(4, dump, sizeof(dump), &pos, &umps[n_umps], ARRAY_SIZE(umps) - n_umps);
+    zassert_equal(pos, sizeof(dump));
+    zassert_equal(n_umps, ARRAY_SIZE(umps));
+    zassert_equal(umps[0][0] >> 16, 0x3416);
+    zassert_equal(umps[n_umps - 1][0] >> 16, 0x3432);
+
+    midi_sysex_assembler_init(&assembler, received, sizeof(received));
+    int len = 0;
+    for (size_t i=0; i<n_umps; i++){
+        len = midi_ump_sysex_assemble(&assembler, umps[i]);
+    }
+    zassert_equal(len, sizeof(dump));
+    zassert_mem_equal(received, dump, sizeof(dump));
+
+    // The same bytes, as a MIDI 1.0 stream
+    uint8_t midi1_bytes[sizeof(dump)];
+    size_t midi1_len = 0;
+    for (size_t i=0; i<n_umps; i++){
+        uint8_t bytes[8];
+        size_t n = midi_ump_sysex_bytes(umps[i], bytes);
+        zassert_true(midi1_len + n <= sizeof(midi1_bytes));
+        memcpy(&midi1_bytes[midi1_len], bytes, n);
+        midi1_len += n;
+    }
+    zassert_equal(midi1_len, sizeof(dump));
+    zassert_mem_equal(midi1_bytes, dump, sizeof(dump));
+
+    // The Control Changes of the sensors, to a MIDI 2.0 and to a MIDI 1.0 host
+    BENCH_RUN("midi", "ump_control_change", BENCH_ITERATIONS,
+        midi_ump_control_change(i & 0x0f, 0, 1, i * 0x10001, ump);
+        bench_sink += ump[0] + ump[1]
+    );
+    BENCH_RUN("midi", "ump_to_midi1", BENCH_ITERATIONS,
+        ump[1] = i << 16;
+        bench_sink += midi_ump_to_midi1(ump, pkt) + pkt[2]
+    );
+}
+
+/* Apply the transform of app.overlay to msg, compare to expected or check it is dropped */
+static void check_transform(const uint8_t msg[3], const uint8_t expected[3])
+{
+    uint8_t pkt[3] = {msg[0], msg[1], msg[2]};
+    bool kept = midi_transform_apply(MIDI_TRANSFORM_DT_GET(DT_NODELABEL(bench_transform)), pkt);
+    zassert_equal(kept, expected != NULL, "%02X %d %d", msg[0], msg[1], msg[2]);
+    if (expected){
+        zassert_mem_equal(pkt, expected, 3, "%02X %d %d", msg[0], msg[1], msg[2]);
+    }
+}
+
+ZTEST(midi, test_midi_transform)
+{
+    const struct midi_transform *transform = MIDI_TRANSFORM_DT_GET(DT_NODELABEL(bench_transform));
+
+    // Channel map, note rule and velocity curve
+    check_transform((uint8_t[]) MIDI_NOTE_ON(2, 40, 64), (uint8_t[]) MIDI_NOTE_ON(5, 64, 100));
+    check_transform((uint8_t[]) MIDI_NOTE_ON(2, 40, 32), (uint8_t[]) MIDI_NOTE_ON(5, 64, 46));
+    check_transform((uint8_t[]) MIDI_NOTE_OFF(1, 37, 32), (uint8_t[]) MIDI_NOTE_OFF(1, 61, 32));
+    // A Note On of velocity 0 stays a Note Off, the other ones are not turned into Note Offs
+    check_transform((uint8_t[]) MIDI_NOTE_ON(2, 60, 0), (uint8_t[]) MIDI_NOTE_ON(5, 60, 0));
+    check_transform((uint8_t[]) MIDI_NOTE_ON(2, 60, 2), (uint8_t[]) MIDI_NOTE_ON(5, 60, 1));
+    // Dropped channel and notes, the other notes of the channel are kept
+    check_transform((uint8_t[]) MIDI_NOTE_ON(9, 40, 64), NULL);
+    check_transform((uint8_t[]) MIDI_CONTROL_CHANGE(9, 1, 64), NULL);
+    check_transform((uint8_t[]) MIDI_NOTE_ON(3, 15, 64), NULL);
+    check_transform((uint8_t[]) MIDI_NOTE_ON(3, 21, 64), (uint8_t[]) MIDI_NOTE_ON(3, 21, 100));
+    // The first rule matching wins: one channel per note on channel 0, after the pads
+    check_transform((uint8_t[]) MIDI_NOTE_ON(0, 3, 127), (uint8_t[]) MIDI_NOTE_ON(3, 3, 127));
+    check_transform((uint8_t[]) MIDI_NOTE_ON(0, 20, 127), (uint8_t[]) MIDI_NOTE_ON(4, 20, 127));
+    check_transform((uint8_t[]) MIDI_NOTE_ON(0, 40, 127), (uint8_t[]) MIDI_NOTE_ON(0, 64, 127));
+    // Controller numbers and values
+    check_transform((uint8_t[]) MIDI_CONTROL_CHANGE(2, 7, 0), (uint8_t[]) MIDI_CONTROL_CHANGE(5, 11, 127));
+    check_transform((uint8_t[]) MIDI_CONTROL_CHANGE(0, 3, 64), (uint8_t[]) MIDI_CONTROL_CHANGE(0, 3, 63));
+    // System messages are untouched
+    check_transform((uint8_t[]) {0xF8, 0, 0}, (uint8_t[]) {0xF8, 0, 0});
+
+    // The cost does not depend on the number of rules
+    uint8_t pkt[3];
+    BENCH_RUN("midi", "transform_note_on", BENCH_ITERATIONS,
+        pkt[0] = 0x90 | (i & 0x0f); pkt[1] = i & 0x7f; pkt[2] = 100;
+        bench_sink += midi_transform_apply(transform, pkt) + pkt[1]
+    );
+    BENCH_RUN("midi", "transform_cc", BENCH_ITERATIONS,
+        pkt[0] = 0xB0 | (i & 0x0f); pkt[1] = i & 0x7f; pkt[2] = 64;
+        bench_sink += midi_transform_apply(transform, pkt) + pkt[2]
+    );
+}
+
+/* Commands of a RTP-MIDI packet: running status across a realtime command, delta times of 1 and 2 bytes */
+static const struct midi_rtp_cmd rtp_cmds[] = {
+    {1000, MIDI_NOTE_ON(0, 60, 100)},
+    {1000, MIDI_NOTE_ON(0, 62, 100)},
+    {1010, MIDI_CONTROL_CHANGE(0, 7, 100)},
+    {1300, {0xF8, 0, 0}},
+    {1300, MIDI_CONTROL_CHANGE(0, 7, 101)},
+};
+
+static const uint8_t rtp_cmds_list[] = {
+    0x80, 16,
+    0x90, 60, 100,
+    0x00, 62, 100,
+    0x0A, 0xB0, 7, 100,
+    0x82, 0x22, 0xF8,
+    0x00, 7, 101,
+};
+
+static struct midi_rtp_cmd rtp_decoded[8];
+static size_t rtp_n_decoded;
+
+static void rtp_decoded_cmd(const struct midi_rtp_cmd *cmd, void *user_data)
+{
+    rtp_decoded[rtp_n_decoded++ % ARRAY_SIZE(rtp_decoded)] = *cmd;
+}
+
+ZTEST(midi, test_midi_rtp)
+{
+    struct midi_rtp_journal_entry entries[8];
+    struct midi_rtp_journal journal;
+    struct midi_rtp_header hdr = {.seq=10, .timestamp=1000, .ssrc=0x12345678};
+    uint8_t buf[128];
+
+    midi_rtp_journal_init(&journal, entries, ARRAY_SIZE(entries), 9);
+    int len = midi_rtp_encode(buf, sizeof(buf), &hdr, rtp_cmds, ARRAY_SIZE(rtp_cmds), &journal);
+    zassert_equal(len, MIDI_RTP_HEADER_SIZE + sizeof(rtp_cmds_list));
+    zassert_mem_equal(&buf[MIDI_RTP_HEADER_SIZE], rtp_cmds_list, sizeof(rtp_cmds_list));
+
+    struct midi_rtp_header decoded_hdr;
+    rtp_n_decoded = 0;
+    zassert_equal(midi_rtp_decode(buf, len, &decoded_hdr, rtp_decoded_cmd, NULL), ARRAY_SIZE(rtp_cmds));
+    zassert_equal(decoded_hdr.seq, 10);
+    zassert_equal(decoded_hdr.ssrc, 0x12345678);
+    for (size_t i=0; i<ARRAY_SIZE(rtp_cmds); i++){
+        zassert_equal(rtp_decoded[i].timestamp, rtp_cmds[i].timestamp, "command %d", (int) i);
+        zassert_mem_equal(rtp_decoded[i].pkt, rtp_cmds[i].pkt, 3, "command %d", (int) i);
+    }
+
+    // The journal of the next packet codes the last values of the notes and controller
+    for (size_t i=0; i<ARRAY_SIZE(rtp_cmds); i++){
+        midi_rtp_journal_record(&journal, 10, rtp_cmds[i].pkt);
+    }
+    static const uint8_t journal_note_on[] = {
+        0x20, 0x00, 0x09,
+        0x00, 0x0C, 0x48,
+        0x00, 7, 101,
+        0x02, 0xF0, 60, 0x80 | 100, 62, 0x80 | 100,
+    };
+    const struct midi_rtp_cmd note_off = {2000, MIDI_NOTE_OFF(0, 60, 0)};
+    hdr = (struct midi_rtp_header) {.seq=11, .timestamp=2000, .ssrc=0x12345678};
+    len = midi_rtp_encode(buf, sizeof(buf), &hdr, &note_off, 1, &journal);
+    zassert_equal(buf[MIDI_RTP_HEADER_SIZE], 0x40 | 3);
+    zassert_equal(len, MIDI_RTP_HEADER_SIZE + 4 + sizeof(journal_note_on));
+    zassert_mem_equal(&buf[MIDI_RTP_HEADER_SIZE + 4], journal_note_on, sizeof(journal_note_on));
+    rtp_n_decoded = 0;
+    zassert_equal(midi_rtp_decode(buf, len, &decoded_hdr, rtp_decoded_cmd, NULL), 1);
+    zassert_mem_equal(rtp_decoded[0].pkt, note_off.pkt, 3);
+
+    // Acknowledged up to 10: only the Note Off of 11 is left, in the offbits
+    midi_rtp_journal_record(&journal, 11, note_off.pkt);
+    midi_rtp_journal_ack(&journal, 10);
+    static const uint8_t journal_note_off[] = {
+        0x20, 0x00, 0x0A,
+        0x00, 0x06, 0x08,
+        0x00, 0x77, 0x08,
+    };
+    hdr = (struct midi_rtp_header) {.seq=12, .timestamp=1000, .ssrc=0x12345678};
+    len = midi_rtp_encode(buf, sizeof(buf), &hdr, rtp_cmds, 1, &journal);
+    zassert_mem_equal(&buf[MIDI_RTP_HEADER_SIZE + 4], journal_note_off, sizeof(journal_note_off));
+    midi_rtp_journal_ack(&journal, 12);
+    zassert_equal(journal.n, 0);
+
+    // A full journal overwrites its oldest entry
+    for (uint8_t cc=0; cc<ARRAY_SIZE(entries) + 1; cc++){
+        midi_rtp_journal_record(&journal, 13 + cc, (uint8_t[]) MIDI_CONTROL_CHANGE(1, cc, 64));
+    }
+    zassert_equal(journal.n, ARRAY_SIZE(entries));
+    zassert_equal(journal.overflows, 1);
+
+    // A packet of a 1ms batch of the instrument, with a journal of 8 controllers
+    BENCH_RUN("midi", "rtp_encode", BENCH_ITERATIONS / 10,
+        len = midi_rtp_encode(buf, sizeof(buf), &hdr, rtp_cmds, ARRAY_SIZE(rtp_cmds), &journal);
+        bench_sink += len
+    );
+    zassert_equal(midi_rtp_decode(buf, len, &decoded_hdr, rtp_decoded_cmd, NULL), ARRAY_SIZE(rtp_cmds));
+    BENCH_RUN("midi", "rtp_decode", BENCH_ITERATIONS / 10,
+        rtp_n_decoded = 0;
+        bench_sink += midi_rtp_decode(buf, len, &decoded_hdr, rtp_decoded_cmd, NULL)
+    );
+}
+
+ZTEST_SUITE(midi, NULL, NULL, NULL, NULL, NULL);
@@ -0,0 +1,86 @@
+#include "bench.h"
+#include "usb_midi_ring.h"
+
+#include <zephyr/ztest.h>
+
+/* Same size as the buffers of the USB-MIDI function */
+RING_BUF_DECLARE(bench_ring, 64);
+
+static void usb_midi_ring_before(void *fixture)
+{
+    ring_buf_reset(&bench_ring);
+}
+
+ZTEST(usb_midi_ring, test_put_get)
+{
+    const uint8_t pkt[] = MIDI_CONTROL_CHANGE(3, 42, 127);
+    uint8_t cable, out[3];
+
+    zassert_ok(usb_midi_ring_put(&bench_ring, 5, pkt));
+    zassert_ok(usb_midi_ring_get(&bench_ring, &cable, out));
+    zassert_equal(cable, 5);
+    zassert_mem_equal(out, pkt, sizeof(pkt));
+    zassert_equal(usb_midi_ring_get(&bench_ring, &cable, out), -EAGAIN);
+
+    BENCH_RUN("usb_midi_ring", "put_get", BENCH_ITERATIONS,
+        usb_midi_ring_put(&bench_ring, 1, pkt);
+        usb_midi_ring_get(&bench_ring, &cable, out);
+        bench_sink += out[2]
+    );
+}
+
+ZTEST(usb_midi_ring, test_fill_drain)
+{
+    const uint8_t pkt[] = MIDI_NOTE_ON(0, 60, 100);
+    uint8_t cable, out[3];
+    size_t n = 0;
+
+    while (usb_midi_ring_put(&bench_ring, 0, pkt) == 0){
+        n++;
+    }
+    zassert_equal(n, 64 / 4, "%d packets fit in the ring", (int) n);
+    while (usb_midi_ring_get(&bench_ring, &cable, out) == 0){
+        n--;
+    }
+    zassert_equal(n, 0);
+
+    // One iteration fills the ring up to the first refused packet, then drains it
+    BENCH_RUN("usb_midi_ring", "fill_drain", BENCH_ITERATIONS / 16,
+        while (usb_midi_ring_put(&bench_ring, 0, pkt) == 0){}
+        while (usb_midi_ring_get(&bench_ring, &cable, out) == 0){
+            bench_sink += out[1];
+        }
+    );
+}
+
+ZTEST(usb_midi_ring, test_put_get_ump)
+{
+    const uint32_t words[] = {midi_ump_jr_timestamp(1000), 0x41B30100, 0x12345678};
+    uint32_t ump[MIDI_UMP_MAX_WORDS];
+    uint8_t buf[64];
+
+    // Stored in little endian, the JR timestamp and its message as two UMPs
+    zassert_ok(usb_midi_ring_put_ump(&bench_ring, words, ARRAY_SIZE(words)));
+    zassert_equal(ring_buf_size_get(&bench_ring), sizeof(words));
+    zassert_equal(usb_midi_ring_get_ump(&bench_ring, ump), 1);
+    zassert_equal(ump[0], words[0]);
+    zassert_equal(usb_midi_ring_get_ump(&bench_ring, ump), 2);
+    zassert_mem_equal(ump, &words[1], 8);
+    zassert_equal(usb_midi_ring_get_ump(&bench_ring, ump), -EAGAIN);
+
+    // All or nothing when full, and no UMP split in a transfer
+    size_t n = 0;
+    while (usb_midi_ring_put_ump(&bench_ring, words, ARRAY_SIZE(words)) == 0){
+        n++;
+    }
+    zassert_equal(n, 64 / sizeof(words));
+    zassert_equal(usb_midi_ring_get_umps(&bench_ring, buf, 10), 4);
+    zassert_equal(usb_midi_ring_get_umps(&bench_ring, buf, sizeof(buf)), 4 * (n * ARRAY_SIZE(words) - 1));
+
+    BENCH_RUN("usb_midi_ring", "put_get_ump", BENCH_ITERATIONS,
+        usb_midi_ring_put_ump(&bench_ring, &words[1], 2);
+        bench_sink += usb_midi_ring_get_ump(&bench_ring, ump) + ump[1]
+    );
+}
+
+ZTEST_SUITE(usb_midi_ring, NULL, NULL, usb_midi_ring_before, NULL, NULL);
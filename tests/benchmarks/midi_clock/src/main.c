@@ -0,0 +1,149 @@
+/**
+ * Tracking of an incoming MIDI clock by the midi_clock PLL on native_sim:
+ * the clock ticks are fed with jittered, bursty or tempo-stepped timestamps,
+ * and the lock time, the tempo error and the beat phase error are reported
+ * on "CLOCK" lines collected by twister.
+ */
+
+#include "midi_clock.h"
+#include "usb_midi.h"
+
+#include <stdlib.h>
+#include <zephyr/ztest.h>
+
+/* Tempo in thousandths of BPM, as returned by midi_clock_get_tempo */
+#define BPM(bpm) ((uint32_t) ((bpm) * 1000))
+
+/* Locked within 2 beats (6 after a tempo step), then within 0.5% of the
+ * tempo and a quarter tick */
+#define MAX_LOCK_TICKS (2 * MIDI_CLOCK_PPQN)
+#define MAX_RELOCK_TICKS (6 * MIDI_CLOCK_PPQN)
+#define MAX_TEMPO_ERR_PERMILLE 5
+#define MAX_PHASE_ERR (0x10000 / MIDI_CLOCK_PPQN / 4)
+
+/* Ideal time of the next tick, and number of ticks since the Start */
+static uint32_t next_tick;
+static uint32_t n_ticks;
+static uint32_t rand_state;
+
+static uint32_t tick_period(uint32_t tempo)
+{
+    return ((uint64_t) sys_clock_hw_cycles_per_sec() * 60000) / ((uint64_t) tempo * MIDI_CLOCK_PPQN);
+}
+
+static uint32_t max_tempo_err(uint32_t tempo)
+{
+    return tempo * MAX_TEMPO_ERR_PERMILLE / 1000;
+}
+
+/* Reproducible jitter, in -max..max */
+static int32_t jitter(int32_t max)
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return (int32_t) ((rand_state >> 16) % (2 * max + 1)) - max;
+}
+
+static void wait_until(uint32_t cycles)
+{
+    int32_t remaining = cycles - k_cycle_get_32();
+    if (remaining > 0){
+        k_sleep(K_CYC(remaining));
+    }
+}
+
+/*
+ * Send ticks at a tempo, each one timestamped with up to max_jitter cycles of
+ * jitter, or by bursts of ticks all timestamped at the reception of the last
+ * one, like several ticks in a single USB transfer. Returns the number of
+ * ticks before the PLL settled: locked, and within the tempo error bound
+ * until the last tick. -1 if it did not settle.
+ */
+static int send_ticks(uint32_t tempo, size_t n, int32_t max_jitter, size_t burst)
+{
+    uint32_t period = tick_period(tempo);
+    int settled = 0;
+
+    for (size_t i=0; i<n; i++){
+        uint32_t timestamp;
+        if (burst > 1){
+            timestamp = next_tick + (i - i % burst + burst - 1) * period;
+        } else {
+            timestamp = next_tick + i * period + jitter(max_jitter);
+        }
+        wait_until(timestamp);
+        midi_clock_input(MIDI_RT_CLOCK, timestamp);
+        // The ticks of a burst are all received at once
+        if ((i + 1) % burst){
+            continue;
+        }
+
+        uint32_t estimated = midi_clock_get_tempo();
+        if (! midi_clock_is_locked() || abs((int32_t) (estimated - tempo)) > max_tempo_err(tempo)){
+            settled = -1;
+        } else if (settled < 0){
+            settled = i;
+        }
+    }
+
+    next_tick += n * period;
+    n_ticks += n;
+    return settled;
+}
+
+/* Error of the beat phase half a tick after the last one sent */
+static int32_t phase_error(uint32_t tempo)
+{
+    uint32_t period = tick_period(tempo);
+    wait_until(next_tick - period / 2);
+
+    uint32_t expected = (2 * ((n_ticks - 1) % MIDI_CLOCK_PPQN) + 1) * 0x10000 / (2 * MIDI_CLOCK_PPQN);
+    return (int32_t) midi_clock_beat_phase() - (int32_t) expected;
+}
+
+static void report(const char *name, int settled, int max_settled, uint32_t tempo)
+{
+    uint32_t estimated = midi_clock_get_tempo();
+    int32_t tempo_err = estimated - tempo;
+    int32_t phase_err = phase_error(tempo);
+
+    printk("CLOCK %s lock_ticks=%d tempo=%u tempo_err=%d phase_err=%d\n",
+           name, settled, estimated, tempo_err, phase_err);
+
+    zassert_true(settled >= 0 && settled <= max_settled, "Settled after %d ticks", settled);
+    zassert_true(abs(tempo_err) <= max_tempo_err(tempo), "Tempo error of %d", tempo_err);
+    zassert_true(abs(phase_err) <= MAX_PHASE_ERR, "Phase error of %d", phase_err);
+}
+
+ZTEST(midi_clock, test_jitter)
+{
+    int settled = send_ticks(BPM(120), 16 * MIDI_CLOCK_PPQN, k_us_to_cyc_near32(1000), 1);
+    report("jitter_1ms", settled, MAX_LOCK_TICKS, BPM(120));
+}
+
+ZTEST(midi_clock, test_bursts)
+{
+    int settled = send_ticks(BPM(174), 16 * MIDI_CLOCK_PPQN, 0, 3);
+    report("bursts_3", settled, MAX_LOCK_TICKS, BPM(174));
+}
+
+ZTEST(midi_clock, test_tempo_step)
+{
+    zassert_true(send_ticks(BPM(100), 8 * MIDI_CLOCK_PPQN, k_us_to_cyc_near32(500), 1) >= 0);
+    int settled = send_ticks(BPM(130), 8 * MIDI_CLOCK_PPQN, k_us_to_cyc_near32(500), 1);
+    report("tempo_step", settled, MAX_RELOCK_TICKS, BPM(130));
+}
+
+static void midi_clock_before(void *fixture)
+{
+    // Lose the clock of the previous test: the PLL starts over on the next tick
+    k_sleep(K_MSEC(500));
+    zassert_false(midi_clock_is_locked());
+    zassert_equal(midi_clock_get_tempo(), 0);
+
+    rand_state = 1;
+    n_ticks = 0;
+    next_tick = k_cycle_get_32() + k_us_to_cyc_near32(1000);
+    midi_clock_input(MIDI_RT_START, k_cycle_get_32());
+}
+
+ZTEST_SUITE(midi_clock, NULL, NULL, midi_clock_before, NULL, NULL);
@@ -0,0 +1,210 @@
+/**
+ * Timing of the MIDI sequencer on native_sim: the lateness of the clock
+ * ticks (jitter) and the drift of the clock over several bars, reported on
+ * "JITTER" lines collected by twister.
+ */
+
+#include "midi_sequencer.h"
+#include "usb_midi.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/ztest.h>
+
+#define TEST_TICKS (MIDI_SEQ_PPQN * 4 * 8)
+#define MAX_JITTER_US 100
+
+static uint32_t clock_cycles[TEST_TICKS];
+static size_t n_clocks;
+static size_t wait_clocks;
+
+static struct {
+    uint16_t tick;
+    uint8_t pkt[3];
+} events[16];
+static size_t n_events;
+
+static bool started;
+static bool stopped;
+
+static K_SEM_DEFINE(clocks_received, 0, 1);
+
+static void test_output(const uint8_t pkt[3])
+{
+    switch (pkt[0]){
+    case MIDI_RT_START:
+        started = true;
+        break;
+    case MIDI_RT_STOP:
+        stopped = true;
+        break;
+    case MIDI_RT_CLOCK:
+        if (n_clocks < TEST_TICKS){
+            clock_cycles[n_clocks++] = k_cycle_get_32();
+        }
+        if (n_clocks == wait_clocks){
+            k_sem_give(&clocks_received);
+        }
+        break;
+    default:
+        if (n_events < ARRAY_SIZE(events)){
+            events[n_events].tick = n_clocks - 1;
+            memcpy(events[n_events].pkt, pkt, 3);
+            n_events++;
+        }
+        break;
+    }
+}
+
+static void wait_for_clocks(size_t n)
+{
+    wait_clocks = n;
+    zassert_ok(k_sem_take(&clocks_received, K_SECONDS(60)), "Only %d clocks", (int) n_clocks);
+}
+
+static int64_t clock_interval_ns(size_t from, size_t to)
+{
+    return k_cyc_to_ns_floor64(clock_cycles[to] - clock_cycles[from]);
+}
+
+static uint64_t tick_period_ns(uint32_t tempo)
+{
+    return (60ULL * NSEC_PER_SEC * 1000) / ((uint64_t) tempo * MIDI_SEQ_PPQN);
+}
+
+/* Report the jitter since the last reset, and the drift of the clocks from..to */
+static void report(const char *name, size_t from, size_t to, uint32_t tempo)
+{
+    struct midi_seq_stats stats;
+    midi_seq_get_stats(&stats);
+
+    int64_t drift_ns = clock_interval_ns(from, to) - (int64_t) ((to - from) * tick_period_ns(tempo));
+    printk("JITTER %s ticks=%u late_min_us=%u late_avg_us=%u late_max_us=%u drift_us=%d\n",
+           name, stats.ticks, stats.late_min_us, stats.late_avg_us, stats.late_max_us,
+           (int) (drift_ns / 1000));
+
+    zassert_true(stats.late_max_us < MAX_JITTER_US, "Jitter of %uus", stats.late_max_us);
+    zassert_true(llabs(drift_ns) < MAX_JITTER_US * 1000, "Drift of %dus", (int) (drift_ns / 1000));
+}
+
+ZTEST(midi_sequencer, test_clock)
+{
+    zassert_ok(midi_seq_set_tempo(MIDI_SEQ_BPM(120)));
+    midi_seq_start();
+    wait_for_clocks(TEST_TICKS);
+    midi_seq_stop();
+
+    zassert_true(started);
+    report("clock_120bpm", 0, TEST_TICKS - 1, MIDI_SEQ_BPM(120));
+}
+
+ZTEST(midi_sequencer, test_tempo_change)
+{
+    const size_t half = TEST_TICKS / 2;
+
+    zassert_ok(midi_seq_set_tempo(MIDI_SEQ_BPM(100)));
+    midi_seq_start();
+    wait_for_clocks(half);
+    // Effective after the next tick
+    zassert_ok(midi_seq_set_tempo(MIDI_SEQ_BPM(137.5)));
+    wait_for_clocks(TEST_TICKS);
+    midi_seq_stop();
+
+    report("tempo_change", half + 1, TEST_TICKS - 1, MIDI_SEQ_BPM(137.5));
+    zassert_equal(midi_seq_set_tempo(MIDI_SEQ_BPM(1000)), -EINVAL);
+}
+
+ZTEST(midi_sequencer, test_pattern)
+{
+    static const struct midi_seq_event pattern_events[] = {
+        {.tick=0, .pkt=MIDI_NOTE_ON(9, 36, 127)},
+        {.tick=12, .pkt=MIDI_NOTE_OFF(9, 36, 0)},
+        {.tick=12, .pkt=MIDI_NOTE_ON(9, 38, 127)},
+        {.tick=18, .pkt=MIDI_NOTE_OFF(9, 38, 0)},
+    };
+    static const struct midi_seq_pattern pattern = {
+        .events = pattern_events,
+        .n_events = ARRAY_SIZE(pattern_events),
+        .length = MIDI_SEQ_PPQN,
+    };
+    static const struct midi_seq_event invalid_events[] = {
+        {.tick=MIDI_SEQ_PPQN, .pkt=MIDI_NOTE_ON(9, 36, 127)},
+    };
+    static const struct midi_seq_pattern invalid = {
+        .events = invalid_events,
+        .n_events = ARRAY_SIZE(invalid_events),
+        .length = MIDI_SEQ_PPQN,
+    };
+    static const struct midi_seq_event unsorted_events[] = {
+        {.tick=12, .pkt=MIDI_NOTE_ON(9, 36, 127)},
+        {.tick=0, .pkt=MIDI_NOTE_OFF(9, 36, 0)},
+    };
+    static const struct midi_seq_pattern unsorted = {
+        .events = unsorted_events,
+        .n_events = ARRAY_SIZE(unsorted_events),
+        .length = MIDI_SEQ_PPQN,
+    };
+
+    zassert_equal(midi_seq_set_pattern(&invalid), -EINVAL);
+    zassert_equal(midi_seq_set_pattern(&unsorted), -EINVAL);
+    zassert_ok(midi_seq_set_pattern(&pattern));
+    zassert_ok(midi_seq_set_tempo(MIDI_SEQ_BPM(180)));
+    midi_seq_start();
+    wait_for_clocks(2 * MIDI_SEQ_PPQN);
+    midi_seq_stop();
+    zassert_ok(midi_seq_set_pattern(NULL));
+
+    zassert_equal(n_events, 2 * ARRAY_SIZE(pattern_events));
+    for (size_t i=0; i<n_events; i++){
+        const struct midi_seq_event *expected = &pattern_events[i % ARRAY_SIZE(pattern_events)];
+        zassert_equal(events[i].tick, expected->tick + MIDI_SEQ_PPQN * (i / ARRAY_SIZE(pattern_events)));
+        zassert_mem_equal(events[i].pkt, expected->pkt, 3);
+    }
+    report("pattern_180bpm", 0, 2 * MIDI_SEQ_PPQN - 1, MIDI_SEQ_BPM(180));
+}
+
+ZTEST(midi_sequencer, test_restart)
+{
+    zassert_ok(midi_seq_set_tempo(MIDI_SEQ_BPM(120)));
+    midi_seq_start();
+    wait_for_clocks(MIDI_SEQ_PPQN);
+    started = false;
+
+    // Both before the sequencer thread wakes up
+    k_sched_lock();
+    midi_seq_stop();
+    midi_seq_start();
+    k_sched_unlock();
+
+    wait_for_clocks(2 * MIDI_SEQ_PPQN);
+    zassert_true(stopped);
+    zassert_true(started);
+
+    // The restart left nothing behind: the next stop stops
+    midi_seq_stop();
+    k_sleep(K_MSEC(1));
+    size_t n = n_clocks;
+    k_sleep(K_MSEC(100));
+    zassert_false(midi_seq_is_running());
+    zassert_equal(n_clocks, n, "%d clocks after the stop", (int) (n_clocks - n));
+}
+
+static void midi_sequencer_before(void *fixture)
+{
+    n_clocks = 0;
+    n_events = 0;
+    started = false;
+    stopped = false;
+    k_sem_reset(&clocks_received);
+    midi_seq_set_output(test_output);
+    midi_seq_reset_stats();
+}
+
+static void midi_sequencer_after(void *fixture)
+{
+    // Let the sequencer thread send Stop
+    k_sleep(K_MSEC(1));
+    zassert_true(stopped);
+}
+
+ZTEST_SUITE(midi_sequencer, NULL, NULL, midi_sequencer_before, midi_sequencer_after, NULL);
@@ -0,0 +1,229 @@
+#include "midi_clock.h"
+#include "usb_midi.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+
+/* Gains of the PLL, as right shifts of the tick error: 1/8 on the phase, 1/64 on the period */
+#define PLL_PHASE_SHIFT 3
+#define PLL_PERIOD_SHIFT 6
+
+/* Locked after a beat of ticks, with an average error below period/4 */
+#define PLL_LOCK_TICKS MIDI_CLOCK_PPQN
+#define PLL_LOCK_ERROR_DIV 4
+
+/* Averaging of the absolute tick error, as a right shift */
+#define PLL_ERROR_AVG_SHIFT 4
+
+/* The clock is lost after this many periods without tick */
+#define PLL_TIMEOUT_PERIODS 3
+
+/* Ticks received less than period/4 after the previous one are part of a
+ * burst, up to this many ticks */
+#define PLL_BURST_DIV 4
+#define PLL_MAX_BURST 8
+
+/* Extremes of the period, at 300 and 20 BPM */
+#define MIN_PERIOD_CYCLES (sys_clock_hw_cycles_per_sec() / (300 * MIDI_CLOCK_PPQN / 60))
+#define MAX_PERIOD_CYCLES (sys_clock_hw_cycles_per_sec() / (20 * MIDI_CLOCK_PPQN / 60))
+
+static struct k_spinlock lock;
+
+/* State of the loop filter, updated on each tick */
+struct pll_filter {
+    // Filtered time of the last tick
+    uint32_t anchor;
+    // Filtered tick period in cycles, with 8 fractional bits
+    int64_t period_q8;
+    // 2^48 / period, to extrapolate the phase with a multiplication
+    uint64_t inv_period;
+    // Ticks since the period is known, up to PLL_LOCK_TICKS
+    uint8_t lock_count;
+    // Average absolute error of the ticks, in cycles
+    int32_t avg_error;
+};
+
+static struct {
+    bool has_tick;
+    bool has_period;
+    bool playing;
+    // The next tick is the first one of the song
+    bool started;
+    // Raw timestamp of the last tick
+    uint32_t last_input;
+    struct pll_filter filter;
+    // The filter before the first tick of the current burst, and its ticks
+    struct pll_filter burst_start;
+    uint8_t burst_ticks;
+    // Position of the last tick in its beat, 0..MIDI_CLOCK_PPQN-1
+    uint8_t tick;
+} pll = {.playing = true};
+
+static inline uint32_t pll_period(void)
+{
+    return pll.filter.period_q8 >> 8;
+}
+
+static void pll_set_period(int64_t period_q8)
+{
+    pll.filter.period_q8 = CLAMP(period_q8, (int64_t) MIN_PERIOD_CYCLES << 8, (int64_t) MAX_PERIOD_CYCLES << 8);
+    pll.filter.inv_period = BIT64(48) / pll_period();
+}
+
+/* Update the loop filter with the time of a tick */
+static void pll_step(uint32_t timestamp)
+{
+    int32_t period = pll_period();
+    int32_t err = timestamp - (pll.filter.anchor + period);
+
+    // Bounded, so that a lost or an extra tick does not throw the loop off
+    err = CLAMP(err, -period / 2, period / 2);
+    pll.filter.anchor += period + (err >> PLL_PHASE_SHIFT);
+    pll_set_period(pll.filter.period_q8 + (((int64_t) err << 8) >> PLL_PERIOD_SHIFT));
+
+    pll.filter.avg_error += (ABS(err) - pll.filter.avg_error) >> PLL_ERROR_AVG_SHIFT;
+    pll.filter.lock_count = MIN(pll.filter.lock_count + 1, PLL_LOCK_TICKS);
+}
+
+static void pll_clock(uint32_t timestamp)
+{
+    uint32_t previous = pll.last_input;
+    int32_t raw_period = timestamp - previous;
+    pll.last_input = timestamp;
+
+    if (! pll.has_tick){
+        pll.has_tick = true;
+        pll.filter.anchor = timestamp;
+        pll.burst_ticks = 1;
+    } else if (! pll.has_period && raw_period < (int32_t) MIN_PERIOD_CYCLES){
+        // Another tick of the same transfer
+        pll.burst_ticks = MIN(pll.burst_ticks + 1, PLL_MAX_BURST);
+    } else if (! pll.has_period){
+        // The ticks of the previous transfer give the period, the loop
+        // starts from the last one of them
+        pll_set_period(((int64_t) raw_period << 8) / pll.burst_ticks);
+        pll.has_period = true;
+        pll.filter.anchor = previous;
+        pll.filter.lock_count = 0;
+        pll.filter.avg_error = 0;
+        pll.burst_start = pll.filter;
+        pll.burst_ticks = 1;
+        pll_step(timestamp);
+    } else if (raw_period < (int32_t) pll_period() / PLL_BURST_DIV && pll.burst_ticks < PLL_MAX_BURST){
+        /*
+         * Several ticks in a single transfer get the same timestamp: the
+         * first ones were late. The filter is rewound to the start of the
+         * burst, and its ticks are replayed one period apart, up to this one.
+         */
+        pll.filter = pll.burst_start;
+        pll.burst_ticks++;
+        uint32_t period = pll_period();
+        for (uint32_t i=pll.burst_ticks; i>0; i--){
+            pll_step(timestamp - (i - 1) * period);
+        }
+    } else if ((int32_t) (timestamp - pll.filter.anchor) > 3 * (int32_t) pll_period()){
+        // Clock interrupted: start over from this tick
+        pll.has_period = false;
+        pll.filter.anchor = timestamp;
+        pll.burst_ticks = 1;
+    } else {
+        pll.burst_start = pll.filter;
+        pll.burst_ticks = 1;
+        pll_step(timestamp);
+    }
+
+    if (pll.started){
+        pll.tick = 0;
+        pll.started = false;
+    } else if (pll.playing){
+        pll.tick = (pll.tick + 1) % MIDI_CLOCK_PPQN;
+    }
+}
+
+void midi_clock_input(uint8_t status, uint32_t timestamp)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    switch (status){
+    case MIDI_RT_CLOCK:
+        pll_clock(timestamp);
+        break;
+    case MIDI_RT_START:
+        pll.playing = true;
+        pll.started = true;
+        break;
+    case MIDI_RT_CONTINUE:
+        pll.playing = true;
+        break;
+    case MIDI_RT_STOP:
+        pll.playing = false;
+        break;
+    default:
+        break;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+static bool pll_is_locked(uint32_t now)
+{
+    return pll.has_period && pll.filter.lock_count >= PLL_LOCK_TICKS
+        && pll.filter.avg_error < pll_period() / PLL_LOCK_ERROR_DIV
+        && (now - pll.last_input) < PLL_TIMEOUT_PERIODS * pll_period();
+}
+
+bool midi_clock_is_locked(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    bool locked = pll_is_locked(k_cycle_get_32());
+    k_spin_unlock(&lock, key);
+    return locked;
+}
+
+uint32_t midi_clock_get_tempo(void)
+{
+    uint32_t tempo = 0;
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (pll_is_locked(k_cycle_get_32())){
+        // Thousandths of BPM: 60s * 1000 / (ticks per beat * period)
+        tempo = ((uint64_t) sys_clock_hw_cycles_per_sec() * 60000 << 8) / (MIDI_CLOCK_PPQN * pll.filter.period_q8);
+    }
+    k_spin_unlock(&lock, key);
+    return tempo;
+}
+
+uint16_t midi_clock_beat_phase(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    uint32_t now = k_cycle_get_32();
+    uint32_t phase = (uint32_t) pll.tick << 16;
+
+    if (pll.playing && pll_is_locked(now)){
+        // Extrapolated up to the next tick, which is expected to correct it
+        int32_t elapsed = now - pll.filter.anchor;
+        if (elapsed >= (int32_t) pll_period()){
+            phase += 0xffff;
+        } else if (elapsed > 0){
+            phase += ((uint64_t) elapsed * pll.filter.inv_period) >> 32;
+        }
+    }
+    k_spin_unlock(&lock, key);
+
+    return phase / MIDI_CLOCK_PPQN;
+}
+
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+
+static int cmd_midi_clock(const struct shell *sh, size_t argc, char **argv)
+{
+    uint32_t tempo = midi_clock_get_tempo();
+    if (! tempo){
+        shell_print(sh, "Not locked");
+        return 0;
+    }
+    shell_print(sh, "%u.%03u BPM, beat phase %u/65536", tempo / 1000, tempo % 1000, midi_clock_beat_phase());
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((midi), clock, NULL, "Show the tempo of the incoming MIDI clock", cmd_midi_clock, 1, 0);
+
+#endif
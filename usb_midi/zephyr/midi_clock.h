@@ -0,0 +1,43 @@
+/**
+ * MIDI clock follower: the tempo and the beat phase of an incoming MIDI clock.
+ *
+ * The clock ticks are timestamped by their source, as close as possible to
+ * their reception (on completion of a USB transfer, in a UART ISR...), then
+ * filtered by a second order PLL. The transport jitter, like several ticks
+ * received in the same USB transfer, is smoothed out. Consumers only query
+ * the estimated phase, with no processing per tick.
+ */
+
+#ifndef MIDI_CLOCK_H_
+#define MIDI_CLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Clock ticks per quarter note */
+#define MIDI_CLOCK_PPQN 24
+
+/**
+ * @brief      Feed a System Realtime message to the follower, callable from
+ *             any context. Clock, Start, Continue and Stop are used, the
+ *             others are ignored.
+ * @param[in]  status     The realtime status byte
+ * @param[in]  timestamp  The reception time of the message (k_cycle_get_32)
+ */
+void midi_clock_input(uint8_t status, uint32_t timestamp);
+
+/* Whether the PLL follows a steady clock */
+bool midi_clock_is_locked(void);
+
+/* The estimated tempo in thousandths of BPM, 0 when not locked */
+uint32_t midi_clock_get_tempo(void);
+
+/**
+ * @brief      Get the position in the current beat (quarter note), from 0
+ *             at its start to 0xffff at its end. The phase is extrapolated
+ *             from the last tick, it holds when stopped or when the clock
+ *             is lost.
+ */
+uint16_t midi_clock_beat_phase(void);
+
+#endif
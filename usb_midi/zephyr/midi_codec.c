@@ -0,0 +1,250 @@
+#include "midi_codec.h"
+
+#include <errno.h>
+#include <string.h>
+
+/* Status bytes of SysEx (midi10, 4) */
+#define SYSEX_START 0xF0
+#define SYSEX_END   0xF7
+
+/* Code Index Numbers (midi10, table 4-1) */
+#define CIN_SYS_COMMON2 0x2
+#define CIN_SYS_COMMON3 0x3
+#define CIN_SYSEX_START 0x4
+#define CIN_SYS_COMMON1 0x5
+#define CIN_SYSEX_END2  0x6
+#define CIN_SYSEX_END3  0x7
+#define CIN_SINGLE_BYTE 0xF
+
+const uint8_t midi_status_length_table[256] = {
+    [0x80 ... 0xBF] = 3,
+    [0xC0 ... 0xDF] = 2,
+    [0xE0 ... 0xEF] = 3,
+    [0xF1] = 2,
+    [0xF2] = 3,
+    [0xF3] = 2,
+    [0xF6] = 1,
+    [0xF7] = 1,
+    [0xF8 ... 0xFF] = 1,
+};
+
+const uint8_t midi_status_cin_table[256] = {
+    [0x80 ... 0x8F] = 0x8,
+    [0x90 ... 0x9F] = 0x9,
+    [0xA0 ... 0xAF] = 0xA,
+    [0xB0 ... 0xBF] = 0xB,
+    [0xC0 ... 0xCF] = 0xC,
+    [0xD0 ... 0xDF] = 0xD,
+    [0xE0 ... 0xEF] = 0xE,
+    [SYSEX_START] = CIN_SYSEX_START,
+    [0xF1] = CIN_SYS_COMMON2,
+    [0xF2] = CIN_SYS_COMMON3,
+    [0xF3] = CIN_SYS_COMMON2,
+    [0xF6] = CIN_SYS_COMMON1,
+    [SYSEX_END] = CIN_SYS_COMMON1,
+    [0xF8 ... 0xFF] = CIN_SINGLE_BYTE,
+};
+
+const uint8_t midi_cin_length_table[16] = {
+    0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1,
+};
+
+/* The CIN of the last packet of a SysEx, by its number of bytes */
+static const uint8_t sysex_end_cin[4] = {0, CIN_SYS_COMMON1, CIN_SYSEX_END2, CIN_SYSEX_END3};
+
+void midi_parser_init(struct midi_parser *parser, uint8_t cable_number)
+{
+    *parser = (struct midi_parser) {.cable_number = cable_number};
+}
+
+static void midi_parser_emit(struct midi_parser *parser, uint8_t cin, uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE])
+{
+    usb_pkt[0] = (parser->cable_number << 4) | cin;
+    memset(&usb_pkt[1], 0, 3);
+    memcpy(&usb_pkt[1], parser->buf, parser->n);
+}
+
+bool midi_parser_feed(struct midi_parser *parser, uint8_t byte, uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE])
+{
+    if (byte >= 0xF8){
+        // System Realtime: interleaved, the message in progress is kept
+        usb_pkt[0] = (parser->cable_number << 4) | CIN_SINGLE_BYTE;
+        usb_pkt[1] = byte;
+        usb_pkt[2] = 0;
+        usb_pkt[3] = 0;
+        return true;
+    }
+
+    if (byte & 0x80){
+        if (parser->sysex && byte == SYSEX_END){
+            parser->buf[parser->n++] = byte;
+            midi_parser_emit(parser, sysex_end_cin[parser->n], usb_pkt);
+            parser->sysex = false;
+            parser->n = 0;
+            return true;
+        }
+
+        // Any other status ends a SysEx or a message in progress
+        parser->sysex = byte == SYSEX_START;
+        parser->buf[0] = byte;
+        parser->n = 1;
+        parser->expected = midi_status_length(byte);
+
+        if (parser->expected == 1){
+            // Tune Request, or a lone SysEx end
+            midi_parser_emit(parser, midi_status_cin(byte), usb_pkt);
+            parser->n = 0;
+            parser->expected = 0;
+            return true;
+        }
+        return false;
+    }
+
+    if (parser->sysex){
+        parser->buf[parser->n++] = byte;
+        if (parser->n == 3){
+            midi_parser_emit(parser, CIN_SYSEX_START, usb_pkt);
+            parser->n = 0;
+            return true;
+        }
+        return false;
+    }
+
+    if (! parser->expected){
+        return false;
+    }
+
+    if (parser->n == 0){
+        // Running status: only channel messages keep their status
+        parser->n = 1;
+    }
+    parser->buf[parser->n++] = byte;
+    if (parser->n < parser->expected){
+        return false;
+    }
+
+    midi_parser_emit(parser, midi_status_cin(parser->buf[0]), usb_pkt);
+    parser->n = 0;
+    if (parser->buf[0] >= 0xF0){
+        parser->expected = 0;
+    }
+    return true;
+}
+
+size_t midi_decode(struct midi_parser *parser, const uint8_t *bytes, size_t *n_bytes,
+                   uint8_t usb_pkts[][MIDI_CODEC_PKT_SIZE], size_t max_pkts)
+{
+    size_t n_pkts = 0;
+    size_t i = 0;
+
+    while (i < *n_bytes && n_pkts < max_pkts){
+        if (midi_parser_feed(parser, bytes[i++], usb_pkts[n_pkts])){
+            n_pkts++;
+        }
+    }
+    *n_bytes = i;
+    return n_pkts;
+}
+
+void midi_encoder_init(struct midi_encoder *encoder, bool running_status)
+{
+    *encoder = (struct midi_encoder) {.running_status = running_status};
+}
+
+size_t midi_encoder_put(struct midi_encoder *encoder, const uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE], uint8_t bytes[3])
+{
+    size_t len = midi_cin_length(usb_pkt[0]);
+    uint8_t status = usb_pkt[1];
+
+    if (len == 0){
+        return 0;
+    }
+
+    if (status >= 0x80 && status < 0xF0){
+        if (encoder->running_status && status == encoder->last_status){
+            memcpy(bytes, &usb_pkt[2], len - 1);
+            return len - 1;
+        }
+        encoder->last_status = status;
+    } else if (status >= 0xF0 && status < 0xF8){
+        // System Common and SysEx cancel the running status, not Realtime
+        encoder->last_status = 0;
+    }
+
+    memcpy(bytes, &usb_pkt[1], len);
+    return len;
+}
+
+size_t midi_encode(struct midi_encoder *encoder, const uint8_t usb_pkts[][MIDI_CODEC_PKT_SIZE], size_t *n_pkts,
+                   uint8_t *bytes, size_t max_bytes)
+{
+    size_t n_bytes = 0;
+    size_t i = 0;
+
+    while (i < *n_pkts && max_bytes - n_bytes >= 3){
+        n_bytes += midi_encoder_put(encoder, usb_pkts[i++], &bytes[n_bytes]);
+    }
+    *n_pkts = i;
+    return n_bytes;
+}
+
+size_t midi_sysex_segment(uint8_t cable_number, const uint8_t *sysex, size_t len, size_t *pos,
+                          uint8_t usb_pkts[][MIDI_CODEC_PKT_SIZE], size_t max_pkts)
+{
+    const uint8_t header = (cable_number << 4) | CIN_SYSEX_START;
+    size_t i = *pos;
+    size_t n_pkts = 0;
+
+    // The packets before the last one are full
+    while (n_pkts < max_pkts && len - i > 3){
+        usb_pkts[n_pkts][0] = header;
+        memcpy(&usb_pkts[n_pkts][1], &sysex[i], 3);
+        n_pkts++;
+        i += 3;
+    }
+
+    if (n_pkts < max_pkts && i < len){
+        size_t n = len - i;
+        usb_pkts[n_pkts][0] = (cable_number << 4) | sysex_end_cin[n];
+        memset(&usb_pkts[n_pkts][1], 0, 3);
+        memcpy(&usb_pkts[n_pkts][1], &sysex[i], n);
+        n_pkts++;
+        i = len;
+    }
+
+    *pos = i;
+    return n_pkts;
+}
+
+void midi_sysex_assembler_init(struct midi_sysex_assembler *assembler, uint8_t *buf, size_t size)
+{
+    *assembler = (struct midi_sysex_assembler) {.buf = buf, .size = size};
+}
+
+int midi_sysex_assemble(struct midi_sysex_assembler *assembler, const uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE])
+{
+    uint8_t cin = usb_pkt[0] & 0x0f;
+    size_t n = midi_cin_length(cin);
+
+    if (usb_pkt[1] == SYSEX_START){
+        assembler->receiving = true;
+        assembler->overflow = false;
+        assembler->len = 0;
+    }
+    if (! assembler->receiving){
+        return 0;
+    }
+
+    if (assembler->len + n > assembler->size){
+        assembler->overflow = true;
+    } else {
+        memcpy(&assembler->buf[assembler->len], &usb_pkt[1], n);
+        assembler->len += n;
+    }
+
+    if (cin == CIN_SYSEX_START){
+        return 0;
+    }
+    assembler->receiving = false;
+    return assembler->overflow ? -ENOMEM : (int) assembler->len;
+}
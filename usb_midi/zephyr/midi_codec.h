@@ -0,0 +1,194 @@
+/**
+ * MIDI codec shared by the USB-MIDI function and the applications: framing of
+ * MIDI byte streams (DIN, UART) to USB-MIDI event packets and back.
+ *
+ * An event packet is 4 bytes, as on the USB bus (midi10, 4): its header
+ * (cable number << 4 | Code Index Number) followed by the MIDI bytes of the
+ * event, padded with zeros. The lengths and CINs are looked up in tables
+ * indexed by the status byte or by the CIN, with no branching.
+ */
+
+#ifndef MIDI_CODEC_H_
+#define MIDI_CODEC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MIDI_CODEC_PKT_SIZE 4
+
+/* Length of the message starting with each status byte, 0 for the data
+ * bytes, the undefined status and SysEx start (of variable length) */
+extern const uint8_t midi_status_length_table[256];
+
+/* CIN of the event packet starting with each status byte, 0 (reserved) for
+ * the data bytes and the undefined status */
+extern const uint8_t midi_status_cin_table[256];
+
+/* Number of MIDI bytes in an event packet of each CIN, 0 for the reserved ones */
+extern const uint8_t midi_cin_length_table[16];
+
+static inline size_t midi_status_length(uint8_t status)
+{
+    return midi_status_length_table[status];
+}
+
+static inline uint8_t midi_status_cin(uint8_t status)
+{
+    return midi_status_cin_table[status];
+}
+
+static inline size_t midi_cin_length(uint8_t cin)
+{
+    return midi_cin_length_table[cin & 0x0f];
+}
+
+/**
+ * @brief      Build the event packet of a MIDI message (not SysEx)
+ * @param[in]  cable_number  The USB-MIDI cable number
+ * @param[in]  midi_pkt      The MIDI message
+ * @param[out] usb_pkt       The event packet
+ */
+static inline void midi_codec_pkt(uint8_t cable_number, const uint8_t midi_pkt[3],
+                                  uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE])
+{
+    size_t len = midi_status_length(midi_pkt[0]);
+    usb_pkt[0] = (cable_number << 4) | midi_status_cin(midi_pkt[0]);
+    usb_pkt[1] = midi_pkt[0];
+    usb_pkt[2] = len > 1 ? midi_pkt[1] : 0;
+    usb_pkt[3] = len > 2 ? midi_pkt[2] : 0;
+}
+
+/* Whether an event packet carries a part of a SysEx (CIN 4 to 7, CIN 5 being
+ * shared with the 1-byte System Common messages) */
+static inline bool midi_codec_is_sysex(const uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE])
+{
+    uint8_t cin = usb_pkt[0] & 0x0f;
+    return (cin >= 0x4 && cin <= 0x7) && (cin != 0x5 || usb_pkt[1] == 0xF7);
+}
+
+/**
+ * @brief      Segment a SysEx message in event packets: CIN 4 for its first
+ *             packets, CIN 5, 6 or 7 for its last one
+ * @param[in]  cable_number  The USB-MIDI cable number
+ * @param[in]  sysex         The SysEx message, from 0xF0 to 0xF7 included
+ * @param[in]  len           The length of the message
+ * @param      pos           The position of the next packet in the message,
+ *                           from 0, updated to the end of the last packet
+ * @param[out] usb_pkts      The event packets
+ * @param[in]  max_pkts      The capacity of usb_pkts
+ * @return     The number of event packets
+ */
+size_t midi_sysex_segment(uint8_t cable_number, const uint8_t *sysex, size_t len, size_t *pos,
+                          uint8_t usb_pkts[][MIDI_CODEC_PKT_SIZE], size_t max_pkts);
+
+/* Reassembler of the SysEx event packets into a buffer, see midi_sysex_assemble */
+struct midi_sysex_assembler {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool receiving;
+    bool overflow;
+};
+
+/**
+ * @brief      Reset a reassembler, to receive in buf
+ */
+void midi_sysex_assembler_init(struct midi_sysex_assembler *assembler, uint8_t *buf, size_t size);
+
+/**
+ * @brief      Add a SysEx event packet (see midi_codec_is_sysex) to the
+ *             message being reassembled. The packets before the start of a
+ *             message are dropped.
+ * @return     The length of the message when complete, 0 if in progress,
+ *             -ENOMEM if the complete message did not fit in the buffer
+ */
+int midi_sysex_assemble(struct midi_sysex_assembler *assembler, const uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE]);
+
+/* Streaming parser of a MIDI byte stream, see midi_parser_feed */
+struct midi_parser {
+    uint8_t cable_number;
+    // Message being received, its status first (or SysEx bytes)
+    uint8_t buf[3];
+    uint8_t n;
+    // Length of the message, 0 when waiting for a status byte
+    uint8_t expected;
+    bool sysex;
+};
+
+/**
+ * @brief      Reset a parser, for the packets of a cable
+ */
+void midi_parser_init(struct midi_parser *parser, uint8_t cable_number);
+
+/**
+ * @brief      Parse a byte of a MIDI stream. Running status is supported,
+ *             System Realtime bytes are emitted as soon as received, even in
+ *             the middle of another message, and SysEx is split in packets
+ *             of 3 bytes. Unexpected data bytes are dropped.
+ * @param      parser   The parser
+ * @param[in]  byte     The received byte
+ * @param[out] usb_pkt  The event packet completed by this byte, if any
+ * @return     true if a packet is complete
+ */
+bool midi_parser_feed(struct midi_parser *parser, uint8_t byte, uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE]);
+
+/**
+ * @brief      Parse a buffer of a MIDI stream into event packets
+ * @param      parser    The parser
+ * @param[in]  bytes     The MIDI bytes
+ * @param      n_bytes   The number of bytes, set to the number of parsed bytes
+ * @param[out] usb_pkts  The event packets
+ * @param[in]  max_pkts  The capacity of usb_pkts, parsing stops when full
+ * @return     The number of event packets
+ */
+size_t midi_decode(struct midi_parser *parser, const uint8_t *bytes, size_t *n_bytes,
+                   uint8_t usb_pkts[][MIDI_CODEC_PKT_SIZE], size_t max_pkts);
+
+/* Serializer of event packets to a MIDI byte stream, see midi_encoder_put */
+struct midi_encoder {
+    bool running_status;
+    // Status of the last channel message, 0 if none
+    uint8_t last_status;
+};
+
+/**
+ * @brief      Reset a serializer
+ * @param[in]  running_status  Whether to omit the status of the channel
+ *                             messages repeating the previous one
+ */
+void midi_encoder_init(struct midi_encoder *encoder, bool running_status);
+
+/**
+ * @brief      Serialize an event packet, its cable number is ignored
+ * @param      encoder  The serializer
+ * @param[in]  usb_pkt  The event packet
+ * @param[out] bytes    The MIDI bytes to send
+ * @return     The number of bytes, from 0 (reserved CIN) to 3
+ */
+size_t midi_encoder_put(struct midi_encoder *encoder, const uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE], uint8_t bytes[3]);
+
+/**
+ * @brief      Serialize a MIDI message (not SysEx), see midi_encoder_put
+ */
+static inline size_t midi_encoder_put_msg(struct midi_encoder *encoder, const uint8_t midi_pkt[3], uint8_t bytes[3])
+{
+    uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE];
+    midi_codec_pkt(0, midi_pkt, usb_pkt);
+    return midi_encoder_put(encoder, usb_pkt, bytes);
+}
+
+/**
+ * @brief      Serialize event packets to a MIDI byte stream
+ * @param      encoder    The serializer
+ * @param[in]  usb_pkts   The event packets
+ * @param      n_pkts     The number of packets, set to the number of serialized packets
+ * @param[out] bytes      The MIDI bytes
+ * @param[in]  max_bytes  The capacity of bytes, serializing stops when less
+ *                        than 3 bytes are left
+ * @return     The number of bytes
+ */
+size_t midi_encode(struct midi_encoder *encoder, const uint8_t usb_pkts[][MIDI_CODEC_PKT_SIZE], size_t *n_pkts,
+                   uint8_t *bytes, size_t max_bytes);
+
+#endif
@@ -0,0 +1,144 @@
+#include "midi_monitor.h"
+#include "usb_midi.h"
+
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(midi_monitor, CONFIG_USB_MIDI_LOG_LEVEL);
+
+#define N_ENTRIES BIT(CONFIG_USB_MIDI_MONITOR_ENTRIES_POW2)
+
+static struct midi_monitor_entry entries[N_ENTRIES];
+// Free running counter of the recorded packets
+static uint32_t head;
+static struct k_spinlock lock;
+
+void midi_monitor_record(uint8_t port, const uint8_t pkt[3])
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    struct midi_monitor_entry *entry = &entries[head % N_ENTRIES];
+    entry->timestamp = k_cycle_get_32();
+    entry->port = port;
+    entry->pkt[0] = pkt[0];
+    entry->pkt[1] = pkt[1];
+    entry->pkt[2] = pkt[2];
+    head++;
+    k_spin_unlock(&lock, key);
+}
+
+size_t midi_monitor_get(struct midi_monitor_reader *reader, struct midi_monitor_entry *res,
+                        size_t n, uint32_t *lost)
+{
+    size_t i;
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    *lost = 0;
+    if (head - reader->tail > N_ENTRIES){
+        *lost = head - reader->tail - N_ENTRIES;
+        reader->tail = head - N_ENTRIES;
+    }
+
+    for (i=0; i<n && reader->tail != head; i++, reader->tail++){
+        res[i] = entries[reader->tail % N_ENTRIES];
+    }
+
+    k_spin_unlock(&lock, key);
+    return i;
+}
+
+#if defined(CONFIG_USB_MIDI_MONITOR_LOG) || defined(CONFIG_SHELL)
+
+static const char *const midi_cmd_names[16] = {
+    [MIDI_CMD_SYS_COMMON2] = "SysCommon",
+    [MIDI_CMD_SYS_COMMON3] = "SysCommon",
+    [MIDI_CMD_SYSEX_START] = "SysEx",
+    [MIDI_CMD_SYS_COMMON1] = "SysCommon",
+    [MIDI_CMD_SYSEX_2B] = "SysEx end",
+    [MIDI_CMD_SYSEX_3B] = "SysEx end",
+    [MIDI_CMD_NOTE_OFF] = "Note Off",
+    [MIDI_CMD_NOTE_ON] = "Note On",
+    [MIDI_CMD_POLY_KEYPRESS] = "Poly Keypress",
+    [MIDI_CMD_CONTROL_CHANGE] = "Control Change",
+    [MIDI_CMD_PROGRAM_CHANGE] = "Program Change",
+    [MIDI_CMD_CHAN_PRESSURE] = "Channel Pressure",
+    [MIDI_CMD_PITCH_BEND] = "Pitch Bend",
+    [MIDI_CMD_SINGLE_BYTE] = "System",
+};
+
+/* Decode an entry, timestamped relatively to the previous one */
+static void midi_monitor_format(char *buf, size_t len, const struct midi_monitor_entry *e, uint32_t delta_us)
+{
+    const char *name = midi_cmd_names[e->pkt[0] >> 4];
+    snprintk(buf, len, "+%6uus %s %3d %02X %02X %02X %s", delta_us,
+             (e->port & MIDI_MONITOR_IN) ? "IN " : "OUT", e->port & ~MIDI_MONITOR_IN,
+             e->pkt[0], e->pkt[1], e->pkt[2], name ? name : "?");
+}
+
+#endif
+
+#if defined(CONFIG_USB_MIDI_MONITOR_LOG)
+
+static void midi_monitor_log_task()
+{
+    struct midi_monitor_reader reader = {0};
+    struct midi_monitor_entry batch[16];
+    uint32_t last_timestamp = k_cycle_get_32();
+
+    while (true){
+        uint32_t lost;
+        size_t n = midi_monitor_get(&reader, batch, ARRAY_SIZE(batch), &lost);
+        if (lost){
+            LOG_WRN("%u packets lost", lost);
+        }
+        for (size_t i=0; i<n; i++){
+            char line[64];
+            midi_monitor_format(line, sizeof(line), &batch[i],
+                                k_cyc_to_us_floor32(batch[i].timestamp - last_timestamp));
+            LOG_INF("%s", line);
+            last_timestamp = batch[i].timestamp;
+        }
+        if (n < ARRAY_SIZE(batch)){
+            k_sleep(K_MSEC(CONFIG_USB_MIDI_MONITOR_LOG_PERIOD_MS));
+        }
+    }
+}
+
+K_THREAD_DEFINE(midi_monitor_log_id, 1024, midi_monitor_log_task, NULL, NULL, NULL,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
+
+#endif
+
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+
+static int cmd_midi_monitor(const struct shell *sh, size_t argc, char **argv)
+{
+    static struct midi_monitor_reader reader;
+    struct midi_monitor_entry batch[16];
+    uint32_t lost;
+    uint32_t last_timestamp = 0;
+    size_t n;
+    bool first = true;
+
+    do {
+        n = midi_monitor_get(&reader, batch, ARRAY_SIZE(batch), &lost);
+        if (lost){
+            shell_warn(sh, "%u packets lost", lost);
+        }
+        for (size_t i=0; i<n; i++){
+            char line[64];
+            midi_monitor_format(line, sizeof(line), &batch[i],
+                                first ? 0 : k_cyc_to_us_floor32(batch[i].timestamp - last_timestamp));
+            shell_print(sh, "%s", line);
+            last_timestamp = batch[i].timestamp;
+            first = false;
+        }
+    } while (n == ARRAY_SIZE(batch));
+
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((midi), monitor, NULL, "Show the MIDI packets since the previous call", cmd_midi_monitor, 1, 0);
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * MIDI monitor: a fixed-size ring of timestamped raw MIDI packets.
+ *
+ * Recording a packet only copies 8 bytes, all decoding and printing is
+ * deferred to the "midi monitor" shell command or to a low priority logging
+ * thread (CONFIG_USB_MIDI_MONITOR_LOG). When the ring is full, the oldest
+ * packets are overwritten. Each consumer reads the ring with its own
+ * struct midi_monitor_reader, so they all see every packet.
+ */
+
+#ifndef MIDI_MONITOR_H_
+#define MIDI_MONITOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Direction bit of the port number, set for packets received by the device */
+#define MIDI_MONITOR_IN 0x80
+
+/* Port numbers of the USB-MIDI cables, other ports are application defined */
+#define MIDI_MONITOR_PORT_USB(cable) (cable)
+
+/* Port number of the RTP-MIDI session (midi_rtp.h) */
+#define MIDI_MONITOR_PORT_RTP 0x40
+
+/* Port numbers of the MIDI DIN ports of the applications, after the 16
+ * possible USB-MIDI cables */
+#define MIDI_MONITOR_PORT_DIN(n) (16 + (n))
+
+struct midi_monitor_entry {
+    // Cycle counter (k_cycle_get_32) when the packet was recorded
+    uint32_t timestamp;
+    uint8_t port;
+    uint8_t pkt[3];
+};
+
+/* Position of a consumer in the ring, zero initialized */
+struct midi_monitor_reader {
+    // Free running counter of the packets consumed by this reader
+    uint32_t tail;
+};
+
+#if defined(CONFIG_USB_MIDI_MONITOR)
+
+/**
+ * @brief      Record a MIDI packet, callable from any context
+ * @param[in]  port  The port number, ORed with MIDI_MONITOR_IN for
+ *                   received packets
+ * @param[in]  pkt   The MIDI packet
+ */
+void midi_monitor_record(uint8_t port, const uint8_t pkt[3]);
+
+/**
+ * @brief      Consume the oldest packets not read yet by a consumer
+ * @param      reader   The position of the consumer in the ring
+ * @param[out] entries  The consumed packets
+ * @param[in]  n        The maximal number of packets to consume
+ * @param[out] lost     The number of packets overwritten before being
+ *                      consumed, since the previous call
+ * @return     The number of consumed packets
+ */
+size_t midi_monitor_get(struct midi_monitor_reader *reader, struct midi_monitor_entry *entries,
+                        size_t n, uint32_t *lost);
+
+#else
+
+static inline void midi_monitor_record(uint8_t port, const uint8_t pkt[3]) {}
+
+#endif
+
+#endif
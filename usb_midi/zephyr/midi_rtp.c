@@ -0,0 +1,659 @@
+#include "midi_rtp.h"
+#include "midi_rtp_payload.h"
+#include "midi_monitor.h"
+#include "midi_clock.h"
+#include "midi_trace.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/random/random.h>
+#include <zephyr/sys/byteorder.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(midi_rtp, CONFIG_USB_MIDI_LOG_LEVEL);
+
+/* AppleMIDI session protocol: commands after a 0xFFFF signature */
+#define APPLEMIDI_SIGNATURE 0xFFFF
+#define APPLEMIDI_VERSION 2
+#define APPLEMIDI_CMD(a, b) (((a) << 8) | (b))
+#define APPLEMIDI_INVITATION APPLEMIDI_CMD('I', 'N')
+#define APPLEMIDI_ACCEPT     APPLEMIDI_CMD('O', 'K')
+#define APPLEMIDI_REJECT     APPLEMIDI_CMD('N', 'O')
+#define APPLEMIDI_END        APPLEMIDI_CMD('B', 'Y')
+#define APPLEMIDI_SYNC       APPLEMIDI_CMD('C', 'K')
+#define APPLEMIDI_FEEDBACK   APPLEMIDI_CMD('R', 'S')
+
+/* Sizes of the session commands: invitations and their answers without the name */
+#define APPLEMIDI_SESSION_SIZE 16
+#define APPLEMIDI_SYNC_SIZE 36
+#define APPLEMIDI_FEEDBACK_SIZE 12
+
+/* Sockets of the control and data ports */
+#define PORT_CONTROL 0
+#define PORT_DATA 1
+
+#define MIDI_RTP_PACKET_SIZE 1024
+
+/* Period of the session timers, and their delays */
+#define MIDI_RTP_TIMER_MS 100
+#define MIDI_RTP_INVITATION_PERIOD_MS 1000
+#define MIDI_RTP_INVITATION_ATTEMPTS 12
+#define MIDI_RTP_SYNC_PERIOD_MS 10000
+#define MIDI_RTP_FEEDBACK_PERIOD_MS 1000
+// A peer is lost when not heard of for several of its synchronizations
+#define MIDI_RTP_TIMEOUT_MS 60000
+
+static const char *const state_names[] = {
+    [MIDI_RTP_IDLE] = "idle",
+    [MIDI_RTP_INVITING] = "inviting",
+    [MIDI_RTP_CONNECTED] = "connected",
+};
+
+static struct {
+    enum midi_rtp_state state;
+    bool initiator;
+    // Port of the invitation in progress, control then data
+    int inviting_port;
+    int attempts;
+    int64_t next_timer_ms;
+    int64_t last_rx_ms;
+    int64_t next_feedback_ms;
+    // Control port of the peer, its data port is the next one
+    struct sockaddr_in peer;
+    uint32_t token;
+    uint32_t peer_ssrc;
+    char peer_name[32];
+    // Next sequence number to send, last one received
+    uint16_t seq;
+    uint16_t rx_seq;
+    bool rx_started;
+    bool feedback_pending;
+} session;
+
+static K_MUTEX_DEFINE(session_lock);
+
+static uint32_t ssrc;
+static int sockets[2] = {-1, -1};
+
+/* Used by the session thread */
+static uint8_t rx_buf[MIDI_RTP_PACKET_SIZE];
+static uint8_t ctl_buf[APPLEMIDI_SYNC_SIZE + sizeof(CONFIG_MIDI_RTP_SESSION_NAME)];
+
+/* Used by the flush work, under the session lock */
+static uint8_t tx_buf[MIDI_RTP_PACKET_SIZE];
+static struct midi_rtp_journal_entry journal_entries[CONFIG_MIDI_RTP_JOURNAL_ENTRIES];
+static struct midi_rtp_journal journal;
+
+/* The commands written since the last packet */
+static struct {
+    struct midi_rtp_cmd cmds[CONFIG_MIDI_RTP_BATCH_SIZE];
+    size_t n;
+} batch;
+
+static struct k_spinlock batch_lock;
+
+static midi_rtp_rx_handler_t rx_handler = NULL;
+
+static struct midi_rtp_stats stats;
+
+static void midi_rtp_flush(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(midi_rtp_flush_work, midi_rtp_flush);
+
+/* The packets are sent from their own work queue: a send blocked on a slow
+ * link only delays the next RTP-MIDI packets */
+K_THREAD_STACK_DEFINE(midi_rtp_tx_stack, CONFIG_MIDI_RTP_TX_STACK_SIZE);
+static struct k_work_q midi_rtp_tx_queue;
+
+/* Session time, in units of 100us */
+static uint64_t midi_rtp_now()
+{
+    return k_ticks_to_us_floor64(k_uptime_ticks()) / 100;
+}
+
+static struct sockaddr_in midi_rtp_peer_addr(int port)
+{
+    struct sockaddr_in addr = session.peer;
+    addr.sin_port = htons(ntohs(session.peer.sin_port) + port);
+    return addr;
+}
+
+static bool midi_rtp_is_peer(const struct sockaddr_in *from, int port)
+{
+    return session.state != MIDI_RTP_IDLE
+        && from->sin_addr.s_addr == session.peer.sin_addr.s_addr
+        && ntohs(from->sin_port) == ntohs(session.peer.sin_port) + port;
+}
+
+static void midi_rtp_send(int port, const struct sockaddr_in *to, const uint8_t *buf, size_t len)
+{
+    if (zsock_sendto(sockets[port], buf, len, 0, (const struct sockaddr *) to, sizeof(*to)) < 0){
+        stats.send_errors++;
+        LOG_DBG("Send to port %d failed (%d)", port, errno);
+    }
+}
+
+/* Invitation, acceptance, rejection or end of the session */
+static void midi_rtp_send_session(int port, const struct sockaddr_in *to, uint16_t cmd, uint32_t token)
+{
+    sys_put_be16(APPLEMIDI_SIGNATURE, &ctl_buf[0]);
+    sys_put_be16(cmd, &ctl_buf[2]);
+    sys_put_be32(APPLEMIDI_VERSION, &ctl_buf[4]);
+    sys_put_be32(token, &ctl_buf[8]);
+    sys_put_be32(ssrc, &ctl_buf[12]);
+
+    size_t len = APPLEMIDI_SESSION_SIZE;
+    if (cmd != APPLEMIDI_END){
+        memcpy(&ctl_buf[len], CONFIG_MIDI_RTP_SESSION_NAME, sizeof(CONFIG_MIDI_RTP_SESSION_NAME));
+        len += sizeof(CONFIG_MIDI_RTP_SESSION_NAME);
+    }
+    midi_rtp_send(port, to, ctl_buf, len);
+}
+
+static void midi_rtp_send_sync(uint8_t count, const uint64_t timestamps[3])
+{
+    sys_put_be16(APPLEMIDI_SIGNATURE, &ctl_buf[0]);
+    sys_put_be16(APPLEMIDI_SYNC, &ctl_buf[2]);
+    sys_put_be32(ssrc, &ctl_buf[4]);
+    ctl_buf[8] = count;
+    memset(&ctl_buf[9], 0, 3);
+    for (int i=0; i<3; i++){
+        sys_put_be64(timestamps[i], &ctl_buf[12 + 8 * i]);
+    }
+    struct sockaddr_in to = midi_rtp_peer_addr(PORT_DATA);
+    midi_rtp_send(PORT_DATA, &to, ctl_buf, APPLEMIDI_SYNC_SIZE);
+}
+
+static void midi_rtp_send_feedback()
+{
+    sys_put_be16(APPLEMIDI_SIGNATURE, &ctl_buf[0]);
+    sys_put_be16(APPLEMIDI_FEEDBACK, &ctl_buf[2]);
+    sys_put_be32(ssrc, &ctl_buf[4]);
+    sys_put_be16(session.rx_seq, &ctl_buf[8]);
+    sys_put_be16(0, &ctl_buf[10]);
+    struct sockaddr_in to = midi_rtp_peer_addr(PORT_CONTROL);
+    midi_rtp_send(PORT_CONTROL, &to, ctl_buf, APPLEMIDI_FEEDBACK_SIZE);
+}
+
+static void midi_rtp_set_state(enum midi_rtp_state state)
+{
+    if (state == MIDI_RTP_CONNECTED && session.state != MIDI_RTP_CONNECTED){
+        session.seq = sys_rand32_get();
+        session.rx_started = false;
+        session.feedback_pending = false;
+        session.last_rx_ms = k_uptime_get();
+        session.next_timer_ms = k_uptime_get();
+        midi_rtp_journal_init(&journal, journal_entries, ARRAY_SIZE(journal_entries), session.seq - 1);
+        stats.sessions++;
+        LOG_INF("Session with %s connected", session.peer_name);
+    } else if (state != MIDI_RTP_CONNECTED && session.state == MIDI_RTP_CONNECTED){
+        LOG_INF("Session with %s ended", session.peer_name);
+    }
+    session.state = state;
+}
+
+static void midi_rtp_set_peer_name(const uint8_t *pkt, size_t len)
+{
+    size_t n = len > APPLEMIDI_SESSION_SIZE ? MIN(len - APPLEMIDI_SESSION_SIZE, sizeof(session.peer_name) - 1) : 0;
+    memcpy(session.peer_name, &pkt[APPLEMIDI_SESSION_SIZE], n);
+    session.peer_name[n] = 0;
+}
+
+static void midi_rtp_start_invitation(int port)
+{
+    session.inviting_port = port;
+    session.attempts = 0;
+    session.next_timer_ms = k_uptime_get();
+}
+
+static void midi_rtp_sync(const uint8_t *pkt)
+{
+    uint8_t count = pkt[8];
+    uint64_t timestamps[3];
+    for (int i=0; i<3; i++){
+        timestamps[i] = sys_get_be64(&pkt[12 + 8 * i]);
+    }
+
+    switch (count){
+    case 0:
+        timestamps[1] = midi_rtp_now();
+        midi_rtp_send_sync(1, timestamps);
+        break;
+    case 1:
+        timestamps[2] = midi_rtp_now();
+        midi_rtp_send_sync(2, timestamps);
+        stats.latency_us = (timestamps[2] - timestamps[0]) * 100 / 2;
+        break;
+    case 2:
+        // Round trip in the clock of the peer
+        stats.latency_us = (timestamps[2] - timestamps[0]) * 100 / 2;
+        break;
+    }
+}
+
+static void midi_rtp_command(int port, const struct sockaddr_in *from, const uint8_t *pkt, size_t len)
+{
+    uint16_t cmd = sys_get_be16(&pkt[2]);
+    uint32_t token = len >= APPLEMIDI_SESSION_SIZE ? sys_get_be32(&pkt[8]) : 0;
+
+    switch (cmd){
+    case APPLEMIDI_INVITATION:
+        if (len < APPLEMIDI_SESSION_SIZE){
+            return;
+        }
+        // A single session, set up on the control port first
+        if ((session.state != MIDI_RTP_IDLE || port == PORT_DATA) && ! midi_rtp_is_peer(from, port)){
+            midi_rtp_send_session(port, from, APPLEMIDI_REJECT, token);
+            return;
+        }
+        if (port == PORT_CONTROL){
+            // Also when invited again by the peer, after its restart
+            session.peer = *from;
+            session.token = token;
+            session.peer_ssrc = sys_get_be32(&pkt[12]);
+            session.initiator = false;
+            midi_rtp_set_peer_name(pkt, len);
+            midi_rtp_set_state(MIDI_RTP_INVITING);
+            session.next_timer_ms = k_uptime_get() + MIDI_RTP_INVITATION_PERIOD_MS * MIDI_RTP_INVITATION_ATTEMPTS;
+        } else {
+            midi_rtp_set_state(MIDI_RTP_CONNECTED);
+        }
+        midi_rtp_send_session(port, from, APPLEMIDI_ACCEPT, token);
+        break;
+
+    case APPLEMIDI_ACCEPT:
+        if (session.state != MIDI_RTP_INVITING || ! session.initiator || token != session.token
+            || ! midi_rtp_is_peer(from, port) || port != session.inviting_port){
+            return;
+        }
+        if (port == PORT_CONTROL){
+            session.peer_ssrc = len >= APPLEMIDI_SESSION_SIZE ? sys_get_be32(&pkt[12]) : 0;
+            midi_rtp_set_peer_name(pkt, len);
+            midi_rtp_start_invitation(PORT_DATA);
+        } else {
+            // The first synchronization is sent by the next timer
+            midi_rtp_set_state(MIDI_RTP_CONNECTED);
+        }
+        break;
+
+    case APPLEMIDI_REJECT:
+        if (session.state == MIDI_RTP_INVITING && session.initiator && token == session.token){
+            LOG_WRN("Invitation rejected");
+            midi_rtp_set_state(MIDI_RTP_IDLE);
+        }
+        break;
+
+    case APPLEMIDI_END:
+        if (midi_rtp_is_peer(from, port)){
+            midi_rtp_set_state(MIDI_RTP_IDLE);
+        }
+        break;
+
+    case APPLEMIDI_SYNC:
+        if (len >= APPLEMIDI_SYNC_SIZE && session.state == MIDI_RTP_CONNECTED && midi_rtp_is_peer(from, port)){
+            midi_rtp_sync(pkt);
+        }
+        break;
+
+    case APPLEMIDI_FEEDBACK:
+        if (len >= APPLEMIDI_FEEDBACK_SIZE && session.state == MIDI_RTP_CONNECTED
+            && sys_get_be32(&pkt[4]) == session.peer_ssrc){
+            midi_rtp_journal_ack(&journal, sys_get_be16(&pkt[8]));
+        }
+        break;
+    }
+}
+
+static void midi_rtp_receive_cmd(const struct midi_rtp_cmd *cmd, void *user_data)
+{
+    ARG_UNUSED(user_data);
+
+#if defined(CONFIG_MIDI_CLOCK_FOLLOWER)
+    if (cmd->pkt[0] >= 0xF8){
+        midi_clock_input(cmd->pkt[0], k_cycle_get_32());
+    }
+#endif
+    midi_monitor_record(MIDI_MONITOR_IN | MIDI_MONITOR_PORT_RTP, cmd->pkt);
+    stats.rx_commands++;
+    if (rx_handler){
+        rx_handler(cmd->pkt);
+    }
+}
+
+static void midi_rtp_receive(int port)
+{
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t len = zsock_recvfrom(sockets[port], rx_buf, sizeof(rx_buf), 0, (struct sockaddr *) &from, &from_len);
+    if (len < 4 || from.sin_family != AF_INET){
+        return;
+    }
+
+    k_mutex_lock(&session_lock, K_FOREVER);
+    bool from_peer = midi_rtp_is_peer(&from, port);
+    if (from_peer){
+        session.last_rx_ms = k_uptime_get();
+    }
+    if (sys_get_be16(rx_buf) == APPLEMIDI_SIGNATURE){
+        midi_rtp_command(port, &from, rx_buf, len);
+        k_mutex_unlock(&session_lock);
+        return;
+    }
+    bool connected = from_peer && port == PORT_DATA && session.state == MIDI_RTP_CONNECTED;
+    k_mutex_unlock(&session_lock);
+
+    if (! connected){
+        return;
+    }
+
+    // The commands are handled out of the lock, the handler may write
+    struct midi_rtp_header hdr;
+    if (midi_rtp_decode(rx_buf, len, &hdr, midi_rtp_receive_cmd, NULL) < 0){
+        stats.rx_errors++;
+        return;
+    }
+
+    k_mutex_lock(&session_lock, K_FOREVER);
+    stats.rx_packets++;
+    if (session.rx_started && (int16_t) (hdr.seq - session.rx_seq) > 1){
+        stats.rx_lost += (uint16_t) (hdr.seq - session.rx_seq - 1);
+    }
+    if (! session.rx_started || (int16_t) (hdr.seq - session.rx_seq) > 0){
+        session.rx_seq = hdr.seq;
+    }
+    session.rx_started = true;
+    session.feedback_pending = true;
+    k_mutex_unlock(&session_lock);
+}
+
+static void midi_rtp_timers()
+{
+    int64_t now = k_uptime_get();
+
+    k_mutex_lock(&session_lock, K_FOREVER);
+    switch (session.state){
+    case MIDI_RTP_IDLE:
+        break;
+
+    case MIDI_RTP_INVITING:
+        if (now < session.next_timer_ms){
+            break;
+        }
+        if (! session.initiator || session.attempts >= MIDI_RTP_INVITATION_ATTEMPTS){
+            LOG_WRN("Invitation timed out");
+            midi_rtp_set_state(MIDI_RTP_IDLE);
+            break;
+        }
+        struct sockaddr_in to = midi_rtp_peer_addr(session.inviting_port);
+        midi_rtp_send_session(session.inviting_port, &to, APPLEMIDI_INVITATION, session.token);
+        session.attempts++;
+        session.next_timer_ms = now + MIDI_RTP_INVITATION_PERIOD_MS;
+        break;
+
+    case MIDI_RTP_CONNECTED:
+        if (now - session.last_rx_ms > MIDI_RTP_TIMEOUT_MS){
+            LOG_WRN("Peer %s lost", session.peer_name);
+            midi_rtp_set_state(MIDI_RTP_IDLE);
+            break;
+        }
+        if (session.initiator && now >= session.next_timer_ms){
+            const uint64_t timestamps[3] = {midi_rtp_now(), 0, 0};
+            midi_rtp_send_sync(0, timestamps);
+            session.next_timer_ms = now + MIDI_RTP_SYNC_PERIOD_MS;
+        }
+        if (session.feedback_pending && now >= session.next_feedback_ms){
+            midi_rtp_send_feedback();
+            session.feedback_pending = false;
+            session.next_feedback_ms = now + MIDI_RTP_FEEDBACK_PERIOD_MS;
+        }
+        break;
+    }
+    k_mutex_unlock(&session_lock);
+}
+
+static int midi_rtp_open_socket(int port)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_MIDI_RTP_CONTROL_PORT + port),
+        .sin_addr = {.s_addr = INADDR_ANY},
+    };
+
+    sockets[port] = zsock_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sockets[port] < 0){
+        return -errno;
+    }
+    if (zsock_bind(sockets[port], (struct sockaddr *) &addr, sizeof(addr)) < 0){
+        return -errno;
+    }
+    return 0;
+}
+
+static void midi_rtp_task()
+{
+    ssrc = sys_rand32_get();
+
+    // Before the session is connected, the writes do not schedule the flush
+    const struct k_work_queue_config cfg = {.name = "midi_rtp_tx"};
+    k_work_queue_init(&midi_rtp_tx_queue);
+    k_work_queue_start(&midi_rtp_tx_queue, midi_rtp_tx_stack, K_THREAD_STACK_SIZEOF(midi_rtp_tx_stack),
+                       CONFIG_MIDI_RTP_PRIORITY, &cfg);
+
+    for (int port=PORT_CONTROL; port<=PORT_DATA; port++){
+        int r = midi_rtp_open_socket(port);
+        if (r){
+            LOG_ERR("Unable to open UDP port %d (%d)", CONFIG_MIDI_RTP_CONTROL_PORT + port, r);
+            return;
+        }
+    }
+    LOG_INF("Listening on UDP ports %d and %d", CONFIG_MIDI_RTP_CONTROL_PORT, CONFIG_MIDI_RTP_CONTROL_PORT + 1);
+
+    if (sizeof(CONFIG_MIDI_RTP_PEER) > 1){
+        midi_rtp_invite(CONFIG_MIDI_RTP_PEER, CONFIG_MIDI_RTP_PEER_PORT);
+    }
+
+    struct zsock_pollfd fds[] = {
+        {.fd = sockets[PORT_CONTROL], .events = ZSOCK_POLLIN},
+        {.fd = sockets[PORT_DATA], .events = ZSOCK_POLLIN},
+    };
+    while (true){
+        if (zsock_poll(fds, ARRAY_SIZE(fds), MIDI_RTP_TIMER_MS) > 0){
+            for (int port=PORT_CONTROL; port<=PORT_DATA; port++){
+                if (fds[port].revents & ZSOCK_POLLIN){
+                    midi_rtp_receive(port);
+                }
+            }
+        }
+        midi_rtp_timers();
+    }
+}
+
+K_THREAD_DEFINE(midi_rtp_tid, CONFIG_MIDI_RTP_STACK_SIZE, midi_rtp_task, NULL, NULL, NULL,
+                CONFIG_MIDI_RTP_PRIORITY, 0, 0);
+
+/* Send the batch in a packet, from the RTP-MIDI work queue */
+static void midi_rtp_flush(struct k_work *work)
+{
+    ARG_UNUSED(work);
+
+    static struct midi_rtp_cmd cmds[CONFIG_MIDI_RTP_BATCH_SIZE];
+    k_spinlock_key_t key = k_spin_lock(&batch_lock);
+    size_t n_cmds = batch.n;
+    memcpy(cmds, batch.cmds, n_cmds * sizeof(cmds[0]));
+    batch.n = 0;
+    k_spin_unlock(&batch_lock, key);
+
+    if (! n_cmds){
+        return;
+    }
+
+    k_mutex_lock(&session_lock, K_FOREVER);
+    if (session.state != MIDI_RTP_CONNECTED){
+        k_mutex_unlock(&session_lock);
+        return;
+    }
+
+    const struct midi_rtp_header hdr = {.seq=session.seq, .timestamp=cmds[0].timestamp, .ssrc=ssrc};
+    int len = midi_rtp_encode(tx_buf, sizeof(tx_buf), &hdr, cmds, n_cmds, &journal);
+    if (len < 0){
+        stats.tx_no_journal++;
+        len = midi_rtp_encode(tx_buf, sizeof(tx_buf), &hdr, cmds, n_cmds, NULL);
+    }
+    if (len > 0){
+        struct sockaddr_in to = midi_rtp_peer_addr(PORT_DATA);
+        MIDI_TRACE("rtp_send", session.seq, len);
+        midi_rtp_send(PORT_DATA, &to, tx_buf, len);
+
+        // Recorded after encoding: the journal of a packet codes the previous ones
+        for (size_t i=0; i<n_cmds; i++){
+            midi_rtp_journal_record(&journal, session.seq, cmds[i].pkt);
+        }
+        stats.journal_overflows = journal.overflows;
+        stats.tx_packets++;
+        stats.tx_commands += n_cmds;
+        session.seq++;
+    }
+    k_mutex_unlock(&session_lock);
+}
+
+int midi_rtp_write(const uint8_t midi_pkt[3])
+{
+    if (session.state != MIDI_RTP_CONNECTED){
+        return -EAGAIN;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&batch_lock);
+    if (batch.n == ARRAY_SIZE(batch.cmds)){
+        k_spin_unlock(&batch_lock, key);
+        stats.tx_dropped++;
+        return -EAGAIN;
+    }
+    struct midi_rtp_cmd *cmd = &batch.cmds[batch.n++];
+    cmd->timestamp = midi_rtp_now();
+    memcpy(cmd->pkt, midi_pkt, 3);
+    bool first = batch.n == 1;
+    bool full = batch.n == ARRAY_SIZE(batch.cmds);
+    k_spin_unlock(&batch_lock, key);
+
+    midi_monitor_record(MIDI_MONITOR_PORT_RTP, midi_pkt);
+
+    // The realtime commands are not delayed, nor the ones of a full batch
+    if (full || midi_pkt[0] >= 0xF8){
+        k_work_reschedule_for_queue(&midi_rtp_tx_queue, &midi_rtp_flush_work, K_NO_WAIT);
+    } else if (first){
+        k_work_schedule_for_queue(&midi_rtp_tx_queue, &midi_rtp_flush_work, K_USEC(CONFIG_MIDI_RTP_BATCH_US));
+    }
+    return 0;
+}
+
+void midi_rtp_set_rx_handler(midi_rtp_rx_handler_t handler)
+{
+    rx_handler = handler;
+}
+
+int midi_rtp_invite(const char *addr, uint16_t port)
+{
+    struct sockaddr_in peer = {.sin_family = AF_INET, .sin_port = htons(port)};
+    if (zsock_inet_pton(AF_INET, addr, &peer.sin_addr) != 1){
+        return -EINVAL;
+    }
+
+    int r = 0;
+    k_mutex_lock(&session_lock, K_FOREVER);
+    if (session.state != MIDI_RTP_IDLE){
+        r = -EBUSY;
+    } else {
+        session.peer = peer;
+        session.token = sys_rand32_get();
+        session.initiator = true;
+        strncpy(session.peer_name, addr, sizeof(session.peer_name) - 1);
+        session.peer_name[sizeof(session.peer_name) - 1] = 0;
+        midi_rtp_set_state(MIDI_RTP_INVITING);
+        midi_rtp_start_invitation(PORT_CONTROL);
+    }
+    k_mutex_unlock(&session_lock);
+    return r;
+}
+
+void midi_rtp_end()
+{
+    k_mutex_lock(&session_lock, K_FOREVER);
+    if (session.state != MIDI_RTP_IDLE){
+        struct sockaddr_in to = midi_rtp_peer_addr(PORT_CONTROL);
+        midi_rtp_send_session(PORT_CONTROL, &to, APPLEMIDI_END, session.token);
+        midi_rtp_set_state(MIDI_RTP_IDLE);
+    }
+    k_mutex_unlock(&session_lock);
+}
+
+enum midi_rtp_state midi_rtp_get_state()
+{
+    return session.state;
+}
+
+void midi_rtp_get_stats(struct midi_rtp_stats *res)
+{
+    k_mutex_lock(&session_lock, K_FOREVER);
+    *res = stats;
+    k_mutex_unlock(&session_lock);
+}
+
+void midi_rtp_reset_stats()
+{
+    k_mutex_lock(&session_lock, K_FOREVER);
+    memset(&stats, 0, sizeof(stats));
+    journal.overflows = 0;
+    k_mutex_unlock(&session_lock);
+}
+
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#include <stdlib.h>
+
+static int cmd_midi_rtp_status(const struct shell *sh, size_t argc, char **argv)
+{
+    struct midi_rtp_stats st;
+    midi_rtp_get_stats(&st);
+
+    shell_print(sh, "Session %s%s%s, %u since boot", state_names[session.state],
+                session.state != MIDI_RTP_IDLE ? " with " : "",
+                session.state != MIDI_RTP_IDLE ? session.peer_name : "", st.sessions);
+    shell_print(sh, "sent:     %u packets, %u commands, %u dropped, %u without journal",
+                st.tx_packets, st.tx_commands, st.tx_dropped, st.tx_no_journal);
+    shell_print(sh, "journal:  %u entries, %u overflows", (unsigned) journal.n, st.journal_overflows);
+    shell_print(sh, "received: %u packets, %u commands, %u lost, %u malformed",
+                st.rx_packets, st.rx_commands, st.rx_lost, st.rx_errors);
+    shell_print(sh, "latency %uus, %u send errors", st.latency_us, st.send_errors);
+    return 0;
+}
+
+static int cmd_midi_rtp_connect(const struct shell *sh, size_t argc, char **argv)
+{
+    uint16_t port = argc > 2 ? strtoul(argv[2], NULL, 10) : CONFIG_MIDI_RTP_PEER_PORT;
+    int r = midi_rtp_invite(argv[1], port);
+    if (r == -EINVAL){
+        shell_error(sh, "Invalid IPv4 address %s", argv[1]);
+    } else if (r == -EBUSY){
+        shell_error(sh, "Session in progress");
+    }
+    return r;
+}
+
+static int cmd_midi_rtp_disconnect(const struct shell *sh, size_t argc, char **argv)
+{
+    midi_rtp_end();
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(midi_rtp_cmds,
+    SHELL_CMD(status, NULL, "Show the session and its counters", cmd_midi_rtp_status),
+    SHELL_CMD_ARG(connect, NULL, "Invite a peer <ipv4> [port]", cmd_midi_rtp_connect, 2, 1),
+    SHELL_CMD(disconnect, NULL, "End the session", cmd_midi_rtp_disconnect),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((midi), rtp, &midi_rtp_cmds, "RTP-MIDI network session", NULL, 1, 0);
+#endif
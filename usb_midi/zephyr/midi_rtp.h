@@ -0,0 +1,79 @@
+/**
+ * RTP-MIDI network transport: an AppleMIDI session with a single peer, over
+ * UDP on IPv4.
+ *
+ * The session is set up by the invitation handshake on the control and data
+ * ports (CONFIG_MIDI_RTP_CONTROL_PORT and the next one), from the peer or to
+ * the peer of CONFIG_MIDI_RTP_PEER. Its clocks are then synchronized, every
+ * 10 seconds by the initiator.
+ *
+ * The commands written within CONFIG_MIDI_RTP_BATCH_US are sent in a single
+ * RTP packet, with their delta times and the recovery journal of the
+ * packets not yet acknowledged by the peer (see midi_rtp_payload.h). System
+ * Realtime commands are sent at once.
+ */
+
+#ifndef MIDI_RTP_H_
+#define MIDI_RTP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum midi_rtp_state {
+    MIDI_RTP_IDLE,
+    // Invitation handshake in progress, from or to the peer
+    MIDI_RTP_INVITING,
+    MIDI_RTP_CONNECTED,
+};
+
+/* Called for each command received from the peer, from the session thread */
+typedef void (*midi_rtp_rx_handler_t)(const uint8_t midi_pkt[3]);
+
+struct midi_rtp_stats {
+    uint32_t sessions;
+    uint32_t tx_packets;
+    uint32_t tx_commands;
+    // Commands dropped on a full batch
+    uint32_t tx_dropped;
+    // Packets sent without their journal, too large for a packet
+    uint32_t tx_no_journal;
+    // Journal entries overwritten before being acknowledged
+    uint32_t journal_overflows;
+    uint32_t rx_packets;
+    uint32_t rx_commands;
+    // Gaps in the sequence numbers of the peer, and malformed packets
+    uint32_t rx_lost;
+    uint32_t rx_errors;
+    uint32_t send_errors;
+    // Half the round trip of the last clock synchronization
+    uint32_t latency_us;
+};
+
+/**
+ * @brief      Send a MIDI command (not SysEx) to the peer
+ * @return     0 on success, -EAGAIN if no session is connected or the batch
+ *             is full
+ */
+int midi_rtp_write(const uint8_t midi_pkt[3]);
+
+void midi_rtp_set_rx_handler(midi_rtp_rx_handler_t handler);
+
+/**
+ * @brief      Invite a peer to a session
+ * @param[in]  addr  The IPv4 address of the peer
+ * @param[in]  port  Its control port
+ * @return     0 if the invitation is started, -EINVAL for an invalid
+ *             address, -EBUSY if a session is in progress
+ */
+int midi_rtp_invite(const char *addr, uint16_t port);
+
+/* End the session in progress, if any */
+void midi_rtp_end();
+
+enum midi_rtp_state midi_rtp_get_state();
+
+void midi_rtp_get_stats(struct midi_rtp_stats *stats);
+
+void midi_rtp_reset_stats();
+
+#endif
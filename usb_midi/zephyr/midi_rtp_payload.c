@@ -0,0 +1,422 @@
+#include "midi_rtp_payload.h"
+#include "midi_codec.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/util.h>
+
+/* Version 2, no padding, extension nor contributing sources */
+#define RTP_VERSION 0x80
+#define RTP_VERSION_MASK 0xC0
+#define RTP_EXTENSION 0x10
+#define RTP_CSRC_COUNT_MASK 0x0F
+
+/* Header of the command section (RFC 6295, 3) */
+#define CMD_B 0x80
+#define CMD_J 0x40
+#define CMD_Z 0x20
+#define CMD_LEN_MASK 0x0F
+#define CMD_MAX_LEN 0x0FFF
+
+/* Header of the recovery journal (RFC 6295, 5) */
+#define JOURNAL_A 0x20
+
+/* Chapters of a channel journal (RFC 6295, 5.2) */
+#define CHAPTER_C 0x40
+#define CHAPTER_W 0x10
+#define CHAPTER_N 0x08
+
+/* Y bit of the note logs: the receiver plays the recovered Note On */
+#define NOTE_LOG_Y 0x80
+
+#define STATUS_NOTE_OFF    0x80
+#define STATUS_NOTE_ON     0x90
+#define STATUS_CONTROL     0xB0
+#define STATUS_PITCH_BEND  0xE0
+#define STATUS_SYSEX_START 0xF0
+#define STATUS_SYSEX_END   0xF7
+#define STATUS_SYSEX_ABORT 0xF4
+#define STATUS_REALTIME    0xF8
+
+void midi_rtp_journal_init(struct midi_rtp_journal *journal, struct midi_rtp_journal_entry *entries,
+                           size_t size, uint16_t checkpoint)
+{
+    journal->entries = entries;
+    journal->size = size;
+    journal->n = 0;
+    journal->checkpoint = checkpoint;
+    journal->overflows = 0;
+}
+
+void midi_rtp_journal_record(struct midi_rtp_journal *journal, uint16_t seq, const uint8_t midi_pkt[3])
+{
+    uint8_t status = midi_pkt[0] & 0xF0;
+    uint8_t number = midi_pkt[1] & 0x7F;
+    uint8_t value[2] = {midi_pkt[2] & 0x7F, 0};
+
+    switch (status){
+    case STATUS_NOTE_OFF:
+        status = STATUS_NOTE_ON;
+        value[0] = 0;
+        break;
+    case STATUS_NOTE_ON:
+    case STATUS_CONTROL:
+        break;
+    case STATUS_PITCH_BEND:
+        number = 0;
+        value[0] = midi_pkt[1] & 0x7F;
+        value[1] = midi_pkt[2] & 0x7F;
+        break;
+    default:
+        return;
+    }
+    status |= midi_pkt[0] & 0x0F;
+
+    struct midi_rtp_journal_entry *entry = NULL;
+    for (size_t i=0; i<journal->n; i++){
+        if (journal->entries[i].status == status && journal->entries[i].number == number){
+            entry = &journal->entries[i];
+            break;
+        }
+    }
+    if (! entry && journal->n < journal->size){
+        entry = &journal->entries[journal->n++];
+    }
+    if (! entry){
+        entry = &journal->entries[0];
+        for (size_t i=1; i<journal->n; i++){
+            if ((int16_t) (journal->entries[i].seq - entry->seq) < 0){
+                entry = &journal->entries[i];
+            }
+        }
+        journal->overflows++;
+    }
+
+    *entry = (struct midi_rtp_journal_entry) {
+        .seq=seq, .status=status, .number=number, .value={value[0], value[1]},
+    };
+}
+
+void midi_rtp_journal_ack(struct midi_rtp_journal *journal, uint16_t seq)
+{
+    // Ignore late feedback
+    if ((int16_t) (seq - journal->checkpoint) <= 0){
+        return;
+    }
+    journal->checkpoint = seq;
+
+    size_t n = 0;
+    for (size_t i=0; i<journal->n; i++){
+        if ((int16_t) (journal->entries[i].seq - seq) > 0){
+            journal->entries[n++] = journal->entries[i];
+        }
+    }
+    journal->n = n;
+}
+
+/* Channel journal of a channel with entries: chapters C, W and N in this order */
+static int midi_rtp_journal_encode_channel(const struct midi_rtp_journal *journal, uint8_t channel,
+                                           uint8_t *buf, size_t size)
+{
+    size_t n_controls = 0;
+    size_t n_notes = 0;
+    const struct midi_rtp_journal_entry *wheel = NULL;
+    // Note Offs, bit 7 of octet k for the note 8 * k
+    uint8_t offbits[16] = {0};
+    int low = 15;
+    int high = -1;
+
+    for (size_t i=0; i<journal->n; i++){
+        const struct midi_rtp_journal_entry *entry = &journal->entries[i];
+        if ((entry->status & 0x0F) != channel){
+            continue;
+        }
+        switch (entry->status & 0xF0){
+        case STATUS_CONTROL:
+            n_controls++;
+            break;
+        case STATUS_PITCH_BEND:
+            wheel = entry;
+            break;
+        case STATUS_NOTE_ON:
+            if (entry->value[0]){
+                n_notes++;
+            } else {
+                offbits[entry->number >> 3] |= 0x80 >> (entry->number & 7);
+                low = MIN(low, entry->number >> 3);
+                high = MAX(high, entry->number >> 3);
+            }
+            break;
+        }
+    }
+    // LOW = 15 and HIGH = 0 codes no offbits, and 128 note logs with LEN = 127
+    if (n_notes == 127 && high < 0){
+        low = high = 0;
+    }
+    bool chapter_n = n_notes || high >= 0;
+    size_t n_offbits = high >= 0 ? high - low + 1 : 0;
+
+    size_t len = 3
+        + (n_controls ? 1 + 2 * n_controls : 0)
+        + (wheel ? 2 : 0)
+        + (chapter_n ? 2 + 2 * n_notes + n_offbits : 0);
+    if (len > size){
+        return -ENOMEM;
+    }
+
+    buf[0] = (channel << 3) | (len >> 8);
+    buf[1] = len & 0xFF;
+    buf[2] = (n_controls ? CHAPTER_C : 0) | (wheel ? CHAPTER_W : 0) | (chapter_n ? CHAPTER_N : 0);
+    size_t pos = 3;
+
+    if (n_controls){
+        buf[pos++] = n_controls - 1;
+        for (size_t i=0; i<journal->n; i++){
+            const struct midi_rtp_journal_entry *entry = &journal->entries[i];
+            if (entry->status == (STATUS_CONTROL | channel)){
+                buf[pos++] = entry->number;
+                buf[pos++] = entry->value[0];
+            }
+        }
+    }
+    if (wheel){
+        buf[pos++] = wheel->value[0];
+        buf[pos++] = wheel->value[1];
+    }
+    if (chapter_n){
+        buf[pos++] = n_notes & 0x7F;
+        buf[pos++] = high >= 0 ? (low << 4) | high : 0xF0;
+        for (size_t i=0; i<journal->n; i++){
+            const struct midi_rtp_journal_entry *entry = &journal->entries[i];
+            if (entry->status == (STATUS_NOTE_ON | channel) && entry->value[0]){
+                buf[pos++] = entry->number;
+                buf[pos++] = NOTE_LOG_Y | entry->value[0];
+            }
+        }
+        memcpy(&buf[pos], &offbits[low], n_offbits);
+        pos += n_offbits;
+    }
+    return pos;
+}
+
+static int midi_rtp_journal_encode(const struct midi_rtp_journal *journal, uint8_t *buf, size_t size)
+{
+    if (size < 3){
+        return -ENOMEM;
+    }
+
+    uint16_t channels = 0;
+    for (size_t i=0; i<journal->n; i++){
+        channels |= BIT(journal->entries[i].status & 0x0F);
+    }
+
+    size_t pos = 3;
+    int n_channels = 0;
+    for (uint8_t channel=0; channel<16; channel++){
+        if (channels & BIT(channel)){
+            int r = midi_rtp_journal_encode_channel(journal, channel, &buf[pos], size - pos);
+            if (r < 0){
+                return r;
+            }
+            pos += r;
+            n_channels++;
+        }
+    }
+
+    // No system journal, TOTCHAN is the number of channel journals - 1
+    buf[0] = JOURNAL_A | (n_channels - 1);
+    sys_put_be16(journal->checkpoint, &buf[1]);
+    return pos;
+}
+
+/* Delta time: 1 to 4 octets of 7 bits, most significant first */
+static size_t midi_rtp_put_delta(uint8_t *buf, uint32_t delta)
+{
+    delta = MIN(delta, 0x0FFFFFFF);
+    size_t n = 1;
+    for (uint32_t rest = delta >> 7; rest; rest >>= 7){
+        n++;
+    }
+    for (size_t i=0; i<n; i++){
+        buf[i] = ((delta >> (7 * (n - 1 - i))) & 0x7F) | (i < n - 1 ? 0x80 : 0);
+    }
+    return n;
+}
+
+int midi_rtp_encode(uint8_t *buf, size_t size, const struct midi_rtp_header *hdr,
+                    const struct midi_rtp_cmd *cmds, size_t n_cmds, const struct midi_rtp_journal *journal)
+{
+    if (size < MIDI_RTP_HEADER_SIZE + 2){
+        return -ENOMEM;
+    }
+
+    buf[0] = RTP_VERSION;
+    buf[1] = MIDI_RTP_PAYLOAD_TYPE;
+    sys_put_be16(hdr->seq, &buf[2]);
+    sys_put_be32(hdr->timestamp, &buf[4]);
+    sys_put_be32(hdr->ssrc, &buf[8]);
+
+    // The command list is written after a long header, and moved if it fits a short one
+    uint8_t *list = &buf[MIDI_RTP_HEADER_SIZE + 2];
+    size_t max_len = MIN(size - (MIDI_RTP_HEADER_SIZE + 2), CMD_MAX_LEN);
+    size_t len = 0;
+    uint32_t time = hdr->timestamp;
+    uint8_t running_status = 0;
+    bool first = true;
+    uint8_t flags = 0;
+
+    for (size_t i=0; i<n_cmds; i++){
+        uint8_t status = cmds[i].pkt[0];
+        size_t cmd_len = midi_status_length(status);
+        if (! cmd_len || status == STATUS_SYSEX_END){
+            continue;
+        }
+        if (len + 4 + cmd_len > max_len){
+            return -ENOMEM;
+        }
+
+        // The delta time of the first command is only coded when not 0
+        uint32_t delta = cmds[i].timestamp - time;
+        if (! first || delta){
+            len += midi_rtp_put_delta(&list[len], delta);
+            flags |= first ? CMD_Z : 0;
+        }
+        time = cmds[i].timestamp;
+        first = false;
+
+        // Running status between the channel messages, the System Common ones cancel it
+        if (status != running_status){
+            list[len++] = status;
+        }
+        if (status < STATUS_SYSEX_START){
+            running_status = status;
+        } else if (status < STATUS_REALTIME){
+            running_status = 0;
+        }
+        for (size_t k=1; k<cmd_len; k++){
+            list[len++] = cmds[i].pkt[k] & 0x7F;
+        }
+    }
+
+    size_t pos;
+    if (journal && journal->n){
+        flags |= CMD_J;
+    }
+    if (len <= CMD_LEN_MASK){
+        buf[MIDI_RTP_HEADER_SIZE] = flags | len;
+        memmove(&buf[MIDI_RTP_HEADER_SIZE + 1], list, len);
+        pos = MIDI_RTP_HEADER_SIZE + 1 + len;
+    } else {
+        buf[MIDI_RTP_HEADER_SIZE] = CMD_B | flags | (len >> 8);
+        buf[MIDI_RTP_HEADER_SIZE + 1] = len & 0xFF;
+        pos = MIDI_RTP_HEADER_SIZE + 2 + len;
+    }
+
+    if (flags & CMD_J){
+        int r = midi_rtp_journal_encode(journal, &buf[pos], size - pos);
+        if (r < 0){
+            return r;
+        }
+        pos += r;
+    }
+    return pos;
+}
+
+int midi_rtp_decode(const uint8_t *buf, size_t len, struct midi_rtp_header *hdr,
+                    midi_rtp_cmd_handler_t handler, void *user_data)
+{
+    if (len < MIDI_RTP_HEADER_SIZE + 1 || (buf[0] & RTP_VERSION_MASK) != RTP_VERSION
+        || (buf[1] & 0x7F) != MIDI_RTP_PAYLOAD_TYPE){
+        return -EINVAL;
+    }
+    hdr->seq = sys_get_be16(&buf[2]);
+    hdr->timestamp = sys_get_be32(&buf[4]);
+    hdr->ssrc = sys_get_be32(&buf[8]);
+
+    size_t pos = MIDI_RTP_HEADER_SIZE + 4 * (buf[0] & RTP_CSRC_COUNT_MASK);
+    if ((buf[0] & RTP_EXTENSION) && pos + 4 <= len){
+        pos += 4 + 4 * sys_get_be16(&buf[pos + 2]);
+    }
+    if (pos >= len){
+        return -EINVAL;
+    }
+
+    uint8_t flags = buf[pos++];
+    size_t list_len = flags & CMD_LEN_MASK;
+    if (flags & CMD_B){
+        if (pos >= len){
+            return -EINVAL;
+        }
+        list_len = (list_len << 8) | buf[pos++];
+    }
+    if (pos + list_len > len){
+        return -EINVAL;
+    }
+
+    size_t end = pos + list_len;
+    uint32_t time = hdr->timestamp;
+    uint8_t running_status = 0;
+    bool first = true;
+    int n = 0;
+
+    while (pos < end){
+        if (! first || (flags & CMD_Z)){
+            uint32_t delta = 0;
+            for (size_t k=0; k<4 && pos<end; k++){
+                uint8_t byte = buf[pos++];
+                delta = (delta << 7) | (byte & 0x7F);
+                if (! (byte & 0x80)){
+                    break;
+                }
+            }
+            time += delta;
+        }
+        first = false;
+        if (pos >= end){
+            break;
+        }
+
+        uint8_t status = buf[pos];
+        if (status & 0x80){
+            pos++;
+        } else if (running_status){
+            status = running_status;
+        } else {
+            return -EINVAL;
+        }
+
+        // SysEx segments end with 0xF7, 0xF0 (to be continued) or 0xF4 (cancelled)
+        if (status == STATUS_SYSEX_START || status == STATUS_SYSEX_END){
+            while (pos < end){
+                uint8_t byte = buf[pos++];
+                if (byte == STATUS_SYSEX_END || byte == STATUS_SYSEX_START || byte == STATUS_SYSEX_ABORT){
+                    break;
+                }
+            }
+            running_status = 0;
+            continue;
+        }
+
+        size_t cmd_len = midi_status_length(status);
+        if (! cmd_len || pos + cmd_len - 1 > end){
+            return -EINVAL;
+        }
+        struct midi_rtp_cmd cmd = {.timestamp=time, .pkt={status, 0, 0}};
+        for (size_t k=1; k<cmd_len; k++){
+            cmd.pkt[k] = buf[pos++];
+            if (cmd.pkt[k] & 0x80){
+                return -EINVAL;
+            }
+        }
+        if (status < STATUS_SYSEX_START){
+            running_status = status;
+        } else if (status < STATUS_REALTIME){
+            running_status = 0;
+        }
+
+        handler(&cmd, user_data);
+        n++;
+    }
+    return n;
+}
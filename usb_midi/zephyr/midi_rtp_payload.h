@@ -0,0 +1,113 @@
+/**
+ * RTP-MIDI payload (RFC 6295): the RTP header, the MIDI command section and
+ * the recovery journal of the packets of a session.
+ *
+ * The command section carries several MIDI commands per packet, with their
+ * delta times and running status. The recovery journal lets the receiver
+ * repair the state of the notes, controllers and pitch wheels after a packet
+ * loss: it codes the last value of each of them changed since the checkpoint,
+ * the last packet acknowledged by the receiver. Other commands are not
+ * journaled.
+ *
+ * Timestamps are in units of 100us, the rate of the AppleMIDI sessions.
+ */
+
+#ifndef MIDI_RTP_PAYLOAD_H_
+#define MIDI_RTP_PAYLOAD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MIDI_RTP_HEADER_SIZE 12
+#define MIDI_RTP_PAYLOAD_TYPE 97
+
+struct midi_rtp_header {
+    uint16_t seq;
+    uint32_t timestamp;
+    uint32_t ssrc;
+};
+
+/* A MIDI command (not SysEx) and its absolute timestamp */
+struct midi_rtp_cmd {
+    uint32_t timestamp;
+    uint8_t pkt[3];
+};
+
+/* Last value of a note, controller or pitch wheel of a channel */
+struct midi_rtp_journal_entry {
+    // Sequence number of the packet of its last change
+    uint16_t seq;
+    // 0x90 (notes), 0xB0 (controllers) or 0xE0 (pitch wheel) | channel
+    uint8_t status;
+    // Note or controller number, 0 for the pitch wheel
+    uint8_t number;
+    // Velocity (0 for a Note Off), controller value, or pitch wheel LSB and MSB
+    uint8_t value[2];
+};
+
+struct midi_rtp_journal {
+    struct midi_rtp_journal_entry *entries;
+    size_t size;
+    size_t n;
+    uint16_t checkpoint;
+    // Entries overwritten by newer ones before being acknowledged
+    uint32_t overflows;
+};
+
+/**
+ * @brief      Reset a journal
+ * @param      journal     The journal
+ * @param      entries     The storage of the entries
+ * @param[in]  size        The capacity of entries
+ * @param[in]  checkpoint  The sequence number before the first packet
+ */
+void midi_rtp_journal_init(struct midi_rtp_journal *journal, struct midi_rtp_journal_entry *entries,
+                           size_t size, uint16_t checkpoint);
+
+/**
+ * @brief      Record a command sent in a packet. When the journal is full,
+ *             the oldest entry is overwritten.
+ * @param[in]  seq       The sequence number of the packet
+ * @param[in]  midi_pkt  The MIDI command
+ */
+void midi_rtp_journal_record(struct midi_rtp_journal *journal, uint16_t seq, const uint8_t midi_pkt[3]);
+
+/**
+ * @brief      The receiver got all the packets up to seq: it becomes the
+ *             checkpoint, the entries of the previous packets are dropped
+ */
+void midi_rtp_journal_ack(struct midi_rtp_journal *journal, uint16_t seq);
+
+/**
+ * @brief      Encode a RTP-MIDI packet
+ * @param[out] buf      The packet
+ * @param[in]  size     The capacity of buf
+ * @param[in]  hdr      The RTP header, its timestamp is the time of the
+ *                      first command
+ * @param[in]  cmds     The MIDI commands, in time order
+ * @param[in]  n_cmds   The number of commands
+ * @param[in]  journal  The recovery journal of the previous packets, NULL
+ *                      for none
+ * @return     The size of the packet, -ENOMEM if it does not fit
+ */
+int midi_rtp_encode(uint8_t *buf, size_t size, const struct midi_rtp_header *hdr,
+                    const struct midi_rtp_cmd *cmds, size_t n_cmds, const struct midi_rtp_journal *journal);
+
+/* Called for each MIDI command of a decoded packet */
+typedef void (*midi_rtp_cmd_handler_t)(const struct midi_rtp_cmd *cmd, void *user_data);
+
+/**
+ * @brief      Decode a RTP-MIDI packet. The SysEx commands are skipped, the
+ *             recovery journal is ignored.
+ * @param[in]  buf        The packet
+ * @param[in]  len        The length of the packet
+ * @param[out] hdr        The RTP header
+ * @param[in]  handler    Called for each MIDI command, in order
+ * @param      user_data  Passed to the handler
+ * @return     The number of commands, -EINVAL for a malformed packet
+ */
+int midi_rtp_decode(const uint8_t *buf, size_t len, struct midi_rtp_header *hdr,
+                    midi_rtp_cmd_handler_t handler, void *user_data);
+
+#endif
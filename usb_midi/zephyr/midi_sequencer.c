@@ -0,0 +1,316 @@
+#include "midi_sequencer.h"
+#include "usb_midi.h"
+#include "midi_trace.h"
+
+#include <errno.h>
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+
+#include <zephyr/logging/log.h>
+LOG_MODULE_REGISTER(midi_sequencer, CONFIG_USB_MIDI_LOG_LEVEL);
+
+#define NSEC_PER_MIN (60ULL * NSEC_PER_SEC)
+
+static struct k_spinlock lock;
+static midi_seq_output_t output;
+static bool running;
+/* Incremented by each start, so that the thread sees a stop and a start
+ * that both happened while it was sleeping */
+static uint32_t generation;
+
+static uint32_t tempo = MIDI_SEQ_BPM(120);
+static uint64_t tick_period_ns;
+/* The ideal time of the next tick is base_ns + n_ticks * tick_period_ns,
+ * base_ns being the start of the sequence or the last tempo change */
+static uint64_t base_ns;
+static uint32_t n_ticks;
+
+static const struct midi_seq_pattern *pattern;
+static const struct midi_seq_pattern *next_pattern;
+static bool pattern_pending;
+static uint16_t position;
+static size_t next_event;
+
+/* Lateness of the ticks, in cycles */
+static struct {
+    uint32_t ticks;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} lateness = {.min = UINT32_MAX};
+
+/* Only wakes the idle thread up, which then looks at running */
+static K_SEM_DEFINE(seq_started, 0, 1);
+
+static inline uint64_t midi_seq_tick_period_ns(uint32_t tempo)
+{
+    return (NSEC_PER_MIN * 1000) / ((uint64_t) tempo * MIDI_SEQ_PPQN);
+}
+
+static void midi_seq_send(const uint8_t pkt[3])
+{
+    MIDI_TRACE("seq_out", MIDI_TRACE_PKT(pkt), position);
+    if (output){
+        output(pkt);
+    }
+}
+
+void midi_seq_set_output(midi_seq_output_t new_output)
+{
+    output = new_output;
+}
+
+int midi_seq_set_tempo(uint32_t new_tempo)
+{
+    if (new_tempo < MIDI_SEQ_MIN_TEMPO || new_tempo > MIDI_SEQ_MAX_TEMPO){
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (running){
+        // Keep the next tick where it is, the new period applies after it
+        base_ns += n_ticks * tick_period_ns;
+        n_ticks = 0;
+    }
+    tempo = new_tempo;
+    tick_period_ns = midi_seq_tick_period_ns(tempo);
+    k_spin_unlock(&lock, key);
+    return 0;
+}
+
+uint32_t midi_seq_get_tempo(void)
+{
+    return tempo;
+}
+
+int midi_seq_set_pattern(const struct midi_seq_pattern *new_pattern)
+{
+    if (new_pattern){
+        for (size_t i=0; i<new_pattern->n_events; i++){
+            if (new_pattern->events[i].tick >= new_pattern->length){
+                return -EINVAL;
+            }
+            // midi_seq_tick walks the events in order
+            if (i > 0 && new_pattern->events[i].tick < new_pattern->events[i - 1].tick){
+                return -EINVAL;
+            }
+        }
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    next_pattern = new_pattern;
+    pattern_pending = true;
+    k_spin_unlock(&lock, key);
+    return 0;
+}
+
+void midi_seq_start(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (running){
+        k_spin_unlock(&lock, key);
+        return;
+    }
+    running = true;
+    generation++;
+    tick_period_ns = midi_seq_tick_period_ns(tempo);
+    base_ns = k_ticks_to_ns_floor64(k_uptime_ticks());
+    n_ticks = 0;
+    position = 0;
+    next_event = 0;
+    k_spin_unlock(&lock, key);
+
+    k_sem_give(&seq_started);
+}
+
+bool midi_seq_is_running(void)
+{
+    return running;
+}
+
+void midi_seq_get_stats(struct midi_seq_stats *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    *stats = (struct midi_seq_stats) {.ticks = lateness.ticks};
+    if (lateness.ticks){
+        stats->late_min_us = k_cyc_to_us_floor32(lateness.min);
+        stats->late_avg_us = k_cyc_to_us_floor32(lateness.total / lateness.ticks);
+        stats->late_max_us = k_cyc_to_us_floor32(lateness.max);
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void midi_seq_reset_stats(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    lateness.ticks = 0;
+    lateness.min = UINT32_MAX;
+    lateness.max = 0;
+    lateness.total = 0;
+    k_spin_unlock(&lock, key);
+}
+
+static void midi_seq_record_lateness(uint64_t deadline_ns)
+{
+    int32_t late = k_cycle_get_32() - (uint32_t) k_ns_to_cyc_near64(deadline_ns);
+    uint32_t cycles = MAX(late, 0);
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    lateness.ticks++;
+    lateness.min = MIN(lateness.min, cycles);
+    lateness.max = MAX(lateness.max, cycles);
+    lateness.total += cycles;
+    k_spin_unlock(&lock, key);
+}
+
+/* Emit the clock, then the events of the pattern at this tick */
+static void midi_seq_tick(void)
+{
+    const uint8_t clock[3] = {MIDI_RT_CLOCK, 0, 0};
+    midi_seq_send(clock);
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (pattern_pending && (position == 0 || ! pattern)){
+        pattern = next_pattern;
+        pattern_pending = false;
+        position = 0;
+        next_event = 0;
+    }
+    const struct midi_seq_pattern *current = pattern;
+    k_spin_unlock(&lock, key);
+
+    if (! current){
+        return;
+    }
+
+    while (next_event < current->n_events && current->events[next_event].tick == position){
+        midi_seq_send(current->events[next_event].pkt);
+        next_event++;
+    }
+
+    position++;
+    if (position >= current->length){
+        position = 0;
+        next_event = 0;
+    }
+}
+
+static void midi_seq_thread(void *p1, void *p2, void *p3)
+{
+    const uint8_t start[3] = {MIDI_RT_START, 0, 0};
+    const uint8_t stop[3] = {MIDI_RT_STOP, 0, 0};
+
+    if (CONFIG_SYS_CLOCK_TICKS_PER_SEC < 10000){
+        LOG_WRN("Ticks of %dus, the clock jitter will be above 100us",
+                (int) (USEC_PER_SEC / CONFIG_SYS_CLOCK_TICKS_PER_SEC));
+    }
+
+    bool playing = false;
+    uint32_t played = 0;
+
+    while (true){
+        k_spinlock_key_t key = k_spin_lock(&lock);
+        bool stopped = playing && (! running || generation != played);
+        bool started = running && (! playing || generation != played);
+        played = generation;
+        uint64_t deadline_ns = base_ns + n_ticks * tick_period_ns;
+        k_spin_unlock(&lock, key);
+
+        if (stopped){
+            midi_seq_send(stop);
+            playing = false;
+        }
+        if (started){
+            midi_seq_send(start);
+            playing = true;
+        }
+        if (! playing){
+            k_sem_take(&seq_started, K_FOREVER);
+            continue;
+        }
+
+        k_sleep(K_TIMEOUT_ABS_TICKS(k_ns_to_ticks_ceil64(deadline_ns)));
+        // Woken up early by midi_seq_stop, or stopped and restarted meanwhile
+        if (! running || generation != played){
+            continue;
+        }
+
+        midi_seq_record_lateness(deadline_ns);
+        midi_seq_tick();
+
+        key = k_spin_lock(&lock);
+        if (generation == played){
+            n_ticks++;
+        }
+        k_spin_unlock(&lock, key);
+    }
+}
+
+K_THREAD_DEFINE(midi_seq_tid, CONFIG_MIDI_SEQUENCER_STACK_SIZE,
+                midi_seq_thread, NULL, NULL, NULL,
+                CONFIG_MIDI_SEQUENCER_PRIORITY, 0, 0);
+
+void midi_seq_stop(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    bool was_running = running;
+    running = false;
+    k_spin_unlock(&lock, key);
+
+    if (was_running){
+        k_wakeup(midi_seq_tid);
+    }
+}
+
+#if defined(CONFIG_SHELL)
+#include <stdlib.h>
+#include <zephyr/shell/shell.h>
+
+static int cmd_midi_seq_start(const struct shell *sh, size_t argc, char **argv)
+{
+    midi_seq_start();
+    return 0;
+}
+
+static int cmd_midi_seq_stop(const struct shell *sh, size_t argc, char **argv)
+{
+    midi_seq_stop();
+    return 0;
+}
+
+static int cmd_midi_seq_tempo(const struct shell *sh, size_t argc, char **argv)
+{
+    if (argc > 1){
+        if (midi_seq_set_tempo(MIDI_SEQ_BPM(strtoul(argv[1], NULL, 10)))){
+            shell_error(sh, "Tempo out of %u..%u BPM",
+                        MIDI_SEQ_MIN_TEMPO / 1000, MIDI_SEQ_MAX_TEMPO / 1000);
+            return -EINVAL;
+        }
+    }
+    uint32_t current = midi_seq_get_tempo();
+    shell_print(sh, "%u.%03u BPM", current / 1000, current % 1000);
+    return 0;
+}
+
+static int cmd_midi_seq_stats(const struct shell *sh, size_t argc, char **argv)
+{
+    struct midi_seq_stats stats;
+    midi_seq_get_stats(&stats);
+    midi_seq_reset_stats();
+
+    shell_print(sh, "%u ticks, lateness min %uus avg %uus max %uus",
+                stats.ticks, stats.late_min_us, stats.late_avg_us, stats.late_max_us);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(midi_seq_cmds,
+    SHELL_CMD(start, NULL, "Start the sequencer", cmd_midi_seq_start),
+    SHELL_CMD(stop, NULL, "Stop the sequencer", cmd_midi_seq_stop),
+    SHELL_CMD_ARG(tempo, NULL, "Show or set the tempo [bpm]", cmd_midi_seq_tempo, 1, 1),
+    SHELL_CMD(stats, NULL, "Show and reset the clock lateness", cmd_midi_seq_stats),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_SUBCMD_ADD((midi), seq, &midi_seq_cmds, "MIDI sequencer", NULL, 1, 0);
+
+#endif
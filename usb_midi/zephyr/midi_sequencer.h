@@ -0,0 +1,83 @@
+/**
+ * MIDI sequencer: MIDI clock at MIDI_SEQ_PPQN, and a looping pattern of
+ * MIDI events scheduled on the clock ticks.
+ *
+ * Every tick is emitted at an absolute deadline, computed from the start of
+ * the sequence (or the last tempo change) in nanoseconds: the time spent in
+ * the output does not accumulate as drift. The sequencer runs in its own
+ * cooperative thread, so the output may block (on a DIN UART for example).
+ */
+
+#ifndef MIDI_SEQUENCER_H_
+#define MIDI_SEQUENCER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Clock ticks per quarter note, as in the MIDI clock */
+#define MIDI_SEQ_PPQN 24
+
+/* Tempo in thousandths of BPM */
+#define MIDI_SEQ_BPM(bpm) ((uint32_t) ((bpm) * 1000))
+#define MIDI_SEQ_MIN_TEMPO MIDI_SEQ_BPM(20)
+#define MIDI_SEQ_MAX_TEMPO MIDI_SEQ_BPM(300)
+
+struct midi_seq_event {
+    // Position in the pattern, in clock ticks
+    uint16_t tick;
+    uint8_t pkt[3];
+};
+
+struct midi_seq_pattern {
+    // Events sorted by tick, all before length
+    const struct midi_seq_event *events;
+    size_t n_events;
+    // Length of the loop, in clock ticks
+    uint16_t length;
+};
+
+/* Lateness of the clock ticks, from their ideal time to their output */
+struct midi_seq_stats {
+    uint32_t ticks;
+    uint32_t late_min_us;
+    uint32_t late_avg_us;
+    uint32_t late_max_us;
+};
+
+/* Output of the sequencer, called from its thread */
+typedef void (*midi_seq_output_t)(const uint8_t pkt[3]);
+
+void midi_seq_set_output(midi_seq_output_t output);
+
+/**
+ * @brief      Set the tempo, effective from the next clock tick
+ * @param[in]  tempo  The tempo, see MIDI_SEQ_BPM
+ * @return     0 on success, -EINVAL if out of MIDI_SEQ_MIN_TEMPO..MIDI_SEQ_MAX_TEMPO
+ */
+int midi_seq_set_tempo(uint32_t tempo);
+
+uint32_t midi_seq_get_tempo(void);
+
+/**
+ * @brief      Set the pattern to play, from its start at the end of the
+ *             current pattern (immediately when stopped). NULL only sends
+ *             the clock. The pattern must stay valid while it is played.
+ * @return     0 on success, -EINVAL if an event is out of the pattern or the
+ *             events are not sorted by tick
+ */
+int midi_seq_set_pattern(const struct midi_seq_pattern *pattern);
+
+/* Send Start and the first clock tick now, then play the pattern */
+void midi_seq_start(void);
+
+/* Send Stop, immediately */
+void midi_seq_stop(void);
+
+bool midi_seq_is_running(void);
+
+void midi_seq_get_stats(struct midi_seq_stats *stats);
+
+void midi_seq_reset_stats(void);
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ * MIDI-aware trace points, emitted as named events of the Zephyr tracing
+ * subsystem (CTF format), next to its scheduling events.
+ *
+ * Names are limited to 20 characters by the CTF named_event. Both arguments
+ * are 32 bits; MIDI packets are packed with MIDI_TRACE_PKT.
+ */
+
+#ifndef MIDI_TRACE_H_
+#define MIDI_TRACE_H_
+
+#include <stdint.h>
+
+#if defined(CONFIG_USB_MIDI_TRACING)
+#include <zephyr/tracing/tracing.h>
+
+#define MIDI_TRACE(name, arg0, arg1) sys_trace_named_event((name), (arg0), (arg1))
+#else
+#define MIDI_TRACE(name, arg0, arg1) do {} while (0)
+#endif
+
+/* A MIDI packet as 0x00SSDDDD (status, then data bytes) */
+#define MIDI_TRACE_PKT(pkt) (((uint32_t) (pkt)[0] << 16) | ((uint32_t) (pkt)[1] << 8) | (pkt)[2])
+
+#endif
@@ -0,0 +1,155 @@
+#include "midi_transform.h"
+#include "usb_midi.h"
+
+#include <zephyr/sys/util.h>
+
+/*
+ * The tables are generated by the preprocessor: each entry is a constant
+ * expression folding the properties and the rules of the node.
+ */
+
+/* Element idx of an array property, or 0 past its end */
+#define ELEM_OR_0(node, prop, idx) \
+    COND_CODE_1(DT_PROP_HAS_IDX(node, prop, idx), (DT_PROP_BY_IDX(node, prop, idx)), (0))
+
+/* Channel map: `ch == idx ? out :` for each element of channel-map, then ch */
+#define CHANNEL_MAP_TERM(node, prop, idx, ch) ((ch) == (idx)) ? DT_PROP_BY_IDX(node, prop, idx) :
+
+#define CHANNEL_OUT(node, ch)                                                          \
+    (COND_CODE_1(DT_NODE_HAS_PROP(node, channel_map),                                  \
+        (DT_FOREACH_PROP_ELEM_VARGS(node, channel_map, CHANNEL_MAP_TERM, ch)), ())     \
+     (ch))
+
+/* Controller renumbering: `c == in ? out :` for each (in, out) pair of cc-map, then c */
+#define CC_MAP_TERM(node, prop, idx, c)                                                \
+    ((idx) % 2 == 0 && (c) == DT_PROP_BY_IDX(node, prop, idx)) ?                       \
+        ELEM_OR_0(node, prop, UTIL_INC(idx)) :
+
+#define CC_MAP_ENTRY(c, node)                                                          \
+    (COND_CODE_1(DT_NODE_HAS_PROP(node, cc_map),                                       \
+        (DT_FOREACH_PROP_ELEM_VARGS(node, cc_map, CC_MAP_TERM, c)), ())                \
+     (c))
+
+/*
+ * Curves: (x, y) breakpoints as pairs of elements, interpolated linearly.
+ * Their value is the sum of the terms of the segment before the first
+ * point, of each segment [x(k), x(k+1)[ and of the segment after the last
+ * point, only one of them being non zero.
+ */
+#define CURVE_X(node, prop, idx) DT_PROP_BY_IDX(node, prop, idx)
+#define CURVE_Y(node, prop, idx) ELEM_OR_0(node, prop, UTIL_INC(idx))
+#define CURVE_NEXT(idx) UTIL_INC(UTIL_INC(idx))
+
+#define CURVE_SEGMENT(node, prop, idx, v)                                              \
+    (((idx) % 2 == 0 && (v) >= CURVE_X(node, prop, idx)                                \
+      && (v) < CURVE_X(node, prop, CURVE_NEXT(idx))) ?                                 \
+        CURVE_Y(node, prop, idx) + ((v) - CURVE_X(node, prop, idx))                    \
+            * (CURVE_Y(node, prop, CURVE_NEXT(idx)) - CURVE_Y(node, prop, idx))        \
+            / MAX(CURVE_X(node, prop, CURVE_NEXT(idx)) - CURVE_X(node, prop, idx), 1)  \
+        : 0)
+
+#define CURVE_LAST(node, prop, idx, v) \
+    (((idx) % 2 == 0 && (v) >= CURVE_X(node, prop, idx)) ? CURVE_Y(node, prop, idx) : 0)
+
+#define CURVE_TERM(node, prop, idx, v)                                                 \
+    + COND_CODE_1(DT_PROP_HAS_IDX(node, prop, UTIL_INC(CURVE_NEXT(idx))),              \
+        (CURVE_SEGMENT(node, prop, idx, v)),                                           \
+        (CURVE_LAST(node, prop, idx, v)))
+
+#define CURVE(node, prop, v)                                                           \
+    (((v) < CURVE_X(node, prop, 0) ? CURVE_Y(node, prop, 0) : 0)                       \
+     DT_FOREACH_PROP_ELEM_VARGS(node, prop, CURVE_TERM, v))
+
+#define CC_CURVE_ENTRY(v, node) \
+    COND_CODE_1(DT_NODE_HAS_PROP(node, cc_curve), (CURVE(node, cc_curve, v)), (v))
+
+/* A Note On of velocity 0 is a Note Off: the curve keeps it, and never maps
+ * another velocity to 0 */
+#define VELOCITY_CURVE_ENTRY(v, node) \
+    COND_CODE_1(DT_NODE_HAS_PROP(node, velocity_curve), ((v) ? MAX(CURVE(node, velocity_curve, v), 1) : 0), (v))
+
+/* Note rules: `match ? entry :` for each child node, then the channel map */
+#define RULE_FIRST_NOTE(rule) \
+    COND_CODE_1(DT_NODE_HAS_PROP(rule, notes), (DT_PROP_BY_IDX(rule, notes, 0)), (0))
+
+#define RULE_MATCH(rule, ch, n)                                                        \
+    (COND_CODE_1(DT_NODE_HAS_PROP(rule, channel), ((ch) == DT_PROP(rule, channel)), (1)) \
+     && COND_CODE_1(DT_NODE_HAS_PROP(rule, notes),                                     \
+        ((n) >= DT_PROP_BY_IDX(rule, notes, 0) && (n) <= DT_PROP_BY_IDX(rule, notes, 1)), (1)))
+
+#define RULE_NOTE(rule, n) \
+    COND_CODE_1(DT_NODE_HAS_PROP(rule, to_note), (DT_PROP(rule, to_note) + (n) - RULE_FIRST_NOTE(rule)), (n))
+
+#define RULE_CHANNEL(rule, ch, n)                                                      \
+    COND_CODE_1(DT_NODE_HAS_PROP(rule, to_channel),                                    \
+        (DT_PROP(rule, to_channel) + (DT_PROP(rule, channel_per_note) ? (n) - RULE_FIRST_NOTE(rule) : 0)), \
+        (CHANNEL_OUT(DT_PARENT(rule), ch)))
+
+#define NOTE_ENTRY_OF(drop, channel, note)                                             \
+    (((drop) ? MIDI_TRANSFORM_DROP : 0)                                                \
+     | (((channel) & 0x0f) << MIDI_TRANSFORM_CHANNEL_SHIFT)                            \
+     | ((note) & MIDI_TRANSFORM_NOTE_MASK))
+
+#define NOTE_RULE_TERM(rule, ch, n)                                                    \
+    RULE_MATCH(rule, ch, n) ?                                                          \
+        NOTE_ENTRY_OF(DT_PROP(rule, drop), RULE_CHANNEL(rule, ch, n), RULE_NOTE(rule, n)) :
+
+#define NOTE_MAP_ENTRY(i, node)                                                        \
+    (DT_FOREACH_CHILD_VARGS(node, NOTE_RULE_TERM, ((i) >> 7), ((i) & 0x7f))           \
+     NOTE_ENTRY_OF(0, CHANNEL_OUT(node, ((i) >> 7)), ((i) & 0x7f)))
+
+#define DROP_CHANNEL_BIT(node, prop, idx) | BIT(DT_PROP_BY_IDX(node, prop, idx))
+
+#define CHANNEL_MAP_ENTRY(ch, node) CHANNEL_OUT(node, ch)
+
+#define MIDI_TRANSFORM_DEFINE(node)                                                    \
+    const struct midi_transform MIDI_TRANSFORM_NAME(node) = {                          \
+        .drop_channels = 0 COND_CODE_1(DT_NODE_HAS_PROP(node, drop_channels),          \
+            (DT_FOREACH_PROP_ELEM(node, drop_channels, DROP_CHANNEL_BIT)), ()),        \
+        .channel_map = {LISTIFY(16, CHANNEL_MAP_ENTRY, (,), node)},                    \
+        .cc_map = {LISTIFY(128, CC_MAP_ENTRY, (,), node)},                             \
+        .cc_curve = {LISTIFY(128, CC_CURVE_ENTRY, (,), node)},                         \
+        .velocity_curve = {LISTIFY(128, VELOCITY_CURVE_ENTRY, (,), node)},             \
+        .note_map = {LISTIFY(2048, NOTE_MAP_ENTRY, (,), node)},                        \
+    };
+
+DT_FOREACH_STATUS_OKAY(midi_transform, MIDI_TRANSFORM_DEFINE)
+
+bool midi_transform_apply(const struct midi_transform *transform, uint8_t midi_pkt[3])
+{
+    uint8_t cmd = midi_pkt[0] >> 4;
+    uint8_t channel = midi_pkt[0] & 0x0f;
+
+    if (cmd == MIDI_CMD_SINGLE_BYTE){
+        return true;
+    }
+    if (transform->drop_channels & BIT(channel)){
+        return false;
+    }
+
+    switch (cmd){
+    case MIDI_CMD_NOTE_ON:
+    case MIDI_CMD_NOTE_OFF:
+    case MIDI_CMD_POLY_KEYPRESS: {
+        uint16_t entry = transform->note_map[(channel << 7) | (midi_pkt[1] & 0x7f)];
+        if (entry & MIDI_TRANSFORM_DROP){
+            return false;
+        }
+        if (cmd == MIDI_CMD_NOTE_ON){
+            midi_pkt[2] = transform->velocity_curve[midi_pkt[2] & 0x7f];
+        }
+        midi_pkt[0] = (cmd << 4) | ((entry >> MIDI_TRANSFORM_CHANNEL_SHIFT) & 0x0f);
+        midi_pkt[1] = entry & MIDI_TRANSFORM_NOTE_MASK;
+        break;
+    }
+    case MIDI_CMD_CONTROL_CHANGE:
+        midi_pkt[0] = (cmd << 4) | transform->channel_map[channel];
+        midi_pkt[1] = transform->cc_map[midi_pkt[1] & 0x7f];
+        midi_pkt[2] = transform->cc_curve[midi_pkt[2] & 0x7f];
+        break;
+    default:
+        midi_pkt[0] = (cmd << 4) | transform->channel_map[channel];
+        break;
+    }
+    return true;
+}
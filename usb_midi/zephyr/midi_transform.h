@@ -0,0 +1,68 @@
+/**
+ * MIDI transforms: channel filters and remaps, per-channel note remaps,
+ * controller renumbering, velocity and Control Change response curves.
+ *
+ * Each midi-transform devicetree node (see dts/bindings/midi-transform.yaml)
+ * is compiled at build time into lookup tables: applying a transform to an
+ * event costs at most 3 table lookups (channel, controller and value of a
+ * Control Change; note and velocity of a Note On), whatever the number of
+ * rules. A transform can sit between any MIDI source and sink.
+ */
+
+#ifndef MIDI_TRANSFORM_H_
+#define MIDI_TRANSFORM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/sys/util.h>
+
+/* Entries of the note map: output note, output channel and drop flag */
+#define MIDI_TRANSFORM_NOTE_MASK     0x007f
+#define MIDI_TRANSFORM_CHANNEL_SHIFT 8
+#define MIDI_TRANSFORM_DROP          0x8000
+
+struct midi_transform {
+    // Bit n set to drop the channel messages of channel n
+    uint16_t drop_channels;
+    uint8_t channel_map[16];
+    uint8_t cc_map[128];
+    uint8_t cc_curve[128];
+    uint8_t velocity_curve[128];
+    // Note On, Note Off and Poly Pressure, indexed by (channel << 7) | note
+    uint16_t note_map[16 * 128];
+};
+
+#if defined(CONFIG_MIDI_TRANSFORM)
+
+#define MIDI_TRANSFORM_NAME(node_id) UTIL_CAT(midi_transform_, DT_DEP_ORD(node_id))
+
+/* The transform of a midi-transform node */
+#define MIDI_TRANSFORM_DT_GET(node_id) (&MIDI_TRANSFORM_NAME(node_id))
+
+#define MIDI_TRANSFORM_DECLARE(node_id) extern const struct midi_transform MIDI_TRANSFORM_NAME(node_id);
+
+DT_FOREACH_STATUS_OKAY(midi_transform, MIDI_TRANSFORM_DECLARE)
+
+/**
+ * @brief      Apply a transform to a MIDI message, in place. The system
+ *             messages are left unchanged.
+ * @param[in]  transform  The transform
+ * @param      midi_pkt   The MIDI message
+ * @return     true if the message is kept, false if it is filtered out
+ */
+bool midi_transform_apply(const struct midi_transform *transform, uint8_t midi_pkt[3]);
+
+#else
+
+/* Without CONFIG_MIDI_TRANSFORM, the transforms keep all messages unchanged */
+#define MIDI_TRANSFORM_DT_GET(node_id) ((const struct midi_transform *) NULL)
+
+static inline bool midi_transform_apply(const struct midi_transform *transform, uint8_t midi_pkt[3])
+{
+    return true;
+}
+
+#endif
+
+#endif
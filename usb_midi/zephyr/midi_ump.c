@@ -0,0 +1,218 @@
+#include "midi_ump.h"
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/sys/util.h>
+
+#define SYSEX_START 0xF0
+#define SYSEX_END   0xF7
+
+/* Status of the SysEx7 UMPs */
+#define SYSEX7_COMPLETE 0x0
+#define SYSEX7_START    0x1
+#define SYSEX7_CONTINUE 0x2
+#define SYSEX7_END      0x3
+
+#define SYSEX7_BYTES 6
+
+/* Form of the UMP Stream messages, split like the SysEx7 ones */
+#define STREAM_COMPLETE 0x0
+#define STREAM_START    0x1
+#define STREAM_CONTINUE 0x2
+#define STREAM_END      0x3
+
+const uint8_t midi_ump_words_table[16] = {
+    1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4,
+};
+
+uint32_t midi_ump_scale7(uint8_t value)
+{
+    uint32_t scaled = (uint32_t) value << 25;
+    if (value <= 64){
+        return scaled;
+    }
+
+    // Above the center, the 6 low bits are repeated down to the bit 0
+    uint32_t repeat = (uint32_t) (value & 0x3f) << 19;
+    while (repeat){
+        scaled |= repeat;
+        repeat >>= 6;
+    }
+    return scaled;
+}
+
+uint32_t midi_ump_from_midi1(uint8_t group, const uint8_t midi_pkt[3])
+{
+    uint8_t status = midi_pkt[0];
+    size_t len = midi_status_length(status);
+    if (len == 0 || status == SYSEX_END){
+        return 0;
+    }
+
+    uint32_t mt = (status >= 0xF0) ? MIDI_UMP_MT_SYSTEM : MIDI_UMP_MT_MIDI1;
+    return (mt << 28) | ((uint32_t) group << 24) | ((uint32_t) status << 16)
+        | (len > 1 ? midi_pkt[1] << 8 : 0)
+        | (len > 2 ? midi_pkt[2] : 0);
+}
+
+int midi_ump_to_midi1(const uint32_t *ump, uint8_t midi_pkt[3])
+{
+    uint8_t status = ump[0] >> 16;
+    uint8_t index = ump[0] >> 8;
+
+    switch (MIDI_UMP_MT(ump[0])){
+    case MIDI_UMP_MT_SYSTEM:
+    case MIDI_UMP_MT_MIDI1:
+        if (midi_status_length(status) == 0 || status == SYSEX_END){
+            return -ENOTSUP;
+        }
+        midi_pkt[0] = status;
+        midi_pkt[1] = index & 0x7f;
+        midi_pkt[2] = ump[0] & 0x7f;
+        return 0;
+
+    case MIDI_UMP_MT_MIDI2:
+        midi_pkt[0] = status;
+        midi_pkt[1] = index & 0x7f;
+        switch (status >> 4){
+        case 0x8:
+            midi_pkt[2] = ump[1] >> 25;
+            return 0;
+        case 0x9:
+            // A velocity of 0 is a Note On in MIDI 2.0, not a Note Off
+            midi_pkt[2] = MAX(ump[1] >> 25, 1);
+            return 0;
+        case 0xA:
+        case 0xB:
+            midi_pkt[2] = ump[1] >> 25;
+            return 0;
+        case 0xC:
+            midi_pkt[1] = (ump[1] >> 24) & 0x7f;
+            midi_pkt[2] = 0;
+            return 0;
+        case 0xD:
+            midi_pkt[1] = ump[1] >> 25;
+            midi_pkt[2] = 0;
+            return 0;
+        case 0xE:
+            midi_pkt[1] = (ump[1] >> 18) & 0x7f;
+            midi_pkt[2] = ump[1] >> 25;
+            return 0;
+        default:
+            // Registered, assignable and per-note controllers
+            return -ENOTSUP;
+        }
+
+    default:
+        return -ENOTSUP;
+    }
+}
+
+size_t midi_ump_sysex_segment(uint8_t group, const uint8_t *sysex, size_t len, size_t *pos,
+                              uint32_t ump[][2], size_t max_umps)
+{
+    // The payload, between 0xF0 and 0xF7
+    const size_t end = len - 1;
+    size_t i = MAX(*pos, 1);
+    size_t n_umps = 0;
+
+    while (n_umps < max_umps && *pos < len){
+        size_t n = MIN(end - i, SYSEX7_BYTES);
+        bool first = i == 1;
+        bool last = i + n == end;
+        uint8_t status = first ? (last ? SYSEX7_COMPLETE : SYSEX7_START) : (last ? SYSEX7_END : SYSEX7_CONTINUE);
+
+        uint8_t bytes[SYSEX7_BYTES] = {0};
+        memcpy(bytes, &sysex[i], n);
+        ump[n_umps][0] = (MIDI_UMP_MT_SYSEX7 << 28) | ((uint32_t) group << 24) | (status << 20) | (n << 16)
+            | (bytes[0] << 8) | bytes[1];
+        ump[n_umps][1] = ((uint32_t) bytes[2] << 24) | (bytes[3] << 16) | (bytes[4] << 8) | bytes[5];
+        n_umps++;
+
+        i += n;
+        *pos = last ? len : i;
+    }
+    return n_umps;
+}
+
+size_t midi_ump_sysex_bytes(const uint32_t ump[2], uint8_t bytes[8])
+{
+    uint8_t status = (ump[0] >> 20) & 0x0f;
+    size_t n = MIN((ump[0] >> 16) & 0x0f, SYSEX7_BYTES);
+    const uint8_t data[SYSEX7_BYTES] = {ump[0] >> 8, ump[0], ump[1] >> 24, ump[1] >> 16, ump[1] >> 8, ump[1]};
+    size_t len = 0;
+
+    if (status == SYSEX7_COMPLETE || status == SYSEX7_START){
+        bytes[len++] = SYSEX_START;
+    }
+    for (size_t i=0; i<n; i++){
+        bytes[len++] = data[i] & 0x7f;
+    }
+    if (status == SYSEX7_COMPLETE || status == SYSEX7_END){
+        bytes[len++] = SYSEX_END;
+    }
+    return len;
+}
+
+static void midi_ump_sysex_append(struct midi_sysex_assembler *assembler, uint8_t byte)
+{
+    if (assembler->len < assembler->size){
+        assembler->buf[assembler->len++] = byte;
+    } else {
+        assembler->overflow = true;
+    }
+}
+
+int midi_ump_sysex_assemble(struct midi_sysex_assembler *assembler, const uint32_t ump[2])
+{
+    uint8_t status = (ump[0] >> 20) & 0x0f;
+    size_t n = MIN((ump[0] >> 16) & 0x0f, SYSEX7_BYTES);
+    const uint8_t bytes[SYSEX7_BYTES] = {ump[0] >> 8, ump[0], ump[1] >> 24, ump[1] >> 16, ump[1] >> 8, ump[1]};
+
+    if (status == SYSEX7_COMPLETE || status == SYSEX7_START){
+        assembler->receiving = true;
+        assembler->overflow = false;
+        assembler->len = 0;
+        midi_ump_sysex_append(assembler, SYSEX_START);
+    }
+    if (! assembler->receiving){
+        return 0;
+    }
+
+    for (size_t i=0; i<n; i++){
+        midi_ump_sysex_append(assembler, bytes[i] & 0x7f);
+    }
+    if (status == SYSEX7_START || status == SYSEX7_CONTINUE){
+        return 0;
+    }
+
+    midi_ump_sysex_append(assembler, SYSEX_END);
+    assembler->receiving = false;
+    return assembler->overflow ? -ENOMEM : (int) assembler->len;
+}
+
+bool midi_ump_stream_name(uint16_t status, int fb, const char *name, size_t *pos, uint32_t ump[4])
+{
+    uint8_t bytes[4 * MIDI_UMP_MAX_WORDS] = {0};
+    size_t header = (fb >= 0) ? 3 : 2;
+    size_t len = strlen(name);
+    size_t n = MIN(len - *pos, sizeof(bytes) - header);
+
+    bool first = *pos == 0;
+    bool last = *pos + n == len;
+    uint8_t form = first ? (last ? STREAM_COMPLETE : STREAM_START) : (last ? STREAM_END : STREAM_CONTINUE);
+
+    bytes[0] = (MIDI_UMP_MT_STREAM << 4) | (form << 2) | (status >> 8);
+    bytes[1] = status;
+    if (fb >= 0){
+        bytes[2] = fb;
+    }
+    memcpy(&bytes[header], &name[*pos], n);
+    *pos += n;
+
+    for (size_t i=0; i<MIDI_UMP_MAX_WORDS; i++){
+        ump[i] = ((uint32_t) bytes[4 * i] << 24) | (bytes[4 * i + 1] << 16) | (bytes[4 * i + 2] << 8)
+            | bytes[4 * i + 3];
+    }
+    return ! last;
+}
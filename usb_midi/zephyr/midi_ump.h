@@ -0,0 +1,146 @@
+/**
+ * Universal MIDI Packets (UMP), the messages of the USB MIDI 2.0 alternate
+ * setting: see "Universal MIDI Packet (UMP) Format and MIDI 2.0 Protocol",
+ * v1.1 (M2-104-UM).
+ *
+ * A message is 1 to 4 words of 32 bits, its size is given by the message
+ * type in the top 4 bits of its first word, followed by its group (the
+ * USB-MIDI cable number). Words are in the CPU order here, the transfers
+ * carry them in little endian.
+ */
+
+#ifndef MIDI_UMP_H_
+#define MIDI_UMP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "midi_codec.h"
+
+#define MIDI_UMP_MAX_WORDS 4
+
+/* Message types */
+#define MIDI_UMP_MT_UTILITY 0x0
+#define MIDI_UMP_MT_SYSTEM  0x1
+#define MIDI_UMP_MT_MIDI1   0x2
+#define MIDI_UMP_MT_SYSEX7  0x3
+#define MIDI_UMP_MT_MIDI2   0x4
+#define MIDI_UMP_MT_STREAM  0xF
+
+#define MIDI_UMP_MT(word)    ((word) >> 28)
+#define MIDI_UMP_GROUP(word) (((word) >> 24) & 0x0f)
+
+/* Jitter reduction timestamps count periods of 1/31250s, on 16 bits */
+#define MIDI_UMP_JR_TICK_US 32
+
+/* UMP Stream message status (UMP 1.1, 7.1) */
+#define MIDI_UMP_STREAM_ENDPOINT_DISCOVERY   0x000
+#define MIDI_UMP_STREAM_ENDPOINT_INFO        0x001
+#define MIDI_UMP_STREAM_ENDPOINT_NAME        0x003
+#define MIDI_UMP_STREAM_CONFIG_REQUEST       0x005
+#define MIDI_UMP_STREAM_CONFIG_NOTIFY        0x006
+#define MIDI_UMP_STREAM_FB_DISCOVERY         0x010
+#define MIDI_UMP_STREAM_FB_INFO              0x011
+#define MIDI_UMP_STREAM_FB_NAME              0x012
+
+#define MIDI_UMP_STREAM_STATUS(word) (((word) >> 16) & 0x3ff)
+
+/* Protocols of the Stream Configuration */
+#define MIDI_UMP_PROTOCOL_MIDI1 0x01
+#define MIDI_UMP_PROTOCOL_MIDI2 0x02
+
+/* Number of words of the messages of each type */
+extern const uint8_t midi_ump_words_table[16];
+
+static inline size_t midi_ump_words(uint32_t word0)
+{
+    return midi_ump_words_table[MIDI_UMP_MT(word0)];
+}
+
+static inline uint32_t midi_ump_jr_clock(uint16_t time)
+{
+    return 0x00100000 | time;
+}
+
+static inline uint32_t midi_ump_jr_timestamp(uint16_t time)
+{
+    return 0x00200000 | time;
+}
+
+/* MIDI 2.0 Control Change, with a 32 bits value */
+static inline void midi_ump_control_change(uint8_t group, uint8_t channel, uint8_t cc, uint32_t value,
+                                           uint32_t ump[2])
+{
+    ump[0] = (MIDI_UMP_MT_MIDI2 << 28) | (group << 24) | ((0xB0 | channel) << 16) | (cc << 8);
+    ump[1] = value;
+}
+
+/**
+ * @brief      Scale a 7 bits value up to 32 bits, by the min-center-max
+ *             scaling of the MIDI 2.0 protocol: 0, 64 and 127 are mapped to
+ *             0, 0x80000000 and 0xFFFFFFFF
+ */
+uint32_t midi_ump_scale7(uint8_t value);
+
+/**
+ * @brief      Convert a MIDI 1.0 message (not SysEx) to a UMP of one word:
+ *             a System message (MT 1) or a MIDI 1.0 Channel Voice message
+ *             (MT 2)
+ * @return     The UMP, 0 (a NOOP) for a SysEx or an undefined status
+ */
+uint32_t midi_ump_from_midi1(uint8_t group, const uint8_t midi_pkt[3]);
+
+/**
+ * @brief      Convert a System, MIDI 1.0 or MIDI 2.0 Channel Voice UMP to a
+ *             MIDI 1.0 message. The values of MIDI 2.0 are truncated to 7
+ *             (14 for the pitch bend) bits, its Program Change loses its bank.
+ * @return     0 on success, -ENOTSUP for the other messages, and the MIDI 2.0
+ *             messages without a MIDI 1.0 equivalent
+ */
+int midi_ump_to_midi1(const uint32_t *ump, uint8_t midi_pkt[3]);
+
+/**
+ * @brief      Segment a SysEx message in SysEx7 UMPs of 6 bytes, without its
+ *             0xF0 and 0xF7
+ * @param[in]  group     The UMP group
+ * @param[in]  sysex     The SysEx message, from 0xF0 to 0xF7 included
+ * @param[in]  len       The length of the message
+ * @param      pos       The position of the next UMP in the message, from 0,
+ *                       updated to the end of the last UMP
+ * @param[out] ump       The UMPs
+ * @param[in]  max_umps  The capacity of ump
+ * @return     The number of UMPs
+ */
+size_t midi_ump_sysex_segment(uint8_t group, const uint8_t *sysex, size_t len, size_t *pos,
+                              uint32_t ump[][2], size_t max_umps);
+
+/**
+ * @brief      Get the MIDI 1.0 bytes of a SysEx7 UMP: its data bytes, after
+ *             0xF0 if it starts a message, followed by 0xF7 if it ends one
+ * @return     The number of bytes, up to 8
+ */
+size_t midi_ump_sysex_bytes(const uint32_t ump[2], uint8_t bytes[8]);
+
+/**
+ * @brief      Add a SysEx7 UMP to the message being reassembled, with its
+ *             0xF0 and 0xF7 (see midi_sysex_assemble)
+ * @return     The length of the message when complete, 0 if in progress,
+ *             -ENOMEM if the complete message did not fit in the buffer
+ */
+int midi_ump_sysex_assemble(struct midi_sysex_assembler *assembler, const uint32_t ump[2]);
+
+/**
+ * @brief      Build the next UMP Stream message of a name: 14 bytes of UTF-8
+ *             per message, 13 after a function block number
+ * @param[in]  status  The Stream status (MIDI_UMP_STREAM_*_NAME)
+ * @param[in]  fb      The function block number, -1 for none
+ * @param[in]  name    The name
+ * @param      pos     The position of the message in name, from 0, updated
+ *                     to the end of the message
+ * @param[out] ump     The message
+ * @return     true if more messages follow
+ */
+bool midi_ump_stream_name(uint16_t status, int fb, const char *name, size_t *pos, uint32_t ump[4]);
+
+#endif
@@ -1,5 +1,6 @@
 /**
  * See https://www.usb.org/document-library/usb-midi-devices-10
+ * and https://www.usb.org/document-library/usb-midi-devices-20
  */
 
 #include <zephyr/kernel.h>
@@ -9,47 +10,269 @@
 #include <zephyr/usb/usb_device.h>
 
 #include "usb_midi.h"
+#include "usb_midi_ring.h"
+#include "midi_trace.h"
+#include "midi_monitor.h"
+#include "midi_clock.h"
 
 #include <zephyr/logging/log.h>
 LOG_MODULE_REGISTER(usb_midi, CONFIG_USB_MIDI_LOG_LEVEL);
 
-/*             
+/*
+Each cable n of the function has 4 jacks:
+
 MIDI sockets   USB-MIDI function                USB function (host)
 ------------   -----------------                -------------------
 
                ---------------------------
                |                         |
-               *   EMB_OUT_INT_MIDI_IN >-*-0-+
-               |                         |   +---> MIDI_IN_ENDPOINT
-EXT_MIDI_IN  >-*-> EMB_OUT_EXT_MIDI_IN >-*-1-+
+EXT_IN(n)    >-*-> EMB_OUT(n)  >---------*-n---> MIDI_IN_ENDPOINT
                |                         |
-EXT_MIDI_OUT <-*-< EMB_IN_EXT_MIDI_OUT <-*------< MIDI_OUT_ENDPOINT
+EXT_OUT(n)   <-*-< EMB_IN(n)   <---------*-n---< MIDI_OUT_ENDPOINT
                |                         |
                ---------------------------
- */
 
+The cables, and the names of their embedded jacks, come from the usb-midi
+devicetree node.
+
+With CONFIG_USB_MIDI2, the alternate setting 1 of the interface carries UMPs
+on its own pair of endpoints: the legacy device stack cannot share an endpoint
+between alternate settings. Each cable n is a bidirectional Group Terminal
+Block n+1 on the group n, and a Function Block n described by UMP Stream
+messages. Hosts without USB MIDI 2.0 support stay on the alternate setting 0.
+ */
 
-#define EXTERNAL_MIDI_IN_ID  1
-#define EXTERNAL_MIDI_OUT_ID 2
-#define EMBEDDED_OUT_INTERNAL_MIDI_IN_ID 3
-#define EMBEDDED_OUT_EXTERNAL_MIDI_IN_ID 4
-#define EMBEDDED_IN_EXTERNAL_MIDI_OUT_ID 5
+#define CABLE_EMB_IN_ID(n)  (4 * (n) + 1)
+#define CABLE_EXT_OUT_ID(n) (4 * (n) + 2)
+#define CABLE_EXT_IN_ID(n)  (4 * (n) + 3)
+#define CABLE_EMB_OUT_ID(n) (4 * (n) + 4)
 #define MIDI_IN_ENDPOINT_ID  0x81
 #define MIDI_OUT_ENDPOINT_ID 0x01
+#define UMP_IN_ENDPOINT_ID   0x82
+#define UMP_OUT_ENDPOINT_ID  0x02
+#define CABLE_GR_TRM_BLOCK_ID(n) ((n) + 1)
+
+#if defined(CONFIG_USB_MIDI2_JR_TIMESTAMPS)
+#define GR_TRM_PROTOCOL GR_TRM_PROTOCOL_MIDI_2_0_JRTS
+#else
+#define GR_TRM_PROTOCOL GR_TRM_PROTOCOL_MIDI_2_0
+#endif
+
+/* Group Terminal Block of cable n, with iBlockItem as its name */
+#define CABLE_GR_TRM_BLOCK(n, iBlockItem) \
+    MIDI2_GR_TRM_BLOCK(CABLE_GR_TRM_BLOCK_ID(n), (n), 1, iBlockItem, GR_TRM_PROTOCOL)
+
+/* Jack descriptors of cable n, with iJack as the name of its embedded jacks */
+#define CABLE_JACKS(n, iJack) \
+    MIDI_JACKIN_DESCRIPTOR(JACK_EMBEDDED, CABLE_EMB_IN_ID(n), iJack), \
+    MIDI_JACKOUT_DESCRIPTOR(JACK_EXTERNAL, CABLE_EXT_OUT_ID(n), 0, CABLE_EMB_IN_ID(n), 1), \
+    MIDI_JACKIN_DESCRIPTOR(JACK_EXTERNAL, CABLE_EXT_IN_ID(n), 0), \
+    MIDI_JACKOUT_DESCRIPTOR(JACK_EMBEDDED, CABLE_EMB_OUT_ID(n), iJack, CABLE_EXT_IN_ID(n), 1)
+
+#if DT_NODE_EXISTS(USB_MIDI_NODE)
+
+BUILD_ASSERT(USB_MIDI_N_CABLES <= 16, "USB-MIDI supports up to 16 cables");
+
+/*
+ * The iJack strings follow the language, manufacturer, product and serial
+ * number strings of the USB device stack. Like them, they are written in
+ * ASCII and converted to UTF16LE by the stack.
+ */
+#define USB_MIDI_FIRST_STRING_INDEX 4
+
+#define DT_CABLE_JACKS(node) \
+    CABLE_JACKS(USB_MIDI_CABLE(node), USB_MIDI_FIRST_STRING_INDEX + USB_MIDI_CABLE(node))
+#define DT_CABLE_EMB_IN_ID(node)  CABLE_EMB_IN_ID(USB_MIDI_CABLE(node))
+#define DT_CABLE_EMB_OUT_ID(node) CABLE_EMB_OUT_ID(USB_MIDI_CABLE(node))
+#define DT_CABLE_NAME(node) DT_PROP(node, cable_name)
+#define DT_CABLE_GR_TRM_BLOCK(node) \
+    CABLE_GR_TRM_BLOCK(USB_MIDI_CABLE(node), USB_MIDI_FIRST_STRING_INDEX + USB_MIDI_CABLE(node))
+#define DT_CABLE_GR_TRM_BLOCK_ID(node) CABLE_GR_TRM_BLOCK_ID(USB_MIDI_CABLE(node))
+
+#define ALL_CABLES(fn) DT_FOREACH_CHILD_SEP(USB_MIDI_NODE, fn, (,))
+
+#define DT_CABLE_STRING_DESCRIPTOR(node)                                    \
+    struct {                                                                \
+        uint8_t bLength;                                                    \
+        uint8_t bDescriptorType;                                            \
+        uint8_t bString[sizeof(DT_PROP(node, cable_name)) * 2 - 2];         \
+    } __packed UTIL_CAT(cable_, DT_DEP_ORD(node));
+
+#define DT_CABLE_STRING_DESCRIPTOR_INIT(node)                               \
+    {                                                                       \
+        .bLength = sizeof(DT_PROP(node, cable_name)) * 2,                   \
+        .bDescriptorType = USB_DESC_STRING,                                 \
+        .bString = DT_PROP(node, cable_name),                               \
+    }
+
+USBD_STRING_DESCR_USER_DEFINE(primary) struct {
+    DT_FOREACH_CHILD(USB_MIDI_NODE, DT_CABLE_STRING_DESCRIPTOR)
+} __packed usb_midi_cable_strings = {
+    ALL_CABLES(DT_CABLE_STRING_DESCRIPTOR_INIT)
+};
+
+static const char *const cable_names[USB_MIDI_N_CABLES] = {ALL_CABLES(DT_CABLE_NAME)};
+
+/* Cable numbers are given by the order of the jacks in the descriptors: the
+ * enumerators number the child nodes in order, each one has to match the
+ * cable number of its node */
+#define DT_CABLE_INDEX(node) UTIL_CAT(USB_MIDI_CABLE_INDEX_, DT_DEP_ORD(node))
+enum {
+    ALL_CABLES(DT_CABLE_INDEX)
+};
+
+#define DT_CABLE_CHECK(node)                                                \
+    BUILD_ASSERT(USB_MIDI_CABLE(node) == DT_CABLE_INDEX(node),              \
+                 "The cable " DT_NODE_FULL_NAME(node) " must be the child " \
+                 "of the usb-midi node at the index of its cable number");
+DT_FOREACH_CHILD(USB_MIDI_NODE, DT_CABLE_CHECK)
+
+#define USB_MIDI_CS_IF0 \
+    MIDISTREAMING_CONFIG( \
+        ALL_CABLES(DT_CABLE_JACKS), \
+        MIDI_BULK_ENDPOINT(MIDI_IN_ENDPOINT_ID, ALL_CABLES(DT_CABLE_EMB_OUT_ID)), \
+        MIDI_BULK_ENDPOINT(MIDI_OUT_ENDPOINT_ID, ALL_CABLES(DT_CABLE_EMB_IN_ID)), \
+    )
+
+#define USB_MIDI_CS_IF1 \
+    MIDI2_STREAMING_CONFIG( \
+        MIDI2_BULK_ENDPOINT(UMP_IN_ENDPOINT_ID, ALL_CABLES(DT_CABLE_GR_TRM_BLOCK_ID)), \
+        MIDI2_BULK_ENDPOINT(UMP_OUT_ENDPOINT_ID, ALL_CABLES(DT_CABLE_GR_TRM_BLOCK_ID)), \
+    )
+
+#define USB_MIDI_GR_TRM_BLOCKS MIDI2_GR_TRM_BLOCKS(ALL_CABLES(DT_CABLE_GR_TRM_BLOCK))
+
+#else
+
+#define CABLE_JACKS_UNNAMED(n, _) CABLE_JACKS(n, 0)
+#define CABLE_ID(n, fn) fn(n)
+
+#define ALL_CABLES_JACKS() LISTIFY(USB_MIDI_N_CABLES, CABLE_JACKS_UNNAMED, (,))
+#define ALL_CABLES_IDS(fn) LISTIFY(USB_MIDI_N_CABLES, CABLE_ID, (,), fn)
+#define CABLE_GR_TRM_BLOCK_UNNAMED(n, _) CABLE_GR_TRM_BLOCK(n, 0)
+
+static const char *const cable_names[USB_MIDI_N_CABLES];
+
+#define USB_MIDI_CS_IF0 \
+    MIDISTREAMING_CONFIG( \
+        ALL_CABLES_JACKS(), \
+        MIDI_BULK_ENDPOINT(MIDI_IN_ENDPOINT_ID, ALL_CABLES_IDS(CABLE_EMB_OUT_ID)), \
+        MIDI_BULK_ENDPOINT(MIDI_OUT_ENDPOINT_ID, ALL_CABLES_IDS(CABLE_EMB_IN_ID)), \
+    )
+
+#define USB_MIDI_CS_IF1 \
+    MIDI2_STREAMING_CONFIG( \
+        MIDI2_BULK_ENDPOINT(UMP_IN_ENDPOINT_ID, ALL_CABLES_IDS(CABLE_GR_TRM_BLOCK_ID)), \
+        MIDI2_BULK_ENDPOINT(UMP_OUT_ENDPOINT_ID, ALL_CABLES_IDS(CABLE_GR_TRM_BLOCK_ID)), \
+    )
+
+#define USB_MIDI_GR_TRM_BLOCKS \
+    MIDI2_GR_TRM_BLOCKS(LISTIFY(USB_MIDI_N_CABLES, CABLE_GR_TRM_BLOCK_UNNAMED, (,)))
+
+#endif
 
 static void usb_midi_send_to_host();
 static void usb_midi_receive_from_host();
 
-K_SEM_DEFINE(data_to_host_ready, 0, 1);
 K_SEM_DEFINE(data_from_host_ready, 0, 1);
 
 K_WORK_DEFINE(usb_midi_to_host_work, usb_midi_send_to_host);
 K_WORK_DEFINE(usb_midi_from_host_work, usb_midi_receive_from_host);
 
-RING_BUF_ITEM_DECLARE_POW2(usb_midi_to_host_buf, 6);
-RING_BUF_ITEM_DECLARE_POW2(usb_midi_from_host_buf, 6);
+/* Items of 32 bits: one USB-MIDI packet each */
+RING_BUF_ITEM_DECLARE_POW2(usb_midi_to_host_buf, CONFIG_USB_MIDI_TO_HOST_QUEUE_POW2);
+/* The producers of usb_midi_to_host_buf are the application threads, the
+ * work queue (JR clock) and the USB transfer completions (UMP Stream replies):
+ * each packet or UMP is put under this lock, its consumer is the work queue */
+static struct k_spinlock to_host_lock;
+RING_BUF_ITEM_DECLARE_POW2(usb_midi_from_host_buf, CONFIG_USB_MIDI_FROM_HOST_QUEUE_POW2);
+
+BUILD_ASSERT(BIT(CONFIG_USB_MIDI_FROM_HOST_QUEUE_POW2) * 4 >= MIDI_BULK_SIZE,
+             "The queue from the host must hold a bulk packet");
+
+/*
+ * System Realtime messages (clock, start, stop...) bypass the events queued
+ * in usb_midi_to_host_buf: they are put first in the next transfer to the
+ * host, so that their latency does not depend on the controller traffic.
+ */
+struct usb_midi_realtime_pkt {
+    // Or a UMP of one word, on the USB MIDI 2.0 alternate setting
+    uint8_t usb_pkt[4];
+    // k_cycle_get_32() when queued by usb_midi_write
+    uint32_t enqueued;
+};
+
+K_MSGQ_DEFINE(usb_midi_realtime_queue, sizeof(struct usb_midi_realtime_pkt), CONFIG_USB_MIDI_REALTIME_QUEUE_SIZE, 4);
+
+BUILD_ASSERT(CONFIG_USB_MIDI_SYSEX_TRANSFER_SIZE % MIDI_BULK_SIZE == 0,
+             "The SysEx transfers must be made of full bulk packets");
 
-K_THREAD_STACK_DEFINE(usb_midi_work_queue_stack, 1024);
+/* The transfer to the host, while in progress, aligned for the UMP words */
+static uint8_t to_host_transfer[CONFIG_USB_MIDI_SYSEX_TRANSFER_SIZE] __aligned(4);
+static atomic_t to_host_transfer_busy = ATOMIC_INIT(0);
+static uint32_t to_host_realtime_enqueued[MIDI_BULK_SIZE / 4];
+static size_t to_host_realtime_count;
+
+/*
+ * The SysEx being sent by usb_midi_sysex_send, segmented from the buffer of
+ * the caller when filling the transfers. Active while data is not NULL.
+ */
+static struct {
+    const uint8_t *data;
+    size_t len;
+    // Start of the next packet to segment
+    size_t pos;
+    uint8_t cable_number;
+    int result;
+} sysex_tx;
+
+/*
+ * On the USB MIDI 2.0 alternate setting, the queues hold UMPs, in the MIDI 2.0
+ * or MIDI 1.0 protocol negotiated by the host, with or without the jitter
+ * reduction timestamps.
+ */
+static bool ump = false;
+static uint8_t ump_protocol = MIDI_UMP_PROTOCOL_MIDI2;
+static bool ump_jr = false;
+
+/* Queues holding packets of the previous mode, discarded by their consumer */
+#define STALE_TO_HOST   0
+#define STALE_FROM_HOST 1
+static atomic_t stale_queues = ATOMIC_INIT(0);
+
+/* The host expects a JR Clock at least every 250ms */
+#define JR_CLOCK_PERIOD_MS 200
+
+static void usb_midi_jr_clock(struct k_work *work);
+
+K_WORK_DELAYABLE_DEFINE(usb_midi_jr_clock_work, usb_midi_jr_clock);
+
+/* Time base of the JR timestamps: the microseconds of a cycle count, beyond
+ * the wrap of the cycle counter */
+static struct {
+    struct k_spinlock lock;
+    uint32_t cycles;
+    uint32_t us;
+} jr_base;
+
+static K_MUTEX_DEFINE(sysex_tx_lock);
+static K_SEM_DEFINE(sysex_tx_done, 0, 1);
+
+/* End the SysEx being sent, from the completion of its last transfer or on error */
+static void usb_midi_sysex_tx_finish(int result)
+{
+    if (sysex_tx.data){
+        sysex_tx.data = NULL;
+        sysex_tx.result = result;
+        k_sem_give(&sysex_tx_done);
+    }
+}
+
+/* The reassembly of the SysEx from the host, for the cables with a SysEx handler */
+static struct midi_sysex_assembler sysex_rx[USB_MIDI_N_CABLES];
+static usb_midi_sysex_handler_t sysex_handlers[USB_MIDI_N_CABLES];
+
+K_THREAD_STACK_DEFINE(usb_midi_work_queue_stack, CONFIG_USB_MIDI_WORKQUEUE_STACK_SIZE);
 
 static struct k_work_q usb_midi_work_queue;
 
@@ -58,100 +281,203 @@ static bool usb_midi_work_queue_initialized = false;
 static struct usb_ep_cfg_data ep_cfg[] = {
     {.ep_cb=usb_transfer_ep_callback, .ep_addr=MIDI_IN_ENDPOINT_ID},
     {.ep_cb=usb_transfer_ep_callback, .ep_addr=MIDI_OUT_ENDPOINT_ID},
+#if defined(CONFIG_USB_MIDI2)
+    {.ep_cb=usb_transfer_ep_callback, .ep_addr=UMP_IN_ENDPOINT_ID},
+    {.ep_cb=usb_transfer_ep_callback, .ep_addr=UMP_OUT_ENDPOINT_ID},
+#endif
 };
 
+struct usb_midi_if_descriptor {
+    struct usb_if_descriptor if0;
+    uint8_t cs_if0[sizeof((uint8_t[]) USB_MIDI_CS_IF0)];
+#if defined(CONFIG_USB_MIDI2)
+    struct usb_if_descriptor if1;
+    uint8_t cs_if1[sizeof((uint8_t[]) USB_MIDI_CS_IF1)];
+#endif
+} __packed;
+
 USBD_CLASS_DESCR_DEFINE(primary, midistreaming) struct usb_midi_if_descriptor midi_cfg = {
     .if0={
         .bLength=9,
         .bDescriptorType=USB_DESC_INTERFACE,
         .bInterfaceNumber=0,
         .bAlternateSetting=0,
-        .bNumEndpoints=ARRAY_SIZE(ep_cfg),
+        .bNumEndpoints=2,
         .bInterfaceClass=USB_BCC_AUDIO,
         .bInterfaceSubClass=USB_AUDIO_MIDISTREAMING,
         .bInterfaceProtocol=0,
         .iInterface=0
     },
-    .cs_if0=MIDISTREAMING_CONFIG(
-        /* === USB-MIDI elements === */
-        /* Embedded MIDI from host */
-        MIDI_JACKIN_DESCRIPTOR(JACK_EMBEDDED, EMBEDDED_IN_EXTERNAL_MIDI_OUT_ID, 0),
-        /* External MIDI OUT socket */
-        MIDI_JACKOUT_DESCRIPTOR(JACK_EXTERNAL, EXTERNAL_MIDI_OUT_ID, 0,
-            EMBEDDED_IN_EXTERNAL_MIDI_OUT_ID, 1
-        ),
-        /* External MIDI IN socket */
-        MIDI_JACKIN_DESCRIPTOR( JACK_EXTERNAL, EXTERNAL_MIDI_IN_ID, 0),
-        /* Embedded MIDI to host from external MIDI */
-        MIDI_JACKOUT_DESCRIPTOR(JACK_EMBEDDED, EMBEDDED_OUT_EXTERNAL_MIDI_IN_ID, 0,
-            EXTERNAL_MIDI_IN_ID, 1
-        ),
-        /* Embedded MIDI to host from internal MIDI (sensors) */
-        MIDI_JACKOUT_DESCRIPTOR(JACK_EMBEDDED, EMBEDDED_OUT_INTERNAL_MIDI_IN_ID, 0),
-        
-        /* === USB-MIDI endpoints === */
-        /* Bulk endpoint MIDI_IN with 2 embedded MIDI to host */
-        MIDI_BULK_ENDPOINT(MIDI_IN_ENDPOINT_ID,
-            EMBEDDED_OUT_INTERNAL_MIDI_IN_ID,
-            EMBEDDED_OUT_EXTERNAL_MIDI_IN_ID
-        ),
-        /* Bulk endpointMIDI_OUT with 1 embedded MIDI from host */
-        MIDI_BULK_ENDPOINT(MIDI_OUT_ENDPOINT_ID,
-            EMBEDDED_IN_EXTERNAL_MIDI_OUT_ID
-        ),
-    )
+    .cs_if0=USB_MIDI_CS_IF0,
+#if defined(CONFIG_USB_MIDI2)
+    .if1={
+        .bLength=9,
+        .bDescriptorType=USB_DESC_INTERFACE,
+        .bInterfaceNumber=0,
+        .bAlternateSetting=1,
+        .bNumEndpoints=2,
+        .bInterfaceClass=USB_BCC_AUDIO,
+        .bInterfaceSubClass=USB_AUDIO_MIDISTREAMING,
+        .bInterfaceProtocol=0,
+        .iInterface=0
+    },
+    .cs_if1=USB_MIDI_CS_IF1,
+#endif
 };
 
+#if defined(CONFIG_USB_MIDI2)
+static const uint8_t midi_gr_trm_blocks[] = USB_MIDI_GR_TRM_BLOCKS;
+#endif
+
+static usb_midi_rx_handler_t rx_handlers[USB_MIDI_N_CABLES];
+
 static inline void usb_midi_submit_work(struct k_work *work)
 {
     if (! usb_midi_work_queue_initialized){
+        const struct k_work_queue_config cfg = {.name = "usb_midi_wq"};
         k_work_queue_init(&usb_midi_work_queue);
         k_work_queue_start(
             &usb_midi_work_queue,
             usb_midi_work_queue_stack,
             K_THREAD_STACK_SIZEOF(usb_midi_work_queue_stack),
-            5,
-            NULL
+            CONFIG_USB_MIDI_WORKQUEUE_PRIORITY,
+            &cfg
         );
         usb_midi_work_queue_initialized = true;
     }
     k_work_submit_to_queue(&usb_midi_work_queue, work);
 }
 
+static inline uint8_t usb_midi_in_ep()
+{
+    return ump ? UMP_IN_ENDPOINT_ID : MIDI_IN_ENDPOINT_ID;
+}
+
+static inline uint8_t usb_midi_out_ep()
+{
+    return ump ? UMP_OUT_ENDPOINT_ID : MIDI_OUT_ENDPOINT_ID;
+}
+
+/* JR timestamp of a cycle count, in periods of 32us on 16 bits */
+static uint16_t usb_midi_jr_time(uint32_t cycles)
+{
+    k_spinlock_key_t key = k_spin_lock(&jr_base.lock);
+    int32_t delta = cycles - jr_base.cycles;
+    uint32_t us;
+    if (delta >= 0){
+        // Advance the base by whole microseconds, the rest stays in its cycles
+        uint32_t delta_us = k_cyc_to_us_floor32(delta);
+        jr_base.us += delta_us;
+        jr_base.cycles += k_us_to_cyc_floor32(delta_us);
+        us = jr_base.us;
+    } else {
+        // Captured before the last timestamp
+        us = jr_base.us - k_cyc_to_us_floor32(-delta);
+    }
+    k_spin_unlock(&jr_base.lock, key);
+    return us / MIDI_UMP_JR_TICK_US;
+}
+
+/* Switch between the USB-MIDI 1.0 packets and the UMPs, on the selection of an alternate setting */
+static void usb_midi_set_ump(bool enable)
+{
+    if (enable != ump){
+        atomic_set(&stale_queues, BIT(STALE_TO_HOST) | BIT(STALE_FROM_HOST));
+        k_msgq_purge(&usb_midi_realtime_queue);
+        usb_midi_sysex_tx_finish(-EIO);
+        ump = enable;
+        LOG_INF("USB-MIDI %s", enable ? "2.0 (UMP)" : "1.0");
+    }
+    ump_protocol = MIDI_UMP_PROTOCOL_MIDI2;
+    ump_jr = ump && IS_ENABLED(CONFIG_USB_MIDI2_JR_TIMESTAMPS);
+    if (ump_jr){
+        k_spinlock_key_t key = k_spin_lock(&jr_base.lock);
+        jr_base.cycles = k_cycle_get_32();
+        jr_base.us = 0;
+        k_spin_unlock(&jr_base.lock, key);
+        k_work_schedule(&usb_midi_jr_clock_work, K_NO_WAIT);
+    }
+}
+
 static void midi_interface_configure(struct usb_desc_header *head, uint8_t bInterfaceNumber)
 {
     ARG_UNUSED(head);
     midi_cfg.if0.bInterfaceNumber = bInterfaceNumber;
+#if defined(CONFIG_USB_MIDI2)
+    midi_cfg.if1.bInterfaceNumber = bInterfaceNumber;
+#endif
     LOG_DBG("USB MIDI Interface configured: %d", (int) bInterfaceNumber);
 }
 
-static enum usb_dc_status_code current_status = 0;
+/* Configured by the host, and not suspended since */
+static bool configured = false;
+static bool suspended = false;
+
+static usb_midi_suspend_handler_t suspend_handler = NULL;
+static usb_midi_in_transfer_handler_t in_transfer_handler = NULL;
+
+static struct usb_midi_stats stats;
+
+/* Latency of the System Realtime packets, in cycles */
+static struct {
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} realtime_latency = {.min = UINT32_MAX};
+
+/* Record the high-water mark of a queue, in packets */
+#define USB_MIDI_QUEUE_MAX(max, used) do { (max) = MAX((max), (uint32_t) (used)); } while (0)
+
+/* Notify the suspend handler of the transitions only: a reset or a new
+ * configuration wakes the bus up like a resume */
+static void usb_midi_set_suspended(bool value)
+{
+    if (value == suspended){
+        return;
+    }
+    suspended = value;
+    if (suspend_handler){
+        suspend_handler(value);
+    }
+}
 
 static void midi_status_callback(struct usb_cfg_data *cfg, enum usb_dc_status_code status, const uint8_t *param)
 {
     ARG_UNUSED(cfg);
-    current_status = status;
     switch (status){
     case USB_DC_ERROR:
         LOG_DBG("USB error reported by the controller");
         break;
     case USB_DC_RESET:
         LOG_DBG("USB reset");
+        configured = false;
+        usb_midi_set_suspended(false);
+        usb_midi_sysex_tx_finish(-EIO);
+        usb_midi_set_ump(false);
         break;
     case USB_DC_CONNECTED:
         LOG_DBG("USB connection established, hardware enumeration is completed");
         break;
     case USB_DC_CONFIGURED:
         LOG_DBG("USB configuration done");
+        configured = true;
+        usb_midi_set_suspended(false);
+        usb_midi_set_ump(false);
         break;
     case USB_DC_DISCONNECTED:
         LOG_DBG("USB connection lost");
+        configured = false;
+        usb_midi_set_suspended(false);
+        usb_midi_sysex_tx_finish(-EIO);
+        usb_midi_set_ump(false);
         break;
     case USB_DC_SUSPEND:
         LOG_DBG("USB connection suspended by the HOST");
+        usb_midi_set_suspended(true);
         break;
     case USB_DC_RESUME:
         LOG_DBG("USB connection resumed by the HOST");
+        usb_midi_set_suspended(false);
         break;
     case USB_DC_INTERFACE:
         LOG_DBG("USB interface selected");
@@ -178,6 +504,29 @@ static int midi_vendor_handler(struct usb_setup_packet *setup, int32_t *len, uin
     return 0;
 }
 
+#if defined(CONFIG_USB_MIDI2)
+static int midi_custom_handler(struct usb_setup_packet *setup, int32_t *len, uint8_t **data)
+{
+    if (setup->RequestType.recipient != USB_REQTYPE_RECIPIENT_INTERFACE ||
+        (setup->wIndex & 0xff) != midi_cfg.if0.bInterfaceNumber){
+        return -ENOTSUP;
+    }
+
+    // The Group Terminal Blocks of the alternate setting 1 (midi20, 6.2)
+    if (usb_reqtype_is_to_host(setup) && setup->bRequest == USB_SREQ_GET_DESCRIPTOR &&
+        setup->wValue == ((CS_GR_TRM_BLOCK << 8) | 1)){
+        *data = (uint8_t *) midi_gr_trm_blocks;
+        *len = sizeof(midi_gr_trm_blocks);
+        return 0;
+    }
+
+    // Then the device stack enables the endpoints of the alternate setting
+    if (setup->RequestType.type == USB_REQTYPE_TYPE_STANDARD && setup->bRequest == USB_SREQ_SET_INTERFACE){
+        usb_midi_set_ump(setup->wValue == 1);
+    }
+    return -ENOTSUP;
+}
+#endif
 
 USBD_CFG_DATA_DEFINE(primary, midistreaming) struct usb_cfg_data midi_config = {
     .usb_device_description=NULL,
@@ -186,7 +535,11 @@ USBD_CFG_DATA_DEFINE(primary, midistreaming) struct usb_cfg_data midi_config = {
     .cb_usb_status=midi_status_callback,
     .interface={
         .class_handler=NULL,
+#if defined(CONFIG_USB_MIDI2)
+        .custom_handler=midi_custom_handler,
+#else
         .custom_handler=NULL,
+#endif
         .vendor_handler=midi_vendor_handler,
     },
     .num_endpoints=ARRAY_SIZE(ep_cfg),
@@ -195,45 +548,488 @@ USBD_CFG_DATA_DEFINE(primary, midistreaming) struct usb_cfg_data midi_config = {
 
 bool usb_midi_is_configured()
 {
-    return current_status == USB_DC_CONFIGURED;
+    return configured && ! suspended;
 }
 
-static void usb_midi_transfer_done(uint8_t ep, int size, void *data)
+bool usb_midi_is_ump()
+{
+    return usb_midi_is_configured() && ump;
+}
+
+bool usb_midi_is_suspended()
+{
+    return suspended;
+}
+
+void usb_midi_set_suspend_handler(usb_midi_suspend_handler_t handler)
+{
+    suspend_handler = handler;
+}
+
+void usb_midi_set_in_transfer_handler(usb_midi_in_transfer_handler_t handler)
+{
+    in_transfer_handler = handler;
+}
+
+const char *usb_midi_cable_name(uint8_t cable_number)
+{
+    return (cable_number < USB_MIDI_N_CABLES) ? cable_names[cable_number] : NULL;
+}
+
+int usb_midi_set_rx_handler(uint8_t cable_number, usb_midi_rx_handler_t handler)
+{
+    if (cable_number >= USB_MIDI_N_CABLES){
+        return -EINVAL;
+    }
+    rx_handlers[cable_number] = handler;
+    return 0;
+}
+
+int usb_midi_set_sysex_handler(uint8_t cable_number, uint8_t *buf, size_t size, usb_midi_sysex_handler_t handler)
+{
+    if (cable_number >= USB_MIDI_N_CABLES){
+        return -EINVAL;
+    }
+    sysex_handlers[cable_number] = NULL;
+    midi_sysex_assembler_init(&sysex_rx[cable_number], buf, size);
+    sysex_handlers[cable_number] = handler;
+    return 0;
+}
+
+/* Wait for a complete message from the host, a single transfer can hold
+ * several packets. The semaphore is given on each transfer, even when the
+ * reader did not wait for it: it is reset before looking at the queue, and
+ * only taken while the queue is still empty. */
+static void usb_midi_wait_from_host()
 {
+    if (atomic_test_and_clear_bit(&stale_queues, STALE_FROM_HOST)){
+        ring_buf_get(&usb_midi_from_host_buf, NULL, ring_buf_size_get(&usb_midi_from_host_buf));
+    }
+    k_sem_reset(&data_from_host_ready);
+    while (ump ? usb_midi_ring_peek_ump(&usb_midi_from_host_buf) == 0 : ring_buf_is_empty(&usb_midi_from_host_buf)){
+        usb_midi_submit_work(&usb_midi_from_host_work);
+        k_sem_take(&data_from_host_ready, K_FOREVER);
+    }
+}
+
+/* Result of the reassembly of a SysEx from the host */
+static void usb_midi_sysex_received(uint8_t cable_number, int len)
+{
+    if (len > 0){
+        stats.sysex_received++;
+        sysex_handlers[cable_number](cable_number, sysex_rx[cable_number].buf, len);
+    } else if (len < 0){
+        stats.sysex_dropped++;
+        LOG_WRN("SysEx of more than %u bytes on cable %d dropped",
+                (unsigned) sysex_rx[cable_number].size, cable_number);
+    }
+}
+
+/* Dispatch a UMP from the host, its group is the cable number */
+static void usb_midi_dispatch_ump(const uint32_t *msg)
+{
+    uint8_t cable_number = MIDI_UMP_GROUP(msg[0]);
+    uint8_t midi_pkt[3];
+
+    if (cable_number >= USB_MIDI_N_CABLES){
+        return;
+    }
+    if (MIDI_UMP_MT(msg[0]) == MIDI_UMP_MT_SYSEX7){
+        if (sysex_handlers[cable_number]){
+            usb_midi_sysex_received(cable_number, midi_ump_sysex_assemble(&sysex_rx[cable_number], msg));
+        }
+        return;
+    }
+    // The Utility and Stream messages are handled on reception
+    if (midi_ump_to_midi1(msg, midi_pkt)){
+        return;
+    }
+
+    midi_monitor_record(MIDI_MONITOR_IN | MIDI_MONITOR_PORT_USB(cable_number), midi_pkt);
+    if (rx_handlers[cable_number]){
+        rx_handlers[cable_number](cable_number, midi_pkt);
+    }
+}
+
+int usb_midi_dispatch()
+{
+    uint8_t usb_pkts[MIDI_BULK_SIZE / 4][4];
+
+    usb_midi_wait_from_host();
+    if (ump){
+        uint32_t msg[MIDI_UMP_MAX_WORDS];
+        size_t n_words = 0;
+        int n;
+        // Up to a bulk packet of words, like the USB-MIDI 1.0 packets
+        while (n_words < MIDI_BULK_SIZE / 4 && (n = usb_midi_ring_get_ump(&usb_midi_from_host_buf, msg)) > 0){
+            usb_midi_dispatch_ump(msg);
+            n_words += n;
+        }
+        return n_words ? 0 : -EAGAIN;
+    }
+
+    size_t n_pkts = ring_buf_get(&usb_midi_from_host_buf, usb_pkts[0], sizeof(usb_pkts)) / 4;
+    if (n_pkts == 0){
+        return -EAGAIN;
+    }
+
+    for (size_t i=0; i<n_pkts; i++){
+        uint8_t cable_number = usb_pkts[i][0] >> 4;
+        const uint8_t *midi_pkt = &usb_pkts[i][1];
+
+        if (cable_number >= USB_MIDI_N_CABLES){
+            continue;
+        }
+        if (sysex_handlers[cable_number] && midi_codec_is_sysex(usb_pkts[i])){
+            usb_midi_sysex_received(cable_number, midi_sysex_assemble(&sysex_rx[cable_number], usb_pkts[i]));
+            continue;
+        }
+
+        midi_monitor_record(MIDI_MONITOR_IN | MIDI_MONITOR_PORT_USB(cable_number), midi_pkt);
+        if (rx_handlers[cable_number]){
+            rx_handlers[cable_number](cable_number, midi_pkt);
+        }
+    }
+    return 0;
+}
+
+static void usb_midi_record_realtime_latency()
+{
+    uint32_t now = k_cycle_get_32();
+    for (size_t i=0; i<to_host_realtime_count; i++){
+        uint32_t latency = now - to_host_realtime_enqueued[i];
+        realtime_latency.min = MIN(realtime_latency.min, latency);
+        realtime_latency.max = MAX(realtime_latency.max, latency);
+        realtime_latency.total += latency;
+        stats.realtime_packets++;
+    }
+}
+
+/* Timestamp the realtime messages from the host on reception, for the clock follower */
+static void usb_midi_clock_input(const uint8_t *data, int size)
+{
+#if defined(CONFIG_MIDI_CLOCK_FOLLOWER)
+    uint32_t now = k_cycle_get_32();
+    for (int i=0; i+4<=size; i+=4){
+        if ((data[i] & 0x0f) == MIDI_CMD_SINGLE_BYTE && midi_is_realtime(data[i+1])){
+            midi_clock_input(data[i+1], now);
+        }
+    }
+#else
     ARG_UNUSED(data);
+    ARG_UNUSED(size);
+#endif
+}
+
+/* Queue UMPs to the host, with the statistics of the queue */
+static int usb_midi_queue_ump(const uint32_t *words, size_t n_words)
+{
+    k_spinlock_key_t key = k_spin_lock(&to_host_lock);
+    int r = usb_midi_ring_put_ump(&usb_midi_to_host_buf, words, n_words);
+    if (r){
+        stats.to_host_dropped++;
+    } else {
+        USB_MIDI_QUEUE_MAX(stats.to_host_queue_max, ring_buf_size_get(&usb_midi_to_host_buf) / 4);
+    }
+    k_spin_unlock(&to_host_lock, key);
+    return r;
+}
+
+/* Queue a UMP to the host, after the JR timestamp of its capture if enabled */
+static int usb_midi_queue_ump_jr(const uint32_t *msg, uint32_t captured)
+{
+    uint32_t words[1 + MIDI_UMP_MAX_WORDS];
+    size_t n_words = midi_ump_words(msg[0]);
+    if (! ump_jr){
+        return usb_midi_queue_ump(msg, n_words);
+    }
+    words[0] = midi_ump_jr_timestamp(usb_midi_jr_time(captured));
+    memcpy(&words[1], msg, 4 * n_words);
+    return usb_midi_queue_ump(words, 1 + n_words);
+}
+
+/* Send a name in UMP Stream messages */
+static void usb_midi_stream_name(uint16_t status, int fb, const char *name)
+{
+    uint32_t msg[MIDI_UMP_MAX_WORDS];
+    size_t pos = 0;
+    bool more;
+    do {
+        more = midi_ump_stream_name(status, fb, name, &pos, msg);
+        usb_midi_queue_ump(msg, ARRAY_SIZE(msg));
+    } while (more);
+}
+
+static void usb_midi_stream_config_notify()
+{
+    uint32_t msg[MIDI_UMP_MAX_WORDS] = {
+        (MIDI_UMP_MT_STREAM << 28) | (MIDI_UMP_STREAM_CONFIG_NOTIFY << 16) | (ump_protocol << 8) | (ump_jr ? BIT(0) : 0),
+    };
+    usb_midi_queue_ump(msg, ARRAY_SIZE(msg));
+}
+
+/*
+ * Answer the UMP Stream messages of the host (UMP 1.1, 7.1): the endpoint
+ * supports both protocols and sends JR timestamps, each cable is a static
+ * Function Block on its group.
+ */
+static void usb_midi_receive_stream(const uint32_t msg[MIDI_UMP_MAX_WORDS])
+{
+    uint8_t filter = msg[1] & 0xff;
+
+    switch (MIDI_UMP_STREAM_STATUS(msg[0])){
+    case MIDI_UMP_STREAM_ENDPOINT_DISCOVERY:
+        if (filter & BIT(0)){
+            uint32_t info[MIDI_UMP_MAX_WORDS] = {
+                (MIDI_UMP_MT_STREAM << 28) | (MIDI_UMP_STREAM_ENDPOINT_INFO << 16) | 0x0101,
+                BIT(31) | (USB_MIDI_N_CABLES << 24) | BIT(9) | BIT(8)
+                    | (IS_ENABLED(CONFIG_USB_MIDI2_JR_TIMESTAMPS) ? BIT(0) : 0),
+            };
+            usb_midi_queue_ump(info, ARRAY_SIZE(info));
+        }
+        if (filter & BIT(2)){
+            usb_midi_stream_name(MIDI_UMP_STREAM_ENDPOINT_NAME, -1, CONFIG_USB_DEVICE_PRODUCT);
+        }
+        if (filter & BIT(4)){
+            usb_midi_stream_config_notify();
+        }
+        break;
+
+    case MIDI_UMP_STREAM_CONFIG_REQUEST: {
+        uint8_t protocol = msg[0] >> 8;
+        if (protocol == MIDI_UMP_PROTOCOL_MIDI1 || protocol == MIDI_UMP_PROTOCOL_MIDI2){
+            ump_protocol = protocol;
+        }
+        ump_jr = IS_ENABLED(CONFIG_USB_MIDI2_JR_TIMESTAMPS) && (msg[0] & BIT(0));
+        if (ump_jr){
+            k_work_schedule(&usb_midi_jr_clock_work, K_NO_WAIT);
+        }
+        usb_midi_stream_config_notify();
+        break;
+    }
+
+    case MIDI_UMP_STREAM_FB_DISCOVERY: {
+        uint8_t fb_filter = msg[0] & 0xff;
+        uint8_t first = (msg[0] >> 8) & 0xff;
+        // 0xFF requests all the Function Blocks
+        uint8_t last = (first == 0xff) ? USB_MIDI_N_CABLES - 1 : first;
+        first = (first == 0xff) ? 0 : first;
+
+        for (uint8_t fb=first; fb<=last && fb<USB_MIDI_N_CABLES; fb++){
+            if (fb_filter & BIT(0)){
+                // Active, bidirectional, sender and receiver, on a single group
+                uint32_t info[MIDI_UMP_MAX_WORDS] = {
+                    (MIDI_UMP_MT_STREAM << 28) | (MIDI_UMP_STREAM_FB_INFO << 16) | BIT(15) | (fb << 8)
+                        | (3 << 4) | 3,
+                    ((uint32_t) fb << 24) | (1 << 16),
+                };
+                usb_midi_queue_ump(info, ARRAY_SIZE(info));
+            }
+            if ((fb_filter & BIT(1)) && cable_names[fb]){
+                usb_midi_stream_name(MIDI_UMP_STREAM_FB_NAME, fb, cable_names[fb]);
+            }
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+    usb_midi_submit_work(&usb_midi_to_host_work);
+}
+
+/* Handle the UMP Stream messages, and timestamp the realtime messages for
+ * the clock follower, on reception */
+static void usb_midi_ump_input(const uint8_t *data, int size)
+{
+    uint32_t now = k_cycle_get_32();
+    uint32_t msg[MIDI_UMP_MAX_WORDS];
+
+    for (int i=0; i+4<=size; ){
+        msg[0] = sys_get_le32(&data[i]);
+        int n = midi_ump_words(msg[0]);
+        if (i + 4 * n > size){
+            break;
+        }
+        if (MIDI_UMP_MT(msg[0]) == MIDI_UMP_MT_STREAM){
+            for (int j=1; j<n; j++){
+                msg[j] = sys_get_le32(&data[i + 4 * j]);
+            }
+            usb_midi_receive_stream(msg);
+        }
+#if defined(CONFIG_MIDI_CLOCK_FOLLOWER)
+        if (MIDI_UMP_MT(msg[0]) == MIDI_UMP_MT_SYSTEM && midi_is_realtime(msg[0] >> 16)){
+            midi_clock_input(msg[0] >> 16, now);
+        }
+#else
+        ARG_UNUSED(now);
+#endif
+        i += 4 * n;
+    }
+}
 
-    if (ep == MIDI_IN_ENDPOINT_ID){
+static void usb_midi_transfer_done(uint8_t ep, int size, void *data)
+{
+    MIDI_TRACE("usbmidi_xfer_done", ep, size);
+
+    if (USB_EP_DIR_IS_IN(ep)){
+        if (in_transfer_handler){
+            in_transfer_handler(true, size);
+        }
+        // Transfers are cancelled on the selection of an alternate setting
         if (size > 0){
-            ring_buf_get_finish(&usb_midi_to_host_buf, size);
-        } else {
-            ring_buf_get_finish(&usb_midi_to_host_buf, 0);
+            stats.in_transfers++;
+            stats.in_bytes += size;
+            usb_midi_record_realtime_latency();
+            if (sysex_tx.data && sysex_tx.pos == sysex_tx.len){
+                stats.sysex_sent++;
+                usb_midi_sysex_tx_finish(0);
+            }
+        } else if (size != -ECANCELED){
+            stats.in_errors++;
+            LOG_WRN("Transfer to host failed (%d)", size);
+            if (sysex_tx.pos > 0){
+                usb_midi_sysex_tx_finish(-EIO);
+            }
         }
+        atomic_clear(&to_host_transfer_busy);
         usb_midi_submit_work(&usb_midi_to_host_work);
     }
 
-    if (ep == MIDI_OUT_ENDPOINT_ID){
+    if (USB_EP_DIR_IS_OUT(ep)){
         if (size > 0){
+            stats.out_transfers++;
+            stats.out_bytes += size;
+            if (ump){
+                usb_midi_ump_input(data, size);
+            } else {
+                usb_midi_clock_input(data, size);
+            }
             ring_buf_put_finish(&usb_midi_from_host_buf, size);
+            USB_MIDI_QUEUE_MAX(stats.from_host_queue_max, ring_buf_size_get(&usb_midi_from_host_buf) / 4);
             k_sem_give(&data_from_host_ready);
         } else {
+            if (size < 0 && size != -ECANCELED){
+                stats.out_errors++;
+            }
             ring_buf_put_finish(&usb_midi_from_host_buf, 0);
         }
         usb_midi_submit_work(&usb_midi_from_host_work);
     }
 }
 
+/* JR Clock messages, the time base of the JR timestamps for the host */
+static void usb_midi_jr_clock(struct k_work *work)
+{
+    ARG_UNUSED(work);
+    if (! ump_jr){
+        return;
+    }
+
+    if (usb_midi_is_configured()){
+        struct usb_midi_realtime_pkt realtime_pkt = {.enqueued = k_cycle_get_32()};
+        sys_put_le32(midi_ump_jr_clock(usb_midi_jr_time(realtime_pkt.enqueued)), realtime_pkt.usb_pkt);
+        if (k_msgq_put(&usb_midi_realtime_queue, &realtime_pkt, K_NO_WAIT) == 0){
+            usb_midi_submit_work(&usb_midi_to_host_work);
+        } else {
+            stats.realtime_dropped++;
+        }
+    }
+    k_work_schedule(&usb_midi_jr_clock_work, K_MSEC(JR_CLOCK_PERIOD_MS));
+}
+
+void usb_midi_get_stats(struct usb_midi_stats *res)
+{
+    unsigned key = irq_lock();
+    *res = stats;
+    if (stats.realtime_packets){
+        res->realtime_latency_min_us = k_cyc_to_us_floor32(realtime_latency.min);
+        res->realtime_latency_max_us = k_cyc_to_us_floor32(realtime_latency.max);
+        res->realtime_latency_avg_us = k_cyc_to_us_floor32(realtime_latency.total / stats.realtime_packets);
+    }
+    irq_unlock(key);
+}
+
+void usb_midi_reset_stats()
+{
+    unsigned key = irq_lock();
+    memset(&stats, 0, sizeof(stats));
+    realtime_latency.min = UINT32_MAX;
+    realtime_latency.max = 0;
+    realtime_latency.total = 0;
+    irq_unlock(key);
+}
+
+void usb_midi_get_queue_sizes(struct usb_midi_queue_sizes *sizes)
+{
+    sizes->to_host = BIT(CONFIG_USB_MIDI_TO_HOST_QUEUE_POW2);
+    sizes->from_host = BIT(CONFIG_USB_MIDI_FROM_HOST_QUEUE_POW2);
+    sizes->realtime = CONFIG_USB_MIDI_REALTIME_QUEUE_SIZE;
+}
+
 static void usb_midi_send_to_host()
 {
-    k_sem_take(&data_to_host_ready, K_FOREVER);
+    // Submitted again on completion of the transfer in progress
+    if (! atomic_cas(&to_host_transfer_busy, 0, 1)){
+        return;
+    }
 
-    uint8_t *queued_data;
-    size_t data_ready = ring_buf_get_claim(&usb_midi_to_host_buf, &queued_data, MIDI_BULK_SIZE);
-    if (data_ready > 0){
-        usb_transfer(MIDI_IN_ENDPOINT_ID, queued_data, data_ready,
-                     USB_TRANS_WRITE, usb_midi_transfer_done, NULL);
-    } else {
-        LOG_DBG("No pending data to host");
-        ring_buf_get_finish(&usb_midi_to_host_buf, 0);
+    if (atomic_test_and_clear_bit(&stale_queues, STALE_TO_HOST)){
+        ring_buf_get(&usb_midi_to_host_buf, NULL, ring_buf_size_get(&usb_midi_to_host_buf));
+    }
+
+    // The System Realtime packets first, then the other events in their order
+    size_t size = 0;
+    struct usb_midi_realtime_pkt realtime_pkt;
+    to_host_realtime_count = 0;
+    while (size < MIDI_BULK_SIZE && k_msgq_get(&usb_midi_realtime_queue, &realtime_pkt, K_NO_WAIT) == 0){
+        memcpy(&to_host_transfer[size], realtime_pkt.usb_pkt, 4);
+        to_host_realtime_enqueued[to_host_realtime_count++] = realtime_pkt.enqueued;
+        size += 4;
+    }
+    // The events queued when a SysEx starts are sent in its first transfer,
+    // then the events wait for its end
+    if (! sysex_tx.data || sysex_tx.pos == 0){
+        if (ump){
+            size += usb_midi_ring_get_umps(&usb_midi_to_host_buf, &to_host_transfer[size],
+                                           sizeof(to_host_transfer) - size);
+        } else {
+            size += ring_buf_get(&usb_midi_to_host_buf, &to_host_transfer[size], sizeof(to_host_transfer) - size);
+        }
+    }
+    if (sysex_tx.data && sysex_tx.pos < sysex_tx.len && ump){
+        uint32_t *words = (uint32_t *) &to_host_transfer[size];
+        size_t n_words = 2 * midi_ump_sysex_segment(sysex_tx.cable_number, sysex_tx.data, sysex_tx.len,
+                                                    &sysex_tx.pos, (uint32_t (*)[2]) words,
+                                                    (sizeof(to_host_transfer) - size) / 8);
+        for (size_t i=0; i<n_words; i++){
+            words[i] = sys_cpu_to_le32(words[i]);
+        }
+        size += 4 * n_words;
+    } else if (sysex_tx.data && sysex_tx.pos < sysex_tx.len){
+        size += 4 * midi_sysex_segment(sysex_tx.cable_number, sysex_tx.data, sysex_tx.len, &sysex_tx.pos,
+                                       (uint8_t (*)[4]) &to_host_transfer[size],
+                                       (sizeof(to_host_transfer) - size) / 4);
+    }
+
+    if (size == 0){
+        atomic_clear(&to_host_transfer_busy);
+        return;
+    }
+
+    if (in_transfer_handler){
+        in_transfer_handler(false, size);
+    }
+    MIDI_TRACE("usbmidi_xfer_submit", usb_midi_in_ep(), size);
+    int r = usb_transfer(usb_midi_in_ep(), to_host_transfer, size,
+                         USB_TRANS_WRITE, usb_midi_transfer_done, NULL);
+    if (r){
+        stats.in_errors++;
+        LOG_WRN("Unable to start transfer to host (%d)", r);
+        atomic_clear(&to_host_transfer_busy);
+        if (sysex_tx.pos > 0){
+            usb_midi_sysex_tx_finish(-EIO);
+        }
     }
 }
 
@@ -242,9 +1038,14 @@ static void usb_midi_receive_from_host()
     uint8_t *rxdata;
     size_t rxsize = ring_buf_put_claim(&usb_midi_from_host_buf, &rxdata, MIDI_BULK_SIZE);
     if (rxsize > 0){
-        usb_transfer(MIDI_OUT_ENDPOINT_ID, rxdata, rxsize,
-                     USB_TRANS_READ, usb_midi_transfer_done, NULL);
+        MIDI_TRACE("usbmidi_xfer_submit", usb_midi_out_ep(), rxsize);
+        if (usb_transfer(usb_midi_out_ep(), rxdata, rxsize,
+                         USB_TRANS_READ, usb_midi_transfer_done, rxdata)){
+            stats.out_errors++;
+            ring_buf_put_finish(&usb_midi_from_host_buf, 0);
+        }
     } else {
+        stats.from_host_overruns++;
         LOG_WRN("No space available for data from host");
         ring_buf_put_finish(&usb_midi_from_host_buf, 0);
     }
@@ -252,63 +1053,252 @@ static void usb_midi_receive_from_host()
 
 int usb_midi_write(uint8_t cable_number, const uint8_t midi_pkt[3])
 {
+    if (cable_number >= USB_MIDI_N_CABLES){
+        return -EINVAL;
+    }
     if (! usb_midi_is_configured()){
+        stats.write_eagain++;
         return -EAGAIN;
     }
 
-    int r = 0;
-    uint8_t *buf;
+    int r;
+    if (midi_is_realtime(midi_pkt[0])){
+        struct usb_midi_realtime_pkt realtime_pkt = {
+            .usb_pkt = {(cable_number << 4) | MIDI_CMD_SINGLE_BYTE, midi_pkt[0], 0, 0},
+            .enqueued = k_cycle_get_32(),
+        };
+        if (ump){
+            sys_put_le32(midi_ump_from_midi1(cable_number, midi_pkt), realtime_pkt.usb_pkt);
+        }
+        r = k_msgq_put(&usb_midi_realtime_queue, &realtime_pkt, K_NO_WAIT) ? -EAGAIN : 0;
+        if (r){
+            stats.realtime_dropped++;
+        } else {
+            USB_MIDI_QUEUE_MAX(stats.realtime_queue_max, k_msgq_num_used_get(&usb_midi_realtime_queue));
+        }
+    } else if (ump){
+        uint32_t msg = midi_ump_from_midi1(cable_number, midi_pkt);
+        if (! msg){
+            return -EINVAL;
+        }
+        r = usb_midi_queue_ump_jr(&msg, k_cycle_get_32());
+    } else {
+        k_spinlock_key_t key = k_spin_lock(&to_host_lock);
+        r = usb_midi_ring_put(&usb_midi_to_host_buf, cable_number, midi_pkt);
+        if (r){
+            stats.to_host_dropped++;
+        } else {
+            USB_MIDI_QUEUE_MAX(stats.to_host_queue_max, ring_buf_size_get(&usb_midi_to_host_buf) / 4);
+        }
+        k_spin_unlock(&to_host_lock, key);
+    }
+    MIDI_TRACE("usbmidi_enqueue", ((uint32_t) cable_number << 24) | MIDI_TRACE_PKT(midi_pkt), r);
+    if (r){
+        stats.write_eagain++;
+        LOG_WRN("No available space in write buffer");
+    } else {
+        midi_monitor_record(MIDI_MONITOR_PORT_USB(cable_number), midi_pkt);
+        usb_midi_submit_work(&usb_midi_to_host_work);
+    }
+    return r;
+}
 
-    uint8_t midi_cmd = midi_pkt[0] >> 4;
-    size_t requested_size = 1 + midi_datasize(midi_cmd);
+int usb_midi_write_ump(uint8_t cable_number, const uint32_t *msg, uint32_t captured)
+{
+    uint8_t mt = MIDI_UMP_MT(msg[0]);
+    if (cable_number >= USB_MIDI_N_CABLES ||
+        (mt != MIDI_UMP_MT_SYSTEM && mt != MIDI_UMP_MT_MIDI1 && mt != MIDI_UMP_MT_MIDI2)){
+        return -EINVAL;
+    }
+    if (! usb_midi_is_configured()){
+        stats.write_eagain++;
+        return -EAGAIN;
+    }
 
-    size_t claimed_size = ring_buf_put_claim(&usb_midi_to_host_buf, &buf, requested_size);
-    if (claimed_size < requested_size){
-        r = -EAGAIN;
-        claimed_size = 0;
-        LOG_WRN("No available space in write buffer");
+    // USB-MIDI 1.0 hosts get MIDI 1.0 messages, System Realtime messages bypass the queue
+    uint8_t midi_pkt[3];
+    bool midi1 = midi_ump_to_midi1(msg, midi_pkt) == 0;
+    if (midi1 && (! ump || midi_is_realtime(midi_pkt[0]))){
+        return usb_midi_write(cable_number, midi_pkt);
+    }
+
+    uint32_t words[MIDI_UMP_MAX_WORDS];
+    if (! ump || (mt == MIDI_UMP_MT_MIDI2 && ump_protocol == MIDI_UMP_PROTOCOL_MIDI1)){
+        if (! midi1){
+            return -ENOTSUP;
+        }
+        words[0] = midi_ump_from_midi1(cable_number, midi_pkt);
     } else {
-        buf[0] = (cable_number << 4) | midi_cmd;
-        memcpy(&buf[1], midi_pkt, midi_datasize(midi_cmd));
+        memcpy(words, msg, 4 * midi_ump_words(msg[0]));
+        words[0] = (words[0] & ~0x0f000000) | ((uint32_t) cable_number << 24);
     }
-    
-    ring_buf_put_finish(&usb_midi_to_host_buf, claimed_size);
-    if (claimed_size) {
+
+    int r = usb_midi_queue_ump_jr(words, captured);
+    MIDI_TRACE("usbmidi_enqueue", ((uint32_t) cable_number << 24) | (words[0] & 0xffffff), r);
+    if (r){
+        stats.write_eagain++;
+        LOG_WRN("No available space in write buffer");
+    } else {
+        if (midi1){
+            midi_monitor_record(MIDI_MONITOR_PORT_USB(cable_number), midi_pkt);
+        }
         usb_midi_submit_work(&usb_midi_to_host_work);
     }
+    return r;
+}
 
-    k_sem_give(&data_to_host_ready);
+int usb_midi_sysex_send(uint8_t cable_number, const uint8_t *sysex, size_t len)
+{
+    if (cable_number >= USB_MIDI_N_CABLES || len < 2 || sysex[0] != 0xF0 || sysex[len - 1] != 0xF7){
+        return -EINVAL;
+    }
+    if (! usb_midi_is_configured()){
+        return -EAGAIN;
+    }
+
+    k_mutex_lock(&sysex_tx_lock, K_FOREVER);
+    k_sem_reset(&sysex_tx_done);
+    sysex_tx.cable_number = cable_number;
+    sysex_tx.len = len;
+    sysex_tx.pos = 0;
+    sysex_tx.data = sysex;
+    MIDI_TRACE("usbmidi_sysex_send", cable_number, len);
+    usb_midi_submit_work(&usb_midi_to_host_work);
+
+    k_sem_take(&sysex_tx_done, K_FOREVER);
+    int r = sysex_tx.result;
+    k_mutex_unlock(&sysex_tx_lock);
+
+    if (r){
+        LOG_WRN("SysEx of %u bytes to host failed (%d)", (unsigned) len, r);
+    }
     return r;
 }
 
-int usb_midi_read(uint8_t *cable_number, uint8_t midi_pkt[3])
+/* Read the next UMP from the host with a MIDI 1.0 equivalent, the others are skipped */
+static int usb_midi_read_ump(uint8_t *cable_number, uint8_t midi_pkt[3])
 {
-    int r;
-    uint8_t *buf;
+    uint32_t msg[MIDI_UMP_MAX_WORDS];
+    while (usb_midi_ring_get_ump(&usb_midi_from_host_buf, msg) > 0){
+        if (MIDI_UMP_GROUP(msg[0]) < USB_MIDI_N_CABLES && midi_ump_to_midi1(msg, midi_pkt) == 0){
+            *cable_number = MIDI_UMP_GROUP(msg[0]);
+            return 0;
+        }
+    }
+    return -EAGAIN;
+}
 
-    usb_midi_submit_work(&usb_midi_from_host_work);
-    k_sem_take(&data_from_host_ready, K_FOREVER);
+int usb_midi_read(uint8_t *cable_number, uint8_t midi_pkt[3])
+{
+    usb_midi_wait_from_host();
 
-    size_t requested_size = 4;
-    size_t claimed_size = ring_buf_get_claim(&usb_midi_from_host_buf, &buf, requested_size);
-    if (claimed_size < 2){
-        // Not enough data available for a USB-MIDI packet
-        r = -EAGAIN;
-        claimed_size = 0;
+    int r = ump ? usb_midi_read_ump(cable_number, midi_pkt)
+                : usb_midi_ring_get(&usb_midi_from_host_buf, cable_number, midi_pkt);
+    if (r){
         LOG_WRN("Not enough data in the read buffer");
     } else {
-        uint8_t midi_cmd = buf[0] & 0x0f;
-        if (claimed_size < 1 + midi_datasize(midi_cmd)){
-            // Not enough data according to MIDI command
-            r = -EAGAIN;
-            claimed_size = 0;
-            LOG_WRN("Not enough data in the read buffer");
-        } else {
-            *cable_number = buf[0] >> 4;
-            memcpy(midi_pkt, &buf[1], midi_datasize(midi_cmd));
+        midi_monitor_record(MIDI_MONITOR_IN | MIDI_MONITOR_PORT_USB(*cable_number), midi_pkt);
+    }
+    return r;
+}
+
+/* The event packets of the last UMP read by usb_midi_read_packet, not read
+ * yet: a SysEx7 UMP of 6 bytes gives up to 3 packets */
+static uint8_t ump_pkts[3][MIDI_CODEC_PKT_SIZE];
+static size_t n_ump_pkts;
+static size_t ump_pkts_pos;
+static struct midi_parser ump_sysex_parsers[USB_MIDI_N_CABLES];
+
+static size_t usb_midi_ump_to_pkts(const uint32_t *msg)
+{
+    uint8_t cable_number = MIDI_UMP_GROUP(msg[0]);
+    if (cable_number >= USB_MIDI_N_CABLES){
+        return 0;
+    }
+
+    if (MIDI_UMP_MT(msg[0]) == MIDI_UMP_MT_SYSEX7){
+        struct midi_parser *parser = &ump_sysex_parsers[cable_number];
+        uint8_t bytes[8];
+        size_t len = midi_ump_sysex_bytes(msg, bytes);
+
+        // The parsers are zeroed before the first switch to UMP
+        parser->cable_number = cable_number;
+        return midi_decode(parser, bytes, &len, ump_pkts, ARRAY_SIZE(ump_pkts));
+    }
+
+    uint8_t midi_pkt[3];
+    if (midi_ump_to_midi1(msg, midi_pkt)){
+        return 0;
+    }
+    midi_codec_pkt(cable_number, midi_pkt, ump_pkts[0]);
+    return 1;
+}
+
+static int usb_midi_read_ump_packet(uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE])
+{
+    uint32_t msg[MIDI_UMP_MAX_WORDS];
+    while (ump_pkts_pos == n_ump_pkts){
+        if (usb_midi_ring_get_ump(&usb_midi_from_host_buf, msg) <= 0){
+            return -EAGAIN;
         }
+        n_ump_pkts = usb_midi_ump_to_pkts(msg);
+        ump_pkts_pos = 0;
     }
+    memcpy(usb_pkt, ump_pkts[ump_pkts_pos++], MIDI_CODEC_PKT_SIZE);
+    return 0;
+}
 
-    ring_buf_get_finish(&usb_midi_from_host_buf, claimed_size);
+int usb_midi_read_packet(uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE])
+{
+    if (atomic_test_bit(&stale_queues, STALE_FROM_HOST)){
+        n_ump_pkts = ump_pkts_pos = 0;
+        for (size_t i=0; i<USB_MIDI_N_CABLES; i++){
+            midi_parser_init(&ump_sysex_parsers[i], i);
+        }
+    }
+    if (! ump || ump_pkts_pos == n_ump_pkts){
+        usb_midi_wait_from_host();
+    }
+
+    int r = ump ? usb_midi_read_ump_packet(usb_pkt) : usb_midi_ring_get_packet(&usb_midi_from_host_buf, usb_pkt);
+    if (r){
+        LOG_WRN("Not enough data in the read buffer");
+    } else {
+        midi_monitor_record(MIDI_MONITOR_IN | MIDI_MONITOR_PORT_USB(usb_pkt[0] >> 4), &usb_pkt[1]);
+    }
     return r;
-}
\ No newline at end of file
+}
+
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+
+static int cmd_midi_usb(const struct shell *sh, size_t argc, char **argv)
+{
+    struct usb_midi_stats st;
+    struct usb_midi_queue_sizes sizes;
+    usb_midi_get_stats(&st);
+    usb_midi_get_queue_sizes(&sizes);
+
+    shell_print(sh, "%s", ! configured ? "Not configured" : suspended ? "Suspended" : "Configured");
+    if (ump){
+        shell_print(sh, "USB-MIDI 2.0: MIDI %d.0 protocol, JR timestamps %s", ump_protocol, ump_jr ? "on" : "off");
+    }
+    shell_print(sh, "to host:   %u transfers, %u bytes, %u errors", st.in_transfers, st.in_bytes, st.in_errors);
+    shell_print(sh, "from host: %u transfers, %u bytes, %u errors", st.out_transfers, st.out_bytes, st.out_errors);
+    shell_print(sh, "queue to host:   max %u/%u, %u dropped", st.to_host_queue_max, sizes.to_host, st.to_host_dropped);
+    shell_print(sh, "queue from host: max %u/%u, %u overruns", st.from_host_queue_max, sizes.from_host,
+                st.from_host_overruns);
+    shell_print(sh, "realtime queue:  max %u/%u, %u dropped", st.realtime_queue_max, sizes.realtime,
+                st.realtime_dropped);
+    shell_print(sh, "usb_midi_write: %u -EAGAIN", st.write_eagain);
+    shell_print(sh, "sysex: %u sent, %u received, %u dropped", st.sysex_sent, st.sysex_received, st.sysex_dropped);
+
+    if (argc > 1 && ! strcmp(argv[1], "reset")){
+        usb_midi_reset_stats();
+    }
+    return 0;
+}
+
+SHELL_SUBCMD_ADD((midi), usb, NULL, "Show the USB-MIDI counters and queue high-water marks [reset]",
+                 cmd_midi_usb, 1, 1);
+#endif
@@ -1,6 +1,9 @@
 /**
  * See "Universal Serial Bus Device Class Definition for MIDI Devices", v1.0
  * https://www.usb.org/sites/default/files/midi10.pdf
+ *
+ * See "Universal Serial Bus Device Class Definition for MIDI Devices", v2.0
+ * https://www.usb.org/sites/default/files/USB%20MIDI%20v2_0.pdf
  * 
  * See "Universal Serial Bus Device Class Definition for Audio Devices", v1.0
  * https://www.usb.org/sites/default/files/audio10.pdf
@@ -10,8 +13,12 @@
 #define ZEPHYR_INCLUDE_USB_CLASS_USB_MIDI_H_
 
 #include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
 #include <zephyr/usb/class/usb_audio.h>
 
+#include "midi_codec.h"
+#include "midi_ump.h"
+
 #define MIDI_BULK_SIZE 64
 
 // MidiStreaming Class-Specific Interface Descriptor Subtypes (midi10, A.1)
@@ -22,9 +29,10 @@
 #define ELEMENT                 0x04
 
 
-// MidiStreaming Class-Specific Endpoint Descriptor Subtypes (midi10, A.2)
+// MidiStreaming Class-Specific Endpoint Descriptor Subtypes (midi10, A.2 and midi20, A.1)
 #define DESCRIPTOR_UNDEFINED 0x00
 #define MS_GENERAL           0x01
+#define MS_GENERAL_2_0       0x02
 
 
 // MidiStreaming MIDI IN and OUT Jack types (midi10, A.3)
@@ -33,11 +41,6 @@
 #define JACK_EXTERNAL       0x02
 
 
-struct usb_midi_if_descriptor {
-    struct usb_if_descriptor if0;
-    uint8_t cs_if0[];
-};
-
 #define N_ELEMS(...) sizeof((uint8_t[]) {__VA_ARGS__})
 
 // Class-Specific MS Interface Header Descriptor (midi10, 6.1.2.1)
@@ -46,8 +49,8 @@ struct usb_midi_if_descriptor {
     USB_DESC_CS_INTERFACE, \
     MS_HEADER, \
     0x01, 0x00, \
-    (7 + N_ELEMS(__VA_ARGS__)) >> 8, \
-    7 + N_ELEMS(__VA_ARGS__)
+    (7 + N_ELEMS(__VA_ARGS__)) & 0xff, \
+    (7 + N_ELEMS(__VA_ARGS__)) >> 8
 
 
 // MIDI IN Jack Descriptor (midi10, 6.1.2.2)
@@ -105,6 +108,83 @@ struct usb_midi_if_descriptor {
         __VA_ARGS__ \
     }
 
+// Group Terminal Block descriptor types and subtypes (midi20, A.4 to A.6)
+#define CS_GR_TRM_BLOCK      0x26
+#define GR_TRM_BLOCK_HEADER  0x01
+#define GR_TRM_BLOCK         0x02
+#define GR_TRM_BIDIRECTIONAL 0x00
+
+// Group Terminal Block protocols (midi20, A.6)
+#define GR_TRM_PROTOCOL_MIDI_2_0      0x11
+#define GR_TRM_PROTOCOL_MIDI_2_0_JRTS 0x12
+
+
+// Class-Specific MS Interface Header Descriptor of the alternate setting 1 (midi20, 5.2.2.1)
+#define MIDI2_CS_IF \
+    7, \
+    USB_DESC_CS_INTERFACE, \
+    MS_HEADER, \
+    0x00, 0x02, \
+    7, 0
+
+
+// Standard MIDI Streaming Bulk Data Endpoint Descriptor (midi20, 5.3.1)
+#define MIDI2_STD_BULK_ENDPOINT(bEndpointAddress) \
+    7, \
+    USB_DESC_ENDPOINT, \
+    (bEndpointAddress), \
+    USB_DC_EP_BULK, \
+    MIDI_BULK_SIZE, 0, \
+    0
+
+
+// Class-Specific MIDI Streaming Data Endpoint Descriptor, with the IDs of its Group Terminal Blocks (midi20, 5.3.2)
+#define MIDI2_CS_BULK_ENDPOINT(...) \
+    4 + N_ELEMS(__VA_ARGS__), \
+    USB_DESC_CS_ENDPOINT, \
+    MS_GENERAL_2_0, \
+    N_ELEMS(__VA_ARGS__), \
+    __VA_ARGS__
+
+#define MIDI2_BULK_ENDPOINT(bEndpointAddress, ...) \
+    MIDI2_STD_BULK_ENDPOINT(bEndpointAddress), \
+    MIDI2_CS_BULK_ENDPOINT(__VA_ARGS__)
+
+
+// MIDIStreaming interface definition of the alternate setting 1 (midi20, 5.2)
+#define MIDI2_STREAMING_CONFIG(...) \
+    { \
+        MIDI2_CS_IF, \
+        __VA_ARGS__ \
+    }
+
+
+// Group Terminal Block Descriptor, with an unknown bandwidth (midi20, 5.4.2.1)
+#define MIDI2_GR_TRM_BLOCK(bGrpTrmBlkID, nGroupTrm, nNumGroupTrm, iBlockItem, bMIDIProtocol) \
+    13, \
+    CS_GR_TRM_BLOCK, \
+    GR_TRM_BLOCK, \
+    (bGrpTrmBlkID), \
+    GR_TRM_BIDIRECTIONAL, \
+    (nGroupTrm), \
+    (nNumGroupTrm), \
+    (iBlockItem), \
+    (bMIDIProtocol), \
+    0, 0, \
+    0, 0
+
+
+// Group Terminal Block descriptors, returned by GET_DESCRIPTOR (midi20, 5.4)
+#define MIDI2_GR_TRM_BLOCKS(...) \
+    { \
+        5, \
+        CS_GR_TRM_BLOCK, \
+        GR_TRM_BLOCK_HEADER, \
+        (5 + N_ELEMS(__VA_ARGS__)) & 0xff, \
+        (5 + N_ELEMS(__VA_ARGS__)) >> 8, \
+        __VA_ARGS__ \
+    }
+
 #define MIDI_CMD_SYS_COMMON2    0x02
 #define MIDI_CMD_SYS_COMMON3    0x03
 #define MIDI_CMD_SYSEX_START    0x04
@@ -132,26 +212,189 @@ struct usb_midi_if_descriptor {
 #define MIDI_CONTROL_CHANGE(channel, cc, value) \
     MIDI_CMD_3B(MIDI_CMD_CONTROL_CHANGE, channel, cc, value)
 
-static inline size_t midi_datasize(uint8_t evt_type)
+/* System Realtime messages */
+#define MIDI_RT_CLOCK           0xF8
+#define MIDI_RT_START           0xFA
+#define MIDI_RT_CONTINUE        0xFB
+#define MIDI_RT_STOP            0xFC
+#define MIDI_RT_ACTIVE_SENSING  0xFE
+#define MIDI_RT_RESET           0xFF
+
+/* System Realtime messages are single status bytes, from 0xF8 to 0xFF */
+static inline bool midi_is_realtime(uint8_t status)
 {
-    switch (evt_type){
-        case MIDI_CMD_SYS_COMMON1:
-        case MIDI_CMD_SINGLE_BYTE:
-            return 1;
-        case MIDI_CMD_SYS_COMMON2:
-        case MIDI_CMD_SYSEX_2B:
-        case MIDI_CMD_PROGRAM_CHANGE:
-        case MIDI_CMD_CHAN_PRESSURE:
-            return 2;
-        default:
-            return 3;
-    }
+    return status >= 0xF8;
 }
 
+/* The usb-midi devicetree node, defining the cables of the function */
+#define USB_MIDI_NODE DT_COMPAT_GET_ANY_STATUS_OKAY(usb_midi)
+
+#define USB_MIDI_COUNT_CABLE(node_id) 1
+
+#if DT_NODE_EXISTS(USB_MIDI_NODE)
+#define USB_MIDI_N_CABLES (DT_FOREACH_CHILD_SEP(USB_MIDI_NODE, USB_MIDI_COUNT_CABLE, (+)))
+#else
+#define USB_MIDI_N_CABLES 2
+#endif
+
+/* Cable number of a cable node of the usb-midi devicetree node */
+#define USB_MIDI_CABLE(node_id) DT_REG_ADDR(node_id)
+
+/* Handler of the MIDI packets received on a cable, see usb_midi_dispatch */
+typedef void (*usb_midi_rx_handler_t)(uint8_t cable_number, const uint8_t midi_pkt[3]);
+
+/* Handler of the SysEx messages received on a cable, from 0xF0 to 0xF7 */
+typedef void (*usb_midi_sysex_handler_t)(uint8_t cable_number, const uint8_t *sysex, size_t len);
+
+/* Handler of the suspend and resume of the bus by the host, called from the
+ * USB status callback: it must not block */
+typedef void (*usb_midi_suspend_handler_t)(bool suspended);
+
+/* Handler of the transfers to the host, called on their submission (done is
+ * false) and on their completion (size is negative on failure), possibly
+ * from the USB interrupt: it must not block */
+typedef void (*usb_midi_in_transfer_handler_t)(bool done, int size);
+
+/* Configured by the host, and not suspended */
 bool usb_midi_is_configured();
 
+/* Configured by the host on the USB MIDI 2.0 alternate setting: the function
+ * exchanges UMPs, see usb_midi_write_ump */
+bool usb_midi_is_ump();
+
+bool usb_midi_is_suspended();
+
+/**
+ * @brief      Set the handler of the suspend and resume of the bus, to lower
+ *             the power draw of the device while the host sleeps
+ */
+void usb_midi_set_suspend_handler(usb_midi_suspend_handler_t handler);
+
+/**
+ * @brief      Set the handler of the transfers to the host, for instance to
+ *             measure their latency
+ */
+void usb_midi_set_in_transfer_handler(usb_midi_in_transfer_handler_t handler);
+
+/**
+ * @brief      Get the name of a cable, as shown by the host
+ * @return     The name, or NULL for an unnamed or non existing cable
+ */
+const char *usb_midi_cable_name(uint8_t cable_number);
+
+/**
+ * @brief      Set the handler of the MIDI packets received on a cable
+ * @return     0 on success, -EINVAL if the cable does not exist
+ */
+int usb_midi_set_rx_handler(uint8_t cable_number, usb_midi_rx_handler_t handler);
+
+/**
+ * @brief      Reassemble the SysEx received on a cable in a buffer, and pass
+ *             them to a handler once complete. The SysEx which do not fit
+ *             in the buffer are dropped.
+ * @param[in]  buf      The buffer, owned by the function until the handler
+ *                      is removed
+ * @param[in]  handler  The handler, NULL to pass the SysEx packets to the
+ *                      rx handler of the cable instead
+ * @return     0 on success, -EINVAL if the cable does not exist
+ */
+int usb_midi_set_sysex_handler(uint8_t cable_number, uint8_t *buf, size_t size, usb_midi_sysex_handler_t handler);
+
+/**
+ * @brief      Wait for MIDI packets from the host, and pass all the received
+ *             ones to the handlers of their cable, if any
+ * @return     0 on success, -EAGAIN if no packet was received
+ */
+int usb_midi_dispatch();
+
+/**
+ * @brief      Send a SysEx message to the host, segmented on the fly from the
+ *             buffer of the caller to the transfers. The other events wait
+ *             for the end of the SysEx, the System Realtime messages do not.
+ * @param[in]  sysex  The message, from 0xF0 to 0xF7 included, not copied
+ * @return     0 once sent, -EINVAL for an invalid cable or message, -EAGAIN
+ *             if the function is not configured, -EIO if a transfer failed
+ */
+int usb_midi_sysex_send(uint8_t cable_number, const uint8_t *sysex, size_t len);
+
+/* Completed bulk transfers, IN is to the host and OUT from the host */
+struct usb_midi_stats {
+    uint32_t in_transfers;
+    uint32_t in_bytes;
+    uint32_t out_transfers;
+    uint32_t out_bytes;
+    /* System Realtime packets sent to the host, and dropped on a full queue */
+    uint32_t realtime_packets;
+    uint32_t realtime_dropped;
+    /* From usb_midi_write() to the completion of their transfer, the jitter
+     * of a clock is at most max - min */
+    uint32_t realtime_latency_min_us;
+    uint32_t realtime_latency_avg_us;
+    uint32_t realtime_latency_max_us;
+    /* SysEx messages sent, received, and dropped on reception */
+    uint32_t sysex_sent;
+    uint32_t sysex_received;
+    uint32_t sysex_dropped;
+    /* High-water marks of the queues, in packets (see usb_midi_get_queue_sizes) */
+    uint32_t to_host_queue_max;
+    uint32_t from_host_queue_max;
+    uint32_t realtime_queue_max;
+    /* Events dropped by usb_midi_write() on a full queue to the host, and all
+     * its -EAGAIN returns, including while not configured */
+    uint32_t to_host_dropped;
+    uint32_t write_eagain;
+    /* Transfers from the host postponed on a full queue */
+    uint32_t from_host_overruns;
+    /* Failed transfers to (IN) and from (OUT) the host */
+    uint32_t in_errors;
+    uint32_t out_errors;
+};
+
+/* Capacities of the queues, in packets */
+struct usb_midi_queue_sizes {
+    uint32_t to_host;
+    uint32_t from_host;
+    uint32_t realtime;
+};
+
+/**
+ * @brief      Get the transfer counters since boot or their last reset.
+ *             The fill ratio of the bulk transfers is bytes / (transfers * MIDI_BULK_SIZE)
+ *             The realtime latencies are 0 if no realtime packet was sent.
+ */
+void usb_midi_get_stats(struct usb_midi_stats *stats);
+
+void usb_midi_reset_stats();
+
+void usb_midi_get_queue_sizes(struct usb_midi_queue_sizes *sizes);
+
 int usb_midi_read(uint8_t *cable_number, uint8_t midi_pkt[3]);
 
+/**
+ * @brief      Wait for and read the next event packet from the host, with its
+ *             header: unlike usb_midi_read, the SysEx packets are included,
+ *             for a pass-through to a MIDI byte stream (see midi_encoder_put).
+ *             On the USB MIDI 2.0 alternate setting, the UMPs are converted
+ *             to MIDI 1.0 event packets.
+ * @param[out] usb_pkt  The event packet
+ * @return     0 on success, -EAGAIN if no packet was received
+ */
+int usb_midi_read_packet(uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE]);
+
 int usb_midi_write(uint8_t cable_number, const uint8_t midi_pkt[3]);
 
+/**
+ * @brief      Send a System, MIDI 1.0 or MIDI 2.0 Channel Voice UMP to the
+ *             host, on the group of a cable. When the host has selected the
+ *             USB-MIDI 1.0 alternate setting or the MIDI 1.0 protocol, it is
+ *             converted to a MIDI 1.0 message (see midi_ump_to_midi1).
+ * @param[in]  ump       The message, its group is replaced by the cable number
+ * @param[in]  captured  The k_cycle_get_32() of the capture of the event, sent
+ *                       as its jitter reduction timestamp
+ * @return     0 on success, -EINVAL if the cable does not exist, -ENOTSUP for
+ *             a message without MIDI 1.0 equivalent on a MIDI 1.0 host,
+ *             -EAGAIN if the function is not configured or the queue is full
+ */
+int usb_midi_write_ump(uint8_t cable_number, const uint32_t *ump, uint32_t captured);
+
 #endif
@@ -0,0 +1,161 @@
+/**
+ * Queuing of USB-MIDI event packets in the byte ring buffers of the USB-MIDI
+ * function. Each packet is stored as on the bus: its header byte (cable number
+ * and code index) followed by the MIDI bytes of its event, padded with zeros
+ * to 4 bytes. The ring buffers can then be copied as is in bulk transfers.
+ *
+ * On the USB MIDI 2.0 alternate setting, they hold UMPs instead: each word in
+ * little endian, as on the bus too.
+ */
+
+#ifndef USB_MIDI_RING_H_
+#define USB_MIDI_RING_H_
+
+#include <errno.h>
+#include <string.h>
+#include <zephyr/sys/byteorder.h>
+#include <zephyr/sys/ring_buffer.h>
+
+#include "usb_midi.h"
+
+/**
+ * @brief      Queue a MIDI event
+ * @param      rb            The ring buffer
+ * @param[in]  cable_number  The USB-MIDI cable number
+ * @param[in]  midi_pkt      The MIDI event
+ * @return     0 on success, -EAGAIN if there is not enough space
+ */
+static inline int usb_midi_ring_put(struct ring_buf *rb, uint8_t cable_number, const uint8_t midi_pkt[3])
+{
+    uint8_t *buf;
+    size_t claimed_size = ring_buf_put_claim(rb, &buf, 4);
+    if (claimed_size < 4){
+        ring_buf_put_finish(rb, 0);
+        return -EAGAIN;
+    }
+
+    midi_codec_pkt(cable_number, midi_pkt, buf);
+    ring_buf_put_finish(rb, 4);
+    return 0;
+}
+
+/**
+ * @brief      Dequeue a MIDI event
+ * @param      rb            The ring buffer
+ * @param[out] cable_number  The USB-MIDI cable number
+ * @param[out] midi_pkt      The MIDI event
+ * @return     0 on success, -EAGAIN if there is no complete packet
+ */
+static inline int usb_midi_ring_get(struct ring_buf *rb, uint8_t *cable_number, uint8_t midi_pkt[3])
+{
+    uint8_t *buf;
+    size_t claimed_size = ring_buf_get_claim(rb, &buf, 4);
+
+    // Not a complete packet
+    if (claimed_size < 4){
+        ring_buf_get_finish(rb, 0);
+        return -EAGAIN;
+    }
+
+    *cable_number = buf[0] >> 4;
+    memcpy(midi_pkt, &buf[1], midi_cin_length(buf[0]));
+    ring_buf_get_finish(rb, 4);
+    return 0;
+}
+
+/**
+ * @brief      Get the next USB-MIDI event packet from the ring buffer, with
+ *             its header (cable number and CIN)
+ * @param      rb       The ring buffer
+ * @param[out] usb_pkt  The event packet
+ * @return     0 on success, -EAGAIN if there is no complete packet
+ */
+static inline int usb_midi_ring_get_packet(struct ring_buf *rb, uint8_t usb_pkt[4])
+{
+    uint8_t *buf;
+    size_t claimed_size = ring_buf_get_claim(rb, &buf, 4);
+
+    if (claimed_size < 4){
+        ring_buf_get_finish(rb, 0);
+        return -EAGAIN;
+    }
+
+    memcpy(usb_pkt, buf, 4);
+    ring_buf_get_finish(rb, 4);
+    return 0;
+}
+
+/**
+ * @brief      Queue a UMP, or a jitter reduction timestamp followed by its
+ *             UMP: the words are queued all together or not at all
+ * @param      rb       The ring buffer
+ * @param[in]  ump      The words
+ * @param[in]  n_words  Their number, up to MIDI_UMP_MAX_WORDS + 1
+ * @return     0 on success, -EINVAL for too many words, -EAGAIN if there is
+ *             not enough space
+ */
+static inline int usb_midi_ring_put_ump(struct ring_buf *rb, const uint32_t *ump, size_t n_words)
+{
+    uint8_t buf[4 * (MIDI_UMP_MAX_WORDS + 1)];
+    if (n_words > sizeof(buf) / 4){
+        return -EINVAL;
+    }
+    if (ring_buf_space_get(rb) < 4 * n_words){
+        return -EAGAIN;
+    }
+
+    for (size_t i=0; i<n_words; i++){
+        sys_put_le32(ump[i], &buf[4 * i]);
+    }
+    ring_buf_put(rb, buf, 4 * n_words);
+    return 0;
+}
+
+/* Size of the UMP at the head of the queue, in bytes, 0 if it is not complete */
+static inline size_t usb_midi_ring_peek_ump(struct ring_buf *rb)
+{
+    uint8_t word[4];
+    if (ring_buf_peek(rb, word, 4) < 4){
+        return 0;
+    }
+    size_t size = 4 * midi_ump_words(sys_get_le32(word));
+    return (ring_buf_size_get(rb) >= size) ? size : 0;
+}
+
+/**
+ * @brief      Dequeue a UMP
+ * @param      rb    The ring buffer
+ * @param[out] ump   The UMP
+ * @return     Its number of words, -EAGAIN if there is no complete UMP
+ */
+static inline int usb_midi_ring_get_ump(struct ring_buf *rb, uint32_t ump[MIDI_UMP_MAX_WORDS])
+{
+    uint8_t buf[4 * MIDI_UMP_MAX_WORDS];
+    size_t size = usb_midi_ring_peek_ump(rb);
+    if (size == 0){
+        return -EAGAIN;
+    }
+
+    ring_buf_get(rb, buf, size);
+    for (size_t i=0; i<size/4; i++){
+        ump[i] = sys_get_le32(&buf[4 * i]);
+    }
+    return size / 4;
+}
+
+/**
+ * @brief      Dequeue whole UMPs as stored, for a transfer to the host: a UMP
+ *             is never split between two transfers
+ * @return     The number of bytes dequeued
+ */
+static inline size_t usb_midi_ring_get_umps(struct ring_buf *rb, uint8_t *buf, size_t size)
+{
+    size_t len = 0;
+    size_t ump_size;
+    while ((ump_size = usb_midi_ring_peek_ump(rb)) > 0 && len + ump_size <= size){
+        len += ring_buf_get(rb, &buf[len], ump_size);
+    }
+    return len;
+}
+
+#endif
@@ -0,0 +1,6 @@
+#include <zephyr/shell/shell.h>
+
+/* Root of the MIDI shell commands, extended with SHELL_SUBCMD_ADD((midi), ...) */
+SHELL_SUBCMD_SET_CREATE(midi_cmds, (midi));
+
+SHELL_CMD_REGISTER(midi, &midi_cmds, "MIDI commands", NULL);
@@ -5,6 +5,8 @@
 #include <drivers/uart.h>
 
 #include "usb_midi.h"
+#include "midi_monitor.h"
+#include "midi_transform.h"
 
 #include <logging/log.h>
 LOG_MODULE_REGISTER(app);
@@ -32,28 +34,33 @@ void main(void)
         return;
     }
 
+    const struct midi_transform *drum_map = MIDI_TRANSFORM_DT_GET(DT_NODELABEL(volca_drum_map));
+    struct midi_encoder encoder;
+    midi_encoder_init(&encoder, true);
+
     while (1){
-        uint8_t cable_id;
-        uint8_t midi_pkt[3] = {0, 0, 0};
+        uint8_t usb_pkt[MIDI_CODEC_PKT_SIZE];
         while (1){
-            if (usb_midi_read(&cable_id, midi_pkt)){
+            // Full event packets, for the SysEx to pass through
+            if (usb_midi_read_packet(usb_pkt)){
                 k_sleep(K_MSEC(1));
                 continue;
             }
 
-            printf("[%hhd] %02hhX %02hhX %02hhX\n", cable_id, midi_pkt[0], midi_pkt[1], midi_pkt[2]);
-
-            uint8_t cmd = midi_pkt[0] >> 4;
-            if (cmd == MIDI_CMD_NOTE_ON || cmd == MIDI_CMD_NOTE_OFF){
-                // The volca drum has 1 instrument per channel, so we convert the
-                // note to a channel number
-                uint8_t note = midi_pkt[1] & 0x0f;
-                midi_pkt[0] = (cmd << 4) | note;
+            // The volca drum has 1 instrument per channel (see app.overlay)
+            if (! midi_codec_is_sysex(usb_pkt)){
+                if (! midi_transform_apply(drum_map, &usb_pkt[1])){
+                    continue;
+                }
+                midi_codec_pkt(0, &usb_pkt[1], usb_pkt);
             }
 
-            for (size_t i=0; i<3; i++){
-                uart_poll_out(midi_uart, midi_pkt[i]);
+            uint8_t bytes[3];
+            size_t n_bytes = midi_encoder_put(&encoder, usb_pkt, bytes);
+            for (size_t i=0; i<n_bytes; i++){
+                uart_poll_out(midi_uart, bytes[i]);
             }
+            midi_monitor_record(MIDI_MONITOR_PORT_DIN(0), &usb_pkt[1]);
         }
     }
 }